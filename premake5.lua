@@ -84,3 +84,113 @@ project "Triangle"
 	filter "configurations:Release"
 		optimize "On"
 
+project "AssetPacker"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "build"
+	
+	SpecifyWarnings()
+	
+	-- /MD
+	staticruntime "off"
+	runtime "Release"
+	
+	includedirs { "src", "third_party" }
+
+	files {
+		"src/tool_asset_packer/**",
+		"src/fire/**",
+	}
+	
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+project "TextureCompressor"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "build"
+	
+	SpecifyWarnings()
+	
+	-- /MD
+	staticruntime "off"
+	runtime "Release"
+	
+	includedirs { "src", "third_party" }
+
+	files {
+		"src/tool_texture_compressor/**",
+		"src/fire/**",
+		"third_party/stb_image.c",
+	}
+	
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+project "BlockAllocatorTests"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "build"
+	
+	SpecifyWarnings()
+	
+	-- /MD
+	staticruntime "off"
+	runtime "Release"
+	
+	includedirs { "src", "third_party" }
+
+	-- Only the allocator itself, so that this runs without Vulkan or a GPU
+	files {
+		"src/test_block_allocator/**",
+		"src/gpu/gpu_block_allocator.h",
+		"src/gpu/gpu_block_allocator.c",
+		"src/fire/**",
+	}
+	
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+project "AssetImportTests"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "build"
+	
+	SpecifyWarnings()
+	
+	-- /MD
+	staticruntime "off"
+	runtime "Release"
+	
+	includedirs { "src", "third_party" }
+
+	-- Only the Assimp conversion, the mesh optimization and the job system, so that this runs without Vulkan or a GPU
+	files {
+		"src/test_asset_import/**",
+		"src/demo_pbr_renderer/assimp_convert.h",
+		"src/demo_pbr_renderer/assimp_convert.cpp",
+		"src/demo_pbr_renderer/mesh_optimize.h",
+		"src/demo_pbr_renderer/mesh_optimize.cpp",
+		"src/demo_pbr_renderer/os_utils.h",
+		"src/demo_pbr_renderer/os_utils.cpp",
+		"src/fire/**",
+	}
+	
+	-- Add Assimp
+	links "third_party/assimp/lib/assimp-vc143-mt.lib"
+	postbuildcommands "copy \"..\\third_party\\assimp\\lib\\assimp-vc143-mt.dll\" ..\\build\\assimp-vc143-mt.dll"
+	
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
@@ -0,0 +1,35 @@
+// Asset archive format, shared by the renderer (see OpenAssetArchive) and by tool_asset_packer.
+//
+// An archive packs every file of a directory tree into one file, so that loading a scene is a single memory mapping rather
+// than an open/seek/read for each of its textures. The table of contents is an open-addressing hash table with linear probing,
+// keyed by the hash of each file's path relative to the packed directory. The paths are lowercase and use / as the separator.
+// The data of each file starts at a 4 KiB-aligned offset, so that it starts on its own page in the mapping.
+//
+// Layout: AssetArchiveHeader | AssetArchiveEntry[slot_count] | path strings | file data
+// Bump ASSET_ARCHIVE_VERSION whenever the layout changes!
+
+#define ASSET_ARCHIVE_MAGIC 0x4B434150 // "PACK"
+#define ASSET_ARCHIVE_VERSION 1
+#define ASSET_ARCHIVE_ALIGNMENT 4096
+
+struct AssetArchiveHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_count; // power of two, always greater than file_count so that probing terminates
+	uint32_t file_count;
+	uint64_t entries_offset; // AssetArchiveEntry[slot_count]
+	uint64_t strings_offset; // char[string_data_size]
+	uint64_t string_data_size;
+};
+
+struct AssetArchiveEntry {
+	uint64_t path_hash; // see AssetArchivePathHash
+	uint64_t data_offset;
+	uint64_t data_size;
+	uint32_t path_offset; // offset into the string data
+	uint32_t path_size; // 0 for empty slots
+};
+
+static uint64_t AssetArchivePathHash(STR_View relative_path) {
+	return DS_MurmurHash64A(relative_path.data, (int)relative_path.size, 0);
+}
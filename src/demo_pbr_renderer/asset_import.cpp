@@ -2,219 +2,2340 @@
 #include "render.h"
 #include "os_utils.h"
 #include "asset_import.h"
+#include "asset_archive.h"
+#include "texture_streaming.h"
+#include "mesh_optimize.h"
+#include "assimp_convert.h"
 
 #include "stb_image.h"
 #include "ddspp.h"
 
+#include <stdio.h>
+#include <float.h> // FLT_MAX
+#include <stdlib.h> // atoi, free
+#include <math.h> // isfinite
+#include <xmmintrin.h> // SSE
+#include <emmintrin.h> // SSE2
+
 #define ASSIMP_DLL
 #define ASSIMP_API
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <assimp/cimport.h>
 
+#include "cgltf.h"
+
+#define FIRE_OS_TIMING_IMPLEMENTATION
+#include "fire/fire_os_timing.h"
+
 extern DS_Arena* TEMP; // Arena for per-frame, temporary allocations
 
-GPU_Texture* MakeTextureFromHDRIFile(STR_View filepath) {
-	int x, y, comp;
-	void* data = stbi_loadf(STR_ToC(TEMP, filepath), &x, &y, &comp, 4);
-	assert(data);
-	assert(y == x*6);
+// Adds the time since `*tick` to `*phase_time`, and moves `*tick` to now so that the next phase starts from here.
+static void EndLoadPhase(uint64_t* tick, double* phase_time) {
+	uint64_t now = OS_GetCPUTick();
+	*phase_time += OS_GetDuration(OS_GetCPUFrequency(), *tick, now);
+	*tick = now;
+}
 
-	GPU_Texture* result = GPU_MakeTexture(GPU_Format_RGBA32F, (uint32_t)x, (uint32_t)x, 1, GPU_TextureFlag_Cubemap|GPU_TextureFlag_HasMipmaps, data);
+// The merged result of the importers, before anything is processed for the GPU. See CookMesh.
+struct ImportedMeshPart {
+	uint32_t first_index;
+	uint32_t index_count; // all LODs
+	uint32_t lod_count;
+	MeshLOD lods[MESH_LOD_MAX_COUNT];
+	uint32_t first_vertex; // Each part references only its own range of vertices
+	uint32_t vertex_count;
+	uint32_t first_instance; // into ImportedMesh::instances
+	uint32_t instance_count; // 0 if the vertices are already in world space
+	STR_View texture_paths[4]; // base color, normal, orm, emissive. Relative to the mesh file directory; empty if there is no texture.
+};
 
-	stbi_image_free(data);
-	return result;
+struct ImportedMesh {
+	const Vertex* vertices;
+	const uint32_t* indices;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	const MeshInstance* instances; // only with LoadMeshFlag_KeepInstances
+	uint32_t instance_count;
+	DS_DynArray<ImportedMeshPart> parts;
+	DS_DynArray<STR_View> embedded_images; // encoded image files referenced by "*<index>" texture paths. Only used by glTF.
+};
+
+// The LoadMeshStats of importing and optimizing, kept in the cooked mesh so that warm loads report them too
+struct CookedMeshStats {
+	uint32_t split_material_mesh_count;
+	uint32_t cluster_count;
+	float acmr_before;
+	float acmr_after;
+	uint32_t lod_triangle_counts[MESH_LOD_MAX_COUNT];
+};
+
+struct CookedMeshPart {
+	uint32_t index_type; // GPU_IndexType, 16-bit if the part has few enough vertices
+	uint32_t first_index; // in units of index_type
+	uint32_t index_count; // all LODs
+	uint32_t lod_count;
+	MeshLOD lods[MESH_LOD_MAX_COUNT];
+	uint32_t first_vertex; // the indices are relative to this
+	uint32_t vertex_count;
+	uint32_t first_instance; // into CookedMesh::instances
+	uint32_t instance_count; // 0 if the vertices are already in world space
+	HMM_Vec3 bounds_min; // of the vertices, in the local space of the instances
+	HMM_Vec3 bounds_max;
+	HMM_Vec3 position_min; // for dequantizing PackedVertex positions
+	HMM_Vec3 position_scale;
+	float uv_density; // UV units per local unit on LOD 0, 0 if the part has no UV mapping
+	uint32_t first_meshlet; // only with LoadMeshFlag_BuildMeshlets, see CookMeshlets
+	uint32_t meshlet_count;
+	STR_View texture_paths[4]; // same as in ImportedMeshPart
+};
+
+// An ImportedMesh processed into what goes into the GPU buffers. The vertices are PackedVertex with PACKED_VERTICES and Vertex
+// otherwise, and each part's indices are rebased to its first vertex and packed as `index_type`. This either comes fresh out
+// of CookMesh or points straight into a memory-mapped cooked mesh file.
+struct CookedMesh {
+	const void* vertex_data;
+	const void* index_data;
+	uint32_t vertex_data_size;
+	uint32_t index_data_size; // a multiple of 4, as the voxelize shader reads the indices as uints
+	uint32_t vertex_count;
+	const MeshInstance* instances;
+	uint32_t instance_count;
+	
+	// Only with LoadMeshFlag_BuildMeshlets. Laid out the same way as RenderObject::meshlet_buffer.
+	const void* meshlet_data;
+	uint32_t meshlet_data_size;
+	uint32_t meshlet_vertices_offset;
+	uint32_t meshlet_triangles_offset;
+	uint32_t meshlet_count;
+	
+	DS_DynArray<CookedMeshPart> parts;
+	CookedMeshStats stats;
+};
+
+// -- Cooked mesh cache ----------------------------------------------------------
+// Assimp import is most of our startup time on big scenes, so after importing we write the cooked result next to the source
+// file as "<filepath>.cooked". On the next launch, if the cooked file matches the source modtime and the import parameters,
+// we map it and upload the vertex and index blobs directly.
+// Bump COOKED_MESH_VERSION whenever the layout or the contents of the cooked file change!
+
+#define COOKED_MESH_MAGIC 0x4853454D // "MESH"
+#define COOKED_MESH_VERSION 9
+
+#if PACKED_VERTICES
+#define COOKED_MESH_VERTEX_SIZE sizeof(PackedVertex)
+#else
+#define COOKED_MESH_VERTEX_SIZE sizeof(Vertex)
+#endif
+
+struct CookedMeshHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_modtime;
+	HMM_Vec3 offset;
+	float scale;
+	uint32_t import_flags; // the LoadMeshFlags that change the cooked result
+	uint32_t cluster_triangle_count; // LOAD_MESH_CLUSTER_TRIANGLE_COUNT with LoadMeshFlag_SplitIntoClusters, otherwise 0
+	uint32_t vertex_size; // COOKED_MESH_VERTEX_SIZE, which depends on PACKED_VERTICES
+	uint32_t vertex_count;
+	uint32_t vertex_data_size;
+	uint32_t index_data_size;
+	uint32_t instance_count;
+	uint32_t part_count;
+	uint32_t string_data_size;
+	uint32_t meshlet_data_size;
+	uint32_t meshlet_vertices_offset; // within the meshlet data
+	uint32_t meshlet_triangles_offset;
+	uint32_t meshlet_count;
+	CookedMeshStats stats;
+	uint64_t parts_offset;     // CookedMeshFilePart[part_count]
+	uint64_t strings_offset;   // char[string_data_size]
+	uint64_t vertices_offset;  // char[vertex_data_size], 16-byte aligned
+	uint64_t instances_offset; // MeshInstance[instance_count], 16-byte aligned
+	uint64_t meshlets_offset;  // char[meshlet_data_size], 16-byte aligned
+	uint64_t indices_offset;   // char[index_data_size], 4-byte aligned
+};
+
+// CookedMeshPart with the texture paths as offsets into the string data
+struct CookedMeshFilePart {
+	CookedMeshPart part;
+	uint32_t texture_path_offsets[4];
+	uint32_t texture_path_sizes[4];
+};
+
+static uint32_t GetClusterTriangleCount(uint32_t import_flags) {
+	return (import_flags & LoadMeshFlag_SplitIntoClusters) ? LOAD_MESH_CLUSTER_TRIANGLE_COUNT : 0;
 }
 
-// may return NULL
-static GPU_Texture* LoadMeshTexture(STR_View base_directory, aiMaterial* mat, enum aiTextureType type) {
-	if (aiGetMaterialTextureCount(mat, type) != 0) {
-		aiString path;
-		uint32_t flags;
-		if (aiGetMaterialTexture(mat, type, 0, &path, NULL, NULL, NULL, NULL, NULL, &flags) == AI_SUCCESS) {
-			DS_ArenaMark dds_file_mark = DS_ArenaGetMark(TEMP);
-			STR_View texture_path = STR_Form(TEMP, "%v/%s", base_directory, path.data);
+static bool CookedMeshRangeIsValid(STR_View file_data, uint64_t offset, uint64_t size) {
+	return offset <= file_data.size && size <= file_data.size - offset;
+}
+
+static bool ReadCookedMesh(STR_View file_data, uint64_t source_modtime, HMM_Vec3 offset, float scale, uint32_t import_flags, CookedMesh* out_mesh) {
+	if (file_data.size < sizeof(CookedMeshHeader)) return false;
+
+	const CookedMeshHeader* header = (const CookedMeshHeader*)file_data.data;
+	if (header->magic != COOKED_MESH_MAGIC) return false;
+	if (header->version != COOKED_MESH_VERSION) return false;
+	if (source_modtime != 0 && header->source_modtime != source_modtime) return false;
+	if (memcmp(&header->offset, &offset, sizeof(offset)) != 0 || header->scale != scale) return false;
+	if (header->import_flags != import_flags) return false;
+	if (header->cluster_triangle_count != GetClusterTriangleCount(import_flags)) return false;
+	if (header->vertex_size != COOKED_MESH_VERTEX_SIZE) return false;
+	if ((uint64_t)header->vertex_count * header->vertex_size != header->vertex_data_size) return false;
+	if (header->index_data_size % 4 != 0) return false;
+
+	if (!CookedMeshRangeIsValid(file_data, header->parts_offset, (uint64_t)header->part_count * sizeof(CookedMeshFilePart))) return false;
+	if (!CookedMeshRangeIsValid(file_data, header->strings_offset, header->string_data_size)) return false;
+	if (!CookedMeshRangeIsValid(file_data, header->vertices_offset, header->vertex_data_size)) return false;
+	if (!CookedMeshRangeIsValid(file_data, header->instances_offset, (uint64_t)header->instance_count * sizeof(MeshInstance))) return false;
+	if (header->instances_offset % 16 != 0) return false;
+	if (!CookedMeshRangeIsValid(file_data, header->meshlets_offset, header->meshlet_data_size)) return false;
+	if (header->meshlet_vertices_offset > header->meshlet_triangles_offset || header->meshlet_triangles_offset > header->meshlet_data_size) return false;
+	if ((uint64_t)header->meshlet_count * sizeof(Meshlet) > header->meshlet_vertices_offset) return false;
+	if (!CookedMeshRangeIsValid(file_data, header->indices_offset, header->index_data_size)) return false;
+
+	const CookedMeshFilePart* file_parts = (const CookedMeshFilePart*)(file_data.data + header->parts_offset);
+	const char* string_data = file_data.data + header->strings_offset;
+
+	DS_ArrInit(&out_mesh->parts, TEMP);
+	for (uint32_t i = 0; i < header->part_count; i++) {
+		CookedMeshPart part = file_parts[i].part;
+		uint32_t index_size = part.index_type == GPU_IndexType_U16 ? 2 : 4;
+		if (part.index_type != GPU_IndexType_U16 && part.index_type != GPU_IndexType_U32) return false;
+		if (((uint64_t)part.first_index + part.index_count) * index_size > header->index_data_size) return false;
+		if ((uint64_t)part.first_vertex + part.vertex_count > header->vertex_count) return false;
+		if ((uint64_t)part.first_instance + part.instance_count > header->instance_count) return false;
+		if ((uint64_t)part.first_meshlet + part.meshlet_count > header->meshlet_count) return false;
+		if (part.lod_count == 0 || part.lod_count > MESH_LOD_MAX_COUNT) return false;
+		for (uint32_t j = 0; j < part.lod_count; j++) {
+			const MeshLOD* lod = &part.lods[j];
+			if ((uint64_t)lod->first_index + lod->index_count > part.index_count) return false;
+		}
+
+		for (int j = 0; j < 4; j++) {
+			uint32_t path_offset = file_parts[i].texture_path_offsets[j];
+			uint32_t path_size = file_parts[i].texture_path_sizes[j];
+			if ((uint64_t)path_offset + path_size > header->string_data_size) return false;
+			part.texture_paths[j] = STR_View{string_data + path_offset, path_size};
+		}
+		DS_ArrPush(&out_mesh->parts, part);
+	}
+
+	out_mesh->vertex_data = file_data.data + header->vertices_offset;
+	out_mesh->index_data = file_data.data + header->indices_offset;
+	out_mesh->vertex_data_size = header->vertex_data_size;
+	out_mesh->index_data_size = header->index_data_size;
+	out_mesh->vertex_count = header->vertex_count;
+	out_mesh->instances = (const MeshInstance*)(file_data.data + header->instances_offset);
+	out_mesh->instance_count = header->instance_count;
+	out_mesh->meshlet_data = file_data.data + header->meshlets_offset;
+	out_mesh->meshlet_data_size = header->meshlet_data_size;
+	out_mesh->meshlet_vertices_offset = header->meshlet_vertices_offset;
+	out_mesh->meshlet_triangles_offset = header->meshlet_triangles_offset;
+	out_mesh->meshlet_count = header->meshlet_count;
+	out_mesh->stats = header->stats;
+	return true;
+}
+
+static void WriteCookedMesh(STR_View cooked_filepath, const CookedMesh* mesh, uint64_t source_modtime, HMM_Vec3 offset, float scale, uint32_t import_flags) {
+	DS_ArenaMark mark = DS_ArenaGetMark(TEMP);
+
+	uint32_t string_data_size = 0;
+	for (int i = 0; i < mesh->parts.count; i++) {
+		for (int j = 0; j < 4; j++) string_data_size += (uint32_t)mesh->parts.data[i].texture_paths[j].size;
+	}
+
+	CookedMeshHeader header = {};
+	header.magic = COOKED_MESH_MAGIC;
+	header.version = COOKED_MESH_VERSION;
+	header.source_modtime = source_modtime;
+	header.offset = offset;
+	header.scale = scale;
+	header.import_flags = import_flags;
+	header.cluster_triangle_count = GetClusterTriangleCount(import_flags);
+	header.vertex_size = COOKED_MESH_VERTEX_SIZE;
+	header.vertex_count = mesh->vertex_count;
+	header.vertex_data_size = mesh->vertex_data_size;
+	header.index_data_size = mesh->index_data_size;
+	header.instance_count = mesh->instance_count;
+	header.part_count = (uint32_t)mesh->parts.count;
+	header.string_data_size = string_data_size;
+	header.meshlet_data_size = mesh->meshlet_data_size;
+	header.meshlet_vertices_offset = mesh->meshlet_vertices_offset;
+	header.meshlet_triangles_offset = mesh->meshlet_triangles_offset;
+	header.meshlet_count = mesh->meshlet_count;
+	header.stats = mesh->stats;
+	header.parts_offset = sizeof(CookedMeshHeader);
+	header.strings_offset = header.parts_offset + header.part_count * sizeof(CookedMeshFilePart);
+	header.vertices_offset = DS_AlignUpPow2(header.strings_offset + string_data_size, 16);
+	header.instances_offset = DS_AlignUpPow2(header.vertices_offset + header.vertex_data_size, 16);
+	header.meshlets_offset = DS_AlignUpPow2(header.instances_offset + header.instance_count * sizeof(MeshInstance), 16);
+	header.indices_offset = header.meshlets_offset + header.meshlet_data_size;
+	uint64_t file_size = header.indices_offset + header.index_data_size;
+
+	char* file_data = DS_ArenaPushZero(TEMP, file_size);
+	memcpy(file_data, &header, sizeof(header));
+
+	CookedMeshFilePart* file_parts = (CookedMeshFilePart*)(file_data + header.parts_offset);
+	char* string_data = file_data + header.strings_offset;
+	uint32_t string_offset = 0;
+
+	for (int i = 0; i < mesh->parts.count; i++) {
+		const CookedMeshPart* part = &mesh->parts.data[i];
+		CookedMeshFilePart* file_part = &file_parts[i];
+		file_part->part = *part;
+		for (int j = 0; j < 4; j++) {
+			STR_View path = part->texture_paths[j];
+			memcpy(string_data + string_offset, path.data, path.size);
+			file_part->part.texture_paths[j] = {}; // the pointers mean nothing in the file
+			file_part->texture_path_offsets[j] = string_offset;
+			file_part->texture_path_sizes[j] = (uint32_t)path.size;
+			string_offset += (uint32_t)path.size;
+		}
+	}
+
+	memcpy(file_data + header.vertices_offset, mesh->vertex_data, mesh->vertex_data_size);
+	memcpy(file_data + header.instances_offset, mesh->instances, mesh->instance_count * sizeof(MeshInstance));
+	memcpy(file_data + header.meshlets_offset, mesh->meshlet_data, mesh->meshlet_data_size);
+	memcpy(file_data + header.indices_offset, mesh->index_data, mesh->index_data_size);
+
+	// Failing to write the cache is not fatal, we'll just import again next time.
+	OS_WriteEntireFile(cooked_filepath, STR_View{file_data, file_size});
+	DS_ArenaSetMark(TEMP, mark);
+}
+
+// -------------------------------------------------------------------------------
+
+// -- Texture cache --------------------------------------------------------------
+// Materials reference the same texture files over and over, also across different meshes. Textures are shared by the hash of
+// their normalized path and refcounted, so that each file is only loaded once. Every texture returned by LoadTextures must
+// be given back with ReleaseTexture.
+
+struct TextureCacheEntry {
+	GPU_Texture* texture;
+	uint32_t refcount;
+};
+
+struct TextureCache {
+	DS_Map(uint64_t, TextureCacheEntry) entry_from_path_hash;
+	DS_Map(GPU_Texture*, uint64_t) path_hash_from_texture;
+};
+
+static TextureCache TEXTURE_CACHE;
+
+// Lowercases the path, turns backslashes into slashes and resolves "." and ".." segments, so that different spellings
+// of the same file end up with the same hash.
+static STR_View NormalizePath(DS_Arena* arena, STR_View path) {
+	STR_View lower = STR_ToLower(arena, path);
+	for (size_t i = 0; i < lower.size; i++) {
+		if (lower.data[i] == '\\') ((char*)lower.data)[i] = '/';
+	}
+
+	DS_DynArray<STR_View> segments = {arena};
+	STR_View remaining = lower;
+	while (remaining.size > 0) {
+		STR_View segment = STR_ParseUntilAndSkip(&remaining, '/');
+		if (segment.size == 0 || STR_Match(segment, ".")) continue;
+		
+		if (STR_Match(segment, "..") && segments.count > 0 && !STR_Match(DS_ArrPeek(segments), "..")) {
+			DS_ArrPop(&segments);
+			continue;
+		}
+		DS_ArrPush(&segments, segment);
+	}
+
+	char* data = DS_ArenaPush(arena, lower.size + 1);
+	size_t size = 0;
+	if (lower.size > 0 && lower.data[0] == '/') data[size++] = '/';
+	
+	for (int i = 0; i < segments.count; i++) {
+		if (i > 0) data[size++] = '/';
+		memcpy(data + size, segments[i].data, segments[i].size);
+		size += segments[i].size;
+	}
+	return STR_View{data, size};
+}
+
+static void ReleaseTexture(GPU_Texture* texture) {
+	if (texture == NULL) return;
+
+	uint64_t path_hash;
+	bool found = DS_MapFind(&TEXTURE_CACHE.path_hash_from_texture, texture, &path_hash);
+	assert(found);
+
+	TextureCacheEntry* entry = (TextureCacheEntry*)DS_MapFindPtr(&TEXTURE_CACHE.entry_from_path_hash, path_hash);
+	assert(entry && entry->refcount > 0);
+	
+	entry->refcount--;
+	if (entry->refcount == 0) {
+		UnregisterStreamedTexture(texture);
+		GPU_DestroyTexture(texture);
+		DS_MapRemove(&TEXTURE_CACHE.entry_from_path_hash, path_hash);
+		DS_MapRemove(&TEXTURE_CACHE.path_hash_from_texture, texture);
+
+		if (TEXTURE_CACHE.entry_from_path_hash.count == 0) {
+			DS_MapDeinit(&TEXTURE_CACHE.entry_from_path_hash);
+			DS_MapDeinit(&TEXTURE_CACHE.path_hash_from_texture);
+			TEXTURE_CACHE = {};
+		}
+	}
+}
+
+// -- Asset archive --------------------------------------------------------------
+// When an archive is open, every asset that's in it is read straight out of its mapping. Anything else falls back to loose files.
+
+struct AssetArchive {
+	OS_FileMapping file;
+	DS_Arena arena;
+	STR_View root; // normalized directory of the archive file, ending with a slash unless empty
+	const AssetArchiveHeader* header;
+	const AssetArchiveEntry* entries;
+	const char* string_data;
+};
+
+static AssetArchive ASSET_ARCHIVE;
+
+static bool AssetArchiveIsValid(STR_View file_data) {
+	if (file_data.size < sizeof(AssetArchiveHeader)) return false;
+
+	const AssetArchiveHeader* header = (const AssetArchiveHeader*)file_data.data;
+	if (header->magic != ASSET_ARCHIVE_MAGIC || header->version != ASSET_ARCHIVE_VERSION) return false;
+	if (header->slot_count == 0 || (header->slot_count & (header->slot_count - 1)) != 0 || header->file_count >= header->slot_count) return false;
+	if (!CookedMeshRangeIsValid(file_data, header->entries_offset, (uint64_t)header->slot_count * sizeof(AssetArchiveEntry))) return false;
+	if (!CookedMeshRangeIsValid(file_data, header->strings_offset, header->string_data_size)) return false;
+
+	const AssetArchiveEntry* entries = (const AssetArchiveEntry*)(file_data.data + header->entries_offset);
+	for (uint32_t i = 0; i < header->slot_count; i++) {
+		const AssetArchiveEntry* entry = &entries[i];
+		if (entry->path_size == 0) continue;
+		if ((uint64_t)entry->path_offset + entry->path_size > header->string_data_size) return false;
+		if (!CookedMeshRangeIsValid(file_data, entry->data_offset, entry->data_size)) return false;
+	}
+	return true;
+}
+
+bool OpenAssetArchive(STR_View filepath) {
+	assert(ASSET_ARCHIVE.header == NULL); // only one archive can be open at a time
+
+	OS_FileMapping file;
+	if (!OS_MapEntireFile(filepath, &file)) return false;
+	if (!AssetArchiveIsValid(file.data)) {
+		OS_UnmapFile(&file);
+		return false;
+	}
+
+	ASSET_ARCHIVE.file = file;
+	DS_ArenaInit(&ASSET_ARCHIVE.arena, 256, DS_HEAP);
+	
+	STR_View directory = STR_BeforeLast(filepath, '/');
+	if (directory.size < filepath.size) {
+		ASSET_ARCHIVE.root = STR_Form(&ASSET_ARCHIVE.arena, "%v/", NormalizePath(TEMP, directory));
+	}
+	
+	ASSET_ARCHIVE.header = (const AssetArchiveHeader*)file.data.data;
+	ASSET_ARCHIVE.entries = (const AssetArchiveEntry*)(file.data.data + ASSET_ARCHIVE.header->entries_offset);
+	ASSET_ARCHIVE.string_data = file.data.data + ASSET_ARCHIVE.header->strings_offset;
+	return true;
+}
+
+void CloseAssetArchive() {
+	if (ASSET_ARCHIVE.header == NULL) return;
+	OS_UnmapFile(&ASSET_ARCHIVE.file);
+	DS_ArenaDeinit(&ASSET_ARCHIVE.arena);
+	ASSET_ARCHIVE = {};
+}
+
+// If `filepath` is in the open archive, returns a view of its data inside the archive mapping.
+static bool FindArchivedFile(STR_View filepath, STR_View* out_data) {
+	if (ASSET_ARCHIVE.header == NULL) return false;
+
+	STR_View normalized_path = NormalizePath(TEMP, filepath);
+	if (!STR_StartsWith(normalized_path, ASSET_ARCHIVE.root)) return false;
+	
+	STR_View relative_path = STR_SliceAfter(normalized_path, ASSET_ARCHIVE.root.size);
+	uint64_t path_hash = AssetArchivePathHash(relative_path);
+
+	uint32_t mask = ASSET_ARCHIVE.header->slot_count - 1;
+	for (uint32_t i = (uint32_t)path_hash & mask;; i = (i + 1) & mask) {
+		const AssetArchiveEntry* entry = &ASSET_ARCHIVE.entries[i];
+		if (entry->path_size == 0) return false;
+
+		STR_View entry_path = {ASSET_ARCHIVE.string_data + entry->path_offset, entry->path_size};
+		if (entry->path_hash == path_hash && STR_Match(entry_path, relative_path)) {
+			*out_data = STR_View{ASSET_ARCHIVE.file.data.data + entry->data_offset, entry->data_size};
+			return true;
+		}
+	}
+}
+
+// Gives a read-only view of a file, either out of the open archive or memory-mapped from disk. `out_mapping` is only
+// filled in in the latter case, so call OS_UnmapFile when its data is set.
+static bool MapAssetFile(STR_View filepath, OS_FileMapping* out_mapping, STR_View* out_data) {
+	*out_mapping = {};
+	if (FindArchivedFile(filepath, out_data)) return true;
+	if (!OS_MapEntireFile(filepath, out_mapping)) return false;
+	*out_data = out_mapping->data;
+	return true;
+}
+
+// -------------------------------------------------------------------------------
+
+// -- Texture loading ------------------------------------------------------------
+// The textures of a mesh are read from disk and decoded on worker threads, a batch at a time. Each batch is uploaded with
+// GPU_UploadTextureAsync and submitted right away, so the GPU copies it while the workers decode the next batch.
+
+#define TEXTURE_DECODE_BATCH_SIZE 32
+
+struct TextureLoadJob {
+	STR_View filepath;
+	STR_View mapped_data; // if set, the image is decoded from here instead of being read from `filepath`. Embedded images and archived files use this.
+	bool streamable; // false for embedded images, since their data goes away after LoadMesh. See texture_streaming.h
+	uint64_t path_hash;
+	GPU_Texture* texture;
+
+	// Written by the worker thread
+	DS_Arena arena; // holds the file data
+	void* decoded_pixels; // for non-DDS images, allocated by stb_image
+	const char* data; // all layers and mip levels, in the order they're stored in the DDS file
+	uint32_t data_size;
+	GPU_Format format;
+	GPU_TextureFlags flags;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mip_level_count; // 0 if the mip chain should be generated on the GPU
+	GPU_TextureCopyRegion* regions; // offsets are relative to `data`
+	uint32_t region_count;
+	uint32_t first_mip; // if non-zero, only the mips from this one onwards are loaded, and the rest are streamed in later
+	StreamedTextureSource stream_source; // only set if first_mip is non-zero
+	uint64_t bytes_read;
+	double read_time;
+	double decode_time;
+};
+
+static void TextureLoadJobRun(void* user_data, uint32_t index) {
+	TextureLoadJob* job = &((TextureLoadJob*)user_data)[index];
+	DS_ArenaInit(&job->arena, DS_KIB(4), DS_HEAP);
+	uint64_t tick = OS_GetCPUTick();
+
+	STR_View file_data = job->mapped_data;
+	
+	// With streaming, loose DDS files are read in two steps: the header, and then only the mips that start out resident.
+	bool only_header_read = false;
+	if (file_data.size == 0 && job->streamable && TextureStreamingIsEnabled()) {
+		char* header = DS_ArenaPushZero(&job->arena, DDSPP_MAX_HEADER_SIZE);
+		uint64_t header_size = OS_ReadFileRange(&job->arena, job->filepath, 0, DDSPP_MAX_HEADER_SIZE, header);
+		job->bytes_read += header_size;
+		only_header_read = STR_StartsWithC(STR_View{header, (size_t)header_size}, "DDS ");
+		if (only_header_read) file_data = STR_View{header, (size_t)header_size};
+	}
+	
+	if (file_data.size == 0) {
+		bool ok = OS_ReadEntireFile(&job->arena, job->filepath, &file_data);
+		assert(ok);
+		job->bytes_read += file_data.size;
+	}
+	EndLoadPhase(&tick, &job->read_time);
+
+	if (!STR_StartsWithC(file_data, "DDS ")) {
+		// PNG, JPG and the like. Decode to RGBA8 and generate the mips on the GPU.
+		int width, height, comp;
+		job->decoded_pixels = stbi_load_from_memory((const stbi_uc*)file_data.data, (int)file_data.size, &width, &height, &comp, 4);
+		assert(job->decoded_pixels);
+
+		job->format = GPU_Format_RGBA8UN;
+		job->flags = GPU_TextureFlag_HasMipmaps;
+		job->mip_level_count = 0;
+		job->region_count = 1;
+		job->regions = (GPU_TextureCopyRegion*)DS_ArenaPushZero(&job->arena, sizeof(GPU_TextureCopyRegion));
+		job->data = (const char*)job->decoded_pixels;
+		job->data_size = (uint32_t)width * (uint32_t)height * 4;
+		job->width = (uint32_t)width;
+		job->height = (uint32_t)height;
+		if (job->mapped_data.size > 0) job->bytes_read += file_data.size;
+		EndLoadPhase(&tick, &job->decode_time);
+		return;
+	}
+
+	DDSPP_Descriptor desc = {};
+	DDSPP_Result result = ddspp_decode_header((uint8_t*)file_data.data, &desc);
+	assert(result == DDSPP_Success);
+
+	if (desc.format == BC1_UNORM)           job->format = GPU_Format_BC1_RGBA_UN;
+	else if (desc.format == BC3_UNORM)      job->format = GPU_Format_BC3_RGBA_UN;
+	else if (desc.format == R8G8B8A8_UNORM) job->format = GPU_Format_RGBA8UN;
+	else if (desc.format == BC5_UNORM)      job->format = GPU_Format_BC5_UN;
+	else if (desc.format == BC7_UNORM)      job->format = GPU_Format_BC7_RGBA_UN;
+	else assert(0);
+
+	bool is_cubemap = desc.type == Cubemap;
+	assert(desc.type == Texture2D || is_cubemap);
+	
+	uint32_t layer_count = is_cubemap ? 6 * desc.arraySize : desc.arraySize;
+	assert(layer_count == (is_cubemap ? 6u : 1u)); // Texture arrays aren't supported by the GPU layer.
+
+	// If the file has no mip chain, we generate one on the GPU. Block-compressed formats can't be blitted to, so those are left with one mip.
+	bool generate_mipmaps = desc.numMips == 1 && !desc.compressed;
+	job->mip_level_count = generate_mipmaps ? 0 : desc.numMips;
+	job->flags = (is_cubemap ? GPU_TextureFlag_Cubemap : 0) | (generate_mipmaps ? GPU_TextureFlag_HasMipmaps : 0);
+
+	// Streamed textures start out with only their mip tail resident
+	job->first_mip = 0;
+	if (job->streamable && TextureStreamingIsEnabled() && !is_cubemap && desc.numMips > 1 && desc.numMips <= TEXTURE_STREAMING_MAX_MIPS) {
+		job->first_mip = GetTextureStreamingTailMip(desc.width, desc.height, desc.numMips);
+	}
+	uint32_t resident_mip_count = desc.numMips - job->first_mip;
+	if (job->first_mip > 0) job->mip_level_count = resident_mip_count;
+
+	// DDS stores the full mip chain of each layer one after another.
+	job->region_count = layer_count * resident_mip_count;
+	job->regions = (GPU_TextureCopyRegion*)DS_ArenaPush(&job->arena, job->region_count * sizeof(GPU_TextureCopyRegion));
+	
+	uint32_t offset = 0;
+	uint32_t data_begin = 0; // offset of the first resident mip. Only streamed textures skip mips, and those have a single layer.
+	for (uint32_t layer = 0; layer < layer_count; layer++) {
+		for (uint32_t mip = 0; mip < desc.numMips; mip++) {
+			uint32_t mip_width = desc.width >> mip;
+			uint32_t mip_height = desc.height >> mip;
+			uint32_t blocks_x = ((mip_width ? mip_width : 1) + desc.blockWidth - 1) / desc.blockWidth;
+			uint32_t blocks_y = ((mip_height ? mip_height : 1) + desc.blockHeight - 1) / desc.blockHeight;
+			uint32_t row_pitch = (blocks_x * desc.bitsPerPixelOrBlock + 7) / 8;
+			uint32_t mip_size = row_pitch * blocks_y;
+
+			if (mip == job->first_mip && layer == 0) data_begin = offset;
+			if (mip >= job->first_mip) {
+				GPU_TextureCopyRegion region = {offset - data_begin, layer, mip - job->first_mip};
+				job->regions[layer * resident_mip_count + mip - job->first_mip] = region;
+			}
+			if (job->first_mip > 0) {
+				job->stream_source.mip_offsets[mip] = desc.headerSize + offset;
+				job->stream_source.mip_sizes[mip] = mip_size;
+			}
+			offset += mip_size;
+		}
+	}
+
+	job->data_size = offset - data_begin;
+	EndLoadPhase(&tick, &job->decode_time);
+	if (only_header_read) {
+		char* data = DS_ArenaPush(&job->arena, job->data_size);
+		uint64_t read_size = OS_ReadFileRange(&job->arena, job->filepath, desc.headerSize + data_begin, job->data_size, data);
+		assert(read_size == job->data_size);
+		job->bytes_read += read_size;
+		job->data = data;
+		EndLoadPhase(&tick, &job->read_time);
+	}
+	else {
+		assert(desc.headerSize + offset <= file_data.size);
+		job->data = file_data.data + desc.headerSize + data_begin;
+		if (job->mapped_data.size > 0) job->bytes_read += desc.headerSize + job->data_size; // only the resident mips get touched
+	}
+	job->width = desc.width >> job->first_mip ? desc.width >> job->first_mip : 1;
+	job->height = desc.height >> job->first_mip ? desc.height >> job->first_mip : 1;
+
+	if (job->first_mip > 0) {
+		job->stream_source.filepath = job->filepath;
+		job->stream_source.mapped_data = job->mapped_data;
+		job->stream_source.format = job->format;
+		job->stream_source.width = desc.width;
+		job->stream_source.height = desc.height;
+		job->stream_source.mip_level_count = desc.numMips;
+	}
+}
+
+static void AddTextureStats(LoadMeshStats* stats, GPU_Format format, uint64_t bytes) {
+	uint32_t i = 0;
+	for (; i < stats->texture_format_count && stats->textures[i].format != format; i++) {}
+	if (i == stats->texture_format_count) {
+		assert(i < LOAD_MESH_STATS_MAX_TEXTURE_FORMATS);
+		stats->textures[i].format = format;
+		stats->texture_format_count++;
+	}
+	stats->textures[i].texture_count++;
+	stats->textures[i].bytes += bytes;
+}
+
+// If an uncompressed image has a DDS file with the same name next to it (see TextureCompressor), that gets loaded instead.
+static STR_View FindCompressedTexture(STR_View filepath) {
+	if (STR_EndsWithC(STR_ToLower(TEMP, filepath), ".dds")) return filepath;
+
+	STR_View dds_filepath = STR_Form(TEMP, "%v.dds", STR_BeforeLast(filepath, '.'));
+	STR_View archived_data;
+	uint64_t modtime;
+	if (FindArchivedFile(dds_filepath, &archived_data) || OS_FileLastModificationTime(dds_filepath, &modtime)) return dds_filepath;
+	return filepath;
+}
+
+// `relative_paths` are relative to the directory of `mesh_filepath`, or "*<index>" for an image in `embedded_images`.
+// `out_textures[i]` is set to NULL for every empty path. Textures that are already in the cache aren't loaded again.
+static void LoadTextures(STR_View mesh_filepath, const STR_View* relative_paths, uint32_t count, const STR_View* embedded_images, uint32_t embedded_image_count,
+	GPU_Texture** out_textures, LoadMeshStats* stats)
+{
+	STR_View base_directory = STR_BeforeLast(mesh_filepath, '/');
+	DS_ArenaMark mark = DS_ArenaGetMark(TEMP);
+
+	if (TEXTURE_CACHE.entry_from_path_hash.allocator == NULL) {
+		DS_MapInit(&TEXTURE_CACHE.entry_from_path_hash, DS_HEAP);
+		DS_MapInit(&TEXTURE_CACHE.path_hash_from_texture, DS_HEAP);
+	}
+
+	DS_DynArray<TextureLoadJob> jobs = {TEMP};
+	DS_Map(uint64_t, uint32_t) job_from_path_hash;
+	DS_MapInit(&job_from_path_hash, TEMP);
+
+	uint32_t* texture_job_indices = (uint32_t*)DS_ArenaPush(TEMP, count * sizeof(uint32_t));
+	
+	for (uint32_t i = 0; i < count; i++) {
+		out_textures[i] = NULL;
+		texture_job_indices[i] = UINT32_MAX;
+		if (relative_paths[i].size == 0) continue;
+		
+		// Embedded images are keyed by the mesh file they come from
+		bool is_embedded = STR_StartsWithC(relative_paths[i], "*");
+		STR_View filepath = is_embedded ? STR_Form(TEMP, "%v%v", mesh_filepath, relative_paths[i]) : STR_Form(TEMP, "%v/%v", base_directory, relative_paths[i]);
+		STR_View normalized_path = NormalizePath(TEMP, filepath);
+		uint64_t path_hash = DS_MurmurHash64A(normalized_path.data, (int)normalized_path.size, 0);
+
+		TextureCacheEntry* cached = (TextureCacheEntry*)DS_MapFindPtr(&TEXTURE_CACHE.entry_from_path_hash, path_hash);
+		if (cached) {
+			cached->refcount++;
+			out_textures[i] = cached->texture;
+			continue;
+		}
+
+		uint32_t* job_index;
+		if (DS_MapGetOrAddPtr(&job_from_path_hash, path_hash, &job_index)) {
+			*job_index = (uint32_t)jobs.count;
+			TextureLoadJob job = {};
+			job.filepath = filepath;
+			job.path_hash = path_hash;
+			if (is_embedded) {
+				uint32_t image_index = (uint32_t)atoi(STR_ToC(TEMP, STR_AfterFirst(relative_paths[i], '*')));
+				assert(image_index < embedded_image_count && embedded_images[image_index].size > 0);
+				job.mapped_data = embedded_images[image_index];
+			}
+			else {
+				job.filepath = FindCompressedTexture(filepath);
+				FindArchivedFile(job.filepath, &job.mapped_data);
+				job.streamable = true;
+			}
+			DS_ArrPush(&jobs, job);
+		}
+		texture_job_indices[i] = *job_index;
+	}
 
-			STR_View tex_file_data;
-			bool ok = OS_ReadEntireFile(TEMP, texture_path, &tex_file_data);
-			assert(ok);
+	for (uint32_t first = 0; first < (uint32_t)jobs.count; first += TEXTURE_DECODE_BATCH_SIZE) {
+		uint32_t batch_count = (uint32_t)jobs.count - first;
+		if (batch_count > TEXTURE_DECODE_BATCH_SIZE) batch_count = TEXTURE_DECODE_BATCH_SIZE;
+		
+		OS_ParallelFor(batch_count, TextureLoadJobRun, &jobs[first]);
+		uint64_t upload_tick = OS_GetCPUTick();
 
-			DDSPP_Descriptor desc = {};
-			DDSPP_Result result = ddspp_decode_header((uint8_t*)tex_file_data.data, &desc);
-			const void* tex_data = tex_file_data.data + desc.headerSize + ddspp_get_offset(&desc, 0, 0);
+		for (uint32_t i = first; i < first + batch_count; i++) {
+			TextureLoadJob* job = &jobs[i];
+			
+			job->texture = GPU_MakeTextureEx(job->format, job->width, job->height, 1, job->mip_level_count, job->flags);
+			if (job->first_mip > 0) {
+				RegisterStreamedTexture(job->texture, &job->stream_source, job->first_mip);
+			}
 			
-			GPU_Format format;
-			if (desc.format == BC1_UNORM)           format = GPU_Format_BC1_RGBA_UN;
-			else if (desc.format == BC3_UNORM)      format = GPU_Format_BC3_RGBA_UN;
-			else if (desc.format == R8G8B8A8_UNORM) format = GPU_Format_RGBA8UN;
-			else if (desc.format == BC5_UNORM)      format = GPU_Format_BC5_UN;
-			else assert(0);
+			// The textures are only used by graphs recorded after this, which the GPU layer orders after the upload, so there's no need to wait for the ticket.
+			GPU_UploadTextureAsync(job->texture, job->data, job->data_size, job->regions, job->region_count);
+		}
 
-			GPU_Texture* texture = GPU_MakeTexture(format, desc.width, desc.height, 1, 0, tex_data);
-			DS_ArenaSetMark(TEMP, dds_file_mark);
+		GPU_FlushUploads(); // start copying this batch while the next one is decoded
+		EndLoadPhase(&upload_tick, &stats->gpu_upload_time);
+	}
+
+	for (int i = 0; i < jobs.count; i++) {
+		TextureLoadJob* job = &jobs[i];
+		stats->bytes_read += job->bytes_read;
+		stats->texture_read_time += job->read_time;
+		stats->texture_decode_time += job->decode_time;
+		AddTextureStats(stats, job->format, job->data_size);
+		
+		DS_ArenaDeinit(&job->arena);
+		if (job->decoded_pixels) stbi_image_free(job->decoded_pixels);
+
+		TextureCacheEntry entry = {job->texture, 0};
+		DS_MapInsert(&TEXTURE_CACHE.entry_from_path_hash, job->path_hash, entry);
+		DS_MapInsert(&TEXTURE_CACHE.path_hash_from_texture, job->texture, job->path_hash);
+	}
 
-			return texture;
+	for (uint32_t i = 0; i < count; i++) {
+		if (texture_job_indices[i] != UINT32_MAX) {
+			TextureLoadJob* job = &jobs[texture_job_indices[i]];
+			TextureCacheEntry* entry = (TextureCacheEntry*)DS_MapFindPtr(&TEXTURE_CACHE.entry_from_path_hash, job->path_hash);
+			entry->refcount++;
+			out_textures[i] = job->texture;
 		}
 	}
-	return NULL;
+
+	DS_ArenaSetMark(TEMP, mark);
+}
+
+// Returns an empty string if the material has no texture of this type
+static STR_View GetMaterialTexturePath(aiMaterial* mat, enum aiTextureType type) {
+	if (aiGetMaterialTextureCount(mat, type) != 0) {
+		aiString path;
+		uint32_t flags;
+		if (aiGetMaterialTexture(mat, type, 0, &path, NULL, NULL, NULL, NULL, NULL, &flags) == AI_SUCCESS) {
+			return STR_Clone(TEMP, STR_View{path.data, path.length});
+		}
+	}
+	return {};
 }
 
 void UnloadMesh(RenderObject* mesh) {
 	GPU_DestroyBuffer(mesh->vertex_buffer);
 	GPU_DestroyBuffer(mesh->index_buffer);
+	GPU_DestroyBuffer(mesh->instance_buffer);
+	if (mesh->meshlet_buffer) GPU_DestroyBuffer(mesh->meshlet_buffer);
 	
 	for (int i = 0; i < mesh->parts.count; i++) {
 		RenderObjectPart* part = &mesh->parts[i];
-		GPU_DestroyDescriptorSet(part->descriptor_set);
-		GPU_DestroyTexture(part->tex_base_color);
-		GPU_DestroyTexture(part->tex_normal);
-		GPU_DestroyTexture(part->tex_orm);
-		GPU_DestroyTexture(part->tex_emissive);
+		if (!part->shares_descriptor_set) GPU_DestroyDescriptorSet(part->descriptor_set);
+		ReleaseTexture(part->tex_base_color);
+		ReleaseTexture(part->tex_normal);
+		ReleaseTexture(part->tex_orm);
+		ReleaseTexture(part->tex_emissive);
 	}
 	
 	DS_ArrDeinit(&mesh->parts);
 	*mesh = {};
 }
 
-RenderObject LoadMesh(Renderer* renderer, STR_View filepath, HMM_Vec3 offset, float scale) {
-	RenderObject render_object = {};
-	DS_ArrInit(&render_object.parts, DS_HEAP);
-	
-	assert(!STR_ContainsU(filepath, '\\')); // we should use / for path separators
-	STR_View base_directory = STR_BeforeLast(filepath, '/');
-
-	char* filepath_cstr = STR_ToC(TEMP, filepath);
-	
-	// aiProcess_GlobalScale uses the scale settings from the file. It looks like the blender exporter uses it too.
-	const aiScene* scene = aiImportFile(filepath_cstr, aiProcess_Triangulate|aiProcess_PreTransformVertices|aiProcess_GlobalScale|aiProcess_CalcTangentSpace);
-	assert(scene != NULL);
+// Geometry of a single material, before all of them are merged into one ImportedMesh
+struct MaterialMesh {
+	Vertex* vertices; // a slice of the vertex array shared by all material meshes, see MergeMaterialMeshes
+	uint32_t vertex_count;
+	DS_DynArray<uint32_t> indices; // LOD 0, followed by the other LODs
+	uint32_t lod_count;
+	MeshLOD lods[MESH_LOD_MAX_COUNT];
+	uint32_t first_instance; // see ImportedMeshPart
+	uint32_t instance_count;
+	STR_View texture_paths[4]; // see ImportedMeshPart
+};
 
-	typedef struct {
-		DS_DynArray<Vertex> vertices;
-		DS_DynArray<uint32_t> indices;
-	} MatMesh;
-	
-	DS_DynArray<MatMesh> mat_meshes = {TEMP};
-	
-	MatMesh empty_mat_mesh = {};
-	DS_ArrResize(&mat_meshes, empty_mat_mesh, scene->mNumMaterials);
-	
+// Welds and reorders each material mesh, generates its LODs, and merges all of them into `out_mesh`. Each material becomes one part.
+// The vertices of the material meshes must be consecutive slices of one array, which is then compacted in place to become the
+// merged vertex array, so that the vertices are never copied to a second buffer.
+static void MergeMaterialMeshes(MaterialMesh* mat_meshes, int mat_mesh_count, ImportedMesh* out_mesh, LoadMeshStats* stats) {
 	uint32_t total_vertex_count = 0;
 	uint32_t total_index_count = 0;
 
-	for (uint32_t mesh_idx = 0; mesh_idx < scene->mNumMeshes; mesh_idx++) {
-		aiMesh* mesh = scene->mMeshes[mesh_idx];
-		
-		MatMesh* mat_mesh = &mat_meshes[mesh->mMaterialIndex];
-		DS_ArrInit(&mat_mesh->vertices, TEMP);
-		DS_ArrInit(&mat_mesh->indices, TEMP);
-		uint32_t first_new_vertex = (uint32_t)mat_mesh->vertices.count;
-
-		for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
-			assert(mesh->mNormals != NULL);
-			assert(mesh->mTextureCoords[0] != NULL);
-			aiVector3D pos = mesh->mVertices[i];
-			aiVector3D normal = mesh->mNormals[i];
-			aiVector3D tangent = mesh->mTangents[i];
-			aiVector3D tex_coord = mesh->mTextureCoords[0][i];
-			
-			// NOTE: flip Y and Z and texcoord y
-			Vertex v;
-			v.position  = {(pos.x + offset.X)*scale, (pos.z * -1.f + offset.Y)*scale, (pos.y + offset.Z)*scale};
-			v.normal    = {normal.x,  normal.z  * -1.f, normal.y};
-			v.tangent   = {tangent.x, tangent.z * -1.f, tangent.y};
-			v.tex_coord = {tex_coord.x, 1.f - tex_coord.y};
-			DS_ArrPush(&mat_mesh->vertices, v);
-		}
+	MeshOptimizeStats total_stats = {};
+	for (int mat_mesh_i = 0; mat_mesh_i < mat_mesh_count; mat_mesh_i++) {
+		MaterialMesh* mat_mesh = &mat_meshes[mat_mesh_i];
+		
+		uint32_t vertex_count = mat_mesh->vertex_count;
+		MeshOptimizeStats optimize_stats = OptimizeMesh(TEMP, mat_mesh->vertices, &vertex_count, mat_mesh->indices.data, (uint32_t)mat_mesh->indices.count);
+		mat_mesh->vertex_count = vertex_count;
 
-		for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
-			aiFace face = mesh->mFaces[i];
-			assert(face.mNumIndices == 3);
+		// Each LOD is simplified from the previous one and appended after it, so that all of them share the vertices.
+		// The simplifier error is relative to its input, so the errors add up along the chain.
+		mat_mesh->lods[0] = {0, (uint32_t)mat_mesh->indices.count, 0.f};
+		mat_mesh->lod_count = 1;
+		for (; mat_mesh->lod_count < MESH_LOD_MAX_COUNT; mat_mesh->lod_count++) {
+			MeshLOD prev_lod = mat_mesh->lods[mat_mesh->lod_count - 1];
+			uint32_t* lod_indices = (uint32_t*)DS_ArenaPush(TEMP, prev_lod.index_count * sizeof(uint32_t));
+			float lod_error;
+			uint32_t lod_index_count = SimplifyMesh(TEMP, mat_mesh->vertices, vertex_count,
+				mat_mesh->indices.data + prev_lod.first_index, prev_lod.index_count, prev_lod.index_count / 2, lod_indices, &lod_error);
+			
+			if (lod_index_count == 0 || lod_index_count > prev_lod.index_count / 4 * 3) break; // not worth another LOD
 
-			DS_ArrPush(&mat_mesh->indices, first_new_vertex + face.mIndices[0]);
-			DS_ArrPush(&mat_mesh->indices, first_new_vertex + face.mIndices[1]);
-			DS_ArrPush(&mat_mesh->indices, first_new_vertex + face.mIndices[2]);
+			mat_mesh->lods[mat_mesh->lod_count] = {(uint32_t)mat_mesh->indices.count, lod_index_count, prev_lod.error + lod_error};
+			DS_ArrPushN(&mat_mesh->indices, lod_indices, (int)lod_index_count);
 		}
 		
-		total_vertex_count += mesh->mNumVertices;
-		total_index_count += mesh->mNumFaces*3;
+		for (uint32_t i = 0; i < mat_mesh->lod_count; i++) {
+			stats->lod_triangle_counts[i] += mat_mesh->lods[i].index_count / 3;
+		}
+
+		total_stats.vertex_count_before += optimize_stats.vertex_count_before;
+		total_stats.vertex_count_after += optimize_stats.vertex_count_after;
+		total_stats.triangle_count += optimize_stats.triangle_count;
+		total_stats.cache_misses_before += optimize_stats.cache_misses_before;
+		total_stats.cache_misses_after += optimize_stats.cache_misses_after;
+
+		total_vertex_count += vertex_count;
+		total_index_count += (uint32_t)mat_mesh->indices.count;
 	}
 
-	void* merged_vertices = DS_ArenaPush(TEMP, total_vertex_count * sizeof(Vertex));
-	void* merged_indices = DS_ArenaPush(TEMP, total_index_count * sizeof(uint32_t));
+	if (total_stats.triangle_count > 0) {
+		stats->acmr_before = (float)total_stats.cache_misses_before / (float)total_stats.triangle_count;
+		stats->acmr_after = (float)total_stats.cache_misses_after / (float)total_stats.triangle_count;
+	}
+
+	Vertex* merged_vertices = mat_mesh_count > 0 ? mat_meshes[0].vertices : NULL;
+	uint32_t* merged_indices = (uint32_t*)DS_ArenaPush(TEMP, total_index_count * sizeof(uint32_t));
 	
+	DS_ArrInit(&out_mesh->parts, TEMP);
 	{
 		uint32_t first_vertex = 0;
 		uint32_t first_index = 0;
 		
-		for (int mat_mesh_i = 0; mat_mesh_i < mat_meshes.count; mat_mesh_i++) {
-			MatMesh* mat_mesh = &mat_meshes[mat_mesh_i];
+		for (int mat_mesh_i = 0; mat_mesh_i < mat_mesh_count; mat_mesh_i++) {
+			MaterialMesh* mat_mesh = &mat_meshes[mat_mesh_i];
 
-			RenderObjectPart part = {};
+			ImportedMeshPart part = {};
 			part.first_index = first_index;
 			part.index_count = (uint32_t)mat_mesh->indices.count;
+			part.lod_count = mat_mesh->lod_count;
+			memcpy(part.lods, mat_mesh->lods, sizeof(part.lods));
+			part.first_vertex = first_vertex;
+			part.vertex_count = mat_mesh->vertex_count;
+			part.first_instance = mat_mesh->first_instance;
+			part.instance_count = mat_mesh->instance_count;
+			memcpy(part.texture_paths, mat_mesh->texture_paths, sizeof(part.texture_paths));
 
-			memcpy((Vertex*)merged_vertices + first_vertex, mat_mesh->vertices.data, mat_mesh->vertices.count * sizeof(Vertex));
+			// Welding only ever shrinks the slices, so moving each one down never overwrites one that hasn't been moved yet
+			assert(mat_mesh->vertices >= merged_vertices + first_vertex);
+			memmove(merged_vertices + first_vertex, mat_mesh->vertices, mat_mesh->vertex_count * sizeof(Vertex));
 
 			for (int i = 0; i < mat_mesh->indices.count; i++) {
-				((uint32_t*)merged_indices)[first_index] = first_vertex + mat_mesh->indices[i];
+				merged_indices[first_index] = first_vertex + mat_mesh->indices[i];
 				first_index++;
 			}
-			first_vertex += (uint32_t)mat_mesh->vertices.count;
+			first_vertex += mat_mesh->vertex_count;
 			
-			DS_ArrPush(&render_object.parts, part);
+			DS_ArrPush(&out_mesh->parts, part);
 		}
 
 		assert(first_vertex == total_vertex_count);
 		assert(first_index == total_index_count);
 	}
 
-	render_object.vertex_buffer = GPU_MakeBuffer(total_vertex_count * sizeof(Vertex), GPU_BufferFlag_GPU | GPU_BufferFlag_StorageBuffer, merged_vertices);
-	render_object.index_buffer = GPU_MakeBuffer(total_index_count * sizeof(uint32_t), GPU_BufferFlag_GPU | GPU_BufferFlag_StorageBuffer, merged_indices);
+	out_mesh->vertices = merged_vertices;
+	out_mesh->indices = merged_indices;
+	out_mesh->vertex_count = total_vertex_count;
+	out_mesh->index_count = total_index_count;
+}
+
+// Drops the material meshes that ended up without any triangles. The remaining vertex slices stay in order, as MergeMaterialMeshes wants.
+static void RemoveEmptyMaterialMeshes(DS_DynArray<MaterialMesh>* mat_meshes) {
+	int count = 0;
+	for (int i = 0; i < mat_meshes->count; i++) {
+		if (mat_meshes->data[i].indices.count > 0) mat_meshes->data[count++] = mat_meshes->data[i];
+	}
+	mat_meshes->count = count;
+}
+
+// -- Spatial clusters -----------------------------------------------------------
+// With LoadMeshFlag_SplitIntoClusters, the triangles of each material mesh are split into spatially coherent clusters, which
+// become parts of their own with their own bounds, so that they can be culled separately. The split is a top-down binned SAH
+// partition of the triangle centroids, the same as a BVH build, stopping at LOAD_MESH_CLUSTER_TRIANGLE_COUNT triangles.
+// This runs before welding, so a vertex on the border of two clusters simply ends up in both. The simplifier never moves
+// open border vertices, so the LODs of neighbouring clusters still line up.
+
+#define CLUSTER_SAH_BIN_COUNT 16
+
+struct ClusterTriangle {
+	HMM_Vec3 centroid;
+	HMM_Vec3 bounds_min;
+	HMM_Vec3 bounds_max;
+	uint32_t first_index; // into the indices of the material mesh
+};
+
+struct ClusterBin {
+	HMM_Vec3 bounds_min;
+	HMM_Vec3 bounds_max;
+	uint32_t triangle_count;
+};
+
+static void GrowBounds(HMM_Vec3* bounds_min, HMM_Vec3* bounds_max, HMM_Vec3 min, HMM_Vec3 max) {
+	for (int k = 0; k < 3; k++) {
+		if (min.Elements[k] < bounds_min->Elements[k]) bounds_min->Elements[k] = min.Elements[k];
+		if (max.Elements[k] > bounds_max->Elements[k]) bounds_max->Elements[k] = max.Elements[k];
+	}
+}
+
+static float BoundsSurfaceArea(HMM_Vec3 bounds_min, HMM_Vec3 bounds_max) {
+	HMM_Vec3 d = HMM_SubV3(bounds_max, bounds_min);
+	return 2.f * (d.X*d.Y + d.Y*d.Z + d.Z*d.X);
+}
+
+static int ClusterBinIndex(const ClusterTriangle* triangle, int axis, float axis_min, float bin_scale) {
+	// Clamped as a float, since casting a float that's out of the int range is undefined
+	float bin = (triangle->centroid.Elements[axis] - axis_min) * bin_scale;
+	return bin > 0.f ? (bin < (float)(CLUSTER_SAH_BIN_COUNT - 1) ? (int)bin : CLUSTER_SAH_BIN_COUNT - 1) : 0;
+}
+
+// Reorders the triangles in [begin, end) so that the ones before the best split along the longest axis come first, and returns
+// where the rest start. Both sides are always non-empty.
+static uint32_t SplitClusterTriangles(ClusterTriangle* triangles, uint32_t begin, uint32_t end) {
+	HMM_Vec3 centroid_min = HMM_V3(FLT_MAX, FLT_MAX, FLT_MAX);
+	HMM_Vec3 centroid_max = HMM_V3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (uint32_t i = begin; i < end; i++) {
+		GrowBounds(&centroid_min, &centroid_max, triangles[i].centroid, triangles[i].centroid);
+	}
 	
-	for (int i = 0; i < mat_meshes.count; i++) {
-		MatMesh* mat_mesh = &mat_meshes[i];
-		RenderObjectPart* part = &render_object.parts[i];
+	HMM_Vec3 extent = HMM_SubV3(centroid_max, centroid_min);
+	int axis = extent.X >= extent.Y && extent.X >= extent.Z ? 0 : extent.Y >= extent.Z ? 1 : 2;
+	// When every centroid is in (nearly) the same spot, the bin scale would blow up to inf, and any split will do anyway
+	if (!(extent.Elements[axis] > 1e-6f)) return begin + (end - begin) / 2;
+
+	ClusterBin bins[CLUSTER_SAH_BIN_COUNT];
+	for (int i = 0; i < CLUSTER_SAH_BIN_COUNT; i++) {
+		bins[i] = {HMM_V3(FLT_MAX, FLT_MAX, FLT_MAX), HMM_V3(-FLT_MAX, -FLT_MAX, -FLT_MAX), 0};
+	}
+	float bin_scale = (float)CLUSTER_SAH_BIN_COUNT / extent.Elements[axis];
+	for (uint32_t i = begin; i < end; i++) {
+		ClusterBin* bin = &bins[ClusterBinIndex(&triangles[i], axis, centroid_min.Elements[axis], bin_scale)];
+		GrowBounds(&bin->bounds_min, &bin->bounds_max, triangles[i].bounds_min, triangles[i].bounds_max);
+		bin->triangle_count++;
+	}
+
+	// right_costs[i] is the SAH cost of bins [i, CLUSTER_SAH_BIN_COUNT) going to the right side
+	float right_costs[CLUSTER_SAH_BIN_COUNT] = {};
+	{
+		HMM_Vec3 right_min = HMM_V3(FLT_MAX, FLT_MAX, FLT_MAX);
+		HMM_Vec3 right_max = HMM_V3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		uint32_t right_count = 0;
+		for (int i = CLUSTER_SAH_BIN_COUNT - 1; i > 0; i--) {
+			GrowBounds(&right_min, &right_max, bins[i].bounds_min, bins[i].bounds_max);
+			right_count += bins[i].triangle_count;
+			right_costs[i] = right_count > 0 ? BoundsSurfaceArea(right_min, right_max) * (float)right_count : 0.f;
+		}
+	}
+
+	// The centroids at both ends of the extent land in the first and the last bin, so there's always a split with both sides non-empty
+	int best_split = 0; // first bin of the right side
+	float best_cost = FLT_MAX;
+	{
+		HMM_Vec3 left_min = HMM_V3(FLT_MAX, FLT_MAX, FLT_MAX);
+		HMM_Vec3 left_max = HMM_V3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		uint32_t left_count = 0;
+		for (int i = 1; i < CLUSTER_SAH_BIN_COUNT; i++) {
+			GrowBounds(&left_min, &left_max, bins[i - 1].bounds_min, bins[i - 1].bounds_max);
+			left_count += bins[i - 1].triangle_count;
+			if (left_count == 0 || left_count == end - begin) continue;
+			
+			float cost = BoundsSurfaceArea(left_min, left_max) * (float)left_count + right_costs[i];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_split = i;
+			}
+		}
+	}
+	assert(best_split > 0);
+
+	uint32_t split = begin;
+	for (uint32_t i = begin; i < end; i++) {
+		if (ClusterBinIndex(&triangles[i], axis, centroid_min.Elements[axis], bin_scale) < best_split) {
+			ClusterTriangle tmp = triangles[split];
+			triangles[split] = triangles[i];
+			triangles[i] = tmp;
+			split++;
+		}
+	}
+	return split;
+}
+
+// Replaces every material mesh by its clusters. The cluster vertices are copied into a new array, in which each cluster gets
+// a consecutive slice, as MergeMaterialMeshes wants.
+static void SplitMaterialMeshesIntoClusters(DS_DynArray<MaterialMesh>* mat_meshes, uint32_t cluster_triangle_count, LoadMeshStats* stats) {
+	DS_DynArray<MaterialMesh> clusters = {TEMP};
+	DS_DynArray<uint32_t> cluster_first_vertex = {TEMP};
+	DS_DynArray<Vertex> cluster_vertices = {TEMP};
+	DS_DynArray<uint32_t> ranges = {TEMP}; // stack of [begin, end) triangle ranges that still need to be split
+
+	for (int mat_mesh_i = 0; mat_mesh_i < mat_meshes->count; mat_mesh_i++) {
+		const MaterialMesh* mat_mesh = &mat_meshes->data[mat_mesh_i];
+		uint32_t triangle_count = (uint32_t)mat_mesh->indices.count / 3;
+		
+		ClusterTriangle* triangles = (ClusterTriangle*)DS_ArenaPush(TEMP, triangle_count * sizeof(ClusterTriangle));
+		for (uint32_t i = 0; i < triangle_count; i++) {
+			ClusterTriangle* triangle = &triangles[i];
+			triangle->first_index = i * 3;
+			triangle->bounds_min = HMM_V3(FLT_MAX, FLT_MAX, FLT_MAX);
+			triangle->bounds_max = HMM_V3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (uint32_t c = 0; c < 3; c++) {
+				HMM_Vec3 pos = mat_mesh->vertices[mat_mesh->indices.data[i*3 + c]].position;
+				GrowBounds(&triangle->bounds_min, &triangle->bounds_max, pos, pos);
+			}
+			triangle->centroid = HMM_MulV3F(HMM_AddV3(triangle->bounds_min, triangle->bounds_max), 0.5f);
+		}
+
+		uint32_t* vertex_remap = (uint32_t*)DS_ArenaPush(TEMP, mat_mesh->vertex_count * sizeof(uint32_t));
+		memset(vertex_remap, 0xFF, mat_mesh->vertex_count * sizeof(uint32_t));
+
+		// Depth-first with the first side on top of the stack, so that clusters that are next to each other in space mostly
+		// end up next to each other in the part list too.
+		DS_ArrPush(&ranges, 0u);
+		DS_ArrPush(&ranges, triangle_count);
+		while (ranges.count > 0) {
+			uint32_t end = DS_ArrPop(&ranges);
+			uint32_t begin = DS_ArrPop(&ranges);
+			if (end - begin > cluster_triangle_count) {
+				uint32_t split = SplitClusterTriangles(triangles, begin, end);
+				DS_ArrPush(&ranges, split);
+				DS_ArrPush(&ranges, end);
+				DS_ArrPush(&ranges, begin);
+				DS_ArrPush(&ranges, split);
+				continue;
+			}
+			
+			// The cluster keeps the material, the instances and the texture paths of the material mesh
+			MaterialMesh cluster = *mat_mesh;
+			cluster.vertices = NULL; // set once cluster_vertices stops growing
+			cluster.vertex_count = 0;
+			DS_ArrInit(&cluster.indices, TEMP);
+			DS_ArrResizeUndef(&cluster.indices, (int)(end - begin) * 3);
+			DS_ArrPush(&cluster_first_vertex, (uint32_t)cluster_vertices.count);
 
-		aiMaterial* mat = scene->mMaterials[i];
-		part->tex_base_color = LoadMeshTexture(base_directory, mat, aiTextureType_DIFFUSE);
-		part->tex_normal     = LoadMeshTexture(base_directory, mat, aiTextureType_NORMALS);
-		part->tex_orm        = LoadMeshTexture(base_directory, mat, aiTextureType_SPECULAR);
-		part->tex_emissive   = LoadMeshTexture(base_directory, mat, aiTextureType_EMISSIVE);
+			for (uint32_t i = begin; i < end; i++) {
+				for (uint32_t c = 0; c < 3; c++) {
+					uint32_t vertex = mat_mesh->indices.data[triangles[i].first_index + c];
+					if (vertex_remap[vertex] == UINT32_MAX) {
+						vertex_remap[vertex] = cluster.vertex_count++;
+						DS_ArrPush(&cluster_vertices, mat_mesh->vertices[vertex]);
+					}
+					cluster.indices.data[(i - begin)*3 + c] = vertex_remap[vertex];
+				}
+			}
+			for (uint32_t i = begin; i < end; i++) {
+				for (uint32_t c = 0; c < 3; c++) vertex_remap[mat_mesh->indices.data[triangles[i].first_index + c]] = UINT32_MAX;
+			}
+			DS_ArrPush(&clusters, cluster);
+		}
+	}
 
-		MainPassLayout* pass = &renderer->main_pass_layout;
+	for (int i = 0; i < clusters.count; i++) {
+		clusters[i].vertices = cluster_vertices.data + cluster_first_vertex[i];
+	}
+	
+	stats->split_material_mesh_count = (uint32_t)mat_meshes->count;
+	stats->cluster_count = (uint32_t)clusters.count;
+	*mat_meshes = clusters;
+}
 
-		GPU_DescriptorSet* desc_set = GPU_InitDescriptorSet(NULL, pass->pipeline_layout);
+// Converts a node transform from the Y-up space of the source file into our Z-up space, and applies the import offset and scale
+// on top. The vertices of instanced meshes are converted to Z-up without the offset and scale, so that this maps them to the world.
+static MeshInstance MakeMeshInstance(HMM_Mat4 source_from_local, HMM_Vec3 offset, float scale) {
+	HMM_Mat4 z_up_from_y_up = {}; // (x, y, z) -> (x, -z, y), the same as the vertex conversion
+	z_up_from_y_up.Columns[0] = HMM_V4(1.f, 0.f, 0.f, 0.f);
+	z_up_from_y_up.Columns[1] = HMM_V4(0.f, 0.f, 1.f, 0.f);
+	z_up_from_y_up.Columns[2] = HMM_V4(0.f, -1.f, 0.f, 0.f);
+	z_up_from_y_up.Columns[3] = HMM_V4(0.f, 0.f, 0.f, 1.f);
 
-		GPU_SetBufferBinding(desc_set, pass->globals_binding, renderer->globals_buffer);
-		GPU_SetSamplerBinding(desc_set, pass->sampler_linear_clamp_binding, GPU_SamplerLinearClamp());
-		GPU_SetSamplerBinding(desc_set, pass->sampler_linear_wrap_binding, GPU_SamplerLinearWrap());
-		GPU_SetSamplerBinding(desc_set, pass->sampler_percentage_closer, renderer->sampler_percentage_closer);
+	HMM_Mat4 world_from_local = HMM_MulM4(z_up_from_y_up, HMM_MulM4(source_from_local, HMM_TransposeM4(z_up_from_y_up)));
+	world_from_local = HMM_MulM4(HMM_Translate(offset), world_from_local);
+	world_from_local = HMM_MulM4(HMM_Scale(HMM_V3(scale, scale, scale)), world_from_local);
 
-		GPU_SetTextureBinding(desc_set, pass->tex0_binding, part->tex_base_color ? part->tex_base_color : renderer->dummy_white);
-		GPU_SetTextureBinding(desc_set, pass->tex1_binding, part->tex_normal ? part->tex_normal : renderer->dummy_normal_map);
-		GPU_SetTextureBinding(desc_set, pass->tex2_binding, part->tex_orm ? part->tex_orm : renderer->dummy_black);
-		GPU_SetTextureBinding(desc_set, pass->tex3_binding, part->tex_emissive ? part->tex_emissive : renderer->dummy_black);
-		GPU_SetTextureBinding(desc_set, pass->sun_depth_map_binding_, renderer->sun_depth_rt);
+	MeshInstance instance;
+	instance.world_from_local = world_from_local;
+	instance.normal_from_local = HMM_TransposeM4(HMM_InvGeneralM4(world_from_local));
+	return instance;
+}
 
-		// for lightgrid voxelization
-		GPU_SetBufferBinding(desc_set, pass->ssbo0_binding, render_object.vertex_buffer);
-		GPU_SetBufferBinding(desc_set, pass->ssbo1_binding, render_object.index_buffer);
-		GPU_SetStorageImageBinding(desc_set, pass->img0_binding, renderer->lightgrid, 0);
-		//GPU_SetStorageImageBinding(desc_set, pass->img0_binding_uint, renderer->lightgrid, 0);
+struct AssimpMeshRef {
+	uint32_t mesh_idx;
+	HMM_Mat4 source_from_local;
+};
 
-		// ... unused descriptors. This is stupid.
-		GPU_SetTextureBinding(desc_set, pass->prev_frame_result_binding, renderer->dummy_black);
-		GPU_SetTextureBinding(desc_set, pass->gbuffer_depth_binding, renderer->dummy_black);
-		GPU_SetTextureBinding(desc_set, pass->gbuffer_depth_prev_binding, renderer->dummy_black);
-		GPU_SetTextureBinding(desc_set, pass->gbuffer_velocity_binding, renderer->dummy_black);
-		GPU_SetTextureBinding(desc_set, pass->gbuffer_velocity_prev_binding, renderer->dummy_black);
-		GPU_SetTextureBinding(desc_set, pass->lighting_result_rt, renderer->dummy_black);
+// Collects every mesh reference in the node hierarchy along with the accumulated node transform
+static void GatherAssimpMeshRefs(const aiNode* node, HMM_Mat4 source_from_parent, DS_DynArray<AssimpMeshRef>* out_refs) {
+	const ai_real* m = &node->mTransformation.a1; // row-major
+	HMM_Mat4 parent_from_local;
+	for (int row = 0; row < 4; row++) {
+		for (int column = 0; column < 4; column++) parent_from_local.Elements[column][row] = (float)m[row*4 + column];
+	}
+	HMM_Mat4 source_from_local = HMM_MulM4(source_from_parent, parent_from_local);
 
-		GPU_FinalizeDescriptorSet(desc_set);
-		part->descriptor_set = desc_set;
+	for (uint32_t i = 0; i < node->mNumMeshes; i++) {
+		AssimpMeshRef ref = {node->mMeshes[i], source_from_local};
+		DS_ArrPush(out_refs, ref);
+	}
+	for (uint32_t i = 0; i < node->mNumChildren; i++) {
+		GatherAssimpMeshRefs(node->mChildren[i], source_from_local, out_refs);
 	}
+}
 
-	aiReleaseImport(scene);
-	return render_object;
+// With `keep_instances`, meshes that are referenced by more than one node are converted once in their local space and each get
+// a part of their own, drawn once per node. Meshes referenced by one node are baked into the material parts as usual.
+// Otherwise, aiProcess_PreTransformVertices bakes every node into a separate copy of its meshes.
+// `cluster_triangle_count` is 0 to keep each material in one part, see SplitMaterialMeshesIntoClusters.
+static void ImportMeshWithAssimp(STR_View filepath, HMM_Vec3 offset, float scale, bool keep_instances, uint32_t cluster_triangle_count,
+	ImportedMesh* out_mesh, LoadMeshStats* stats)
+{
+	uint64_t tick = OS_GetCPUTick();
+	char* filepath_cstr = STR_ToC(TEMP, filepath);
+	
+	// aiProcess_GlobalScale uses the scale settings from the file. It looks like the blender exporter uses it too.
+	unsigned int import_flags = aiProcess_Triangulate|aiProcess_GlobalScale|aiProcess_CalcTangentSpace;
+	if (!keep_instances) import_flags |= aiProcess_PreTransformVertices;
+	
+	const aiScene* scene;
+	STR_View archived_data;
+	if (FindArchivedFile(filepath, &archived_data)) {
+		char* extension = STR_ToC(TEMP, STR_AfterLast(filepath, '.'));
+		scene = aiImportFileFromMemory(archived_data.data, (unsigned int)archived_data.size, import_flags, extension);
+		stats->bytes_read += archived_data.size;
+	}
+	else {
+		scene = aiImportFile(filepath_cstr, import_flags);
+		uint64_t file_size;
+		if (OS_FileSize(filepath, &file_size)) stats->bytes_read += file_size; // doesn't count any files that this one references, e.g. .mtl
+	}
+	assert(scene != NULL);
+	EndLoadPhase(&tick, &stats->parse_time);
+
+	// The first mNumMaterials material meshes get everything that's baked. Each instanced aiMesh is appended as its own material mesh.
+	DS_DynArray<MaterialMesh> mat_meshes = {TEMP};
+	DS_DynArray<uint32_t> mat_mesh_material = {TEMP};
+	
+	MaterialMesh empty_mat_mesh = {};
+	DS_ArrResize(&mat_meshes, empty_mat_mesh, scene->mNumMaterials);
+	for (uint32_t i = 0; i < scene->mNumMaterials; i++) DS_ArrPush(&mat_mesh_material, i);
+
+	uint32_t* mesh_mat_mesh = (uint32_t*)DS_ArenaPush(TEMP, scene->mNumMeshes * sizeof(uint32_t));
+	const MeshInstance** mesh_bake_transform = (const MeshInstance**)DS_ArenaPushZero(TEMP, scene->mNumMeshes * sizeof(MeshInstance*));
+	DS_DynArray<MeshInstance> instances = {TEMP};
+	
+	if (keep_instances) {
+		DS_DynArray<AssimpMeshRef> refs = {TEMP};
+		GatherAssimpMeshRefs(scene->mRootNode, HMM_M4D(1.f), &refs);
+		
+		uint32_t* mesh_ref_count = (uint32_t*)DS_ArenaPushZero(TEMP, scene->mNumMeshes * sizeof(uint32_t));
+		for (int i = 0; i < refs.count; i++) mesh_ref_count[refs[i].mesh_idx]++;
+		
+		// Lay out the instances of each instanced mesh back to back
+		uint32_t* mesh_next_instance = (uint32_t*)DS_ArenaPush(TEMP, scene->mNumMeshes * sizeof(uint32_t));
+		for (uint32_t mesh_idx = 0; mesh_idx < scene->mNumMeshes; mesh_idx++) {
+			uint32_t ref_count = mesh_ref_count[mesh_idx];
+			mesh_mat_mesh[mesh_idx] = ref_count == 0 ? UINT32_MAX : scene->mMeshes[mesh_idx]->mMaterialIndex;
+			mesh_next_instance[mesh_idx] = (uint32_t)instances.count;
+			if (ref_count > 1) {
+				MaterialMesh instanced_mat_mesh = {};
+				instanced_mat_mesh.first_instance = (uint32_t)instances.count;
+				instanced_mat_mesh.instance_count = ref_count;
+				mesh_mat_mesh[mesh_idx] = (uint32_t)mat_meshes.count;
+				DS_ArrPush(&mat_meshes, instanced_mat_mesh);
+				DS_ArrPush(&mat_mesh_material, scene->mMeshes[mesh_idx]->mMaterialIndex);
+				DS_ArrResizeUndef(&instances, instances.count + (int)ref_count);
+			}
+		}
+		
+		MeshInstance* bake_transforms = (MeshInstance*)DS_ArenaPushAligned(TEMP, scene->mNumMeshes * sizeof(MeshInstance), 16);
+		for (int i = 0; i < refs.count; i++) {
+			uint32_t mesh_idx = refs[i].mesh_idx;
+			MeshInstance instance = MakeMeshInstance(refs[i].source_from_local, offset, scale);
+			if (mesh_ref_count[mesh_idx] > 1) {
+				instances.data[mesh_next_instance[mesh_idx]++] = instance;
+			} else {
+				bake_transforms[mesh_idx] = instance;
+				mesh_bake_transform[mesh_idx] = &bake_transforms[mesh_idx];
+			}
+		}
+		
+		// The offset and scale are part of the transforms now
+		offset = {};
+		scale = 1.f;
+	}
+	else {
+		for (uint32_t mesh_idx = 0; mesh_idx < scene->mNumMeshes; mesh_idx++) {
+			mesh_mat_mesh[mesh_idx] = scene->mMeshes[mesh_idx]->mMaterialIndex;
+		}
+	}
+	
+	// Lay out the vertices and indices of every material mesh back to back, as MergeMaterialMeshes wants, and find where each
+	// aiMesh goes within its material mesh.
+	AssimpMeshLayout layout;
+	LayoutAssimpMeshes(TEMP, scene, mesh_mat_mesh, (uint32_t)mat_meshes.count, mesh_bake_transform, offset, scale, &layout);
+	for (int i = 0; i < mat_meshes.count; i++) {
+		MaterialMesh* mat_mesh = &mat_meshes[i];
+		mat_mesh->vertices = layout.vertices + layout.slice_first_vertex[i];
+		mat_mesh->vertex_count = layout.slice_vertex_count[i];
+		
+		// Appending the LODs later reallocates the indices out of the shared array
+		int index_count = (int)layout.slice_index_count[i];
+		mat_mesh->indices = {TEMP, layout.indices + layout.slice_first_index[i], index_count, index_count};
+	}
+
+	// Convert straight into the final slices. Each aiMesh writes to its own disjoint range, so they can all be converted in
+	// parallel and the result is the same as converting them in order.
+	OS_ParallelFor(scene->mNumMeshes, AssimpConvertJobRun, &layout.jobs);
+
+	for (int i = 0; i < mat_meshes.count; i++) {
+		aiMaterial* mat = scene->mMaterials[mat_mesh_material[i]];
+		mat_meshes[i].texture_paths[0] = GetMaterialTexturePath(mat, aiTextureType_DIFFUSE);
+		mat_meshes[i].texture_paths[1] = GetMaterialTexturePath(mat, aiTextureType_NORMALS);
+		mat_meshes[i].texture_paths[2] = GetMaterialTexturePath(mat, aiTextureType_SPECULAR);
+		mat_meshes[i].texture_paths[3] = GetMaterialTexturePath(mat, aiTextureType_EMISSIVE);
+	}
+
+	RemoveEmptyMaterialMeshes(&mat_meshes);
+	if (cluster_triangle_count > 0) SplitMaterialMeshesIntoClusters(&mat_meshes, cluster_triangle_count, stats);
+	EndLoadPhase(&tick, &stats->vertex_processing_time);
+	
+	MergeMaterialMeshes(mat_meshes.data, mat_meshes.count, out_mesh, stats);
+	out_mesh->instances = instances.data;
+	out_mesh->instance_count = (uint32_t)instances.count;
+	EndLoadPhase(&tick, &stats->optimize_time);
+	
+	aiReleaseImport(scene);
+}
+
+// -- glTF import ----------------------------------------------------------------
+// glTF files are loaded with cgltf without going through Assimp. The file and its buffers are memory-mapped, and the accessors
+// are read straight out of the mapped buffer views. Embedded images are referenced by "*<image index>" texture paths (the same
+// convention as Assimp uses), and are decoded on the texture loading worker threads along with the rest.
+
+static bool IsGLTFFile(STR_View filepath) {
+	STR_View lower = STR_ToLower(TEMP, filepath);
+	return STR_EndsWithC(lower, ".gltf") || STR_EndsWithC(lower, ".glb");
+}
+
+static const cgltf_accessor* FindGLTFAttribute(const cgltf_primitive* prim, cgltf_attribute_type type, cgltf_int index) {
+	for (cgltf_size i = 0; i < prim->attributes_count; i++) {
+		if (prim->attributes[i].type == type && prim->attributes[i].index == index) return prim->attributes[i].data;
+	}
+	return NULL;
+}
+
+// Returns a pointer to the first element and sets `*out_stride`. Sparse accessors aren't supported.
+static const uint8_t* GetAccessorData(const cgltf_accessor* accessor, uint32_t* out_stride) {
+	assert(accessor->buffer_view != NULL && !accessor->is_sparse);
+	*out_stride = (uint32_t)accessor->stride;
+	return cgltf_buffer_view_data(accessor->buffer_view) + accessor->offset;
+}
+
+// Reads `n` floats of element `index`. Unnormalized float data is read directly, anything else goes through cgltf.
+static void ReadAccessorFloats(const cgltf_accessor* accessor, const uint8_t* data, uint32_t stride, uint32_t index, float* out, uint32_t n) {
+	if (accessor->component_type == cgltf_component_type_r_32f) {
+		memcpy(out, data + index * stride, n * sizeof(float));
+	}
+	else {
+		bool ok = cgltf_accessor_read_float(accessor, index, out, n);
+		assert(ok);
+	}
+}
+
+static STR_View GetGLTFTexturePath(const cgltf_data* data, const cgltf_texture_view* view) {
+	if (view->texture == NULL || view->texture->image == NULL) return {};
+	
+	// Images in a buffer view or a data URI are decoded into `embedded_images` by ImportMeshWithCGLTF
+	const cgltf_image* image = view->texture->image;
+	if (image->buffer_view || (image->uri && STR_StartsWithC(STR_View(image->uri), "data:"))) {
+		return STR_Form(TEMP, "*%d", (int)(image - data->images));
+	}
+	assert(image->uri != NULL);
+	char* uri = STR_ToC(TEMP, STR_View(image->uri));
+	cgltf_decode_uri(uri);
+	return STR_View(uri);
+}
+
+// Accumulates per-triangle UV tangents for meshes that don't provide them
+static void ComputeTangents(Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count) {
+	for (uint32_t v = 0; v < vertex_count; v++) vertices[v].tangent = {};
+	
+	for (uint32_t i = 0; i < index_count; i += 3) {
+		Vertex* v0 = &vertices[indices[i + 0]];
+		Vertex* v1 = &vertices[indices[i + 1]];
+		Vertex* v2 = &vertices[indices[i + 2]];
+		HMM_Vec3 e1 = HMM_SubV3(v1->position, v0->position);
+		HMM_Vec3 e2 = HMM_SubV3(v2->position, v0->position);
+		HMM_Vec2 duv1 = HMM_SubV2(v1->tex_coord, v0->tex_coord);
+		HMM_Vec2 duv2 = HMM_SubV2(v2->tex_coord, v0->tex_coord);
+		
+		float det = duv1.X * duv2.Y - duv2.X * duv1.Y;
+		if (det == 0.f) continue;
+		HMM_Vec3 tangent = HMM_MulV3F(HMM_SubV3(HMM_MulV3F(e1, duv2.Y), HMM_MulV3F(e2, duv1.Y)), 1.f / det);
+		v0->tangent = HMM_AddV3(v0->tangent, tangent);
+		v1->tangent = HMM_AddV3(v1->tangent, tangent);
+		v2->tangent = HMM_AddV3(v2->tangent, tangent);
+	}
+
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		// Gram-Schmidt against the normal
+		HMM_Vec3 n = vertices[v].normal;
+		HMM_Vec3 t = HMM_SubV3(vertices[v].tangent, HMM_MulV3F(n, HMM_DotV3(n, vertices[v].tangent)));
+		float length = HMM_LenV3(t);
+		vertices[v].tangent = length > 0.f ? HMM_MulV3F(t, 1.f / length) : HMM_V3(1.f, 0.f, 0.f);
+	}
+}
+
+struct GLTFMeshNode {
+	const cgltf_node* node;
+	HMM_Mat4 world_from_local;
+};
+
+// Collects every node with a mesh in the hierarchy along with the accumulated node transform, like GatherAssimpMeshRefs
+static void GatherGLTFMeshNodes(const cgltf_node* node, HMM_Mat4 world_from_parent, DS_DynArray<GLTFMeshNode>* out_nodes) {
+	HMM_Mat4 parent_from_local;
+	cgltf_node_transform_local(node, &parent_from_local.Elements[0][0]);
+	HMM_Mat4 world_from_local = HMM_MulM4(world_from_parent, parent_from_local);
+
+	if (node->mesh) {
+		GLTFMeshNode mesh_node = {node, world_from_local};
+		DS_ArrPush(out_nodes, mesh_node);
+	}
+	for (cgltf_size i = 0; i < node->children_count; i++) {
+		GatherGLTFMeshNodes(node->children[i], world_from_local, out_nodes);
+	}
+}
+
+// `out_mesh->embedded_images` and the texture paths point into the mapped files, so those are returned in `out_mappings`
+// and must stay mapped until the textures are loaded.
+// Only the nodes of the default scene are imported, or of the first scene if the file doesn't say which one.
+// `keep_instances` works the same way as in ImportMeshWithAssimp. Each primitive of an instanced mesh becomes its own part.
+static void ImportMeshWithCGLTF(STR_View filepath, HMM_Vec3 offset, float scale, bool keep_instances, uint32_t cluster_triangle_count,
+	DS_DynArray<OS_FileMapping>* out_mappings, ImportedMesh* out_mesh, LoadMeshStats* stats)
+{
+	uint64_t tick = OS_GetCPUTick();
+	STR_View base_directory = STR_BeforeLast(filepath, '/');
+
+	OS_FileMapping file;
+	STR_View file_data;
+	bool ok = MapAssetFile(filepath, &file, &file_data);
+	assert(ok);
+	if (file.data.size > 0) DS_ArrPush(out_mappings, file);
+	stats->bytes_read += file_data.size;
+
+	cgltf_options options = {};
+	cgltf_data* data = NULL;
+	cgltf_result result = cgltf_parse(&options, file_data.data, file_data.size, &data);
+	assert(result == cgltf_result_success);
+
+	// Point the buffers at the GLB binary chunk or at mapped .bin files instead of letting cgltf read them into memory.
+	for (cgltf_size i = 0; i < data->buffers_count; i++) {
+		cgltf_buffer* buffer = &data->buffers[i];
+		if (buffer->uri == NULL) {
+			assert(data->bin != NULL && data->bin_size >= buffer->size);
+			buffer->data = (void*)data->bin;
+		}
+		else if (STR_StartsWithC(STR_View(buffer->uri), "data:")) {
+			const char* comma = strchr(buffer->uri, ',');
+			assert(comma != NULL);
+			void* decoded;
+			result = cgltf_load_buffer_base64(&options, buffer->size, comma + 1, &decoded);
+			assert(result == cgltf_result_success);
+			
+			buffer->data = DS_ArenaPush(TEMP, buffer->size);
+			memcpy(buffer->data, decoded, buffer->size);
+			free(decoded);
+		}
+		else {
+			char* uri = STR_ToC(TEMP, STR_View(buffer->uri));
+			cgltf_decode_uri(uri);
+			
+			OS_FileMapping buffer_file;
+			STR_View buffer_data;
+			ok = MapAssetFile(STR_Form(TEMP, "%v/%v", base_directory, STR_View(uri)), &buffer_file, &buffer_data);
+			assert(ok && buffer_data.size >= buffer->size);
+			if (buffer_file.data.size > 0) DS_ArrPush(out_mappings, buffer_file);
+			buffer->data = (void*)buffer_data.data;
+		}
+		buffer->data_free_method = cgltf_data_free_method_none;
+		if (buffer->uri != NULL) stats->bytes_read += buffer->size; // the GLB binary chunk was already counted with the file
+	}
+	EndLoadPhase(&tick, &stats->parse_time);
+
+	DS_ArrInit(&out_mesh->embedded_images, TEMP);
+	for (cgltf_size i = 0; i < data->images_count; i++) {
+		const cgltf_image* image = &data->images[i];
+		STR_View image_data = {};
+		if (image->buffer_view) {
+			image_data = STR_View{(const char*)cgltf_buffer_view_data(image->buffer_view), image->buffer_view->size};
+		}
+		else if (image->uri && STR_StartsWithC(STR_View(image->uri), "data:")) {
+			// e.g. "data:image/png;base64,...". Unlike buffers, images don't store their size, so get it from the base64 length.
+			const char* comma = strchr(image->uri, ',');
+			assert(comma != NULL && comma - image->uri >= 7 && memcmp(comma - 7, ";base64", 7) == 0);
+			const char* base64 = comma + 1;
+			size_t base64_length = strlen(base64);
+			while (base64_length > 0 && base64[base64_length - 1] == '=') base64_length--;
+			
+			cgltf_size size = base64_length * 3 / 4;
+			void* decoded;
+			result = cgltf_load_buffer_base64(&options, size, base64, &decoded);
+			assert(result == cgltf_result_success);
+			
+			char* image_copy = (char*)DS_ArenaPush(TEMP, size);
+			memcpy(image_copy, decoded, size);
+			free(decoded);
+			image_data = STR_View{image_copy, size};
+			stats->bytes_read += size;
+		}
+		DS_ArrPush(&out_mesh->embedded_images, image_data);
+	}
+
+	// One material mesh per material, plus one for primitives without a material
+	DS_DynArray<MaterialMesh> mat_meshes = {TEMP};
+	MaterialMesh empty_mat_mesh = {};
+	DS_ArrResize(&mat_meshes, empty_mat_mesh, (int)data->materials_count + 1);
+
+	// Instanced meshes get one material mesh per primitive after those, starting at mesh_first_mat_mesh. The instances of a
+	// mesh are shared by all of its primitives.
+	DS_DynArray<GLTFMeshNode> mesh_nodes = {TEMP};
+	const cgltf_scene* scene = data->scene ? data->scene : data->scenes_count > 0 ? &data->scenes[0] : NULL;
+	if (scene) {
+		for (cgltf_size i = 0; i < scene->nodes_count; i++) GatherGLTFMeshNodes(scene->nodes[i], HMM_M4D(1.f), &mesh_nodes);
+	}
+
+	uint32_t* mesh_ref_count = (uint32_t*)DS_ArenaPushZero(TEMP, data->meshes_count * sizeof(uint32_t));
+	uint32_t* mesh_first_node = (uint32_t*)DS_ArenaPush(TEMP, data->meshes_count * sizeof(uint32_t));
+	uint32_t* mesh_first_mat_mesh = (uint32_t*)DS_ArenaPush(TEMP, data->meshes_count * sizeof(uint32_t));
+	uint32_t* mesh_next_instance = (uint32_t*)DS_ArenaPush(TEMP, data->meshes_count * sizeof(uint32_t));
+	for (int node_i = 0; node_i < mesh_nodes.count; node_i++) {
+		const cgltf_node* node = mesh_nodes[node_i].node;
+		size_t mesh_i = node->mesh - data->meshes;
+		if (mesh_ref_count[mesh_i] == 0) mesh_first_node[mesh_i] = (uint32_t)node_i;
+		mesh_ref_count[mesh_i]++;
+	}
+	
+	DS_DynArray<MeshInstance> instances = {TEMP};
+	for (cgltf_size mesh_i = 0; mesh_i < data->meshes_count; mesh_i++) {
+		const cgltf_mesh* mesh = &data->meshes[mesh_i];
+		uint32_t ref_count = mesh_ref_count[mesh_i];
+		mesh_first_mat_mesh[mesh_i] = UINT32_MAX;
+		mesh_next_instance[mesh_i] = (uint32_t)instances.count;
+		if (!keep_instances || ref_count < 2) continue;
+		
+		mesh_first_mat_mesh[mesh_i] = (uint32_t)mat_meshes.count;
+		for (cgltf_size prim_i = 0; prim_i < mesh->primitives_count; prim_i++) {
+			MaterialMesh instanced_mat_mesh = {};
+			instanced_mat_mesh.first_instance = (uint32_t)instances.count;
+			instanced_mat_mesh.instance_count = ref_count;
+			DS_ArrPush(&mat_meshes, instanced_mat_mesh);
+		}
+		DS_ArrResizeUndef(&instances, instances.count + (int)ref_count);
+	}
+	
+	for (int i = 0; i < mat_meshes.count; i++) {
+		DS_ArrInit(&mat_meshes[i].indices, TEMP);
+	}
+
+	// Count the vertices of each material mesh first, so that the slices can be allocated back to back in one go
+	for (int node_i = 0; node_i < mesh_nodes.count; node_i++) {
+		const cgltf_node* node = mesh_nodes[node_i].node;
+		size_t mesh_i = node->mesh - data->meshes;
+		bool is_instanced = mesh_first_mat_mesh[mesh_i] != UINT32_MAX;
+		if (is_instanced && mesh_first_node[mesh_i] != (uint32_t)node_i) continue; // the vertices are only stored once
+
+		for (cgltf_size prim_i = 0; prim_i < node->mesh->primitives_count; prim_i++) {
+			const cgltf_primitive* prim = &node->mesh->primitives[prim_i];
+			if (prim->type != cgltf_primitive_type_triangles) continue;
+			
+			const cgltf_accessor* positions = FindGLTFAttribute(prim, cgltf_attribute_type_position, 0);
+			assert(positions != NULL);
+			uint32_t mat_mesh_i = is_instanced ? mesh_first_mat_mesh[mesh_i] + (uint32_t)prim_i :
+				prim->material ? (uint32_t)(prim->material - data->materials) : (uint32_t)data->materials_count;
+			mat_meshes[mat_mesh_i].vertex_count += (uint32_t)positions->count;
+		}
+	}
+	{
+		uint32_t total_vertex_count = 0;
+		for (int i = 0; i < mat_meshes.count; i++) total_vertex_count += mat_meshes[i].vertex_count;
+		Vertex* vertices = (Vertex*)DS_ArenaPush(TEMP, total_vertex_count * sizeof(Vertex));
+		
+		for (int i = 0; i < mat_meshes.count; i++) {
+			mat_meshes[i].vertices = vertices;
+			vertices += mat_meshes[i].vertex_count;
+			mat_meshes[i].vertex_count = 0; // filled in again below
+		}
+	}
+
+	for (cgltf_size i = 0; i < data->materials_count; i++) {
+		const cgltf_material* mat = &data->materials[i];
+		mat_meshes[(int)i].texture_paths[0] = GetGLTFTexturePath(data, &mat->pbr_metallic_roughness.base_color_texture);
+		mat_meshes[(int)i].texture_paths[1] = GetGLTFTexturePath(data, &mat->normal_texture);
+		mat_meshes[(int)i].texture_paths[2] = GetGLTFTexturePath(data, &mat->pbr_metallic_roughness.metallic_roughness_texture);
+		mat_meshes[(int)i].texture_paths[3] = GetGLTFTexturePath(data, &mat->emissive_texture);
+	}
+	for (cgltf_size mesh_i = 0; mesh_i < data->meshes_count; mesh_i++) {
+		if (mesh_first_mat_mesh[mesh_i] == UINT32_MAX) continue;
+		for (cgltf_size prim_i = 0; prim_i < data->meshes[mesh_i].primitives_count; prim_i++) {
+			const cgltf_material* mat = data->meshes[mesh_i].primitives[prim_i].material;
+			MaterialMesh* instanced_mat_mesh = &mat_meshes[(int)(mesh_first_mat_mesh[mesh_i] + prim_i)];
+			if (mat) memcpy(instanced_mat_mesh->texture_paths, mat_meshes[(int)(mat - data->materials)].texture_paths, sizeof(instanced_mat_mesh->texture_paths));
+		}
+	}
+
+	// Bake the node transforms into the vertices, like aiProcess_PreTransformVertices does. Instanced meshes are converted
+	// only once, in their local space.
+	for (int node_i = 0; node_i < mesh_nodes.count; node_i++) {
+		const cgltf_node* node = mesh_nodes[node_i].node;
+		HMM_Mat4 world_from_local = mesh_nodes[node_i].world_from_local;
+		HMM_Vec3 vertex_offset = offset;
+		float vertex_scale = scale;
+		
+		size_t mesh_i = node->mesh - data->meshes;
+		bool is_instanced = mesh_first_mat_mesh[mesh_i] != UINT32_MAX;
+		if (is_instanced) {
+			instances.data[mesh_next_instance[mesh_i]++] = MakeMeshInstance(world_from_local, offset, scale);
+			if (mesh_first_node[mesh_i] != (uint32_t)node_i) continue;
+			
+			world_from_local = HMM_M4D(1.f);
+			vertex_offset = {};
+			vertex_scale = 1.f;
+		}
+		HMM_Mat4 normal_matrix = HMM_TransposeM4(HMM_InvGeneralM4(world_from_local));
+		
+		// glTF's bitangent is cross(normal, tangent) * w, pointing towards -V. Our bitangent points towards +V, and a mirroring
+		// transform flips the cross product once more.
+		float tangent_sign_scale = HMM_DeterminantM4(world_from_local) < 0.f ? 1.f : -1.f;
+
+		for (cgltf_size prim_i = 0; prim_i < node->mesh->primitives_count; prim_i++) {
+			const cgltf_primitive* prim = &node->mesh->primitives[prim_i];
+			if (prim->type != cgltf_primitive_type_triangles) continue;
+
+			const cgltf_accessor* positions = FindGLTFAttribute(prim, cgltf_attribute_type_position, 0);
+			const cgltf_accessor* normals = FindGLTFAttribute(prim, cgltf_attribute_type_normal, 0);
+			const cgltf_accessor* tangents = FindGLTFAttribute(prim, cgltf_attribute_type_tangent, 0);
+			const cgltf_accessor* tex_coords = FindGLTFAttribute(prim, cgltf_attribute_type_texcoord, 0);
+			assert(positions != NULL);
+			assert(normals != NULL);
+			assert(tex_coords != NULL);
+
+			uint32_t mat_mesh_i = is_instanced ? mesh_first_mat_mesh[mesh_i] + (uint32_t)prim_i :
+				prim->material ? (uint32_t)(prim->material - data->materials) : (uint32_t)data->materials_count;
+			MaterialMesh* mat_mesh = &mat_meshes[(int)mat_mesh_i];
+			uint32_t first_new_vertex = mat_mesh->vertex_count;
+			uint32_t first_new_index = (uint32_t)mat_mesh->indices.count;
+			uint32_t vertex_count = (uint32_t)positions->count;
+
+			uint32_t position_stride, normal_stride, tangent_stride = 0, tex_coord_stride;
+			const uint8_t* position_data = GetAccessorData(positions, &position_stride);
+			const uint8_t* normal_data = GetAccessorData(normals, &normal_stride);
+			const uint8_t* tangent_data = tangents ? GetAccessorData(tangents, &tangent_stride) : NULL;
+			const uint8_t* tex_coord_data = GetAccessorData(tex_coords, &tex_coord_stride);
+
+			Vertex* new_vertices = mat_mesh->vertices + first_new_vertex;
+			mat_mesh->vertex_count += vertex_count;
+
+			for (uint32_t i = 0; i < vertex_count; i++) {
+				HMM_Vec3 pos, normal;
+				HMM_Vec4 tangent = {};
+				HMM_Vec2 tex_coord;
+				ReadAccessorFloats(positions, position_data, position_stride, i, pos.Elements, 3);
+				ReadAccessorFloats(normals, normal_data, normal_stride, i, normal.Elements, 3);
+				if (tangents) ReadAccessorFloats(tangents, tangent_data, tangent_stride, i, tangent.Elements, 4);
+				ReadAccessorFloats(tex_coords, tex_coord_data, tex_coord_stride, i, tex_coord.Elements, 2);
+
+				pos = HMM_MulM4V4(world_from_local, HMM_V4(pos.X, pos.Y, pos.Z, 1.f)).XYZ;
+				normal = HMM_NormV3(HMM_MulM4V4(normal_matrix, HMM_V4(normal.X, normal.Y, normal.Z, 0.f)).XYZ);
+				HMM_Vec3 tangent_dir = HMM_MulM4V4(world_from_local, HMM_V4(tangent.X, tangent.Y, tangent.Z, 0.f)).XYZ;
+				
+				// glTF is Y-up, the same as Assimp's output, so flip Y and Z the same way. The UVs already have the top-left origin.
+				Vertex* v = &new_vertices[i];
+				v->position  = {(pos.X + vertex_offset.X)*vertex_scale, (pos.Z * -1.f + vertex_offset.Y)*vertex_scale, (pos.Y + vertex_offset.Z)*vertex_scale};
+				v->normal    = {normal.X,  normal.Z  * -1.f, normal.Y};
+				v->tangent   = {tangent_dir.X, tangent_dir.Z * -1.f, tangent_dir.Y};
+				v->tangent_sign = tangent.W == 0.f ? 0.f : tangent.W < 0.f ? -tangent_sign_scale : tangent_sign_scale;
+				v->tex_coord = tex_coord;
+			}
+
+			if (prim->indices) {
+				uint32_t index_stride;
+				const uint8_t* index_data = GetAccessorData(prim->indices, &index_stride);
+				uint32_t index_count = (uint32_t)prim->indices->count;
+				DS_ArrResizeUndef(&mat_mesh->indices, (int)(first_new_index + index_count));
+				uint32_t* new_indices = mat_mesh->indices.data + first_new_index;
+
+				if (prim->indices->component_type == cgltf_component_type_r_32u && index_stride == 4 && first_new_vertex == 0) {
+					memcpy(new_indices, index_data, index_count * sizeof(uint32_t)); // already in the right layout
+				}
+				else if (prim->indices->component_type == cgltf_component_type_r_32u) {
+					for (uint32_t i = 0; i < index_count; i++) new_indices[i] = first_new_vertex + *(const uint32_t*)(index_data + i * index_stride);
+				}
+				else if (prim->indices->component_type == cgltf_component_type_r_16u) {
+					for (uint32_t i = 0; i < index_count; i++) new_indices[i] = first_new_vertex + *(const uint16_t*)(index_data + i * index_stride);
+				}
+				else {
+					assert(prim->indices->component_type == cgltf_component_type_r_8u);
+					for (uint32_t i = 0; i < index_count; i++) new_indices[i] = first_new_vertex + *(const uint8_t*)(index_data + i * index_stride);
+				}
+			}
+			else {
+				for (uint32_t i = 0; i < vertex_count; i++) DS_ArrPush(&mat_mesh->indices, first_new_vertex + i);
+			}
+			assert((mat_mesh->indices.count - first_new_index) % 3 == 0);
+
+			if (tangents == NULL) {
+				// The tangents only depend on this primitive's triangles, so rebase the indices temporarily.
+				uint32_t new_index_count = (uint32_t)mat_mesh->indices.count - first_new_index;
+				uint32_t* local_indices = (uint32_t*)DS_ArenaPush(TEMP, new_index_count * sizeof(uint32_t));
+				for (uint32_t i = 0; i < new_index_count; i++) local_indices[i] = mat_mesh->indices[(int)(first_new_index + i)] - first_new_vertex;
+				ComputeTangents(new_vertices, vertex_count, local_indices, new_index_count);
+			}
+		}
+	}
+
+	RemoveEmptyMaterialMeshes(&mat_meshes);
+	if (cluster_triangle_count > 0) SplitMaterialMeshesIntoClusters(&mat_meshes, cluster_triangle_count, stats);
+	EndLoadPhase(&tick, &stats->vertex_processing_time);
+
+	MergeMaterialMeshes(mat_meshes.data, mat_meshes.count, out_mesh, stats);
+	out_mesh->instances = instances.data;
+	out_mesh->instance_count = (uint32_t)instances.count;
+	EndLoadPhase(&tick, &stats->optimize_time);
+
+	cgltf_free(data);
+}
+
+// -- Vertex packing -------------------------------------------------------------
+
+static uint16_t FloatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x007FFFFF;
+
+	if (exponent <= 0) { // Too small for a normal half, so make it denormal or zero
+		if (exponent < -10) return (uint16_t)sign;
+		mantissa |= 0x00800000;
+		uint32_t shift = (uint32_t)(14 - exponent);
+		uint32_t half_mantissa = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1) half_mantissa += 1;
+		return (uint16_t)(sign | half_mantissa);
+	}
+	if (exponent >= 31) { // Too big, or inf / nan
+		bool is_nan = ((bits >> 23) & 0xFF) == 0xFF && mantissa != 0;
+		return (uint16_t)(sign | 0x7C00 | (is_nan ? 0x200 : 0));
+	}
+
+	uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) half += 1; // Round to nearest. Carrying into the exponent is fine.
+	return (uint16_t)half;
+}
+
+static uint16_t QuantizeUNorm16(float value) {
+	float x = value < 0.f ? 0.f : value > 1.f ? 1.f : value;
+	return (uint16_t)(x * 65535.f + 0.5f);
+}
+
+// Octahedral encoding, see "A Survey of Efficient Representations for Independent Unit Vectors" (Cigolle et al. 2014).
+// Decoded by OctahedralDecode in geometry_pass.glsl.
+static void OctahedralEncode(HMM_Vec3 v, uint16_t out[2]) {
+	float l1_norm = fabsf(v.X) + fabsf(v.Y) + fabsf(v.Z);
+	float x = l1_norm > 0.f ? v.X / l1_norm : 0.f;
+	float y = l1_norm > 0.f ? v.Y / l1_norm : 0.f;
+	if (v.Z < 0.f) { // Fold the lower hemisphere over the diagonals
+		float folded_x = (1.f - fabsf(y)) * (x >= 0.f ? 1.f : -1.f);
+		float folded_y = (1.f - fabsf(x)) * (y >= 0.f ? 1.f : -1.f);
+		x = folded_x;
+		y = folded_y;
+	}
+	out[0] = QuantizeUNorm16(x*0.5f + 0.5f);
+	out[1] = QuantizeUNorm16(y*0.5f + 0.5f);
+}
+
+// Positions are quantized relative to the bounds of each part, which keeps the precision high on small parts. `cooked_parts`
+// must have their bounds measured already, and get their dequantization constants written here.
+static PackedVertex* PackVertices(const ImportedMesh* mesh, CookedMeshPart* cooked_parts) {
+	PackedVertex* packed_vertices = (PackedVertex*)DS_ArenaPush(TEMP, mesh->vertex_count * sizeof(PackedVertex));
+
+	// Vertices without a tangent sign (Assimp doesn't give us one) get it by accumulating the UV-space bitangent of the
+	// surrounding triangles.
+	bool derive_tangent_signs = false;
+	for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+		if (mesh->vertices[i].tangent_sign == 0.f) { derive_tangent_signs = true; break; }
+	}
+	HMM_Vec3* bitangents = derive_tangent_signs ? (HMM_Vec3*)DS_ArenaPushZero(TEMP, mesh->vertex_count * sizeof(HMM_Vec3)) : NULL;
+	for (uint32_t i = 0; derive_tangent_signs && i + 2 < mesh->index_count; i += 3) {
+		const uint32_t* tri = &mesh->indices[i];
+		const Vertex* v0 = &mesh->vertices[tri[0]];
+		const Vertex* v1 = &mesh->vertices[tri[1]];
+		const Vertex* v2 = &mesh->vertices[tri[2]];
+
+		HMM_Vec3 edge1 = HMM_SubV3(v1->position, v0->position);
+		HMM_Vec3 edge2 = HMM_SubV3(v2->position, v0->position);
+		HMM_Vec2 delta_uv1 = HMM_SubV2(v1->tex_coord, v0->tex_coord);
+		HMM_Vec2 delta_uv2 = HMM_SubV2(v2->tex_coord, v0->tex_coord);
+		float uv_area = delta_uv1.X*delta_uv2.Y - delta_uv2.X*delta_uv1.Y;
+
+		HMM_Vec3 bitangent = HMM_SubV3(HMM_MulV3F(edge2, delta_uv1.X), HMM_MulV3F(edge1, delta_uv2.X));
+		if (uv_area < 0.f) bitangent = HMM_MulV3F(bitangent, -1.f);
+
+		for (int j = 0; j < 3; j++) {
+			bitangents[tri[j]] = HMM_AddV3(bitangents[tri[j]], bitangent);
+		}
+	}
+
+	for (int part_i = 0; part_i < mesh->parts.count; part_i++) {
+		const ImportedMeshPart* part = &mesh->parts.data[part_i];
+		const Vertex* vertices = mesh->vertices + part->first_vertex;
+
+		CookedMeshPart* cooked_part = &cooked_parts[part_i];
+		HMM_Vec3 min = cooked_part->bounds_min;
+		HMM_Vec3 extent = HMM_SubV3(cooked_part->bounds_max, min);
+		cooked_part->position_min = min;
+		cooked_part->position_scale = HMM_MulV3F(extent, 1.f / 65535.f);
+
+		for (uint32_t i = 0; i < part->vertex_count; i++) {
+			const Vertex* v = &vertices[i];
+			PackedVertex* packed = &packed_vertices[part->first_vertex + i];
+
+			for (int k = 0; k < 3; k++) {
+				float t = extent.Elements[k] > 0.f ? (v->position.Elements[k] - min.Elements[k]) / extent.Elements[k] : 0.f;
+				packed->position[k] = QuantizeUNorm16(t);
+			}
+
+			float tangent_sign = v->tangent_sign;
+			if (tangent_sign == 0.f) tangent_sign = HMM_DotV3(HMM_Cross(v->normal, v->tangent), bitangents[part->first_vertex + i]);
+			packed->tangent_sign = tangent_sign >= 0.f ? 1 : 0;
+
+			OctahedralEncode(v->normal, packed->normal_oct);
+			OctahedralEncode(v->tangent, packed->tangent_oct);
+			packed->tex_coord[0] = FloatToHalf(v->tex_coord.X);
+			packed->tex_coord[1] = FloatToHalf(v->tex_coord.Y);
+		}
+	}
+	return packed_vertices;
+}
+
+// -- HDR environment ------------------------------------------------------------
+// The environment cubemap is only sampled when generating the irradiance and prefiltered maps, but it's big. Instead of RGBA32F,
+// it's stored as shared-exponent RGB9E5 (4 bytes per texel) when the device can sample that, and as RGBA16F (8 bytes) otherwise.
+// RGB9E5 can't be blitted to, so its mips are filtered on the CPU. RGBA16F gets its mips generated on the GPU as before.
+
+// Converts `count` floats to half floats, 8 at a time with SSE2. Rounds the same way as FloatToHalf, but values outside of the
+// half range saturate to +-65504, and so does nan. A single inf texel would otherwise spread through the filtered maps.
+static void FloatsToHalves(const float* src, uint16_t* dst, size_t count) {
+	const __m128i sign_mask = _mm_set1_epi32((int)0x80000000);
+	const __m128 max_half = _mm_set1_ps(65504.f);
+	const __m128i normal_bias = _mm_set1_epi32((112 << 23) - 0x1000); // rebias the exponent, and add half of the dropped mantissa to round
+	const __m128i smallest_normal = _mm_set1_epi32(113 << 23); // 2^-14
+	const __m128i smallest_nonzero = _mm_set1_epi32(102 << 23); // 2^-25, anything below rounds to zero
+	const __m128 denormal_scale = _mm_set1_ps(16777216.f); // 2^24, the step between denormal halfs is 2^-24
+	const __m128 one_half = _mm_set1_ps(0.5f);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i halves[2];
+		for (int j = 0; j < 2; j++) {
+			__m128i bits = _mm_castps_si128(_mm_loadu_ps(src + i + j*4));
+			__m128i sign = _mm_and_si128(bits, sign_mask);
+			__m128 abs_value = _mm_min_ps(_mm_castsi128_ps(_mm_xor_si128(bits, sign)), max_half); // minps returns max_half for nan
+			__m128i abs_bits = _mm_castps_si128(abs_value);
+
+			__m128i normal = _mm_srli_epi32(_mm_sub_epi32(abs_bits, normal_bias), 13); // carrying into the exponent is fine
+			__m128i denormal = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(abs_value, denormal_scale), one_half));
+			denormal = _mm_andnot_si128(_mm_cmplt_epi32(abs_bits, smallest_nonzero), denormal);
+			
+			__m128i is_denormal = _mm_cmplt_epi32(abs_bits, smallest_normal);
+			__m128i half = _mm_or_si128(_mm_and_si128(is_denormal, denormal), _mm_andnot_si128(is_denormal, normal));
+			half = _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+			halves[j] = _mm_srai_epi32(_mm_slli_epi32(half, 16), 16); // sign-extend, so that the signed pack below doesn't saturate
+		}
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(halves[0], halves[1]));
+	}
+
+	for (; i < count; i++) {
+		float value = src[i];
+		if (!(fabsf(value) <= 65504.f)) value = copysignf(65504.f, value);
+		dst[i] = FloatToHalf(value);
+	}
+}
+
+// See VK_FORMAT_E5B9G9R9_UFLOAT_PACK32. Negative values and nan become zero, and big values saturate.
+static uint32_t FloatToRGB9E5(const float* rgb) {
+	const float max_value = 65408.f; // 511/512 * 2^16
+
+	float c[3];
+	for (int k = 0; k < 3; k++) {
+		c[k] = rgb[k] > 0.f ? (rgb[k] < max_value ? rgb[k] : max_value) : 0.f;
+	}
+	float max_component = c[0] > c[1] ? (c[0] > c[2] ? c[0] : c[2]) : (c[1] > c[2] ? c[1] : c[2]);
+
+	// The mantissas have no implicit leading one, so the shared exponent is one above floor(log2(max_component)).
+	uint32_t max_bits;
+	memcpy(&max_bits, &max_component, 4);
+	int32_t exponent = (int32_t)(max_bits >> 23) - 127;
+	if (exponent < -16) exponent = -16;
+	int32_t shared_exponent = exponent + 16; // with the bias of 15
+
+	float scale = ldexpf(1.f, 24 - shared_exponent); // 2^(mantissa bits + bias - shared_exponent)
+	if ((uint32_t)(max_component * scale + 0.5f) == 512) { // rounding overflowed the mantissa
+		shared_exponent++;
+		scale *= 0.5f;
+	}
+
+	uint32_t r = (uint32_t)(c[0] * scale + 0.5f);
+	uint32_t g = (uint32_t)(c[1] * scale + 0.5f);
+	uint32_t b = (uint32_t)(c[2] * scale + 0.5f);
+	return r | (g << 9) | (b << 18) | ((uint32_t)shared_exponent << 27);
+}
+
+// `faces` is the RGBA32F top mip of all 6 faces. Each mip is a 2x2 box filter of the previous one.
+static GPU_Texture* MakeRGB9E5Cubemap(const float* faces, uint32_t size) {
+	uint32_t mip_level_count = 1;
+	for (uint32_t s = size; s > 1; s /= 2) mip_level_count++;
+
+	uint32_t data_size = 0;
+	for (uint32_t mip = 0; mip < mip_level_count; mip++) {
+		uint32_t mip_size = size >> mip;
+		data_size += mip_size * mip_size * 6 * sizeof(uint32_t);
+	}
+	
+	GPU_Graph* graph = GPU_MakeGraph();
+	GPU_Buffer* own_staging_buffer = NULL;
+	GPU_StagingAllocation staging;
+	if (!GPU_AllocateStaging(graph, data_size, 4, &staging)) {
+		// Bigger than the staging ring
+		own_staging_buffer = GPU_MakeBuffer(data_size, GPU_BufferFlag_CPU, NULL);
+		staging = {own_staging_buffer, 0, own_staging_buffer->data};
+	}
+	GPU_TextureCopyRegion* regions = (GPU_TextureCopyRegion*)DS_ArenaPush(TEMP, mip_level_count * 6 * sizeof(GPU_TextureCopyRegion));
+	
+	const float* src = faces;
+	uint32_t offset = 0;
+	for (uint32_t mip = 0; mip < mip_level_count; mip++) {
+		uint32_t mip_size = size >> mip;
+		float* filtered = NULL;
+		if (mip > 0) {
+			uint32_t src_size = size >> (mip - 1);
+			filtered = (float*)DS_ArenaPush(TEMP, mip_size * mip_size * 6 * 4 * sizeof(float));
+			for (uint32_t face = 0; face < 6; face++) {
+				const float* src_face = src + face * src_size * src_size * 4;
+				float* dst_face = filtered + face * mip_size * mip_size * 4;
+				for (uint32_t y = 0; y < mip_size; y++) {
+					for (uint32_t x = 0; x < mip_size; x++) {
+						uint32_t x1 = 2*x + 1 < src_size ? 2*x + 1 : src_size - 1; // odd sizes repeat the last texel
+						uint32_t y1 = 2*y + 1 < src_size ? 2*y + 1 : src_size - 1;
+						for (int k = 0; k < 4; k++) {
+							dst_face[(y*mip_size + x)*4 + k] = 0.25f * (
+								src_face[(2*y*src_size + 2*x)*4 + k] + src_face[(2*y*src_size + x1)*4 + k] +
+								src_face[(y1*src_size + 2*x)*4 + k] + src_face[(y1*src_size + x1)*4 + k]);
+						}
+					}
+				}
+			}
+			src = filtered;
+		}
+		
+		uint32_t* dst = (uint32_t*)((char*)staging.data + offset);
+		for (uint32_t i = 0; i < mip_size * mip_size * 6; i++) {
+			dst[i] = FloatToRGB9E5(&src[i*4]);
+		}
+		for (uint32_t face = 0; face < 6; face++) {
+			GPU_TextureCopyRegion region = {staging.offset + offset + face * mip_size * mip_size * 4, face, mip};
+			regions[mip*6 + face] = region;
+		}
+		offset += mip_size * mip_size * 6 * 4;
+	}
+	
+	GPU_Texture* texture = GPU_MakeTextureEx(GPU_Format_RGB9E5, size, size, 1, mip_level_count, GPU_TextureFlag_Cubemap);
+	GPU_OpCopyBufferToTextureRegions(graph, staging.buffer, texture, regions, mip_level_count * 6);
+	GPU_GraphSubmit(graph);
+	GPU_GraphWait(graph);
+	GPU_DestroyGraph(graph);
+	GPU_DestroyBuffer(own_staging_buffer);
+	return texture;
+}
+
+GPU_Texture* MakeTextureFromHDRIFile(STR_View filepath) {
+	int x, y, comp;
+	float* data;
+	STR_View archived_data;
+	if (FindArchivedFile(filepath, &archived_data)) {
+		data = stbi_loadf_from_memory((const stbi_uc*)archived_data.data, (int)archived_data.size, &x, &y, &comp, 4);
+	}
+	else {
+		data = stbi_loadf(STR_ToC(TEMP, filepath), &x, &y, &comp, 4);
+	}
+	assert(data);
+	assert(y == x*6);
+
+	DS_ArenaMark mark = DS_ArenaGetMark(TEMP);
+	uint32_t size = (uint32_t)x;
+	GPU_Texture* result;
+	if (GPU_FormatSupportsUploadAndSampling(GPU_Format_RGB9E5)) {
+		result = MakeRGB9E5Cubemap(data, size);
+	}
+	else {
+		size_t value_count = (size_t)size * size * 6 * 4;
+		uint16_t* halves = (uint16_t*)DS_ArenaPush(TEMP, value_count * sizeof(uint16_t));
+		FloatsToHalves(data, halves, value_count);
+		result = GPU_MakeTexture(GPU_Format_RGBA16F, size, size, 1, GPU_TextureFlag_Cubemap|GPU_TextureFlag_HasMipmaps, halves);
+	}
+	DS_ArenaSetMark(TEMP, mark);
+
+	stbi_image_free(data);
+	return result;
+}
+
+// -- Cooking --------------------------------------------------------------------
+
+// Turns the imported mesh into what LoadMesh uploads. The indices of each part are rebased to its first vertex, so that
+// parts with few enough vertices can use 16-bit indices. Each range is aligned to its own index size, so that the part's
+// first_index can be counted in units of that size. `import_stats` are the stats that the importers filled in.
+static void CookMesh(const ImportedMesh* mesh, const LoadMeshStats* import_stats, CookedMesh* out_mesh) {
+	*out_mesh = {};
+	DS_ArrInit(&out_mesh->parts, TEMP);
+	DS_ArrResizeUndef(&out_mesh->parts, mesh->parts.count);
+
+	uint32_t index_data_size = 0;
+	for (int i = 0; i < mesh->parts.count; i++) {
+		const ImportedMeshPart* imported_part = &mesh->parts.data[i];
+		CookedMeshPart* part = &out_mesh->parts[i];
+		*part = {};
+		uint32_t index_size = imported_part->vertex_count <= 0xFFFF ? 2 : 4;
+		index_data_size = (uint32_t)DS_AlignUpPow2(index_data_size, index_size);
+
+		part->index_type = index_size == 2 ? GPU_IndexType_U16 : GPU_IndexType_U32;
+		part->first_index = index_data_size / index_size;
+		part->index_count = imported_part->index_count;
+		part->lod_count = imported_part->lod_count;
+		memcpy(part->lods, imported_part->lods, sizeof(part->lods));
+		part->first_vertex = imported_part->first_vertex;
+		part->vertex_count = imported_part->vertex_count;
+		part->first_instance = imported_part->first_instance;
+		part->instance_count = imported_part->instance_count;
+		memcpy(part->texture_paths, imported_part->texture_paths, sizeof(part->texture_paths));
+		index_data_size += imported_part->index_count * index_size;
+
+		const Vertex* vertices = mesh->vertices + imported_part->first_vertex;
+		for (uint32_t j = 0; j < imported_part->vertex_count; j++) {
+			HMM_Vec3 p = vertices[j].position;
+			if (j == 0) { part->bounds_min = p; part->bounds_max = p; }
+			for (int k = 0; k < 3; k++) {
+				if (p.Elements[k] < part->bounds_min.Elements[k]) part->bounds_min.Elements[k] = p.Elements[k];
+				if (p.Elements[k] > part->bounds_max.Elements[k]) part->bounds_max.Elements[k] = p.Elements[k];
+			}
+		}
+
+		// Average UV units per local unit over the triangles of LOD 0, for texture streaming
+		const uint32_t* indices = mesh->indices + imported_part->first_index;
+		float uv_area = 0.f;
+		float local_area = 0.f;
+		for (uint32_t j = 0; j + 2 < imported_part->lods[0].index_count; j += 3) {
+			const Vertex* v0 = &mesh->vertices[indices[j + 0]];
+			const Vertex* v1 = &mesh->vertices[indices[j + 1]];
+			const Vertex* v2 = &mesh->vertices[indices[j + 2]];
+			HMM_Vec2 uv_a = HMM_SubV2(v1->tex_coord, v0->tex_coord);
+			HMM_Vec2 uv_b = HMM_SubV2(v2->tex_coord, v0->tex_coord);
+			uv_area += fabsf(uv_a.X * uv_b.Y - uv_a.Y * uv_b.X);
+			local_area += HMM_LenV3(HMM_Cross(HMM_SubV3(v1->position, v0->position), HMM_SubV3(v2->position, v0->position)));
+		}
+		if (uv_area > 0.f && local_area > 0.f) part->uv_density = sqrtf(uv_area / local_area);
+	}
+	index_data_size = (uint32_t)DS_AlignUpPow2(index_data_size, 4); // The voxelize shader reads the indices as uints
+
+	char* index_data = DS_ArenaPushZero(TEMP, index_data_size);
+	for (int i = 0; i < mesh->parts.count; i++) {
+		const ImportedMeshPart* imported_part = &mesh->parts.data[i];
+		const CookedMeshPart* part = &out_mesh->parts[i];
+		const uint32_t* indices = mesh->indices + imported_part->first_index;
+		
+		if (part->index_type == GPU_IndexType_U16) {
+			uint16_t* dst = (uint16_t*)index_data + part->first_index;
+			for (uint32_t j = 0; j < imported_part->index_count; j++) {
+				assert(indices[j] - imported_part->first_vertex < imported_part->vertex_count);
+				dst[j] = (uint16_t)(indices[j] - imported_part->first_vertex);
+			}
+		}
+		else {
+			uint32_t* dst = (uint32_t*)index_data + part->first_index;
+			for (uint32_t j = 0; j < imported_part->index_count; j++) {
+				assert(indices[j] - imported_part->first_vertex < imported_part->vertex_count);
+				dst[j] = indices[j] - imported_part->first_vertex;
+			}
+		}
+	}
+
+#if PACKED_VERTICES
+	out_mesh->vertex_data = PackVertices(mesh, out_mesh->parts.data);
+#else
+	out_mesh->vertex_data = mesh->vertices;
+#endif
+	out_mesh->vertex_data_size = mesh->vertex_count * COOKED_MESH_VERTEX_SIZE;
+	out_mesh->vertex_count = mesh->vertex_count;
+	out_mesh->index_data = index_data;
+	out_mesh->index_data_size = index_data_size;
+	out_mesh->instances = mesh->instances;
+	out_mesh->instance_count = mesh->instance_count;
+
+	out_mesh->stats.split_material_mesh_count = import_stats->split_material_mesh_count;
+	out_mesh->stats.cluster_count = import_stats->cluster_count;
+	out_mesh->stats.acmr_before = import_stats->acmr_before;
+	out_mesh->stats.acmr_after = import_stats->acmr_after;
+	memcpy(out_mesh->stats.lod_triangle_counts, import_stats->lod_triangle_counts, sizeof(out_mesh->stats.lod_triangle_counts));
+}
+
+// Meshlets are built from the full precision vertices, so the bounds are in world space regardless of PACKED_VERTICES.
+// For instanced parts, that's the local space of the instances. Only LOD 0 gets meshlets.
+static void CookMeshlets(const ImportedMesh* mesh, CookedMesh* cooked_mesh) {
+	DS_DynArray<Meshlet> meshlets = {TEMP};
+	DS_DynArray<uint32_t> meshlet_vertices = {TEMP};
+	DS_DynArray<uint8_t> meshlet_triangles = {TEMP};
+	
+	for (int i = 0; i < mesh->parts.count; i++) {
+		const ImportedMeshPart* imported_part = &mesh->parts.data[i];
+		CookedMeshPart* part = &cooked_mesh->parts[i];
+		part->first_meshlet = (uint32_t)meshlets.count;
+		part->meshlet_count = BuildMeshlets(TEMP, mesh->vertices + imported_part->first_vertex, imported_part->vertex_count,
+			mesh->indices + imported_part->first_index, imported_part->lods[0].index_count, imported_part->first_vertex,
+			&meshlets, &meshlet_vertices, &meshlet_triangles);
+	}
+	
+	uint32_t meshlets_size = meshlets.count * sizeof(Meshlet);
+	uint32_t meshlet_vertices_size = meshlet_vertices.count * sizeof(uint32_t);
+	uint32_t meshlet_triangles_size = (uint32_t)DS_AlignUpPow2(meshlet_triangles.count, 4);
+	uint32_t meshlet_data_size = meshlets_size + meshlet_vertices_size + meshlet_triangles_size;
+	
+	char* meshlet_data = DS_ArenaPushZero(TEMP, meshlet_data_size);
+	memcpy(meshlet_data, meshlets.data, meshlets_size);
+	memcpy(meshlet_data + meshlets_size, meshlet_vertices.data, meshlet_vertices_size);
+	memcpy(meshlet_data + meshlets_size + meshlet_vertices_size, meshlet_triangles.data, meshlet_triangles.count);
+	
+	cooked_mesh->meshlet_data = meshlet_data;
+	cooked_mesh->meshlet_data_size = meshlet_data_size;
+	cooked_mesh->meshlet_vertices_offset = meshlets_size;
+	cooked_mesh->meshlet_triangles_offset = meshlets_size + meshlet_vertices_size;
+	cooked_mesh->meshlet_count = (uint32_t)meshlets.count;
+}
+
+// -------------------------------------------------------------------------------
+
+RenderObject LoadMesh(Renderer* renderer, STR_View filepath, HMM_Vec3 offset, float scale, LoadMeshFlags flags, LoadMeshStats* out_stats) {
+	LoadMeshStats local_stats;
+	LoadMeshStats* stats = out_stats ? out_stats : &local_stats;
+	*stats = {};
+	uint64_t start_tick = OS_GetCPUTick();
+	uint64_t tick = start_tick;
+	
+	RenderObject render_object = {};
+	DS_ArrInit(&render_object.parts, DS_HEAP);
+	
+	assert(!STR_ContainsU(filepath, '\\')); // we should use / for path separators
+
+	// If the source file can't be found, accept any cooked file that matches the import parameters.
+	uint64_t source_modtime = 0;
+	OS_FileLastModificationTime(filepath, &source_modtime);
+
+	STR_View cooked_filepath = STR_Form(TEMP, "%v.cooked", filepath);
+	OS_FileMapping cooked_file = {};
+	STR_View cooked_data;
+	ImportedMesh imported_mesh = {};
+	CookedMesh mesh = {};
+	
+	// glTF files are read directly out of the mapped file, so they don't go through the cooked cache. That also keeps the
+	// embedded images available for LoadTextures.
+	bool is_gltf = IsGLTFFile(filepath);
+	DS_DynArray<OS_FileMapping> gltf_mappings = {TEMP};
+	
+	bool use_cache = !is_gltf;
+	
+	bool keep_instances = (flags & LoadMeshFlag_KeepInstances) != 0;
+	uint32_t import_flags = (uint32_t)(flags & (LoadMeshFlag_KeepInstances|LoadMeshFlag_SplitIntoClusters|LoadMeshFlag_BuildMeshlets));
+	uint32_t cluster_triangle_count = GetClusterTriangleCount(import_flags);
+	
+	bool loaded_from_cache = false;
+	if (use_cache && MapAssetFile(cooked_filepath, &cooked_file, &cooked_data)) {
+		loaded_from_cache = ReadCookedMesh(cooked_data, source_modtime, offset, scale, import_flags, &mesh);
+		if (loaded_from_cache) {
+			stats->bytes_read += cooked_data.size;
+		}
+		else {
+			if (cooked_file.data.size > 0) OS_UnmapFile(&cooked_file);
+			cooked_file = {};
+			mesh = {};
+		}
+		EndLoadPhase(&tick, &stats->parse_time);
+	}
+	
+	if (!loaded_from_cache) {
+		if (is_gltf) {
+			ImportMeshWithCGLTF(filepath, offset, scale, keep_instances, cluster_triangle_count, &gltf_mappings, &imported_mesh, stats);
+		}
+		else {
+			ImportMeshWithAssimp(filepath, offset, scale, keep_instances, cluster_triangle_count, &imported_mesh, stats);
+		}
+		tick = OS_GetCPUTick(); // the importers time their own phases
+		
+		CookMesh(&imported_mesh, stats, &mesh);
+		EndLoadPhase(&tick, &stats->vertex_processing_time);
+		if (flags & LoadMeshFlag_BuildMeshlets) {
+			CookMeshlets(&imported_mesh, &mesh);
+			EndLoadPhase(&tick, &stats->meshlet_time);
+		}
+		if (use_cache) WriteCookedMesh(cooked_filepath, &mesh, source_modtime, offset, scale, import_flags);
+		tick = OS_GetCPUTick();
+	}
+	stats->loaded_from_cache = loaded_from_cache;
+	stats->split_material_mesh_count = mesh.stats.split_material_mesh_count;
+	stats->cluster_count = mesh.stats.cluster_count;
+	stats->acmr_before = mesh.stats.acmr_before;
+	stats->acmr_after = mesh.stats.acmr_after;
+	memcpy(stats->lod_triangle_counts, mesh.stats.lod_triangle_counts, sizeof(stats->lod_triangle_counts));
+
+	stats->vertex_bytes = mesh.vertex_data_size;
+	stats->index_bytes = mesh.index_data_size;
+	render_object.vertex_buffer = GPU_MakeBuffer(mesh.vertex_data_size, GPU_BufferFlag_GPU | GPU_BufferFlag_StorageBuffer, mesh.vertex_data);
+	render_object.index_buffer = GPU_MakeBuffer(mesh.index_data_size, GPU_BufferFlag_GPU | GPU_BufferFlag_StorageBuffer, mesh.index_data);
+	
+	for (int i = 0; i < mesh.parts.count; i++) {
+		if (mesh.parts[i].instance_count > 0) stats->instanced_part_count++;
+	}
+	stats->instance_count = mesh.instance_count;
+
+	// The identity instance goes first, for the parts that aren't instanced
+	uint32_t instance_count = 1 + mesh.instance_count;
+	MeshInstance* instances = (MeshInstance*)DS_ArenaPushAligned(TEMP, instance_count * sizeof(MeshInstance), 16);
+	instances[0].world_from_local = HMM_M4D(1.f);
+	instances[0].normal_from_local = HMM_M4D(1.f);
+	memcpy(instances + 1, mesh.instances, mesh.instance_count * sizeof(MeshInstance));
+	render_object.instance_buffer = GPU_MakeBuffer(instance_count * sizeof(MeshInstance), GPU_BufferFlag_GPU | GPU_BufferFlag_StorageBuffer, instances);
+	EndLoadPhase(&tick, &stats->gpu_upload_time);
+	
+	if (mesh.meshlet_count > 0) {
+		render_object.meshlet_buffer = GPU_MakeBuffer(mesh.meshlet_data_size, GPU_BufferFlag_GPU | GPU_BufferFlag_StorageBuffer, mesh.meshlet_data);
+		render_object.meshlet_vertices_offset = mesh.meshlet_vertices_offset;
+		render_object.meshlet_triangles_offset = mesh.meshlet_triangles_offset;
+		EndLoadPhase(&tick, &stats->gpu_upload_time);
+	}
+	stats->meshlet_count = mesh.meshlet_count;
+	
+	// Load the textures of all parts in one go
+	STR_View* texture_paths = (STR_View*)DS_ArenaPush(TEMP, mesh.parts.count * 4 * sizeof(STR_View));
+	GPU_Texture** textures = (GPU_Texture**)DS_ArenaPush(TEMP, mesh.parts.count * 4 * sizeof(GPU_Texture*));
+	for (int i = 0; i < mesh.parts.count; i++) {
+		memcpy(&texture_paths[i*4], mesh.parts[i].texture_paths, 4 * sizeof(STR_View));
+	}
+	LoadTextures(filepath, texture_paths, mesh.parts.count * 4, imported_mesh.embedded_images.data, (uint32_t)imported_mesh.embedded_images.count, textures, stats);
+	tick = OS_GetCPUTick(); // LoadTextures times its own phases
+
+	for (int i = 0; i < mesh.parts.count; i++) {
+		const CookedMeshPart* cooked_part = &mesh.parts[i];
+
+		RenderObjectPart part = {};
+		part.index_type = (GPU_IndexType)cooked_part->index_type;
+		part.first_index = cooked_part->first_index;
+		part.base_vertex = cooked_part->first_vertex;
+		part.lod_count = cooked_part->lod_count;
+		memcpy(part.lods, cooked_part->lods, sizeof(part.lods));
+		part.first_instance = cooked_part->instance_count > 0 ? 1 + cooked_part->first_instance : 0;
+		part.instance_count = cooked_part->instance_count > 0 ? cooked_part->instance_count : 1;
+		
+		HMM_Vec3 local_min = cooked_part->bounds_min;
+		HMM_Vec3 local_max = cooked_part->bounds_max;
+		
+		// The world bounds cover the corners of the local bounds of every instance. The LOD errors are in local units, so
+		// scale them by the largest instance scale to keep them conservative in world units.
+		part.bounds_min = HMM_V3(FLT_MAX, FLT_MAX, FLT_MAX);
+		part.bounds_max = HMM_V3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		float max_instance_scale = 0.f;
+		float min_instance_scale = FLT_MAX;
+		for (uint32_t j = 0; j < part.instance_count; j++) {
+			const HMM_Mat4* world_from_local = &instances[part.first_instance + j].world_from_local;
+			for (int corner = 0; corner < 8; corner++) {
+				HMM_Vec3 local_pos = HMM_V3(corner & 1 ? local_max.X : local_min.X, corner & 2 ? local_max.Y : local_min.Y, corner & 4 ? local_max.Z : local_min.Z);
+				HMM_Vec3 pos = HMM_MulM4V4(*world_from_local, HMM_V4V(local_pos, 1.f)).XYZ;
+				for (int k = 0; k < 3; k++) {
+					if (pos.Elements[k] < part.bounds_min.Elements[k]) part.bounds_min.Elements[k] = pos.Elements[k];
+					if (pos.Elements[k] > part.bounds_max.Elements[k]) part.bounds_max.Elements[k] = pos.Elements[k];
+				}
+			}
+			for (int k = 0; k < 3; k++) {
+				float axis_scale = HMM_LenV3(world_from_local->Columns[k].XYZ);
+				if (axis_scale > max_instance_scale) max_instance_scale = axis_scale;
+				if (axis_scale < min_instance_scale) min_instance_scale = axis_scale;
+			}
+		}
+		for (uint32_t j = 0; j < part.lod_count; j++) {
+			part.lods[j].error *= max_instance_scale;
+		}
+		
+		// Divide the UV density by the smallest instance scale, since the smallest instance packs the most texels into a world unit
+		if (min_instance_scale > 0.f) part.uv_density = cooked_part->uv_density / min_instance_scale;
+		part.position_min = cooked_part->position_min;
+		part.position_scale = cooked_part->position_scale;
+		part.first_meshlet = cooked_part->first_meshlet;
+		part.meshlet_count = cooked_part->meshlet_count;
+		part.tex_base_color = textures[i*4 + 0];
+		part.tex_normal     = textures[i*4 + 1];
+		part.tex_orm        = textures[i*4 + 2];
+		part.tex_emissive   = textures[i*4 + 3];
+
+		EndLoadPhase(&tick, &stats->vertex_processing_time);
+		
+		// The descriptor set only depends on the textures, so the clusters of a material all share the one of its first cluster
+		const RenderObjectPart* prev_part = i > 0 ? &render_object.parts[i - 1] : NULL;
+		if (prev_part && prev_part->tex_base_color == part.tex_base_color && prev_part->tex_normal == part.tex_normal &&
+			prev_part->tex_orm == part.tex_orm && prev_part->tex_emissive == part.tex_emissive)
+		{
+			part.descriptor_set = prev_part->descriptor_set;
+			part.shares_descriptor_set = true;
+		}
+		else {
+			part.descriptor_set = MakeRenderObjectPartDescriptorSet(renderer, &render_object, &part);
+		}
+		EndLoadPhase(&tick, &stats->descriptor_set_time);
+
+		DS_ArrPush(&render_object.parts, part);
+	}
+
+	if (cooked_file.data.size > 0) {
+		OS_UnmapFile(&cooked_file);
+	}
+	for (int i = 0; i < gltf_mappings.count; i++) {
+		OS_UnmapFile(&gltf_mappings[i]);
+	}
+	
+	stats->temp_arena_peak = TEMP->total_mem_reserved;
+	stats->total_time = OS_GetDuration(OS_GetCPUFrequency(), start_tick, OS_GetCPUTick());
+	return render_object;
+}
+
+static const char* TextureFormatName(GPU_Format format) {
+	switch (format) {
+	case GPU_Format_RGBA8UN:      return "RGBA8";
+	case GPU_Format_BC1_RGBA_UN:  return "BC1";
+	case GPU_Format_BC3_RGBA_UN:  return "BC3";
+	case GPU_Format_BC5_UN:       return "BC5";
+	case GPU_Format_BC7_RGBA_UN:  return "BC7";
+	default: return "other"; // LoadTextures doesn't make any other formats
+	}
+}
+
+static uint32_t ACMRToMilli(float acmr) {
+	return isfinite(acmr) && acmr > 0.f ? (uint32_t)(acmr * 1000.f + 0.5f) : 0; // 0 for meshes without triangles
+}
+
+STR_View LoadMeshStatsToJSON(DS_Arena* arena, const LoadMeshStats* stats) {
+	// No doubles are printed, since STR_PrintF can print them as "inf" or "nan" that aren't valid JSON. The times are printed
+	// as whole microseconds and the ACMRs as thousandths.
+	struct { const char* name; double time; } phases[] = {
+		{"total", stats->total_time},
+		{"parse", stats->parse_time},
+		{"vertex_processing", stats->vertex_processing_time},
+		{"optimize", stats->optimize_time},
+		{"meshlets", stats->meshlet_time},
+		{"texture_read", stats->texture_read_time},
+		{"texture_decode", stats->texture_decode_time},
+		{"gpu_upload", stats->gpu_upload_time},
+		{"descriptor_sets", stats->descriptor_set_time},
+	};
+
+	STR_Builder s = {arena};
+	STR_PrintC(&s, "{\"time_us\": {");
+	for (size_t i = 0; i < DS_ArrayCount(phases); i++) {
+		STR_PrintF(&s, "%s\"%s\": %llu", i > 0 ? ", " : "", phases[i].name, (uint64_t)(phases[i].time * 1000000.0 + 0.5));
+	}
+	STR_PrintF(&s, "}, \"loaded_from_cache\": %s", stats->loaded_from_cache ? "true" : "false");
+	STR_PrintF(&s, ", \"bytes_read\": %llu, \"vertex_bytes\": %llu, \"index_bytes\": %llu, \"temp_arena_peak\": %llu",
+		stats->bytes_read, stats->vertex_bytes, stats->index_bytes, stats->temp_arena_peak);
+	STR_PrintF(&s, ", \"meshlet_count\": %u, \"instanced_part_count\": %u, \"instance_count\": %u",
+		stats->meshlet_count, stats->instanced_part_count, stats->instance_count);
+	STR_PrintF(&s, ", \"split_material_mesh_count\": %u, \"cluster_count\": %u", stats->split_material_mesh_count, stats->cluster_count);
+	STR_PrintF(&s, ", \"acmr_before_milli\": %u, \"acmr_after_milli\": %u", ACMRToMilli(stats->acmr_before), ACMRToMilli(stats->acmr_after));
+
+	STR_PrintC(&s, ", \"lod_triangle_counts\": [");
+	for (int i = 0; i < MESH_LOD_MAX_COUNT; i++) {
+		STR_PrintF(&s, "%s%u", i > 0 ? ", " : "", stats->lod_triangle_counts[i]);
+	}
+	STR_PrintC(&s, "]");
+	
+	STR_PrintC(&s, ", \"textures\": {");
+	for (uint32_t i = 0; i < stats->texture_format_count; i++) {
+		const LoadMeshTextureStats* t = &stats->textures[i];
+		STR_PrintF(&s, "%s\"%s\": {\"count\": %u, \"bytes\": %llu}", i > 0 ? ", " : "", TextureFormatName(t->format), t->texture_count, t->bytes);
+	}
+	STR_PrintC(&s, "}}");
+	return s.str;
 }
@@ -1,5 +1,65 @@
 
-RenderObject LoadMesh(Renderer* renderer, STR_View filepath, HMM_Vec3 offset, float scale); // asserts that the mesh is valid
+typedef int LoadMeshFlags;
+typedef enum LoadMeshFlag {
+	LoadMeshFlag_BuildMeshlets = 1 << 0, // fill RenderObject::meshlet_buffer, see BuildMeshlets
+	LoadMeshFlag_KeepInstances = 1 << 1, // store meshes referenced by several scene nodes once and draw them instanced, see MeshInstance
+	LoadMeshFlag_SplitIntoClusters = 1 << 2, // split each material into spatially coherent parts that can be culled on their own
+} LoadMeshFlag;
+
+#define LOAD_MESH_CLUSTER_TRIANGLE_COUNT 4096 // the most triangles in a part with LoadMeshFlag_SplitIntoClusters
+
+#define LOAD_MESH_STATS_MAX_TEXTURE_FORMATS 8
+
+struct LoadMeshTextureStats {
+	GPU_Format format;
+	uint32_t texture_count;
+	uint64_t bytes; // uploaded, so decoded PNGs and JPGs count as RGBA8 and streamed DDS files only count their mip tail
+};
+
+// Where the time of a LoadMesh call went, and how much data it went through. Times are in seconds. The texture read and decode
+// times are summed over the worker threads, so they can add up to more than the total time.
+struct LoadMeshStats {
+	double total_time;             // also covers the time that isn't part of any phase below, e.g. writing the cooked mesh
+	double parse_time;             // Assimp or cgltf, or reading the cooked mesh
+	double vertex_processing_time; // converting, packing and measuring the vertices and rebasing the indices
+	double optimize_time;          // vertex cache optimization and LOD generation, see OptimizeMesh
+	double meshlet_time;
+	double texture_read_time;
+	double texture_decode_time;
+	double gpu_upload_time;        // making and filling the buffers and textures
+	double descriptor_set_time;
+
+	bool loaded_from_cache;        // true if the cooked mesh was used, in which case there's no vertex processing or optimization
+	uint64_t bytes_read;           // the mesh, buffer and texture files, whether loose or out of the archive
+	uint64_t vertex_bytes;
+	uint64_t index_bytes;
+	uint64_t temp_arena_peak;      // bytes reserved by TEMP at the end of LoadMesh, which is the most it has held since it was last reset
+	uint32_t meshlet_count;        // 0 without LoadMeshFlag_BuildMeshlets
+	uint32_t instanced_part_count; // parts drawn instanced, 0 without LoadMeshFlag_KeepInstances
+	uint32_t instance_count;       // MeshInstances kept for the instanced parts. The parts of one mesh share theirs.
+	uint32_t split_material_mesh_count; // with LoadMeshFlag_SplitIntoClusters, the material meshes that were split up...
+	uint32_t cluster_count;             // ...into this many parts. Both are 0 otherwise.
+
+	// Average cache misses per triangle of LOD 0 before and after OptimizeMesh, simulated with a FIFO cache of
+	// MESH_OPTIMIZE_CACHE_SIZE vertices. The cooked mesh keeps these import stats, so they're the same on warm loads.
+	float acmr_before;
+	float acmr_after;
+	uint32_t lod_triangle_counts[MESH_LOD_MAX_COUNT]; // summed over the parts, 0 for the LODs that no part has
+
+	// Only the textures that weren't already loaded by an earlier LoadMesh
+	LoadMeshTextureStats textures[LOAD_MESH_STATS_MAX_TEXTURE_FORMATS];
+	uint32_t texture_format_count;
+};
+
+RenderObject LoadMesh(Renderer* renderer, STR_View filepath, HMM_Vec3 offset, float scale, LoadMeshFlags flags = 0, LoadMeshStats* out_stats = NULL); // asserts that the mesh is valid
 void UnloadMesh(RenderObject* mesh);
 
+// Returns the stats as a single JSON object, for tracking load times across asset and code changes.
+STR_View LoadMeshStatsToJSON(DS_Arena* arena, const LoadMeshStats* stats);
+
 GPU_Texture* MakeTextureFromHDRIFile(STR_View filepath); // asserts that the texture is valid
+
+// While an archive is open, LoadMesh and MakeTextureFromHDRIFile read every file that it contains straight out of its mapping,
+// and fall back to loose files for the rest. Archives are made with tool_asset_packer, see asset_archive.h.
+bool OpenAssetArchive(STR_View filepath); // returns false if the file doesn't exist or isn't a valid archive
+void CloseAssetArchive();
@@ -0,0 +1,148 @@
+#include "common.h"
+#include "render.h"
+#include "assimp_convert.h"
+
+#include <xmmintrin.h> // SSE
+
+#define ASSIMP_DLL
+#define ASSIMP_API
+#include <assimp/scene.h>
+
+void TransformVertices(Vertex* vertices, uint32_t vertex_count, const MeshInstance* instance) {
+	bool is_mirrored = HMM_DeterminantM4(instance->world_from_local) < 0.f; // flips cross(normal, tangent)
+	for (uint32_t i = 0; i < vertex_count; i++) {
+		Vertex* v = &vertices[i];
+		v->position = HMM_MulM4V4(instance->world_from_local, HMM_V4V(v->position, 1.f)).XYZ;
+		
+		HMM_Vec3 normal = HMM_MulM4V4(instance->normal_from_local, HMM_V4V(v->normal, 0.f)).XYZ;
+		HMM_Vec3 tangent = HMM_MulM4V4(instance->world_from_local, HMM_V4V(v->tangent, 0.f)).XYZ;
+		float normal_length = HMM_LenV3(normal);
+		float tangent_length = HMM_LenV3(tangent);
+		if (normal_length > 0.f) v->normal = HMM_DivV3F(normal, normal_length);
+		if (tangent_length > 0.f) v->tangent = HMM_DivV3F(tangent, tangent_length);
+		if (is_mirrored) v->tangent_sign *= -1.f;
+	}
+}
+
+void ConvertAssimpVerticesScalar(const aiMesh* mesh, uint32_t first_vertex, HMM_Vec3 offset, float scale, Vertex* out_vertices) {
+	for (uint32_t i = first_vertex; i < mesh->mNumVertices; i++) {
+		aiVector3D pos = mesh->mVertices[i];
+		aiVector3D normal = mesh->mNormals[i];
+		aiVector3D tangent = mesh->mTangents[i];
+		aiVector3D tex_coord = mesh->mTextureCoords[0][i];
+		
+		Vertex* v = &out_vertices[i];
+		v->position  = {(pos.x + offset.X)*scale, (pos.z * -1.f + offset.Y)*scale, (pos.y + offset.Z)*scale};
+		v->normal    = {normal.x,  normal.z  * -1.f, normal.y};
+		v->tangent   = {tangent.x, tangent.z * -1.f, tangent.y};
+		v->tangent_sign = 0.f; // derived from the UVs in PackVertices
+		v->tex_coord = {tex_coord.x, 1.f - tex_coord.y};
+	}
+}
+
+// Each attribute is an aiVector3D, so the position, normal and tangent are each loaded as one unaligned SSE vector and
+// swizzled in-register. A 4-wide load reads one float past the vector, so the last vertex is done with scalar code.
+void ConvertAssimpVertices(const aiMesh* mesh, HMM_Vec3 offset, float scale, Vertex* out_vertices) {
+	static_assert(sizeof(aiVector3D) == 3 * sizeof(float), "");
+	const float* positions = &mesh->mVertices[0].x;
+	const float* normals = &mesh->mNormals[0].x;
+	const float* tangents = &mesh->mTangents[0].x;
+	const float* tex_coords = &mesh->mTextureCoords[0][0].x;
+	
+	uint32_t vertex_count = mesh->mNumVertices;
+	uint32_t simd_count = vertex_count > 0 ? vertex_count - 1 : 0;
+	
+	const __m128 flip = _mm_setr_ps(1.f, -1.f, 1.f, 0.f);
+	const __m128 offset_v = _mm_setr_ps(offset.X, offset.Y, offset.Z, 0.f);
+	const __m128 scale_v = _mm_set1_ps(scale);
+	
+	for (uint32_t i = 0; i < simd_count; i++) {
+		// (x, y, z, _) -> (x, z, y, _), then multiplying by `flip` gives (x, -z, y, 0)
+		__m128 pos = _mm_loadu_ps(positions + i*3);
+		__m128 normal = _mm_loadu_ps(normals + i*3);
+		__m128 tangent = _mm_loadu_ps(tangents + i*3);
+		pos = _mm_shuffle_ps(pos, pos, _MM_SHUFFLE(3, 1, 2, 0));
+		normal = _mm_shuffle_ps(normal, normal, _MM_SHUFFLE(3, 1, 2, 0));
+		tangent = _mm_shuffle_ps(tangent, tangent, _MM_SHUFFLE(3, 1, 2, 0));
+
+		// Each store writes 16 bytes and spills into the next field, which is written right after.
+		Vertex* v = &out_vertices[i];
+		_mm_storeu_ps(&v->position.X, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(pos, flip), offset_v), scale_v));
+		_mm_storeu_ps(&v->normal.X, _mm_mul_ps(normal, flip));
+		_mm_storeu_ps(&v->tangent.X, _mm_mul_ps(tangent, flip));
+		v->tangent_sign = 0.f;
+		v->tex_coord = {tex_coords[i*3], 1.f - tex_coords[i*3 + 1]};
+	}
+
+	ConvertAssimpVerticesScalar(mesh, simd_count, offset, scale, out_vertices);
+}
+
+void AssimpConvertJobRun(void* user_data, uint32_t mesh_idx) {
+	AssimpConvertJobs* jobs = (AssimpConvertJobs*)user_data;
+	Vertex* vertices = jobs->mesh_vertices[mesh_idx];
+	if (vertices == NULL) return;
+	
+	const aiMesh* mesh = jobs->scene->mMeshes[mesh_idx];
+	assert(mesh->mNormals != NULL);
+	assert(mesh->mTangents != NULL);
+	assert(mesh->mTextureCoords[0] != NULL);
+	
+	ConvertAssimpVertices(mesh, jobs->offset, jobs->scale, vertices);
+	if (jobs->mesh_bake_transform[mesh_idx]) {
+		TransformVertices(vertices, mesh->mNumVertices, jobs->mesh_bake_transform[mesh_idx]);
+	}
+
+	uint32_t base_vertex = jobs->mesh_base_vertex[mesh_idx];
+	uint32_t* dst_indices = jobs->mesh_indices[mesh_idx];
+	for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
+		const aiFace* face = &mesh->mFaces[i];
+		assert(face->mNumIndices == 3);
+		dst_indices[i*3 + 0] = base_vertex + face->mIndices[0];
+		dst_indices[i*3 + 1] = base_vertex + face->mIndices[1];
+		dst_indices[i*3 + 2] = base_vertex + face->mIndices[2];
+	}
+}
+
+void LayoutAssimpMeshes(DS_Arena* arena, const aiScene* scene, const uint32_t* mesh_slice, uint32_t slice_count,
+	const MeshInstance* const* mesh_bake_transform, HMM_Vec3 offset, float scale, AssimpMeshLayout* out_layout)
+{
+	AssimpMeshLayout layout = {};
+	layout.slice_first_vertex = (uint32_t*)DS_ArenaPush(arena, slice_count * sizeof(uint32_t));
+	layout.slice_vertex_count = (uint32_t*)DS_ArenaPushZero(arena, slice_count * sizeof(uint32_t));
+	layout.slice_first_index = (uint32_t*)DS_ArenaPush(arena, slice_count * sizeof(uint32_t));
+	layout.slice_index_count = (uint32_t*)DS_ArenaPushZero(arena, slice_count * sizeof(uint32_t));
+
+	// Prefix sums over the aiMeshes of each slice, in mesh order. The vertex offsets are also the base vertices of the indices.
+	uint32_t* mesh_first_vertex = (uint32_t*)DS_ArenaPushZero(arena, scene->mNumMeshes * sizeof(uint32_t));
+	uint32_t* mesh_first_index = (uint32_t*)DS_ArenaPushZero(arena, scene->mNumMeshes * sizeof(uint32_t));
+	for (uint32_t mesh_idx = 0; mesh_idx < scene->mNumMeshes; mesh_idx++) {
+		uint32_t slice = mesh_slice[mesh_idx];
+		if (slice == UINT32_MAX) continue;
+		const aiMesh* mesh = scene->mMeshes[mesh_idx];
+		mesh_first_vertex[mesh_idx] = layout.slice_vertex_count[slice];
+		mesh_first_index[mesh_idx] = layout.slice_index_count[slice];
+		layout.slice_vertex_count[slice] += mesh->mNumVertices;
+		layout.slice_index_count[slice] += mesh->mNumFaces * 3;
+	}
+
+	for (uint32_t i = 0; i < slice_count; i++) {
+		layout.slice_first_vertex[i] = layout.vertex_count;
+		layout.slice_first_index[i] = layout.index_count;
+		layout.vertex_count += layout.slice_vertex_count[i];
+		layout.index_count += layout.slice_index_count[i];
+	}
+	layout.vertices = (Vertex*)DS_ArenaPush(arena, layout.vertex_count * sizeof(Vertex));
+	layout.indices = (uint32_t*)DS_ArenaPush(arena, layout.index_count * sizeof(uint32_t));
+
+	Vertex** mesh_vertices = (Vertex**)DS_ArenaPushZero(arena, scene->mNumMeshes * sizeof(Vertex*));
+	uint32_t** mesh_indices = (uint32_t**)DS_ArenaPushZero(arena, scene->mNumMeshes * sizeof(uint32_t*));
+	for (uint32_t mesh_idx = 0; mesh_idx < scene->mNumMeshes; mesh_idx++) {
+		uint32_t slice = mesh_slice[mesh_idx];
+		if (slice == UINT32_MAX) continue;
+		mesh_vertices[mesh_idx] = layout.vertices + layout.slice_first_vertex[slice] + mesh_first_vertex[mesh_idx];
+		mesh_indices[mesh_idx] = layout.indices + layout.slice_first_index[slice] + mesh_first_index[mesh_idx];
+	}
+
+	layout.jobs = {scene, mesh_vertices, mesh_indices, mesh_first_vertex, mesh_bake_transform, offset, scale};
+	*out_layout = layout;
+}
@@ -0,0 +1,51 @@
+// Conversion of Assimp meshes into our vertex and index format. This only touches CPU memory, so it can be run and measured
+// without a GPU.
+
+struct aiMesh;
+struct aiScene;
+
+// Converts from Assimp's Y-up to our Z-up coordinates, applies the import offset and scale, and flips the texcoord Y.
+// The mesh must have normals, tangents and texcoords.
+void ConvertAssimpVertices(const aiMesh* mesh, HMM_Vec3 offset, float scale, Vertex* out_vertices);
+
+// The same conversion without SSE, for vertices `first_vertex` and onwards. It gives bit-identical results, so it's the
+// reference for ConvertAssimpVertices.
+void ConvertAssimpVerticesScalar(const aiMesh* mesh, uint32_t first_vertex, HMM_Vec3 offset, float scale, Vertex* out_vertices);
+
+// Bakes an instance transform into the vertices
+void TransformVertices(Vertex* vertices, uint32_t vertex_count, const MeshInstance* instance);
+
+// Where each aiMesh of `scene` is converted to, indexed by the mesh index. The ranges of the meshes must not overlap.
+struct AssimpConvertJobs {
+	const aiScene* scene;
+	Vertex* const* mesh_vertices; // NULL if the mesh isn't used
+	uint32_t* const* mesh_indices;
+	const uint32_t* mesh_base_vertex; // added to the indices, i.e. where the mesh's vertices start in the vertex array that the indices refer to
+	const MeshInstance* const* mesh_bake_transform; // NULL if there's nothing to bake
+	HMM_Vec3 offset;
+	float scale;
+};
+
+// Converts the vertices and faces of one aiMesh, see AssimpConvertJobs. The meshes can be converted in any order and in
+// parallel, e.g. with OS_ParallelFor, and the result is the same.
+void AssimpConvertJobRun(void* user_data, uint32_t mesh_idx);
+
+// Where the aiMeshes of a scene are converted to. Each used aiMesh goes into one of the slices, after the aiMeshes before it
+// that go into the same slice. The vertex slices are laid out back to back in `vertices`, the index slices in `indices`, and
+// the indices of each slice refer to the vertices of that slice.
+struct AssimpMeshLayout {
+	Vertex* vertices;
+	uint32_t vertex_count;
+	uint32_t* indices;
+	uint32_t index_count;
+	uint32_t* slice_first_vertex;
+	uint32_t* slice_vertex_count;
+	uint32_t* slice_first_index;
+	uint32_t* slice_index_count;
+	AssimpConvertJobs jobs; // converts every aiMesh into its place
+};
+
+// `mesh_slice` is the slice of each aiMesh, or UINT32_MAX if the mesh isn't used. Everything is allocated from `arena`, and the
+// vertices and indices are left uninitialized until the jobs are run.
+void LayoutAssimpMeshes(DS_Arena* arena, const aiScene* scene, const uint32_t* mesh_slice, uint32_t slice_count,
+	const MeshInstance* const* mesh_bake_transform, HMM_Vec3 offset, float scale, AssimpMeshLayout* out_layout);
@@ -1,6 +1,7 @@
 #include "common.h"
 #include "render.h"
 #include "asset_import.h"
+#include "texture_streaming.h"
 
 #define FIRE_OS_WINDOW_IMPLEMENTATION
 #define FIRE_OS_TIMING_IMPLEMENTATION
@@ -8,6 +9,8 @@
 #include "fire/fire_os_timing.h"
 #include "utils/key_input/key_input_fire_os.h"
 
+#include <stdio.h>
+
 DS_Arena* TEMP; // Arena for per-frame, temporary allocations
 
 int main() {
@@ -37,14 +40,23 @@ int main() {
 	Renderer renderer = {};
 	InitRenderer(&renderer, window_width, window_height);
 	
-	RenderObject world = LoadMesh(&renderer, "../resources/SunTemple/SunTemple.fbx", {0.f, 25.f, 0.f}, 1.f);
+	// Pack the resources folder with tool_asset_packer to load everything out of one file. Without it, loose files are used.
+	OpenAssetArchive("../resources/assets.pack");
+
+	// Stream the mips of the mesh textures in as they're needed, rather than loading all of them up front
+	InitTextureStreaming(DS_MIB(512));
+
+	LoadMeshStats world_load_stats;
+	RenderObject world = LoadMesh(&renderer, "../resources/SunTemple/SunTemple.fbx", {0.f, 25.f, 0.f}, 1.f, LoadMeshFlag_BuildMeshlets|LoadMeshFlag_KeepInstances|LoadMeshFlag_SplitIntoClusters, &world_load_stats);
+	printf("Load stats: %s\n", STR_ToC(TEMP, LoadMeshStatsToJSON(TEMP, &world_load_stats)));
 
 	// If you want to load Bistro, replace the line above with one of the following:
 		//RenderObject world = LoadMesh(&renderer, "C:/art_library/Bistro_v5_2/BistroInterior.fbx", {-7.f, -4.f, 0.f}, 4.2f);
 		//RenderObject world = LoadMesh(&renderer, "C:/art_library/Bistro_v5_2/BistroExterior.fbx", {-7.f, -4.f, 0.f}, 1.f);
 
 	RenderObject skybox = LoadMesh(&renderer, "../resources/Skybox_200x200x200.fbx", {}, 1.f);
-	GPU_Texture* tex_env_cube = MakeTextureFromHDRIFile("../resources/shipyard_cranes_track_cube.hdr");
+	STR_View env_filepath = "../resources/shipyard_cranes_track_cube.hdr";
+	GPU_Texture* tex_env_cube = MakeTextureFromHDRIFile(env_filepath);
 
 	GPU_Graph* graphs[2];
 	int graph_idx = 0;
@@ -78,7 +90,7 @@ int main() {
 		if (inputs.KeyIsDown(Input::Key::_7)) render_params.sun_angle.Y += 0.5f;
 		if (inputs.KeyWentDown(Input::Key::G)) render_params.visualize_lightgrid = !render_params.visualize_lightgrid;
 
-		HotreloadShaders(&renderer, tex_env_cube);
+		HotreloadShaders(&renderer, tex_env_cube, env_filepath);
 		
 		float movement_speed = 5.f;
 		float mouse_speed = 0.001f;
@@ -92,6 +104,9 @@ int main() {
 		GPU_Graph* graph = graphs[graph_idx];
 		GPU_GraphWait(graph);
 
+		RenderObject* render_objects[] = {&world, &skybox};
+		UpdateTextureStreaming(&renderer, render_objects, 2, camera);
+
 		// Draw
 		GPU_Texture* backbuffer = GPU_GetBackbuffer(graph);
 		if (backbuffer) {
@@ -106,7 +121,9 @@ int main() {
 
 	UnloadMesh(&world);
 	UnloadMesh(&skybox);
+	DeinitTextureStreaming();
 	GPU_DestroyTexture(tex_env_cube);
+	CloseAssetArchive();
 
 	DeinitRenderer(&renderer);
 
@@ -0,0 +1,606 @@
+#include "common.h"
+#include "render.h"
+#include "mesh_optimize.h"
+
+#include <stdlib.h> // qsort
+
+// Returns the new vertex count. The unique vertices are moved to the front of `vertices`.
+static uint32_t WeldVertices(DS_Arena* temp, Vertex* vertices, uint32_t vertex_count, uint32_t* indices, uint32_t index_count) {
+	uint32_t capacity = 1;
+	while (capacity < vertex_count * 2) capacity *= 2;
+
+	// Open addressing table of indices into the already welded vertices
+	uint32_t* table = (uint32_t*)DS_ArenaPush(temp, capacity * sizeof(uint32_t));
+	memset(table, 0xFF, capacity * sizeof(uint32_t));
+
+	uint32_t* remap = (uint32_t*)DS_ArenaPush(temp, vertex_count * sizeof(uint32_t));
+	uint32_t unique_count = 0;
+
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		uint64_t hash = DS_MurmurHash64A(&vertices[v], sizeof(Vertex), 0);
+
+		for (uint32_t slot = (uint32_t)hash & (capacity - 1);; slot = (slot + 1) & (capacity - 1)) {
+			uint32_t existing = table[slot];
+			if (existing == ~0u) {
+				table[slot] = unique_count;
+				vertices[unique_count] = vertices[v];
+				remap[v] = unique_count;
+				unique_count++;
+				break;
+			}
+			if (memcmp(&vertices[existing], &vertices[v], sizeof(Vertex)) == 0) {
+				remap[v] = existing;
+				break;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < index_count; i++) {
+		indices[i] = remap[indices[i]];
+	}
+	return unique_count;
+}
+
+uint32_t CountVertexCacheMisses(DS_Arena* temp, const uint32_t* indices, uint32_t index_count, uint32_t vertex_count) {
+	DS_ArenaMark mark = DS_ArenaGetMark(temp);
+	const uint32_t k = MESH_OPTIMIZE_CACHE_SIZE;
+
+	// A vertex is in the cache if fewer than k vertices have been added after it
+	uint32_t* insert_time = (uint32_t*)DS_ArenaPushZero(temp, vertex_count * sizeof(uint32_t));
+	uint32_t time = k + 1;
+	uint32_t misses = 0;
+
+	for (uint32_t i = 0; i < index_count; i++) {
+		uint32_t v = indices[i];
+		if (time - insert_time[v] > k) {
+			insert_time[v] = time;
+			time++;
+			misses++;
+		}
+	}
+
+	DS_ArenaSetMark(temp, mark);
+	return misses;
+}
+
+// Tipsify from "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander, Nehab, Barczak 2007).
+// Writes the reordered triangles to `out_indices`. Each time the fanning runs into a dead end, the cache is mostly cold
+// anyway, so we start a new cluster there. The first triangle of each cluster is written to `out_cluster_starts`.
+static uint32_t TipsifyTriangles(DS_Arena* temp, const uint32_t* indices, uint32_t index_count, uint32_t vertex_count,
+	uint32_t* out_indices, uint32_t* out_cluster_starts)
+{
+	const uint32_t k = MESH_OPTIMIZE_CACHE_SIZE;
+	uint32_t triangle_count = index_count / 3;
+
+	// Vertex -> triangle adjacency
+	uint32_t* adjacency_offsets = (uint32_t*)DS_ArenaPushZero(temp, (vertex_count + 1) * sizeof(uint32_t));
+	uint32_t* live_triangles = (uint32_t*)DS_ArenaPushZero(temp, vertex_count * sizeof(uint32_t));
+	uint32_t* adjacency = (uint32_t*)DS_ArenaPush(temp, index_count * sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < index_count; i++) live_triangles[indices[i]]++;
+	for (uint32_t v = 0; v < vertex_count; v++) adjacency_offsets[v + 1] = adjacency_offsets[v] + live_triangles[v];
+	{
+		uint32_t* fill = (uint32_t*)DS_ArenaPush(temp, vertex_count * sizeof(uint32_t));
+		memcpy(fill, adjacency_offsets, vertex_count * sizeof(uint32_t));
+		for (uint32_t i = 0; i < index_count; i++) adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	uint32_t* cache_time = (uint32_t*)DS_ArenaPushZero(temp, vertex_count * sizeof(uint32_t));
+	bool* emitted = (bool*)DS_ArenaPushZero(temp, triangle_count * sizeof(bool));
+	uint32_t* dead_end_stack = (uint32_t*)DS_ArenaPush(temp, index_count * sizeof(uint32_t));
+	uint32_t* candidates = (uint32_t*)DS_ArenaPush(temp, index_count * sizeof(uint32_t));
+	uint32_t dead_end_stack_count = 0;
+
+	uint32_t time = k + 1;
+	uint32_t cursor = 0;
+	uint32_t emitted_index_count = 0;
+	uint32_t cluster_count = 0;
+
+	uint32_t fanning_vertex = 0;
+	bool at_dead_end = true;
+
+	for (;;) {
+		if (at_dead_end) {
+			// Skip the dead end: first try recently used vertices, then go through the vertices in input order.
+			fanning_vertex = ~0u;
+			while (dead_end_stack_count > 0) {
+				uint32_t v = dead_end_stack[--dead_end_stack_count];
+				if (live_triangles[v] > 0) { fanning_vertex = v; break; }
+			}
+			if (fanning_vertex == ~0u) {
+				for (; cursor < vertex_count; cursor++) {
+					if (live_triangles[cursor] > 0) { fanning_vertex = cursor; break; }
+				}
+			}
+			if (fanning_vertex == ~0u) break;
+
+			out_cluster_starts[cluster_count++] = emitted_index_count / 3;
+		}
+
+		// Emit all remaining triangles around the fanning vertex
+		uint32_t candidates_count = 0;
+		for (uint32_t j = adjacency_offsets[fanning_vertex]; j < adjacency_offsets[fanning_vertex + 1]; j++) {
+			uint32_t t = adjacency[j];
+			if (emitted[t]) continue;
+			emitted[t] = true;
+
+			for (uint32_t c = 0; c < 3; c++) {
+				uint32_t v = indices[t*3 + c];
+				out_indices[emitted_index_count++] = v;
+				dead_end_stack[dead_end_stack_count++] = v;
+				candidates[candidates_count++] = v;
+				live_triangles[v]--;
+				if (time - cache_time[v] > k) {
+					cache_time[v] = time;
+					time++;
+				}
+			}
+		}
+
+		// Pick the candidate that will still be in the cache after its remaining triangles are emitted, preferring the oldest one.
+		uint32_t best_vertex = ~0u;
+		int best_priority = -1;
+		for (uint32_t c = 0; c < candidates_count; c++) {
+			uint32_t v = candidates[c];
+			if (live_triangles[v] == 0) continue;
+
+			int priority = 0;
+			if (time - cache_time[v] + 2*live_triangles[v] <= k) priority = (int)(time - cache_time[v]);
+			if (priority > best_priority) {
+				best_priority = priority;
+				best_vertex = v;
+			}
+		}
+
+		at_dead_end = best_vertex == ~0u;
+		fanning_vertex = best_vertex;
+	}
+
+	assert(emitted_index_count == triangle_count * 3);
+	return cluster_count;
+}
+
+struct MeshCluster {
+	float sort_key;
+	uint32_t first_triangle;
+	uint32_t triangle_count;
+};
+
+static int CompareMeshClusters(const void* a, const void* b) {
+	float key_a = ((const MeshCluster*)a)->sort_key;
+	float key_b = ((const MeshCluster*)b)->sort_key;
+	return key_a > key_b ? -1 : key_a < key_b ? 1 : 0;
+}
+
+// View-independent overdraw reduction from the same paper: clusters that face away from the center of the mesh are likely
+// to occlude the rest of the mesh, so draw those first. The order of triangles inside a cluster is kept.
+static void SortClustersForOverdraw(DS_Arena* temp, const Vertex* vertices, uint32_t vertex_count, uint32_t* indices, uint32_t index_count,
+	const uint32_t* cluster_starts, uint32_t cluster_count)
+{
+	uint32_t triangle_count = index_count / 3;
+
+	HMM_Vec3 mesh_center = {};
+	for (uint32_t v = 0; v < vertex_count; v++) mesh_center = HMM_AddV3(mesh_center, vertices[v].position);
+	if (vertex_count > 0) mesh_center = HMM_MulV3F(mesh_center, 1.f / (float)vertex_count);
+
+	MeshCluster* clusters = (MeshCluster*)DS_ArenaPush(temp, cluster_count * sizeof(MeshCluster));
+	for (uint32_t i = 0; i < cluster_count; i++) {
+		MeshCluster* cluster = &clusters[i];
+		cluster->first_triangle = cluster_starts[i];
+		cluster->triangle_count = (i + 1 < cluster_count ? cluster_starts[i + 1] : triangle_count) - cluster->first_triangle;
+
+		HMM_Vec3 weighted_center = {};
+		HMM_Vec3 normal = {}; // area-weighted
+		float area = 0.f;
+		for (uint32_t t = cluster->first_triangle; t < cluster->first_triangle + cluster->triangle_count; t++) {
+			HMM_Vec3 p0 = vertices[indices[t*3 + 0]].position;
+			HMM_Vec3 p1 = vertices[indices[t*3 + 1]].position;
+			HMM_Vec3 p2 = vertices[indices[t*3 + 2]].position;
+			HMM_Vec3 triangle_normal = HMM_Cross(HMM_SubV3(p1, p0), HMM_SubV3(p2, p0));
+			float triangle_area = HMM_LenV3(triangle_normal);
+
+			HMM_Vec3 triangle_center = HMM_MulV3F(HMM_AddV3(HMM_AddV3(p0, p1), p2), 1.f / 3.f);
+			weighted_center = HMM_AddV3(weighted_center, HMM_MulV3F(triangle_center, triangle_area));
+			normal = HMM_AddV3(normal, triangle_normal);
+			area += triangle_area;
+		}
+
+		float normal_length = HMM_LenV3(normal);
+		cluster->sort_key = 0.f;
+		if (area > 0.f && normal_length > 0.f) {
+			HMM_Vec3 center = HMM_MulV3F(weighted_center, 1.f / area);
+			cluster->sort_key = HMM_DotV3(HMM_SubV3(center, mesh_center), normal) / normal_length;
+		}
+	}
+
+	qsort(clusters, cluster_count, sizeof(MeshCluster), CompareMeshClusters);
+
+	uint32_t* sorted_indices = (uint32_t*)DS_ArenaPush(temp, index_count * sizeof(uint32_t));
+	uint32_t sorted_index_count = 0;
+	for (uint32_t i = 0; i < cluster_count; i++) {
+		uint32_t cluster_index_count = clusters[i].triangle_count * 3;
+		memcpy(sorted_indices + sorted_index_count, indices + clusters[i].first_triangle*3, cluster_index_count * sizeof(uint32_t));
+		sorted_index_count += cluster_index_count;
+	}
+	memcpy(indices, sorted_indices, index_count * sizeof(uint32_t));
+}
+
+// Renumbers the vertices in the order they're first referenced by the indices. Unreferenced vertices are dropped.
+static uint32_t ReorderVerticesForFetch(DS_Arena* temp, Vertex* vertices, uint32_t vertex_count, uint32_t* indices, uint32_t index_count) {
+	uint32_t* remap = (uint32_t*)DS_ArenaPush(temp, vertex_count * sizeof(uint32_t));
+	memset(remap, 0xFF, vertex_count * sizeof(uint32_t));
+
+	Vertex* old_vertices = (Vertex*)DS_ArenaPush(temp, vertex_count * sizeof(Vertex));
+	memcpy(old_vertices, vertices, vertex_count * sizeof(Vertex));
+
+	uint32_t new_vertex_count = 0;
+	for (uint32_t i = 0; i < index_count; i++) {
+		uint32_t v = indices[i];
+		if (remap[v] == ~0u) {
+			remap[v] = new_vertex_count;
+			vertices[new_vertex_count] = old_vertices[v];
+			new_vertex_count++;
+		}
+		indices[i] = remap[v];
+	}
+	return new_vertex_count;
+}
+
+MeshOptimizeStats OptimizeMesh(DS_Arena* temp, Vertex* vertices, uint32_t* vertex_count, uint32_t* indices, uint32_t index_count) {
+	DS_ArenaMark mark = DS_ArenaGetMark(temp);
+	assert(index_count % 3 == 0);
+
+	MeshOptimizeStats stats = {};
+	stats.vertex_count_before = *vertex_count;
+	stats.triangle_count = index_count / 3;
+	stats.cache_misses_before = CountVertexCacheMisses(temp, indices, index_count, *vertex_count);
+
+	uint32_t welded_vertex_count = WeldVertices(temp, vertices, *vertex_count, indices, index_count);
+
+	uint32_t* cluster_starts = (uint32_t*)DS_ArenaPush(temp, (stats.triangle_count + 1) * sizeof(uint32_t));
+	uint32_t* tipsified_indices = (uint32_t*)DS_ArenaPush(temp, index_count * sizeof(uint32_t));
+	uint32_t cluster_count = TipsifyTriangles(temp, indices, index_count, welded_vertex_count, tipsified_indices, cluster_starts);
+	memcpy(indices, tipsified_indices, index_count * sizeof(uint32_t));
+
+	SortClustersForOverdraw(temp, vertices, welded_vertex_count, indices, index_count, cluster_starts, cluster_count);
+
+	*vertex_count = ReorderVerticesForFetch(temp, vertices, welded_vertex_count, indices, index_count);
+
+	stats.vertex_count_after = *vertex_count;
+	stats.cache_misses_after = CountVertexCacheMisses(temp, indices, index_count, *vertex_count);
+
+	DS_ArenaSetMark(temp, mark);
+	return stats;
+}
+
+static void ComputeMeshletBounds(const Vertex* vertices, const uint32_t* meshlet_vertices, const uint8_t* meshlet_triangles, Meshlet* meshlet) {
+	// Bounding sphere around the center of the AABB. Not the tightest, but cheap and good enough for culling.
+	HMM_Vec3 min = vertices[meshlet_vertices[0]].position;
+	HMM_Vec3 max = min;
+	for (uint32_t i = 1; i < meshlet->vertex_count; i++) {
+		HMM_Vec3 p = vertices[meshlet_vertices[i]].position;
+		for (int k = 0; k < 3; k++) {
+			if (p.Elements[k] < min.Elements[k]) min.Elements[k] = p.Elements[k];
+			if (p.Elements[k] > max.Elements[k]) max.Elements[k] = p.Elements[k];
+		}
+	}
+	
+	HMM_Vec3 center = HMM_MulV3F(HMM_AddV3(min, max), 0.5f);
+	float radius_sq = 0.f;
+	for (uint32_t i = 0; i < meshlet->vertex_count; i++) {
+		HMM_Vec3 d = HMM_SubV3(vertices[meshlet_vertices[i]].position, center);
+		float d_sq = HMM_DotV3(d, d);
+		if (d_sq > radius_sq) radius_sq = d_sq;
+	}
+	meshlet->bounding_sphere = HMM_V4(center.X, center.Y, center.Z, sqrtf(radius_sq));
+
+	// Normal cone: the axis is the average triangle direction, and the cutoff comes from the triangle that deviates the most.
+	HMM_Vec3 normals[MESHLET_MAX_TRIANGLES];
+	HMM_Vec3 axis = {};
+	for (uint32_t t = 0; t < meshlet->triangle_count; t++) {
+		HMM_Vec3 p0 = vertices[meshlet_vertices[meshlet_triangles[t*3 + 0]]].position;
+		HMM_Vec3 p1 = vertices[meshlet_vertices[meshlet_triangles[t*3 + 1]]].position;
+		HMM_Vec3 p2 = vertices[meshlet_vertices[meshlet_triangles[t*3 + 2]]].position;
+		HMM_Vec3 normal = HMM_Cross(HMM_SubV3(p1, p0), HMM_SubV3(p2, p0));
+		float length = HMM_LenV3(normal);
+		normals[t] = length > 0.f ? HMM_MulV3F(normal, 1.f / length) : HMM_V3(0.f, 0.f, 0.f);
+		axis = HMM_AddV3(axis, normals[t]);
+	}
+
+	float axis_length = HMM_LenV3(axis);
+	float cone_cutoff = 2.f; // never cull
+	if (axis_length > 0.f) {
+		axis = HMM_MulV3F(axis, 1.f / axis_length);
+		
+		float min_dot = 1.f;
+		for (uint32_t t = 0; t < meshlet->triangle_count; t++) {
+			if (normals[t].X == 0.f && normals[t].Y == 0.f && normals[t].Z == 0.f) continue; // degenerate
+			float d = HMM_DotV3(normals[t], axis);
+			if (d < min_dot) min_dot = d;
+		}
+		
+		// If the widest triangle is at angle a from the axis, the whole meshlet is backfacing when the view direction is
+		// within 90 - a degrees of the axis, i.e. when dot(view, axis) >= cos(90 - a) = sin(a).
+		if (min_dot > 0.f) cone_cutoff = sqrtf(1.f - min_dot*min_dot);
+	}
+	meshlet->normal_cone = HMM_V4(axis.X, axis.Y, axis.Z, cone_cutoff);
+}
+
+uint32_t BuildMeshlets(DS_Arena* temp, const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+	uint32_t base_vertex, DS_DynArray<Meshlet>* out_meshlets, DS_DynArray<uint32_t>* out_meshlet_vertices, DS_DynArray<uint8_t>* out_meshlet_triangles)
+{
+	DS_ArenaMark mark = DS_ArenaGetMark(temp);
+	
+	// Index of each vertex inside the current meshlet, or 0xFF if it's not in it
+	uint8_t* local_index = (uint8_t*)DS_ArenaPush(temp, vertex_count);
+	memset(local_index, 0xFF, vertex_count);
+
+	uint32_t first_meshlet = (uint32_t)out_meshlets->count;
+	Meshlet meshlet = {};
+	meshlet.first_vertex = (uint32_t)out_meshlet_vertices->count;
+	meshlet.first_triangle = (uint32_t)out_meshlet_triangles->count / 3;
+
+	for (uint32_t i = 0; i < index_count; i += 3) {
+		uint32_t tri[3] = { indices[i] - base_vertex, indices[i + 1] - base_vertex, indices[i + 2] - base_vertex };
+		
+		uint32_t new_vertex_count = 0;
+		for (int j = 0; j < 3; j++) {
+			assert(tri[j] < vertex_count);
+			bool seen_earlier = (j > 0 && tri[j] == tri[0]) || (j > 1 && tri[j] == tri[1]);
+			if (local_index[tri[j]] == 0xFF && !seen_earlier) new_vertex_count++;
+		}
+
+		if (meshlet.vertex_count + new_vertex_count > MESHLET_MAX_VERTICES || meshlet.triangle_count + 1 > MESHLET_MAX_TRIANGLES) {
+			ComputeMeshletBounds(vertices, out_meshlet_vertices->data + meshlet.first_vertex, out_meshlet_triangles->data + meshlet.first_triangle*3, &meshlet);
+			DS_ArrPush(out_meshlets, meshlet);
+
+			for (uint32_t j = 0; j < meshlet.vertex_count; j++) {
+				local_index[out_meshlet_vertices->data[meshlet.first_vertex + j]] = 0xFF;
+			}
+			meshlet = {};
+			meshlet.first_vertex = (uint32_t)out_meshlet_vertices->count;
+			meshlet.first_triangle = (uint32_t)out_meshlet_triangles->count / 3;
+		}
+
+		for (int j = 0; j < 3; j++) {
+			if (local_index[tri[j]] == 0xFF) {
+				local_index[tri[j]] = (uint8_t)meshlet.vertex_count;
+				DS_ArrPush(out_meshlet_vertices, tri[j]);
+				meshlet.vertex_count++;
+			}
+			DS_ArrPush(out_meshlet_triangles, local_index[tri[j]]);
+		}
+		meshlet.triangle_count++;
+	}
+
+	if (meshlet.triangle_count > 0) {
+		ComputeMeshletBounds(vertices, out_meshlet_vertices->data + meshlet.first_vertex, out_meshlet_triangles->data + meshlet.first_triangle*3, &meshlet);
+		DS_ArrPush(out_meshlets, meshlet);
+	}
+
+	DS_ArenaSetMark(temp, mark);
+	return (uint32_t)out_meshlets->count - first_meshlet;
+}
+
+// Symmetric 4x4 matrix of the sum of squared distances to a set of planes, weighted by triangle area
+struct Quadric {
+	float a2, ab, ac, ad;
+	float b2, bc, bd;
+	float c2, cd;
+	float d2;
+	float weight;
+};
+
+static void QuadricAdd(Quadric* q, const Quadric* other) {
+	float* dst = &q->a2;
+	const float* src = &other->a2;
+	for (int i = 0; i < 11; i++) dst[i] += src[i];
+}
+
+static void QuadricAddTriangle(Quadric* q, HMM_Vec3 p0, HMM_Vec3 p1, HMM_Vec3 p2) {
+	HMM_Vec3 normal = HMM_Cross(HMM_SubV3(p1, p0), HMM_SubV3(p2, p0));
+	float length = HMM_LenV3(normal);
+	if (length == 0.f) return;
+	
+	HMM_Vec3 n = HMM_MulV3F(normal, 1.f / length);
+	float d = -HMM_DotV3(n, p0);
+	float w = length * 0.5f;
+	q->a2 += w*n.X*n.X; q->ab += w*n.X*n.Y; q->ac += w*n.X*n.Z; q->ad += w*n.X*d;
+	q->b2 += w*n.Y*n.Y; q->bc += w*n.Y*n.Z; q->bd += w*n.Y*d;
+	q->c2 += w*n.Z*n.Z; q->cd += w*n.Z*d;
+	q->d2 += w*d*d;
+	q->weight += w;
+}
+
+// Area-weighted mean squared distance from `p` to the planes
+static float QuadricError(const Quadric* q, HMM_Vec3 p) {
+	float x = p.X, y = p.Y, z = p.Z;
+	float e = q->a2*x*x + q->b2*y*y + q->c2*z*z + 2.f*(q->ab*x*y + q->ac*x*z + q->bc*y*z) + 2.f*(q->ad*x + q->bd*y + q->cd*z) + q->d2;
+	if (q->weight == 0.f) return 0.f;
+	float error = e / q->weight;
+	return error > 0.f ? error : 0.f;
+}
+
+struct EdgeCollapse {
+	float error;
+	uint32_t from;
+	uint32_t to;
+};
+
+static int CompareEdgeCollapses(const void* a, const void* b) {
+	float error_a = ((const EdgeCollapse*)a)->error;
+	float error_b = ((const EdgeCollapse*)b)->error;
+	return error_a < error_b ? -1 : error_a > error_b ? 1 : 0;
+}
+
+// Open addressing hash table of directed edges, used to find border edges
+static uint32_t EdgeTableSlot(const uint64_t* table, uint32_t capacity, uint64_t key) {
+	uint64_t hash = DS_MurmurHash64A(&key, sizeof(key), 0);
+	uint32_t slot = (uint32_t)hash & (capacity - 1);
+	while (table[slot] != ~0ull && table[slot] != key) slot = (slot + 1) & (capacity - 1);
+	return slot;
+}
+
+uint32_t SimplifyMesh(DS_Arena* temp, const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+	uint32_t target_index_count, uint32_t* out_indices, float* out_error)
+{
+	DS_ArenaMark mark = DS_ArenaGetMark(temp);
+	assert(index_count % 3 == 0);
+	
+	memcpy(out_indices, indices, index_count * sizeof(uint32_t));
+	*out_error = 0.f;
+	
+	// Vertices were welded by all attributes, so vertices that only share the position sit on a seam.
+	// `position_id` maps each vertex to the first vertex with the same position.
+	uint32_t* position_id = (uint32_t*)DS_ArenaPush(temp, vertex_count * sizeof(uint32_t));
+	uint32_t* position_use_count = (uint32_t*)DS_ArenaPushZero(temp, vertex_count * sizeof(uint32_t));
+	{
+		uint32_t capacity = 1;
+		while (capacity < vertex_count * 2) capacity *= 2;
+		uint32_t* table = (uint32_t*)DS_ArenaPush(temp, capacity * sizeof(uint32_t));
+		memset(table, 0xFF, capacity * sizeof(uint32_t));
+
+		for (uint32_t v = 0; v < vertex_count; v++) {
+			uint64_t hash = DS_MurmurHash64A(&vertices[v].position, sizeof(HMM_Vec3), 0);
+			for (uint32_t slot = (uint32_t)hash & (capacity - 1);; slot = (slot + 1) & (capacity - 1)) {
+				uint32_t existing = table[slot];
+				if (existing == ~0u) {
+					table[slot] = v;
+					position_id[v] = v;
+					break;
+				}
+				if (memcmp(&vertices[existing].position, &vertices[v].position, sizeof(HMM_Vec3)) == 0) {
+					position_id[v] = existing;
+					break;
+				}
+			}
+			position_use_count[position_id[v]]++;
+		}
+	}
+
+	bool* locked = (bool*)DS_ArenaPushZero(temp, vertex_count * sizeof(bool));
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		if (position_use_count[position_id[v]] > 1) locked[v] = true;
+	}
+	
+	// An edge is on a border if no triangle uses it in the opposite direction
+	{
+		uint32_t capacity = 1;
+		while (capacity < index_count * 2) capacity *= 2;
+		uint64_t* table = (uint64_t*)DS_ArenaPush(temp, capacity * sizeof(uint64_t));
+		memset(table, 0xFF, capacity * sizeof(uint64_t));
+
+		for (uint32_t i = 0; i < index_count; i++) {
+			uint32_t a = position_id[indices[i]];
+			uint32_t b = position_id[indices[i - i%3 + (i + 1)%3]];
+			uint64_t key = ((uint64_t)a << 32) | b;
+			table[EdgeTableSlot(table, capacity, key)] = key;
+		}
+		for (uint32_t i = 0; i < index_count; i++) {
+			uint32_t a = indices[i];
+			uint32_t b = indices[i - i%3 + (i + 1)%3];
+			uint64_t reverse_key = ((uint64_t)position_id[b] << 32) | position_id[a];
+			if (table[EdgeTableSlot(table, capacity, reverse_key)] != reverse_key) {
+				locked[a] = true;
+				locked[b] = true;
+			}
+		}
+	}
+
+	Quadric* quadrics = (Quadric*)DS_ArenaPushZero(temp, vertex_count * sizeof(Quadric));
+	for (uint32_t i = 0; i < index_count; i += 3) {
+		HMM_Vec3 p0 = vertices[indices[i + 0]].position;
+		HMM_Vec3 p1 = vertices[indices[i + 1]].position;
+		HMM_Vec3 p2 = vertices[indices[i + 2]].position;
+		for (int j = 0; j < 3; j++) {
+			QuadricAddTriangle(&quadrics[position_id[indices[i + j]]], p0, p1, p2);
+		}
+	}
+
+	uint32_t* adjacency_offsets = (uint32_t*)DS_ArenaPush(temp, (vertex_count + 1) * sizeof(uint32_t));
+	uint32_t* adjacency_fill = (uint32_t*)DS_ArenaPush(temp, vertex_count * sizeof(uint32_t));
+	uint32_t* adjacency = (uint32_t*)DS_ArenaPush(temp, index_count * sizeof(uint32_t));
+	uint32_t* collapse_to = (uint32_t*)DS_ArenaPush(temp, vertex_count * sizeof(uint32_t));
+	bool* touched = (bool*)DS_ArenaPush(temp, vertex_count * sizeof(bool));
+	EdgeCollapse* collapses = (EdgeCollapse*)DS_ArenaPush(temp, index_count * 2 * sizeof(EdgeCollapse));
+
+	// Each pass collapses the cheapest edges whose neighbourhoods don't overlap, then rebuilds the triangle list.
+	float max_error = 0.f;
+	while (index_count > target_index_count) {
+		// Vertex -> triangle adjacency of the current triangles
+		memset(adjacency_offsets, 0, (vertex_count + 1) * sizeof(uint32_t));
+		for (uint32_t i = 0; i < index_count; i++) adjacency_offsets[out_indices[i] + 1]++;
+		for (uint32_t v = 0; v < vertex_count; v++) adjacency_offsets[v + 1] += adjacency_offsets[v];
+		memcpy(adjacency_fill, adjacency_offsets, vertex_count * sizeof(uint32_t));
+		for (uint32_t i = 0; i < index_count; i++) adjacency[adjacency_fill[out_indices[i]]++] = i / 3;
+
+		uint32_t collapse_count = 0;
+		for (uint32_t i = 0; i < index_count; i++) {
+			uint32_t a = out_indices[i];
+			uint32_t b = out_indices[i - i%3 + (i + 1)%3];
+			if (!locked[a]) collapses[collapse_count++] = {QuadricError(&quadrics[a], vertices[b].position), a, b};
+			if (!locked[b]) collapses[collapse_count++] = {QuadricError(&quadrics[b], vertices[a].position), b, a};
+		}
+		if (collapse_count == 0) break;
+		qsort(collapses, collapse_count, sizeof(EdgeCollapse), CompareEdgeCollapses);
+
+		for (uint32_t v = 0; v < vertex_count; v++) collapse_to[v] = v;
+		memset(touched, 0, vertex_count * sizeof(bool));
+
+		// An interior collapse removes two triangles. Don't overshoot the target by much in a single pass.
+		uint32_t collapse_budget = (index_count - target_index_count) / 6 + 1;
+		uint32_t collapsed_count = 0;
+		
+		for (uint32_t c = 0; c < collapse_count && collapsed_count < collapse_budget; c++) {
+			EdgeCollapse collapse = collapses[c];
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+
+			// Reject the collapse if it would flip, or nearly flip, any of the remaining triangles around `from`.
+			// Requiring some margin also rejects slivers, e.g. an interior vertex collapsing onto a straight border.
+			bool flips = false;
+			for (uint32_t j = adjacency_offsets[collapse.from]; j < adjacency_offsets[collapse.from + 1] && !flips; j++) {
+				uint32_t* tri = &out_indices[adjacency[j]*3];
+				if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) continue; // this one disappears
+
+				HMM_Vec3 p[3], p_new[3];
+				for (int k = 0; k < 3; k++) {
+					p[k] = vertices[tri[k]].position;
+					p_new[k] = tri[k] == collapse.from ? vertices[collapse.to].position : p[k];
+				}
+				HMM_Vec3 normal = HMM_Cross(HMM_SubV3(p[1], p[0]), HMM_SubV3(p[2], p[0]));
+				HMM_Vec3 normal_new = HMM_Cross(HMM_SubV3(p_new[1], p_new[0]), HMM_SubV3(p_new[2], p_new[0]));
+				flips = HMM_DotV3(normal, normal_new) <= 0.25f * HMM_LenV3(normal) * HMM_LenV3(normal_new);
+			}
+			if (flips) continue;
+
+			collapse_to[collapse.from] = collapse.to;
+			QuadricAdd(&quadrics[position_id[collapse.to]], &quadrics[collapse.from]); // `to` may be a seam vertex, but `from` never is
+			if (collapse.error > max_error) max_error = collapse.error;
+			collapsed_count++;
+
+			for (uint32_t j = adjacency_offsets[collapse.from]; j < adjacency_offsets[collapse.from + 1]; j++) {
+				uint32_t* tri = &out_indices[adjacency[j]*3];
+				touched[tri[0]] = true;
+				touched[tri[1]] = true;
+				touched[tri[2]] = true;
+			}
+		}
+		if (collapsed_count == 0) break;
+
+		uint32_t new_index_count = 0;
+		for (uint32_t i = 0; i < index_count; i += 3) {
+			uint32_t a = collapse_to[out_indices[i + 0]];
+			uint32_t b = collapse_to[out_indices[i + 1]];
+			uint32_t c = collapse_to[out_indices[i + 2]];
+			if (a == b || b == c || c == a) continue;
+			out_indices[new_index_count++] = a;
+			out_indices[new_index_count++] = b;
+			out_indices[new_index_count++] = c;
+		}
+		index_count = new_index_count;
+	}
+
+	*out_error = sqrtf(max_error);
+	DS_ArenaSetMark(temp, mark);
+	return index_count;
+}
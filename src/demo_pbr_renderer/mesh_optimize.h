@@ -0,0 +1,61 @@
+
+// Import-time mesh optimization. This only touches CPU memory, so it can be run and measured without a GPU.
+
+#define MESH_OPTIMIZE_CACHE_SIZE 16 // Size of the simulated post-transform vertex cache (FIFO)
+
+struct MeshOptimizeStats {
+	uint32_t vertex_count_before;
+	uint32_t vertex_count_after;
+	uint32_t triangle_count;
+	uint32_t cache_misses_before;
+	uint32_t cache_misses_after;
+};
+
+// Runs the full pipeline on a triangle list in place:
+// 1. Weld vertices that have identical attributes
+// 2. Reorder triangles for post-transform vertex cache locality (Tipsify, Sander et al. 2007)
+// 3. Reorder the resulting triangle clusters to reduce overdraw
+// 4. Reorder vertices in the order they're first referenced, for vertex fetch locality
+// `*vertex_count` is updated to the welded vertex count. `temp` is only used for scratch memory.
+MeshOptimizeStats OptimizeMesh(DS_Arena* temp, Vertex* vertices, uint32_t* vertex_count, uint32_t* indices, uint32_t index_count);
+
+// Number of misses when feeding the indices through a FIFO cache of MESH_OPTIMIZE_CACHE_SIZE entries.
+// ACMR (average cache miss ratio) is this divided by the number of triangles.
+uint32_t CountVertexCacheMisses(DS_Arena* temp, const uint32_t* indices, uint32_t index_count, uint32_t vertex_count);
+
+// -- Meshlets -------------------------------------------------------------------
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// 48 bytes, laid out so that it can be read as-is from a storage buffer
+struct Meshlet {
+	HMM_Vec4 bounding_sphere; // xyz = center, w = radius
+	
+	// Normal cone for backface culling. All triangles of the meshlet face away from a camera at `camera_pos` if
+	//   dot(center - camera_pos, cone_axis) >= cone_cutoff * length(center - camera_pos) + radius
+	// If the triangles face too many different directions, cone_cutoff is above 1 so that the test never passes.
+	HMM_Vec4 normal_cone; // xyz = cone_axis, w = cone_cutoff
+	
+	uint32_t first_vertex; // into the meshlet vertex array
+	uint32_t first_triangle; // into the meshlet triangle array. Each triangle is 3 bytes that index the meshlet's own vertices.
+	uint32_t vertex_count;
+	uint32_t triangle_count;
+};
+
+// Splits a triangle list into meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles, in
+// the order of the triangles. Run OptimizeMesh first to get well-connected meshlets.
+// `base_vertex` is subtracted from each index, both when reading `vertices` and when writing `out_meshlet_vertices`.
+// The results are appended to the output arrays. Returns the number of meshlets added.
+uint32_t BuildMeshlets(DS_Arena* temp, const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+	uint32_t base_vertex, DS_DynArray<Meshlet>* out_meshlets, DS_DynArray<uint32_t>* out_meshlet_vertices, DS_DynArray<uint8_t>* out_meshlet_triangles);
+
+// -- Simplification -------------------------------------------------------------
+
+// Quadric error metric simplification ("Surface Simplification Using Quadric Error Metrics", Garland & Heckbert 1997).
+// Edges are collapsed onto one of their existing vertices, so the result indexes the same `vertices` as the input and can share
+// the vertex buffer. Vertices on open borders and on attribute seams (UV / normal splits) are never moved.
+// Writes at most `index_count` indices to `out_indices` and returns the count, which may stay above `target_index_count` if
+// nothing more can be collapsed. `*out_error` is set to the approximate world-space distance of the result from the input.
+uint32_t SimplifyMesh(DS_Arena* temp, const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+	uint32_t target_index_count, uint32_t* out_indices, float* out_error);
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "os_utils.h"
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
@@ -7,6 +8,8 @@
 
 // implement external utilities
 #define FIRE_OS_WINDOW_IMPLEMENTATION
+#define FIRE_OS_SYNC_IMPLEMENTATION
+#include "fire/fire_os_sync.h"
 
 // -- Globals ---------------
 extern DS_Arena* TEMP;
@@ -25,6 +28,16 @@ bool OS_FileLastModificationTime(STR_View filepath, uint64_t* out_modtime) {
 	return ok;
 }
 
+bool OS_FileSize(STR_View filepath, uint64_t* out_size) {
+	wchar_t filepath_wide[MAX_PATH];
+	MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, STR_ToC(TEMP, filepath), -1, filepath_wide, MAX_PATH);
+
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExW(filepath_wide, GetFileExInfoStandard, &attributes)) return false;
+	*out_size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	return true;
+}
+
 void OS_SleepMilliseconds(uint32_t ms) {
 	Sleep(ms);
 }
@@ -35,7 +48,7 @@ void OS_MessageBox(STR_View message) {
 
 bool OS_ReadEntireFile(DS_Arena* arena, STR_View filepath, STR_View* out_data) {
 	FILE* f = NULL;
-	errno_t err = fopen_s(&f, STR_ToC(TEMP, filepath), "rb");
+	errno_t err = fopen_s(&f, STR_ToC(arena, filepath), "rb"); // Use `arena` rather than TEMP here, so that this can be called from worker threads.
 	if (f) {
 		fseek(f, 0, SEEK_END);
 		long fsize = ftell(f);
@@ -50,3 +63,110 @@ bool OS_ReadEntireFile(DS_Arena* arena, STR_View filepath, STR_View* out_data) {
 	}
 	return f != NULL;
 }
+
+uint64_t OS_ReadFileRange(DS_Arena* arena, STR_View filepath, uint64_t offset, uint64_t size, void* dst) {
+	FILE* f = NULL;
+	fopen_s(&f, STR_ToC(arena, filepath), "rb");
+	if (f == NULL) return 0;
+
+	uint64_t result = 0;
+	if (_fseeki64(f, (int64_t)offset, SEEK_SET) == 0) {
+		result = fread(dst, 1, size, f);
+	}
+	fclose(f);
+	return result;
+}
+
+bool OS_WriteEntireFile(STR_View filepath, STR_View data) {
+	FILE* f = NULL;
+	errno_t err = fopen_s(&f, STR_ToC(TEMP, filepath), "wb");
+	if (f) {
+		bool ok = fwrite(data.data, 1, data.size, f) == data.size;
+		fclose(f);
+		return ok;
+	}
+	return false;
+}
+
+bool OS_MapEntireFile(STR_View filepath, OS_FileMapping* out_mapping) {
+	wchar_t filepath_wide[MAX_PATH];
+	MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, STR_ToC(TEMP, filepath), -1, filepath_wide, MAX_PATH);
+
+	HANDLE file = CreateFileW(filepath_wide, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	out_mapping->file_handle = file;
+	out_mapping->mapping_handle = mapping;
+	out_mapping->data = STR_View{(char*)data, (size_t)file_size.QuadPart};
+	return true;
+}
+
+void OS_UnmapFile(OS_FileMapping* mapping) {
+	UnmapViewOfFile(mapping->data.data);
+	CloseHandle((HANDLE)mapping->mapping_handle);
+	CloseHandle((HANDLE)mapping->file_handle);
+	*mapping = {};
+}
+
+uint32_t OS_GetProcessorCount() {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+}
+
+#define OS_MAX_WORKER_THREADS 64
+
+struct OS_ParallelForState {
+	OS_ParallelForFn fn;
+	void* user_data;
+	uint32_t count;
+	volatile LONG next_index;
+};
+
+static void OS_ParallelForWorker(void* user_data) {
+	OS_ParallelForState* state = (OS_ParallelForState*)user_data;
+	for (;;) {
+		uint32_t index = (uint32_t)InterlockedIncrement(&state->next_index) - 1;
+		if (index >= state->count) break;
+		state->fn(state->user_data, index);
+	}
+}
+
+void OS_ParallelFor(uint32_t count, OS_ParallelForFn fn, void* user_data) {
+	OS_ParallelForState state = {fn, user_data, count, 0};
+
+	uint32_t thread_count = OS_GetProcessorCount() - 1; // The calling thread works too
+	if (count <= 1) thread_count = 0;
+	else if (thread_count > count - 1) thread_count = count - 1;
+	if (thread_count > OS_MAX_WORKER_THREADS) thread_count = OS_MAX_WORKER_THREADS;
+
+	OS_SYNC_Thread threads[OS_MAX_WORKER_THREADS] = {};
+	for (uint32_t i = 0; i < thread_count; i++) {
+		OS_SYNC_ThreadStart(&threads[i], OS_ParallelForWorker, &state, "Worker");
+	}
+
+	OS_ParallelForWorker(&state);
+
+	for (uint32_t i = 0; i < thread_count; i++) {
+		OS_SYNC_ThreadJoin(&threads[i]);
+	}
+}
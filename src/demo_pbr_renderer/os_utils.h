@@ -1,9 +1,34 @@
 // OS utilities
 
 bool OS_FileLastModificationTime(STR_View filepath, uint64_t* out_modtime);
+bool OS_FileSize(STR_View filepath, uint64_t* out_size);
 
 void OS_SleepMilliseconds(uint32_t ms);
 
 void OS_MessageBox(STR_View message);
 
 bool OS_ReadEntireFile(DS_Arena* arena, STR_View filepath, STR_View* out_data);
+
+// Reads `size` bytes starting at `offset` into `dst`, and returns the number of bytes actually read. `arena` is only used for the
+// filepath conversion, so this is safe to call from worker threads.
+uint64_t OS_ReadFileRange(DS_Arena* arena, STR_View filepath, uint64_t offset, uint64_t size, void* dst);
+
+bool OS_WriteEntireFile(STR_View filepath, STR_View data);
+
+struct OS_FileMapping {
+	void* file_handle;
+	void* mapping_handle;
+	STR_View data; // read-only view of the whole file
+};
+
+// Maps an entire file into memory for reading. Fails on empty files.
+bool OS_MapEntireFile(STR_View filepath, OS_FileMapping* out_mapping);
+void OS_UnmapFile(OS_FileMapping* mapping);
+
+uint32_t OS_GetProcessorCount();
+
+typedef void (*OS_ParallelForFn)(void* user_data, uint32_t index);
+
+// Calls `fn` for every index in [0, count) on a pool of worker threads, and returns once all calls have finished.
+// The calling thread participates in the work too. `fn` must not touch TEMP, since it isn't thread-safe.
+void OS_ParallelFor(uint32_t count, OS_ParallelForFn fn, void* user_data);
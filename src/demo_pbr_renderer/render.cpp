@@ -6,6 +6,13 @@ extern DS_Arena* TEMP; // Arena for per-frame, temporary allocations
 
 #define LIGHTGRID_SIZE 128
 
+// Must match the vertex inputs of sun_depth_pass.glsl and geometry_pass.glsl
+#if PACKED_VERTICES
+static GPU_Format VERTEX_INPUT_FORMATS[] = { GPU_Format_RGBA16I, GPU_Format_RGBA16I, GPU_Format_RG16F }; // See PackedVertex
+#else
+static GPU_Format VERTEX_INPUT_FORMATS[] = { GPU_Format_RGB32F, GPU_Format_RGB32F, GPU_Format_RGB32F, GPU_Format_R32F, GPU_Format_RG32F }; // See Vertex
+#endif
+
 static GPU_ComputePipeline* MakeComputePipelineFromShader(ShaderAsset shader_asset, GPU_PipelineLayout* pipeline_layout, GPU_ShaderDesc* cs_desc) {
 	STR_View shader_path = ShaderAssetPaths[(int)shader_asset];
 	for (;;) {
@@ -36,6 +43,9 @@ static void LoadVertexAndFragmentShader(DS_Arena* arena, ShaderAsset shader_asse
 	for (;;) {
 		STR_View shader_src;
 		while (!OS_ReadEntireFile(TEMP, shader_path, &shader_src)) {}
+#if PACKED_VERTICES
+		shader_src = STR_Form(TEMP, "#define PACKED_VERTICES\n%v", shader_src); // NOTE: this makes the reported error line numbers off by one
+#endif
 
 		fs_desc->glsl = {shader_src.data, shader_src.size};
 		vs_desc->glsl = {shader_src.data, shader_src.size};
@@ -59,7 +69,132 @@ static void LoadVertexAndFragmentShader(DS_Arena* arena, ShaderAsset shader_asse
 	}
 }
 
-void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
+// -- IBL cache ------------------------------------------------------------------
+// Generating the irradiance map, the prefiltered env map and the BRDF LUT is thousands of samples per texel, done on every start.
+// Instead, the results are read back and stored next to the HDR file as "<filepath>.ibl". The cache is keyed by the HDR file and
+// by the sources of the generating shaders, so hotreloading any of those shaders regenerates the maps and rewrites the file.
+// NOTE: #included shader files aren't part of the key. Bump IBL_CACHE_VERSION if you change one that matters.
+
+#define IBL_CACHE_MAGIC 0x4C424921 // "!IBL"
+#define IBL_CACHE_VERSION 1
+
+struct IBLCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t data_size;
+	uint32_t _pad;
+};
+
+struct IBLCacheLayout {
+	GPU_Texture* textures[3];
+	DS_DynArray<GPU_TextureCopyRegion> regions[3];
+	uint32_t data_size;
+};
+
+// Lists the subresources that the Gen* shaders write to, tightly packed one after another.
+static void GetIBLCacheLayout(Renderer* r, IBLCacheLayout* out) {
+	out->textures[0] = r->irradiance_map;
+	out->textures[1] = r->tex_specular_env_map;
+	out->textures[2] = r->brdf_lut;
+
+	uint32_t offset = 0;
+	for (int i = 0; i < 3; i++) {
+		GPU_Texture* texture = out->textures[i];
+		uint32_t block_size = GPU_GetFormatInfo(texture->format).block_size;
+		DS_ArrInit(&out->regions[i], TEMP);
+
+		for (uint32_t mip = 0; mip < texture->mip_level_count; mip++) {
+			uint32_t size = texture->width >> mip;
+			if (size < 16) break; // GenPrefilteredEnvMap stops at 16x16
+
+			for (uint32_t layer = 0; layer < texture->layer_count; layer++) {
+				GPU_TextureCopyRegion region = {offset, layer, mip};
+				DS_ArrPush(&out->regions[i], region);
+				offset += size * size * block_size;
+			}
+		}
+	}
+	out->data_size = offset;
+}
+
+static uint64_t GetIBLCacheKey(STR_View env_filepath) {
+	uint64_t env_modtime = 0;
+	OS_FileLastModificationTime(env_filepath, &env_modtime);
+	uint64_t key = DS_MurmurHash64A(env_filepath.data, (int)env_filepath.size, env_modtime);
+
+	ShaderAsset shaders[3] = {ShaderAsset::GenIrradianceMap, ShaderAsset::GenPrefilteredEnvMap, ShaderAsset::GenBRDFIntegrationMap};
+	for (int i = 0; i < 3; i++) {
+		STR_View source = {};
+		OS_ReadEntireFile(TEMP, ShaderAssetPaths[(int)shaders[i]], &source);
+		key = DS_MurmurHash64A(source.data, (int)source.size, key);
+	}
+	return key;
+}
+
+static bool LoadIBLCache(Renderer* r, STR_View cache_filepath, uint64_t key) {
+	STR_View file_data;
+	if (!OS_ReadEntireFile(TEMP, cache_filepath, &file_data)) return false;
+	if (file_data.size < sizeof(IBLCacheHeader)) return false;
+
+	IBLCacheLayout layout;
+	GetIBLCacheLayout(r, &layout);
+
+	const IBLCacheHeader* header = (const IBLCacheHeader*)file_data.data;
+	if (header->magic != IBL_CACHE_MAGIC || header->version != IBL_CACHE_VERSION || header->key != key) return false;
+	if (header->data_size != layout.data_size || file_data.size != sizeof(IBLCacheHeader) + layout.data_size) return false;
+
+	GPU_Graph* graph = GPU_MakeGraph();
+	GPU_StagingAllocation staging;
+	bool staged = GPU_AllocateStaging(graph, layout.data_size, 16, &staging);
+	if (staged) {
+		memcpy(staging.data, file_data.data + sizeof(IBLCacheHeader), layout.data_size);
+
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < layout.regions[i].count; j++) layout.regions[i][j].src_offset += staging.offset;
+			GPU_OpCopyBufferToTextureRegions(graph, staging.buffer, layout.textures[i], layout.regions[i].data, (uint32_t)layout.regions[i].count);
+		}
+		GPU_GraphSubmit(graph);
+		GPU_GraphWait(graph);
+	}
+
+	GPU_DestroyGraph(graph);
+	return staged; // if the maps don't fit in the staging ring, they're just generated again
+}
+
+static void WriteIBLCache(Renderer* r, STR_View cache_filepath, uint64_t key) {
+	IBLCacheLayout layout;
+	GetIBLCacheLayout(r, &layout);
+
+	GPU_Buffer* readback_buffer = GPU_MakeBuffer(layout.data_size, GPU_BufferFlag_CPU, NULL);
+
+	GPU_Graph* graph = GPU_MakeGraph();
+	for (int i = 0; i < 3; i++) {
+		GPU_OpCopyTextureToBufferRegions(graph, layout.textures[i], readback_buffer, layout.regions[i].data, (uint32_t)layout.regions[i].count);
+	}
+	GPU_GraphSubmit(graph);
+	GPU_GraphWait(graph);
+
+	IBLCacheHeader header = {};
+	header.magic = IBL_CACHE_MAGIC;
+	header.version = IBL_CACHE_VERSION;
+	header.key = key;
+	header.data_size = layout.data_size;
+
+	char* file_data = DS_ArenaPush(TEMP, sizeof(IBLCacheHeader) + layout.data_size);
+	memcpy(file_data, &header, sizeof(header));
+	memcpy(file_data + sizeof(IBLCacheHeader), readback_buffer->data, layout.data_size);
+
+	// Failing to write the cache is not fatal, we'll just generate the maps again next time.
+	OS_WriteEntireFile(cache_filepath, STR_View{file_data, sizeof(IBLCacheHeader) + layout.data_size});
+
+	GPU_DestroyGraph(graph);
+	GPU_DestroyBuffer(readback_buffer);
+}
+
+// -------------------------------------------------------------------------------
+
+void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube, STR_View env_filepath) {
 	DS_ArenaMark T = DS_ArenaGetMark(TEMP);
 	ShaderHotreloader* loader = &r->shader_hotreloader;
 
@@ -87,7 +222,7 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 		GPU_WaitUntilIdle();
 		GPU_DestroyGraphicsPipeline(r->sun_depth_pipeline);
 
-		GPU_Access accesses[] = {GPU_Read(pass->globals_binding)};
+		GPU_Access accesses[] = {GPU_Read(pass->globals_binding), GPU_Read(pass->instances_binding)};
 
 		GPU_ShaderDesc vs_desc = {};
 		vs_desc.accesses = accesses; vs_desc.accesses_count = DS_ArrayCount(accesses);
@@ -95,15 +230,13 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 		GPU_ShaderDesc fs_desc = {};
 		LoadVertexAndFragmentShader(TEMP, ShaderAsset::SunDepthPass, pass->pipeline_layout, &vs_desc, &fs_desc);
 
-		GPU_Format vertex_formats[] = { GPU_Format_RGB32F, GPU_Format_RGB32F, GPU_Format_RGB32F, GPU_Format_RG32F };
-
 		GPU_GraphicsPipelineDesc desc = {};
 		desc.layout = pass->pipeline_layout;
 		desc.render_pass = r->sun_depth_render_pass;
 		desc.vs = vs_desc;
 		desc.fs = fs_desc;
-		desc.vertex_input_formats = vertex_formats;
-		desc.vertex_input_formats_count = DS_ArrayCount(vertex_formats);
+		desc.vertex_input_formats = VERTEX_INPUT_FORMATS;
+		desc.vertex_input_formats_count = DS_ArrayCount(VERTEX_INPUT_FORMATS);
 		desc.enable_depth_test = true;
 		desc.enable_depth_write = true;
 		// desc.cull_mode = GPU_CullMode_DrawCCW,
@@ -118,7 +251,8 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 		GPU_Access vs_accesses[] = {
 			GPU_Read(pass->globals_binding),
 			GPU_Read(pass->ssbo0_binding),
-			GPU_Read(pass->ssbo1_binding)
+			GPU_Read(pass->ssbo1_binding),
+			GPU_Read(pass->instances_binding),
 		};
 
 		GPU_Access fs_accesses[] = {
@@ -168,6 +302,7 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 		GPU_SetBufferBinding(desc_set, pass->globals_binding, r->globals_buffer);
 		GPU_SetBufferBinding(desc_set, pass->ssbo0_binding, r->globals_buffer);
 		GPU_SetBufferBinding(desc_set, pass->ssbo1_binding, r->globals_buffer);
+		GPU_SetBufferBinding(desc_set, pass->instances_binding, r->globals_buffer);
 		GPU_SetSamplerBinding(desc_set, pass->sampler_linear_clamp_binding, GPU_SamplerLinearClamp());
 		GPU_SetSamplerBinding(desc_set, pass->sampler_linear_wrap_binding, GPU_SamplerLinearWrap());
 		GPU_SetSamplerBinding(desc_set, pass->sampler_percentage_closer, r->sampler_percentage_closer);
@@ -195,6 +330,7 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 
 			GPU_Access vs_accesses[] = {
 				GPU_Read(pass->globals_binding),
+				GPU_Read(pass->instances_binding),
 			};
 
 			GPU_Access fs_acceses[] = {
@@ -213,20 +349,13 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 			fs_desc.accesses = fs_acceses; fs_desc.accesses_count = DS_ArrayCount(fs_acceses);
 			LoadVertexAndFragmentShader(TEMP, ShaderAsset::GeometryPass, pass->pipeline_layout, &vs_desc, &fs_desc);
 
-			GPU_Format vertex_inputs[] = {
-				GPU_Format_RGB32F,
-				GPU_Format_RGB32F,
-				GPU_Format_RGB32F,
-				GPU_Format_RG32F,
-			};
-
 			GPU_GraphicsPipelineDesc desc = {};
 			desc.layout = pass->pipeline_layout;
 			desc.render_pass = r->geometry_render_pass[i];
 			desc.vs = vs_desc;
 			desc.fs = fs_desc;
-			desc.vertex_input_formats = vertex_inputs;
-			desc.vertex_input_formats_count = DS_ArrayCount(vertex_inputs);
+			desc.vertex_input_formats = VERTEX_INPUT_FORMATS;
+			desc.vertex_input_formats_count = DS_ArrayCount(VERTEX_INPUT_FORMATS);
 			desc.enable_depth_test = true;
 			desc.enable_depth_write = true;
 			desc.cull_mode = GPU_CullMode_DrawCCW;
@@ -326,6 +455,7 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 			//GPU_SetStorageImageBinding(desc_set, pass->img0_binding_uint, r->lightgrid, 0);
 			GPU_SetBufferBinding(desc_set, pass->ssbo0_binding, r->globals_buffer);
 			GPU_SetBufferBinding(desc_set, pass->ssbo1_binding, r->globals_buffer);
+			GPU_SetBufferBinding(desc_set, pass->instances_binding, r->globals_buffer);
 			GPU_SetTextureBinding(desc_set, pass->tex0_binding, r->dummy_black);
 			GPU_SetTextureBinding(desc_set, pass->tex1_binding, r->dummy_black);
 			GPU_SetTextureBinding(desc_set, pass->tex2_binding, r->dummy_black);
@@ -376,6 +506,7 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 				//GPU_SetStorageImageBinding(desc_set, pass->img0_binding_uint, r->lightgrid, 0);
 				GPU_SetBufferBinding(desc_set, pass->ssbo0_binding, r->globals_buffer);
 				GPU_SetBufferBinding(desc_set, pass->ssbo1_binding, r->globals_buffer);
+				GPU_SetBufferBinding(desc_set, pass->instances_binding, r->globals_buffer);
 				GPU_SetBufferBinding(desc_set, pass->globals_binding, r->globals_buffer);
 				GPU_SetSamplerBinding(desc_set, pass->sampler_linear_wrap_binding, GPU_SamplerLinearWrap());
 				GPU_SetSamplerBinding(desc_set, pass->sampler_percentage_closer, r->sampler_percentage_closer);
@@ -434,6 +565,7 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 				//GPU_SetStorageImageBinding(desc_set, pass->img0_binding_uint, r->lightgrid, 0);
 				GPU_SetBufferBinding(desc_set, pass->ssbo0_binding, r->globals_buffer);
 				GPU_SetBufferBinding(desc_set, pass->ssbo1_binding, r->globals_buffer);
+				GPU_SetBufferBinding(desc_set, pass->instances_binding, r->globals_buffer);
 				GPU_SetBufferBinding(desc_set, pass->globals_binding, r->globals_buffer);
 				GPU_SetSamplerBinding(desc_set, pass->sampler_linear_wrap_binding, GPU_SamplerLinearWrap());
 				GPU_SetSamplerBinding(desc_set, pass->sampler_percentage_closer, r->sampler_percentage_closer);
@@ -483,6 +615,7 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 			//GPU_SetStorageImageBinding(desc_set, pass->img0_binding_uint, r->lightgrid, 0);
 			GPU_SetBufferBinding(desc_set, pass->ssbo0_binding, r->globals_buffer);
 			GPU_SetBufferBinding(desc_set, pass->ssbo1_binding, r->globals_buffer);
+			GPU_SetBufferBinding(desc_set, pass->instances_binding, r->globals_buffer);
 			GPU_SetBufferBinding(desc_set, pass->globals_binding, r->globals_buffer);
 			GPU_SetSamplerBinding(desc_set, pass->sampler_linear_wrap_binding, GPU_SamplerLinearWrap());
 			GPU_SetSamplerBinding(desc_set, pass->sampler_percentage_closer, r->sampler_percentage_closer);
@@ -502,11 +635,31 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 		}
 	}
 
+	bool* ibl_shader_is_outdated[] = {
+		&loader->shader_is_outdated[(int)ShaderAsset::GenIrradianceMap],
+		&loader->shader_is_outdated[(int)ShaderAsset::GenPrefilteredEnvMap],
+		&loader->shader_is_outdated[(int)ShaderAsset::GenBRDFIntegrationMap],
+	};
+	bool ibl_is_outdated = *ibl_shader_is_outdated[0] || *ibl_shader_is_outdated[1] || *ibl_shader_is_outdated[2];
+	STR_View ibl_cache_filepath = STR_Form(TEMP, "%v.ibl", env_filepath);
+	uint64_t ibl_cache_key = 0;
+
+	if (ibl_is_outdated) {
+		ibl_cache_key = GetIBLCacheKey(env_filepath);
+		if (!r->ibl_cache_checked) {
+			r->ibl_cache_checked = true;
+			if (LoadIBLCache(r, ibl_cache_filepath, ibl_cache_key)) {
+				for (int i = 0; i < 3; i++) *ibl_shader_is_outdated[i] = false;
+				ibl_is_outdated = false;
+			}
+		}
+	}
+
 	if (loader->shader_is_outdated[(int)ShaderAsset::GenIrradianceMap]) {
 		GPU_PipelineLayout* pipeline_layout = GPU_InitPipelineLayout();
 		uint32_t sampler_binding = GPU_SamplerBinding(pipeline_layout, "SAMPLER_LINEAR_CLAMP");
 		uint32_t tex_env_cube_binding = GPU_TextureBinding(pipeline_layout, "TEX_ENV_CUBE");
-		uint32_t output_binding = GPU_StorageImageBinding(pipeline_layout, "OUTPUT", GPU_Format_RGBA32F);
+		uint32_t output_binding = GPU_StorageImageBinding(pipeline_layout, "OUTPUT", GPU_Format_RGBA16F);
 		GPU_FinalizePipelineLayout(pipeline_layout);
 
 		GPU_Access cs_accesses[] = {
@@ -543,7 +696,7 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 		GPU_PipelineLayout* pipeline_layout = GPU_InitPipelineLayout();
 		uint32_t sampler_binding = GPU_SamplerBinding(pipeline_layout, "SAMPLER_LINEAR_CLAMP");
 		uint32_t tex_env_cube_binding = GPU_TextureBinding(pipeline_layout, "TEX_ENV_CUBE");
-		uint32_t output_binding = GPU_StorageImageBinding(pipeline_layout, "OUTPUT", GPU_Format_RGBA32F);
+		uint32_t output_binding = GPU_StorageImageBinding(pipeline_layout, "OUTPUT", GPU_Format_RGBA16F);
 		GPU_FinalizePipelineLayout(pipeline_layout);
 
 		GPU_Access cs_accesses[] = {
@@ -618,6 +771,10 @@ void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube) {
 		GPU_DestroyPipelineLayout(pipeline_layout);
 	}
 
+	if (ibl_is_outdated) {
+		WriteIBLCache(r, ibl_cache_filepath, ibl_cache_key);
+	}
+
 	// Finally, tell the hotreloader that we have checked everything
 	for (int i = 0; i < (int)ShaderAsset::COUNT; i++) {
 		loader->shader_is_outdated[i] = false;
@@ -675,7 +832,7 @@ void InitRenderer(Renderer* r, uint32_t window_width, uint32_t window_height) {
 		r->globals_buffer = GPU_MakeBuffer(sizeof(RendererGlobalsBuffer), GPU_BufferFlag_CPU|GPU_BufferFlag_GPU|GPU_BufferFlag_StorageBuffer, NULL);
 		
 		r->sun_depth_rt       = GPU_MakeTexture(GPU_Format_D32F_Or_X8D24UN, 2048, 2048, 1, GPU_TextureFlag_RenderTarget, NULL);
-		r->lightgrid          = GPU_MakeTexture(GPU_Format_RGBA16F, LIGHTGRID_SIZE, LIGHTGRID_SIZE, LIGHTGRID_SIZE, GPU_TextureFlag_StorageImage, NULL);
+		r->lightgrid          = GPU_MakeTexture(GPU_Format_RGBA16F, LIGHTGRID_SIZE, LIGHTGRID_SIZE, LIGHTGRID_SIZE, GPU_TextureFlag_StorageImage|GPU_TextureFlag_ComputeShared, NULL);
 
 		r->gbuffer_base_color = GPU_MakeTexture(GPU_Format_RGBA8UN, window_width, window_height, 1, GPU_TextureFlag_RenderTarget, NULL);
 		r->gbuffer_normal     = GPU_MakeTexture(GPU_Format_RGBA8UN, window_width, window_height, 1, GPU_TextureFlag_RenderTarget, NULL);
@@ -791,9 +948,9 @@ void InitRenderer(Renderer* r, uint32_t window_width, uint32_t window_height) {
 		r->dummy_normal_map = GPU_MakeTexture(GPU_Format_RGBA8UN, 1, 1, 1, 0, &normal_up);
 		r->dummy_black = GPU_MakeTexture(GPU_Format_RGBA8UN, 1, 1, 1, 0, &black);
 		r->dummy_white = GPU_MakeTexture(GPU_Format_RGBA8UN, 1, 1, 1, 0, &white);
-		r->irradiance_map = GPU_MakeTexture(GPU_Format_RGBA32F, 32, 32, 1, GPU_TextureFlag_Cubemap|GPU_TextureFlag_StorageImage, NULL);
+		r->irradiance_map = GPU_MakeTexture(GPU_Format_RGBA16F, 32, 32, 1, GPU_TextureFlag_Cubemap|GPU_TextureFlag_StorageImage, NULL);
 		r->brdf_lut = GPU_MakeTexture(GPU_Format_RG16F, 256, 256, 1, GPU_TextureFlag_StorageImage, NULL);
-		r->tex_specular_env_map = GPU_MakeTexture(GPU_Format_RGBA32F, 256, 256, 1, GPU_TextureFlag_Cubemap|GPU_TextureFlag_HasMipmaps|GPU_TextureFlag_StorageImage, NULL);
+		r->tex_specular_env_map = GPU_MakeTexture(GPU_Format_RGBA16F, 256, 256, 1, GPU_TextureFlag_Cubemap|GPU_TextureFlag_HasMipmaps|GPU_TextureFlag_StorageImage, NULL);
 
 		{
 			MainPassLayout* lo = &r->main_pass_layout;
@@ -811,6 +968,7 @@ void InitRenderer(Renderer* r, uint32_t window_width, uint32_t window_height) {
 			
 			lo->ssbo0_binding = GPU_BufferBinding(lo->pipeline_layout, "SSBO0");
 			lo->ssbo1_binding = GPU_BufferBinding(lo->pipeline_layout, "SSBO1");
+			lo->instances_binding = GPU_BufferBinding(lo->pipeline_layout, "INSTANCES");
 			
 			// lo->img0_binding_uint = GPU_StorageImageBinding(lo->pipeline_layout, "IMG0_UINT", GPU_Format_R64I);
 			lo->img0_binding = GPU_StorageImageBinding(lo->pipeline_layout, "IMG0", r->lightgrid->format);
@@ -870,6 +1028,11 @@ void InitRenderer(Renderer* r, uint32_t window_width, uint32_t window_height) {
 			}
 		}
 	}
+
+	for (int i = 0; i < 2; i++) {
+		r->geometry_graphs[i] = GPU_MakeGraph();
+		r->lightgrid_sweep_graphs[i] = GPU_MakeComputeGraph();
+	}
 }
 
 void DeinitRenderer(Renderer* r) {
@@ -905,6 +1068,11 @@ void DeinitRenderer(Renderer* r) {
 	
 	// -- Deinit resources created from InitRenderer
 	
+	for (int i = 0; i < 2; i++) {
+		GPU_DestroyGraph(r->geometry_graphs[i]);
+		GPU_DestroyGraph(r->lightgrid_sweep_graphs[i]);
+	}
+
 	for (int i = 0; i < 2; i++) GPU_DestroyDescriptorSet(r->lighting_pass_descriptor_set[i]);
 	GPU_DestroyPipelineLayout(r->lighting_pass_layout.pipeline_layout);
 	GPU_DestroyPipelineLayout(r->main_pass_layout.pipeline_layout);
@@ -951,6 +1119,93 @@ void DeinitRenderer(Renderer* r) {
 	*r = {};
 }
 
+GPU_DescriptorSet* MakeRenderObjectPartDescriptorSet(Renderer* r, const RenderObject* object, const RenderObjectPart* part) {
+	MainPassLayout* pass = &r->main_pass_layout;
+
+	GPU_DescriptorSet* desc_set = GPU_InitDescriptorSet(NULL, pass->pipeline_layout);
+
+	GPU_SetBufferBinding(desc_set, pass->globals_binding, r->globals_buffer);
+	GPU_SetSamplerBinding(desc_set, pass->sampler_linear_clamp_binding, GPU_SamplerLinearClamp());
+	GPU_SetSamplerBinding(desc_set, pass->sampler_linear_wrap_binding, GPU_SamplerLinearWrap());
+	GPU_SetSamplerBinding(desc_set, pass->sampler_percentage_closer, r->sampler_percentage_closer);
+
+	GPU_SetTextureBinding(desc_set, pass->tex0_binding, part->tex_base_color ? part->tex_base_color : r->dummy_white);
+	GPU_SetTextureBinding(desc_set, pass->tex1_binding, part->tex_normal ? part->tex_normal : r->dummy_normal_map);
+	GPU_SetTextureBinding(desc_set, pass->tex2_binding, part->tex_orm ? part->tex_orm : r->dummy_black);
+	GPU_SetTextureBinding(desc_set, pass->tex3_binding, part->tex_emissive ? part->tex_emissive : r->dummy_black);
+	GPU_SetTextureBinding(desc_set, pass->sun_depth_map_binding_, r->sun_depth_rt);
+
+	// for lightgrid voxelization
+	GPU_SetBufferBinding(desc_set, pass->ssbo0_binding, object->vertex_buffer);
+	GPU_SetBufferBinding(desc_set, pass->ssbo1_binding, object->index_buffer);
+	GPU_SetBufferBinding(desc_set, pass->instances_binding, object->instance_buffer);
+	GPU_SetStorageImageBinding(desc_set, pass->img0_binding, r->lightgrid, 0);
+	//GPU_SetStorageImageBinding(desc_set, pass->img0_binding_uint, r->lightgrid, 0);
+
+	// ... unused descriptors. This is stupid.
+	GPU_SetTextureBinding(desc_set, pass->prev_frame_result_binding, r->dummy_black);
+	GPU_SetTextureBinding(desc_set, pass->gbuffer_depth_binding, r->dummy_black);
+	GPU_SetTextureBinding(desc_set, pass->gbuffer_depth_prev_binding, r->dummy_black);
+	GPU_SetTextureBinding(desc_set, pass->gbuffer_velocity_binding, r->dummy_black);
+	GPU_SetTextureBinding(desc_set, pass->gbuffer_velocity_prev_binding, r->dummy_black);
+	GPU_SetTextureBinding(desc_set, pass->lighting_result_rt, r->dummy_black);
+
+	GPU_FinalizeDescriptorSet(desc_set);
+	return desc_set;
+}
+
+// The planes are tested in clip space, so this doesn't care about the depth range convention.
+bool AABBIsInFrustum(HMM_Vec3 bounds_min, HMM_Vec3 bounds_max, const HMM_Mat4& clip_from_world) {
+	uint32_t outside_all = 0x1F;
+	for (int corner = 0; corner < 8; corner++) {
+		HMM_Vec3 p = HMM_V3(corner & 1 ? bounds_max.X : bounds_min.X, corner & 2 ? bounds_max.Y : bounds_min.Y, corner & 4 ? bounds_max.Z : bounds_min.Z);
+		HMM_Vec4 clip = HMM_MulM4V4(clip_from_world, HMM_V4V(p, 1.f));
+		uint32_t outside = 0;
+		if (clip.X < -clip.W) outside |= 1 << 0;
+		if (clip.X > clip.W)  outside |= 1 << 1;
+		if (clip.Y < -clip.W) outside |= 1 << 2;
+		if (clip.Y > clip.W)  outside |= 1 << 3;
+		if (clip.W <= 0.f)    outside |= 1 << 4;
+		outside_all &= outside;
+	}
+	return outside_all == 0;
+}
+
+// Picks the coarsest LOD whose error is at most `max_error` world units
+static uint32_t SelectLOD(const RenderObjectPart* part, float max_error) {
+	uint32_t lod = 0;
+	while (lod + 1 < part->lod_count && part->lods[lod + 1].error <= max_error) lod++;
+	return lod;
+}
+
+// Picks the coarsest LOD whose error projects to at most `max_error_pixels` on screen. The error is projected at the
+// point of the part's bounds closest to the camera, so this is conservative for big parts.
+static uint32_t SelectLODByProjectedError(const RenderObjectPart* part, const Camera& camera, float viewport_height, float max_error_pixels) {
+	HMM_Vec3 closest_point;
+	for (int k = 0; k < 3; k++) {
+		float p = camera.lazy_pos.Elements[k];
+		closest_point.Elements[k] = p < part->bounds_min.Elements[k] ? part->bounds_min.Elements[k] : p > part->bounds_max.Elements[k] ? part->bounds_max.Elements[k] : p;
+	}
+	float distance = HMM_LenV3(HMM_SubV3(closest_point, camera.lazy_pos));
+	if (distance < camera.z_near) distance = camera.z_near;
+
+	// clip_from_view[1][1] is 1 / tan(fov_y / 2)
+	float pixels_per_unit = fabsf(camera.clip_from_view.Elements[1][1]) * 0.5f * viewport_height / distance;
+	return SelectLOD(part, max_error_pixels / pixels_per_unit);
+}
+
+static void PushMeshPartConstants(Renderer* r, GPU_Graph* graph, RenderObjectPart* part, uint32_t lod, HMM_Vec2 taa_jitter) {
+	MeshPartConstants constants = {};
+	constants.taa_jitter = taa_jitter;
+	constants.taa_jitter_prev = r->taa_jitter_prev_frame;
+	constants.position_min.XYZ = part->position_min;
+	constants.position_scale.XYZ = part->position_scale;
+	constants.first_index = part->first_index + part->lods[lod].first_index;
+	constants.base_vertex = part->base_vertex;
+	constants.index_type = (uint32_t)part->index_type;
+	GPU_OpPushGraphicsConstants(graph, r->main_pass_layout.pipeline_layout, &constants, sizeof(constants));
+}
+
 void BuildRenderCommands(Renderer* r, GPU_Graph* graph, GPU_Texture* backbuffer, RenderObject* world, RenderObject* skybox, const Camera& camera, const RenderParameters& params)
 {
 	uint32_t frame_idx = r->frame_idx;
@@ -958,6 +1213,7 @@ void BuildRenderCommands(Renderer* r, GPU_Graph* graph, GPU_Texture* backbuffer,
 
 	const float sun_half_size = 40.f;
 	const float lightgrid_extent = 40.f;
+	const float lod_max_error_pixels = 1.f;
 
 	HMM_Mat4 sun_space_from_world;
 	HMM_Vec3 sun_dir;
@@ -990,129 +1246,172 @@ void BuildRenderCommands(Renderer* r, GPU_Graph* graph, GPU_Texture* backbuffer,
 	globals.visualize_lightgrid = (uint32_t)params.visualize_lightgrid; // (float)Input_IsDown(&inputs, Input_Key_Alt);
 	memcpy(r->globals_buffer->data, &globals, sizeof(globals));
 
-	GPU_OpClearDepthStencil(graph, r->gbuffer_depth[frame_idx_mod2], GPU_MIP_LEVEL_ALL);
+	// The sun depth, voxelize and geometry passes go into their own graph, so that the lightgrid sweep can run on the async compute
+	// queue at the same time. The frame's graph then does the lighting and everything after it once both are done.
+	GPU_Graph* geometry_graph = r->geometry_graphs[frame_idx_mod2];
+	GPU_GraphWait(geometry_graph);
+
+	GPU_OpClearDepthStencil(geometry_graph, r->gbuffer_depth[frame_idx_mod2], GPU_MIP_LEVEL_ALL);
 
 	//  -- Sun depth renderpass ------------------
 
-	GPU_OpClearDepthStencil(graph, r->sun_depth_rt, GPU_MIP_LEVEL_ALL);
+	GPU_OpClearDepthStencil(geometry_graph, r->sun_depth_rt, GPU_MIP_LEVEL_ALL);
 
-	GPU_OpPrepareRenderPass(graph, r->sun_depth_render_pass);
+	GPU_OpPrepareRenderPass(geometry_graph, r->sun_depth_render_pass);
 
 	DS_DynArray(uint32_t) sun_depth_pass_part_draw_params = {TEMP};
 	for (int i = 0; i < world->parts.count; i++) {
 		RenderObjectPart* part = &world->parts[i];
 
-		uint32_t draw_params = GPU_OpPrepareDrawParams(graph, r->sun_depth_pipeline, part->descriptor_set);
+		uint32_t draw_params = GPU_OpPrepareDrawParams(geometry_graph, r->sun_depth_pipeline, part->descriptor_set);
 		DS_ArrPush(&sun_depth_pass_part_draw_params, draw_params);
 	}
 
-	GPU_OpBeginRenderPass(graph);
+	GPU_OpBeginRenderPass(geometry_graph);
+
+	GPU_OpBindVertexBuffer(geometry_graph, world->vertex_buffer);
 
-	GPU_OpBindVertexBuffer(graph, world->vertex_buffer);
-	GPU_OpBindIndexBuffer(graph, world->index_buffer);
+	// Anything below a shadow map texel doesn't matter
+	float sun_depth_texel_size = 2.f * sun_half_size / (float)r->sun_depth_rt->width;
 
 	for (int i = 0; i < world->parts.count; i++) {
 		RenderObjectPart* part = &world->parts[i];
-		GPU_OpBindDrawParams(graph, sun_depth_pass_part_draw_params[i]);
-		GPU_OpDrawIndexed(graph, part->index_count, 1, part->first_index, 0, 0);
+		uint32_t lod = SelectLOD(part, sun_depth_texel_size);
+		GPU_OpBindDrawParams(geometry_graph, sun_depth_pass_part_draw_params[i]);
+		PushMeshPartConstants(r, geometry_graph, part, lod, {});
+		GPU_OpBindIndexBuffer(geometry_graph, world->index_buffer, part->index_type);
+		GPU_OpDrawIndexed(geometry_graph, part->lods[lod].index_count, part->instance_count, part->first_index + part->lods[lod].first_index, part->base_vertex, part->first_instance);
 	}
 
-	GPU_OpEndRenderPass(graph);
+	GPU_OpEndRenderPass(geometry_graph);
 
 	// -- Voxelize pass -------------------------
 
 	bool revoxelize = frame_idx == 0 || params.sun_angle != r->sun_angle_prev_frame;
 	if (revoxelize) {
+		// The lightgrid belongs to whichever queue used it last, and a graph on the other queue has to depend on that graph
+		// before touching it. The previous frame's sweep may still be running on the async compute queue, and the barriers
+		// don't reach across queues, so clearing and voxelizing must wait for it.
+		GPU_GraphDependsOn(geometry_graph, r->lightgrid_sweep_graphs[frame_idx_mod2 ^ 1]);
 
 		if (frame_idx == 0) {
-			GPU_OpClearColorF(graph, r->lightgrid, GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
+			GPU_OpClearColorF(geometry_graph, r->lightgrid, GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
 
 			// clear the initial feedback framebuffers
-			GPU_OpClearDepthStencil(graph, r->gbuffer_depth[0], GPU_MIP_LEVEL_ALL);
-			GPU_OpClearDepthStencil(graph, r->gbuffer_depth[1], GPU_MIP_LEVEL_ALL);
-			GPU_OpClearColorF(graph, r->gbuffer_velocity[0], GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
-			GPU_OpClearColorF(graph, r->gbuffer_velocity[1], GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
-			GPU_OpClearColorF(graph, r->taa_output_rt[0], GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
-			GPU_OpClearColorF(graph, r->taa_output_rt[1], GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
+			GPU_OpClearDepthStencil(geometry_graph, r->gbuffer_depth[0], GPU_MIP_LEVEL_ALL);
+			GPU_OpClearDepthStencil(geometry_graph, r->gbuffer_depth[1], GPU_MIP_LEVEL_ALL);
+			GPU_OpClearColorF(geometry_graph, r->gbuffer_velocity[0], GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
+			GPU_OpClearColorF(geometry_graph, r->gbuffer_velocity[1], GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
+			GPU_OpClearColorF(geometry_graph, r->taa_output_rt[0], GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
+			GPU_OpClearColorF(geometry_graph, r->taa_output_rt[1], GPU_MIP_LEVEL_ALL, 0.f, 0.f, 0.f, 0.f);
 		}
 
-		GPU_OpPrepareRenderPass(graph, r->lightgrid_voxelize_render_pass);
+		GPU_OpPrepareRenderPass(geometry_graph, r->lightgrid_voxelize_render_pass);
 
 		DS_DynArray(uint32_t) voxelize_pass_part_draw_paramss = {TEMP};
 		for (int i = 0; i < world->parts.count; i++) {
 			RenderObjectPart* part = &world->parts[i];
-			uint32_t draw_params = GPU_OpPrepareDrawParams(graph, r->lightgrid_voxelize_pipeline, part->descriptor_set);
+			uint32_t draw_params = GPU_OpPrepareDrawParams(geometry_graph, r->lightgrid_voxelize_pipeline, part->descriptor_set);
 			DS_ArrPush(&voxelize_pass_part_draw_paramss, draw_params);
 		}
 
-		GPU_OpBeginRenderPass(graph);
+		GPU_OpBeginRenderPass(geometry_graph);
+
+		// The lightgrid is coarse, so use the coarsest LOD that stays within half a cell
+		float lightgrid_half_cell_size = lightgrid_extent / (float)LIGHTGRID_SIZE;
 
 		for (int i = 0; i < world->parts.count; i++) {
 			RenderObjectPart* part = &world->parts[i];
-			GPU_OpBindDrawParams(graph, voxelize_pass_part_draw_paramss[i]);
-			GPU_OpDraw(graph, part->index_count, 1, part->first_index, 0);
+			uint32_t lod = SelectLOD(part, lightgrid_half_cell_size);
+			GPU_OpBindDrawParams(geometry_graph, voxelize_pass_part_draw_paramss[i]);
+			PushMeshPartConstants(r, geometry_graph, part, lod, {});
+			GPU_OpDraw(geometry_graph, part->lods[lod].index_count, part->instance_count, 0, part->first_instance); // The shader adds first_index itself
 		}
 
-		GPU_OpEndRenderPass(graph);
+		GPU_OpEndRenderPass(geometry_graph);
 	}
 
-	//  -- Light grid sweep pass -----------------
-
-	// So, let's spread the illumination. We need a cubemap for the sky, but for now lets say its all blue.
-	// Next it'd be interesting to benchmark the timing of this dispatch and compare the speeds when doing it in X vs Y vs Z.
-
-	r->sweep_direction++;
-	if (r->sweep_direction == 3) r->sweep_direction = 0;
-
-	GPU_OpBindComputePipeline(graph, r->lightgrid_sweep_pipeline);
-	GPU_OpBindComputeDescriptorSet(graph, r->lightgrid_sweep_desc_set);
-	GPU_OpPushComputeConstants(graph, r->main_pass_layout.pipeline_layout, &r->sweep_direction, sizeof(r->sweep_direction));
-	
-	assert(LIGHTGRID_SIZE == 128);
-	GPU_OpDispatch(graph, 1, 16, 16); // 1*1, 16*8, 16*8 = (1, 128, 128)
-
 	// -- Geometry pass -------------------------
 
-	GPU_OpPrepareRenderPass(graph, r->geometry_render_pass[frame_idx_mod2]);
+	GPU_OpPrepareRenderPass(geometry_graph, r->geometry_render_pass[frame_idx_mod2]);
 	
+	// Parts outside the view frustum are skipped and get UINT32_MAX for their draw params
 	DS_DynArray(uint32_t) geometry_pass_part_draw_params = {TEMP};
 	for (int i = 0; i < world->parts.count; i++) {
 		RenderObjectPart* part = &world->parts[i];
-		uint32_t draw_params = GPU_OpPrepareDrawParams(graph, r->geometry_pass_pipeline[frame_idx_mod2], part->descriptor_set);
+		uint32_t draw_params = UINT32_MAX;
+		if (AABBIsInFrustum(part->bounds_min, part->bounds_max, camera.clip_from_world)) {
+			draw_params = GPU_OpPrepareDrawParams(geometry_graph, r->geometry_pass_pipeline[frame_idx_mod2], part->descriptor_set);
+		}
 		DS_ArrPush(&geometry_pass_part_draw_params, draw_params);
 	}
 
-	GPU_OpBeginRenderPass(graph);
+	DS_DynArray(uint32_t) skybox_part_draw_params = {TEMP};
+	for (int i = 0; i < skybox->parts.count; i++) {
+		RenderObjectPart* part = &skybox->parts[i];
+		uint32_t draw_params = GPU_OpPrepareDrawParams(geometry_graph, r->geometry_pass_pipeline[frame_idx_mod2], part->descriptor_set);
+		DS_ArrPush(&skybox_part_draw_params, draw_params);
+	}
 
-	{
-		GPU_OpBindVertexBuffer(graph, world->vertex_buffer);
-		GPU_OpBindIndexBuffer(graph, world->index_buffer);
+	GPU_OpBeginRenderPass(geometry_graph);
 
-		HMM_Vec2 constants[2];
-		constants[0] = taa_jitter;
-		constants[1] = r->taa_jitter_prev_frame;
-		GPU_OpPushGraphicsConstants(graph, r->main_pass_layout.pipeline_layout, constants, sizeof(constants));
+	{
+		GPU_OpBindVertexBuffer(geometry_graph, world->vertex_buffer);
 
 		for (int i = 0; i < world->parts.count; i++) {
+			if (geometry_pass_part_draw_params[i] == UINT32_MAX) continue;
 			RenderObjectPart* part = &world->parts[i];
-			GPU_OpBindDrawParams(graph, geometry_pass_part_draw_params[i]);
-			GPU_OpDrawIndexed(graph, part->index_count, 1, part->first_index, 0, 0);
+			uint32_t lod = SelectLODByProjectedError(part, camera, (float)r->window_height, lod_max_error_pixels);
+			GPU_OpBindDrawParams(geometry_graph, geometry_pass_part_draw_params[i]);
+			PushMeshPartConstants(r, geometry_graph, part, lod, taa_jitter);
+			GPU_OpBindIndexBuffer(geometry_graph, world->index_buffer, part->index_type);
+			GPU_OpDrawIndexed(geometry_graph, part->lods[lod].index_count, part->instance_count, part->first_index + part->lods[lod].first_index, part->base_vertex, part->first_instance);
 		}
 	}
 
 	// Draw skybox
 	{
-		GPU_OpBindVertexBuffer(graph, skybox->vertex_buffer);
-		GPU_OpBindIndexBuffer(graph, skybox->index_buffer);
+		GPU_OpBindVertexBuffer(geometry_graph, skybox->vertex_buffer);
 
 		for (int i = 0; i < skybox->parts.count; i++) {
 			RenderObjectPart* part = &skybox->parts[i];
-			GPU_OpBindDrawParams(graph, geometry_pass_part_draw_params[i]);
-			GPU_OpDrawIndexed(graph, part->index_count, 1, part->first_index, 0, 0);
+			GPU_OpBindDrawParams(geometry_graph, skybox_part_draw_params[i]);
+			PushMeshPartConstants(r, geometry_graph, part, 0, taa_jitter);
+			GPU_OpBindIndexBuffer(geometry_graph, skybox->index_buffer, part->index_type);
+			GPU_OpDrawIndexed(geometry_graph, part->lods[0].index_count, part->instance_count, part->first_index + part->lods[0].first_index, part->base_vertex, part->first_instance);
 		}
 	}
 
-	GPU_OpEndRenderPass(graph);
+	GPU_OpEndRenderPass(geometry_graph);
+
+	GPU_GraphSubmit(geometry_graph);
+
+	//  -- Light grid sweep pass -----------------
+
+	// The sweep only touches the lightgrid, so it just has to wait for whatever used the lightgrid last: the voxelize pass if it
+	// ran this frame, otherwise the previous frame's graph.
+	GPU_Graph* sweep_graph = r->lightgrid_sweep_graphs[frame_idx_mod2];
+	GPU_GraphWait(sweep_graph);
+	GPU_GraphDependsOn(sweep_graph, revoxelize ? geometry_graph : r->prev_frame_graph);
+
+	// So, let's spread the illumination. We need a cubemap for the sky, but for now lets say its all blue.
+	// Next it'd be interesting to benchmark the timing of this dispatch and compare the speeds when doing it in X vs Y vs Z.
+
+	r->sweep_direction++;
+	if (r->sweep_direction == 3) r->sweep_direction = 0;
+
+	GPU_OpBindComputePipeline(sweep_graph, r->lightgrid_sweep_pipeline);
+	GPU_OpBindComputeDescriptorSet(sweep_graph, r->lightgrid_sweep_desc_set);
+	GPU_OpPushComputeConstants(sweep_graph, r->main_pass_layout.pipeline_layout, &r->sweep_direction, sizeof(r->sweep_direction));
+	
+	assert(LIGHTGRID_SIZE == 128);
+	GPU_OpDispatch(sweep_graph, 1, 16, 16); // 1*1, 16*8, 16*8 = (1, 128, 128)
+
+	GPU_GraphSubmit(sweep_graph);
+
+	GPU_GraphDependsOn(graph, geometry_graph);
+	GPU_GraphDependsOn(graph, sweep_graph);
+	r->prev_frame_graph = graph;
 
 	// -- Lighting pass -------------------------
 
@@ -1,6 +1,9 @@
 
 #define BLOOM_PASS_COUNT 6
 
+// When enabled, meshes are uploaded as PackedVertex instead of Vertex. The shaders that read vertices get PACKED_VERTICES defined.
+#define PACKED_VERTICES 1
+
 #define SHADER_ASSETS \
 	X(LightgridVoxelize,       "../src/demo_pbr_renderer/shaders/lightgrid_voxelize.glsl")\
 	X(LightgridSweep,          "../src/demo_pbr_renderer/shaders/lightgrid_sweep.glsl")\
@@ -32,9 +35,48 @@ struct Vertex {
 	HMM_Vec3 position;
 	HMM_Vec3 normal; // this could be packed better!
 	HMM_Vec3 tangent; // this could be packed better!
+	float tangent_sign; // 1 if the bitangent is cross(normal, tangent), -1 if it's flipped, 0 if unknown (derived from the UVs when packing)
 	HMM_Vec2 tex_coord;
 };
 
+// 20 bytes instead of 48. The world is drawn in three passes per frame (sun depth, voxelize, geometry), so this adds up.
+struct PackedVertex {
+	uint16_t position[3]; // quantized to the bounds of the mesh part, see MeshPartConstants
+	uint16_t tangent_sign; // 1 if the bitangent is cross(normal, tangent), 0 if it's flipped
+	uint16_t normal_oct[2]; // octahedral encoding, remapped from [-1, 1] to [0, 65535]
+	uint16_t tangent_oct[2]; // octahedral encoding, remapped from [-1, 1] to [0, 65535]
+	uint16_t tex_coord[2]; // half floats
+};
+
+// Push constants when drawing a mesh part in the sun depth, voxelize and geometry passes
+struct MeshPartConstants {
+	HMM_Vec2 taa_jitter;
+	HMM_Vec2 taa_jitter_prev;
+	HMM_Vec4 position_min; // position = position_min + quantized_position * position_scale. With unpacked vertices, these are unused.
+	HMM_Vec4 position_scale;
+	
+	// For fetching the indices manually in lightgrid voxelize. See RenderObjectPart
+	uint32_t first_index;
+	uint32_t base_vertex;
+	uint32_t index_type; // GPU_IndexType
+};
+
+#define MESH_LOD_MAX_COUNT 4
+
+// A simplified version of a mesh part, see SimplifyMesh. All LODs of a part share its vertices.
+struct MeshLOD {
+	uint32_t first_index; // relative to the first index of the part
+	uint32_t index_count;
+	float error; // approximate world-space distance from LOD 0
+};
+
+// Transform of one instance of a mesh part, see LoadMeshFlag_KeepInstances. Parts that aren't instanced use an identity instance.
+// The shaders index this with gl_InstanceIndex.
+struct MeshInstance {
+	HMM_Mat4 world_from_local;
+	HMM_Mat4 normal_from_local; // inverse transpose of world_from_local
+};
+
 struct MainPassLayout {
 	GPU_PipelineLayout* pipeline_layout;
 	
@@ -51,6 +93,7 @@ struct MainPassLayout {
 	
 	uint32_t ssbo0_binding; // for vertex buffer in lightgrid voxelize
 	uint32_t ssbo1_binding; // for index buffer in lightgrid voxelize
+	uint32_t instances_binding; // MeshInstance[]
 	uint32_t img0_binding; // for lightmap image in lightgrid voxelize
 	
 	// TAA resolve stuff
@@ -96,14 +139,35 @@ struct RenderObjectPart {
 	GPU_Texture* tex_orm;
 	GPU_Texture* tex_emissive;
 
-	uint32_t first_index;
-	uint32_t index_count;
-	GPU_DescriptorSet* descriptor_set;
+	GPU_IndexType index_type; // 16-bit if the part has few enough vertices
+	uint32_t first_index; // in units of index_type
+	uint32_t base_vertex; // indices are relative to this
+	uint32_t lod_count; // lods[0] is the full detail mesh
+	MeshLOD lods[MESH_LOD_MAX_COUNT];
+	HMM_Vec3 bounds_min; // world-space AABB of all instances, for LOD selection and culling
+	HMM_Vec3 bounds_max;
+	HMM_Vec3 position_min; // for dequantizing PackedVertex positions
+	HMM_Vec3 position_scale;
+	uint32_t first_instance; // into RenderObject::instance_buffer
+	uint32_t instance_count;
+	uint32_t first_meshlet; // only set with LoadMeshFlag_BuildMeshlets. The meshlet bounds are in the local space of the instances.
+	uint32_t meshlet_count;
+	float uv_density; // UV units per world unit on LOD 0, for texture streaming. 0 if the part has no UV mapping.
+	GPU_DescriptorSet* descriptor_set; // see MakeRenderObjectPartDescriptorSet
+	bool shares_descriptor_set; // if true, `descriptor_set` belongs to the previous part, which has the same textures
 };
 
 struct RenderObject {
 	GPU_Buffer* vertex_buffer;
 	GPU_Buffer* index_buffer;
+	GPU_Buffer* instance_buffer; // MeshInstance[]. The first one is the identity, which all non-instanced parts use.
+	
+	// Optional. Holds all meshlets (struct Meshlet), then the meshlet vertex indices (uint32, relative to the part's
+	// base_vertex), then the meshlet triangles (3 bytes each, padded to 4 at the end). The offsets are in bytes.
+	GPU_Buffer* meshlet_buffer;
+	uint32_t meshlet_vertices_offset;
+	uint32_t meshlet_triangles_offset;
+	
 	DS_DynArray<RenderObjectPart> parts;
 };
 
@@ -180,10 +244,16 @@ struct Renderer {
 	GPU_Texture* irradiance_map;
 	GPU_Texture* brdf_lut;
 	GPU_Texture* tex_specular_env_map;
+	bool ibl_cache_checked; // the IBL cache is only read on the first HotreloadShaders call
 
 	GPU_GraphicsPipeline* lightgrid_voxelize_pipeline;
 	GPU_ComputePipeline* lightgrid_sweep_pipeline;
 	GPU_DescriptorSet* lightgrid_sweep_desc_set;
+
+	// Each frame is split into three graphs, see BuildRenderCommands
+	GPU_Graph* geometry_graphs[2];
+	GPU_Graph* lightgrid_sweep_graphs[2]; // compute graphs
+	GPU_Graph* prev_frame_graph; // the graph that BuildRenderCommands was last called with
 	
 	GPU_GraphicsPipeline* lighting_pass_pipeline;
 	GPU_DescriptorSet* lighting_pass_descriptor_set[2];
@@ -215,6 +285,14 @@ void InitRenderer(Renderer* r, uint32_t window_width, uint32_t window_height);
 
 void DeinitRenderer(Renderer* r);
 
-void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube);
+// `env_filepath` is the HDR file that `tex_env_cube` was loaded from. The maps generated from it are cached in "<env_filepath>.ibl".
+void HotreloadShaders(Renderer* r, GPU_Texture* tex_env_cube, STR_View env_filepath);
+
+// Binds the textures of `part` and the buffers of `object` for the sun depth, voxelize and geometry passes. Each part has its own,
+// unless it shares the one of the previous part (see RenderObjectPart::shares_descriptor_set).
+GPU_DescriptorSet* MakeRenderObjectPartDescriptorSet(Renderer* r, const RenderObject* object, const RenderObjectPart* part);
+
+// Returns false if the world-space AABB is fully outside one of the side planes of the frustum, or behind the camera.
+bool AABBIsInFrustum(HMM_Vec3 bounds_min, HMM_Vec3 bounds_max, const HMM_Mat4& clip_from_world);
 
 void BuildRenderCommands(Renderer* rs, GPU_Graph* graph, GPU_Texture* backbuffer, RenderObject* world, RenderObject* skybox, const Camera& camera, const RenderParameters& params);
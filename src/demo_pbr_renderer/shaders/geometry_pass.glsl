@@ -84,19 +84,46 @@ vec3 FresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness) {
 	return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
 }
 
+// See MeshPartConstants
 layout(push_constant) uniform Constants {
 	vec2 taa_jitter;
 	vec2 taa_jitter_prev;
+	vec4 position_min;
+	vec4 position_scale;
 } PC;
 
+// See MeshInstance
+struct MeshInstance {
+	mat4 world_from_local;
+	mat4 normal_from_local;
+};
+
 // TODO: do the same thing in fire_ui_shader!
 #ifdef GPU_STAGE_VERTEX
 	GPU_BINDING(GLOBALS) { Globals data; } GLOBALS;
+	GPU_BINDING(INSTANCES) { MeshInstance data[]; } INSTANCES;
 	
+#ifdef PACKED_VERTICES
+	// See PackedVertex
+	layout(location = 0) in uvec4 vs_position_and_tangent_sign;
+	layout(location = 1) in uvec4 vs_normal_and_tangent_oct;
+	layout(location = 2) in vec2 vs_tex_coord;
+	
+	vec3 OctahedralDecode(uvec2 encoded) {
+		vec2 f = vec2(encoded) * (2. / 65535.) - 1.;
+		vec3 n = vec3(f, 1. - abs(f.x) - abs(f.y));
+		float t = max(-n.z, 0.);
+		n.x += n.x >= 0. ? -t : t;
+		n.y += n.y >= 0. ? -t : t;
+		return normalize(n);
+	}
+#else
 	layout(location = 0) in vec3 vs_position;
 	layout(location = 1) in vec3 vs_normal;
 	layout(location = 2) in vec3 vs_tangent;
-	layout(location = 3) in vec2 vs_tex_coord;
+	layout(location = 3) in float vs_tangent_sign;
+	layout(location = 4) in vec2 vs_tex_coord;
+#endif
 	
 	layout(location = 0) out vec3 fs_position;
 	layout(location = 1) out vec3 fs_normal;
@@ -106,18 +133,27 @@ layout(push_constant) uniform Constants {
 	layout(location = 5) out vec4 fs_position_cs_old;
 	
 	void main() {
-		vec4 position_clip = GLOBALS.data.clip_space_from_world * vec4(vs_position, 1.);
+#ifdef PACKED_VERTICES
+		vec3 vs_position = PC.position_min.xyz + vec3(vs_position_and_tangent_sign.xyz) * PC.position_scale.xyz;
+		vec3 vs_normal = OctahedralDecode(vs_normal_and_tangent_oct.xy);
+		vec3 vs_tangent = OctahedralDecode(vs_normal_and_tangent_oct.zw);
+		// The tangent sign (vs_position_and_tangent_sign.w) isn't needed, as the bitangent is derived in the fragment shader.
+#endif
+		MeshInstance instance = INSTANCES.data[gl_InstanceIndex];
+		vec3 position = (instance.world_from_local * vec4(vs_position, 1.)).xyz;
+		
+		vec4 position_clip = GLOBALS.data.clip_space_from_world * vec4(position, 1.);
 		position_clip.xy += PC.taa_jitter * position_clip.w;
 		
-		vec4 old_position_clip = GLOBALS.data.old_clip_space_from_world * vec4(vs_position, 1.);
+		vec4 old_position_clip = GLOBALS.data.old_clip_space_from_world * vec4(position, 1.);
 		old_position_clip.xy += PC.taa_jitter_prev * old_position_clip.w;
 		
 		fs_position_cs = position_clip;
 		fs_position_cs_old = old_position_clip;
 		
-		fs_position = vs_position;
-		fs_normal = vs_normal;
-		fs_tangent = vs_tangent;
+		fs_position = position;
+		fs_normal = normalize(mat3(instance.normal_from_local) * vs_normal);
+		fs_tangent = normalize(mat3(instance.world_from_local) * vs_tangent);
 		fs_tex_coord = vs_tex_coord;
 		gl_Position = position_clip;
 	}
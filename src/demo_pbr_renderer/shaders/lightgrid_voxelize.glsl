@@ -18,16 +18,73 @@ struct Globals {
 	uint visualize_light_grid;
 };
 
+// See MeshPartConstants
+layout(push_constant) uniform Constants {
+	vec2 taa_jitter;
+	vec2 taa_jitter_prev;
+	vec4 position_min;
+	vec4 position_scale;
+	uint first_index;
+	uint base_vertex;
+	uint index_type; // 0 = 32-bit, 1 = 16-bit
+} PC;
+
+// See MeshInstance
+struct MeshInstance {
+	mat4 world_from_local;
+	mat4 normal_from_local;
+};
+
 #ifdef GPU_STAGE_VERTEX
 	GPU_BINDING(GLOBALS) { Globals data; } GLOBALS;
+	GPU_BINDING(INSTANCES) { MeshInstance data[]; } INSTANCES;
 
+	GPU_BINDING(SSBO1) {
+		uint data[];
+	} INDEX_BUFFER;
+	
+	uint LoadIndex(uint i) {
+		if (PC.index_type == 1u) {
+			uint pair = INDEX_BUFFER.data[i >> 1u];
+			return ((i & 1u) == 0u ? pair & 0xFFFFu : pair >> 16u) + PC.base_vertex;
+		}
+		return INDEX_BUFFER.data[i] + PC.base_vertex;
+	}
+	
+#ifdef PACKED_VERTICES
+	// Vertex layout (see PackedVertex):
+	// uint16 position[3], uint16 tangent_sign, uint16 normal_oct[2], uint16 tangent_oct[2], float16 uv[2]
+	// total size: 5 dwords
+	GPU_BINDING(SSBO0) {
+		uint data[];
+	} VERTEX_BUFFER;
+	
+	vec3 LoadPosition(uint v) {
+		uint xy = VERTEX_BUFFER.data[v*5];
+		uint zw = VERTEX_BUFFER.data[v*5 + 1];
+		uvec3 quantized = uvec3(xy & 0xFFFFu, xy >> 16u, zw & 0xFFFFu);
+		return PC.position_min.xyz + vec3(quantized) * PC.position_scale.xyz;
+	}
+	
+	vec2 LoadTexCoord(uint v) {
+		return unpackHalf2x16(VERTEX_BUFFER.data[v*5 + 4]);
+	}
+#else
+	// Vertex layout:
+	// vec3 position, vec3 normal, vec3 tangent, float tangent_sign, vec2 uv
+	// total size: 12 dwords
 	GPU_BINDING(SSBO0) {
 		float data[];
 	} VERTEX_BUFFER;
 	
-	GPU_BINDING(SSBO1) {
-		uint data[];
-	} INDEX_BUFFER;
+	vec3 LoadPosition(uint v) {
+		return vec3(VERTEX_BUFFER.data[v*12], VERTEX_BUFFER.data[v*12 + 1], VERTEX_BUFFER.data[v*12 + 2]);
+	}
+	
+	vec2 LoadTexCoord(uint v) {
+		return vec2(VERTEX_BUFFER.data[v*12 + 10], VERTEX_BUFFER.data[v*12 + 11]);
+	}
+#endif
 	
 	layout(location = 0) out vec3 fs_position_ndc;
 	layout(location = 1) out vec3 fs_position_ws;
@@ -36,22 +93,20 @@ struct Globals {
 	
 	void main() {
 		uint this_vertex = gl_VertexIndex % 3;
-		uint base_idx = gl_VertexIndex - this_vertex;
-		uint v0 = INDEX_BUFFER.data[base_idx];
-		uint v1 = INDEX_BUFFER.data[base_idx+1];
-		uint v2 = INDEX_BUFFER.data[base_idx+2];
+		uint base_idx = PC.first_index + gl_VertexIndex - this_vertex;
+		uint v0 = LoadIndex(base_idx);
+		uint v1 = LoadIndex(base_idx+1);
+		uint v2 = LoadIndex(base_idx+2);
 		
 		// We need to access the neighbouring index.
-		// Vertex layout:
-		// vec3 position, vec3 normal, vec3 tangent, vec2 uv
-		// total size: 11 dwords
+		mat4 world_from_local = INSTANCES.data[gl_InstanceIndex].world_from_local;
 		vec3 positions[3] = {
-			vec3(VERTEX_BUFFER.data[v0*11], VERTEX_BUFFER.data[v0*11 + 1], VERTEX_BUFFER.data[v0*11 + 2]),
-			vec3(VERTEX_BUFFER.data[v1*11], VERTEX_BUFFER.data[v1*11 + 1], VERTEX_BUFFER.data[v1*11 + 2]),
-			vec3(VERTEX_BUFFER.data[v2*11], VERTEX_BUFFER.data[v2*11 + 1], VERTEX_BUFFER.data[v2*11 + 2]),
+			(world_from_local * vec4(LoadPosition(v0), 1.)).xyz,
+			(world_from_local * vec4(LoadPosition(v1), 1.)).xyz,
+			(world_from_local * vec4(LoadPosition(v2), 1.)).xyz
 		};
 		
-		vec2 tex_coord = vec2(VERTEX_BUFFER.data[(base_idx+this_vertex)*11 + 9], VERTEX_BUFFER.data[(base_idx+this_vertex)*11 + 10]);
+		vec2 tex_coord = LoadTexCoord(this_vertex == 0 ? v0 : this_vertex == 1 ? v1 : v2);
 		
 		vec3 tri_normal = cross(positions[1] - positions[0], positions[2] - positions[0]);
 		vec3 tri_normal_abs = abs(tri_normal);
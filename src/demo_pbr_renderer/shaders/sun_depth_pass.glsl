@@ -17,18 +17,45 @@ struct Globals {
 #define PI 3.14159265358979323846
 #define GOLDEN_RATIO 1.61803398875
 
+// See MeshPartConstants
+layout(push_constant) uniform Constants {
+	vec2 taa_jitter;
+	vec2 taa_jitter_prev;
+	vec4 position_min;
+	vec4 position_scale;
+} PC;
+
+// See MeshInstance
+struct MeshInstance {
+	mat4 world_from_local;
+	mat4 normal_from_local;
+};
+
 #ifdef GPU_STAGE_VERTEX
 	GPU_BINDING(GLOBALS) {
 		Globals data;
 	} GLOBALS;
 	
+	GPU_BINDING(INSTANCES) {
+		MeshInstance data[];
+	} INSTANCES;
+	
+#ifdef PACKED_VERTICES
+	layout (location = 0) in uvec4 vs_position_and_tangent_sign;
+#else
 	layout (location = 0) in vec3 vs_position;
 	layout (location = 1) in vec3 vs_normal;
 	layout (location = 2) in vec3 vs_tangent;
-	layout (location = 3) in vec2 vs_tex_coord;
+	layout (location = 3) in float vs_tangent_sign;
+	layout (location = 4) in vec2 vs_tex_coord;
+#endif
 	
 	void main() {
-		gl_Position = GLOBALS.data.sun_space_from_world * vec4(vs_position, 1.);
+#ifdef PACKED_VERTICES
+		vec3 vs_position = PC.position_min.xyz + vec3(vs_position_and_tangent_sign.xyz) * PC.position_scale.xyz;
+#endif
+		vec4 position = INSTANCES.data[gl_InstanceIndex].world_from_local * vec4(vs_position, 1.);
+		gl_Position = GLOBALS.data.sun_space_from_world * position;
 	}
 #else
 	void main() {}
@@ -0,0 +1,446 @@
+#include "common.h"
+#include "render.h"
+#include "os_utils.h"
+#include "texture_streaming.h"
+
+#include <stdlib.h> // qsort
+#include <math.h> // log2f
+
+// The fire_os_sync functions are static, so this file gets its own copy of them.
+#define FIRE_OS_SYNC_IMPLEMENTATION
+#include "fire/fire_os_sync.h"
+
+extern DS_Arena* TEMP; // Arena for per-frame, temporary allocations
+
+#define TEXTURE_STREAMING_MAX_REQUESTS 8 // Reads and uploads in flight at once, including evictions
+#define TEXTURE_STREAMING_FRAMES_IN_FLIGHT 2 // Replaced textures and descriptor sets are destroyed this many updates later
+
+enum StreamState {
+	StreamState_Idle,
+	StreamState_Reading, // queued for or being read by the streaming thread
+	StreamState_ReadDone, // set by the streaming thread
+	StreamState_Uploading, // copied into `new_texture` by the GPU layer's upload graph, see upload_ticket
+};
+
+struct StreamedTexture {
+	GPU_Texture* texture;
+	StreamedTextureSource source;
+	uint32_t tail_mip;
+	uint32_t resident_first_mip;
+	uint32_t wanted_first_mip; // finest mip needed by the visible parts this frame
+	uint64_t last_used_frame;
+	bool failed; // reading the file failed, so don't try again
+	bool swapped; // replaced this update, so the descriptor sets using it must be recreated
+
+	// The current request. While it's being read, `state` is protected by the mutex and the rest belongs to the streaming thread.
+	StreamState state;
+	bool read_ok;
+	uint32_t request_first_mip;
+	GPU_Texture* new_texture;
+	GPU_Buffer* staging_buffer;
+	GPU_UploadTicket upload_ticket;
+};
+
+// Things that may still be used by a frame in flight. Either one may be NULL.
+struct RetiredResource {
+	GPU_Texture* texture;
+	GPU_DescriptorSet* descriptor_set;
+	uint64_t retired_frame;
+};
+
+struct TextureStreaming {
+	bool enabled;
+	uint64_t vram_budget;
+	uint64_t frame;
+
+	DS_DynArray<StreamedTexture*> textures;
+	DS_Map(GPU_Texture*, StreamedTexture*) streamed_from_texture;
+	DS_DynArray<RetiredResource> retired;
+
+	// Shared with the streaming thread
+	OS_SYNC_Thread thread;
+	OS_SYNC_Mutex mutex;
+	OS_SYNC_ConditionVar wake_thread; // signaled when a read is queued, or when the thread should quit
+	OS_SYNC_ConditionVar read_finished;
+	DS_DynArray<StreamedTexture*> read_queue;
+	bool quit;
+};
+
+static TextureStreaming TEXTURE_STREAMING;
+
+static uint64_t GetMipChainSize(const StreamedTextureSource* source, uint32_t first_mip) {
+	uint64_t size = 0;
+	for (uint32_t mip = first_mip; mip < source->mip_level_count; mip++) size += source->mip_sizes[mip];
+	return size;
+}
+
+static void StreamingThreadRun(void* user_data) {
+	TextureStreaming* s = &TEXTURE_STREAMING;
+	DS_Arena arena; // for the filepath conversion in OS_ReadFileRange
+	DS_ArenaInit(&arena, DS_KIB(4), DS_HEAP);
+
+	OS_SYNC_MutexLock(&s->mutex);
+	for (;;) {
+		while (s->read_queue.count == 0 && !s->quit) {
+			OS_SYNC_ConditionVarWait(&s->wake_thread, &s->mutex);
+		}
+		if (s->quit) break;
+
+		StreamedTexture* st = s->read_queue[0];
+		DS_ArrRemove(&s->read_queue, 0);
+		OS_SYNC_MutexUnlock(&s->mutex);
+
+		// The mips of a DDS file are contiguous, so the whole requested chain is a single read straight into the staging buffer.
+		const StreamedTextureSource* source = &st->source;
+		uint64_t offset = source->mip_offsets[st->request_first_mip];
+		uint64_t size = GetMipChainSize(source, st->request_first_mip);
+		bool ok;
+		if (source->mapped_data.size > 0) {
+			ok = offset + size <= source->mapped_data.size;
+			if (ok) memcpy(st->staging_buffer->data, source->mapped_data.data + offset, size);
+		}
+		else {
+			ok = OS_ReadFileRange(&arena, source->filepath, offset, size, st->staging_buffer->data) == size;
+			DS_ArenaReset(&arena);
+		}
+
+		OS_SYNC_MutexLock(&s->mutex);
+		st->read_ok = ok;
+		st->state = StreamState_ReadDone;
+		OS_SYNC_ConditionVarBroadcast(&s->read_finished);
+	}
+	OS_SYNC_MutexUnlock(&s->mutex);
+
+	DS_ArenaDeinit(&arena);
+}
+
+void InitTextureStreaming(uint64_t vram_budget) {
+	TextureStreaming* s = &TEXTURE_STREAMING;
+	assert(!s->enabled);
+	*s = {};
+	s->enabled = true;
+	s->vram_budget = vram_budget;
+	DS_ArrInit(&s->textures, DS_HEAP);
+	DS_MapInit(&s->streamed_from_texture, DS_HEAP);
+	DS_ArrInit(&s->retired, DS_HEAP);
+	DS_ArrInit(&s->read_queue, DS_HEAP);
+
+	OS_SYNC_MutexInit(&s->mutex);
+	OS_SYNC_ConditionVarInit(&s->wake_thread);
+	OS_SYNC_ConditionVarInit(&s->read_finished);
+	OS_SYNC_ThreadStart(&s->thread, StreamingThreadRun, NULL, "Texture streaming");
+}
+
+void DeinitTextureStreaming() {
+	TextureStreaming* s = &TEXTURE_STREAMING;
+	if (!s->enabled) return;
+	assert(s->textures.count == 0); // all meshes must have been unloaded
+
+	OS_SYNC_MutexLock(&s->mutex);
+	s->quit = true;
+	OS_SYNC_ConditionVarBroadcast(&s->wake_thread);
+	OS_SYNC_MutexUnlock(&s->mutex);
+	OS_SYNC_ThreadJoin(&s->thread);
+
+	for (int i = 0; i < s->retired.count; i++) {
+		GPU_DestroyTexture(s->retired[i].texture);
+		if (s->retired[i].descriptor_set) GPU_DestroyDescriptorSet(s->retired[i].descriptor_set);
+	}
+
+	OS_SYNC_ConditionVarDestroy(&s->read_finished);
+	OS_SYNC_ConditionVarDestroy(&s->wake_thread);
+	OS_SYNC_MutexDestroy(&s->mutex);
+	DS_ArrDeinit(&s->read_queue);
+	DS_ArrDeinit(&s->retired);
+	DS_MapDeinit(&s->streamed_from_texture);
+	DS_ArrDeinit(&s->textures);
+	*s = {};
+}
+
+bool TextureStreamingIsEnabled() {
+	return TEXTURE_STREAMING.enabled;
+}
+
+uint32_t GetTextureStreamingTailMip(uint32_t width, uint32_t height, uint32_t mip_level_count) {
+	uint32_t mip = 0;
+	while (mip + 1 < mip_level_count && ((width >> mip) > TEXTURE_STREAMING_TAIL_SIZE || (height >> mip) > TEXTURE_STREAMING_TAIL_SIZE)) mip++;
+	return mip;
+}
+
+void RegisterStreamedTexture(GPU_Texture* texture, const StreamedTextureSource* source, uint32_t resident_first_mip) {
+	TextureStreaming* s = &TEXTURE_STREAMING;
+	assert(s->enabled && source->mip_level_count <= TEXTURE_STREAMING_MAX_MIPS);
+
+	StreamedTexture* st = (StreamedTexture*)DS_MemAlloc(DS_HEAP, sizeof(StreamedTexture));
+	*st = {};
+	st->texture = texture;
+	st->source = *source;
+	st->tail_mip = GetTextureStreamingTailMip(source->width, source->height, source->mip_level_count);
+	st->resident_first_mip = resident_first_mip;
+	st->wanted_first_mip = resident_first_mip;
+
+	if (source->filepath.size > 0) {
+		char* filepath = (char*)DS_MemAlloc(DS_HEAP, source->filepath.size);
+		memcpy(filepath, source->filepath.data, source->filepath.size);
+		st->source.filepath = STR_View{filepath, source->filepath.size};
+	}
+
+	DS_ArrPush(&s->textures, st);
+	DS_MapInsert(&s->streamed_from_texture, texture, st);
+}
+
+void UnregisterStreamedTexture(GPU_Texture* texture) {
+	TextureStreaming* s = &TEXTURE_STREAMING;
+	if (!s->enabled) return;
+
+	StreamedTexture* st;
+	if (!DS_MapFind(&s->streamed_from_texture, texture, &st)) return;
+
+	// Cancel the read if it hasn't started yet, otherwise wait for it to finish
+	OS_SYNC_MutexLock(&s->mutex);
+	for (int i = 0; i < s->read_queue.count; i++) {
+		if (s->read_queue[i] == st) {
+			DS_ArrRemove(&s->read_queue, i);
+			st->state = StreamState_ReadDone;
+			break;
+		}
+	}
+	while (st->state == StreamState_Reading) {
+		OS_SYNC_ConditionVarWait(&s->read_finished, &s->mutex);
+	}
+	OS_SYNC_MutexUnlock(&s->mutex);
+
+	GPU_DestroyTexture(st->new_texture); // waits for the upload if it's still going
+	if (st->staging_buffer) GPU_DestroyBuffer(st->staging_buffer);
+
+	for (int i = 0; i < s->textures.count; i++) {
+		if (s->textures[i] == st) {
+			DS_ArrRemove(&s->textures, i);
+			break;
+		}
+	}
+	DS_MapRemove(&s->streamed_from_texture, texture);
+
+	if (st->source.filepath.size > 0) DS_MemFree(DS_HEAP, (void*)st->source.filepath.data);
+	DS_MemFree(DS_HEAP, st);
+}
+
+static StreamedTexture* FindStreamedTexture(GPU_Texture* texture) {
+	StreamedTexture* st = NULL;
+	if (texture) DS_MapFind(&TEXTURE_STREAMING.streamed_from_texture, texture, &st);
+	return st;
+}
+
+static void RetireResource(GPU_Texture* texture, GPU_DescriptorSet* descriptor_set) {
+	RetiredResource retired = {texture, descriptor_set, TEXTURE_STREAMING.frame};
+	DS_ArrPush(&TEXTURE_STREAMING.retired, retired);
+}
+
+static void RequestMips(StreamedTexture* st, uint32_t first_mip) {
+	TextureStreaming* s = &TEXTURE_STREAMING;
+	const StreamedTextureSource* source = &st->source;
+
+	uint32_t width = source->width >> first_mip;
+	uint32_t height = source->height >> first_mip;
+	st->new_texture = GPU_MakeTextureEx(source->format, width ? width : 1, height ? height : 1, 1, source->mip_level_count - first_mip, 0);
+	st->staging_buffer = GPU_MakeBuffer((uint32_t)GetMipChainSize(source, first_mip), GPU_BufferFlag_CPU, NULL);
+	st->request_first_mip = first_mip;
+
+	OS_SYNC_MutexLock(&s->mutex);
+	st->state = StreamState_Reading;
+	DS_ArrPush(&s->read_queue, st);
+	OS_SYNC_ConditionVarSignal(&s->wake_thread);
+	OS_SYNC_MutexUnlock(&s->mutex);
+}
+
+// Screen pixels per world unit at the point of the part's bounds closest to the camera, same as in SelectLODByProjectedError.
+static float GetPixelsPerUnit(const RenderObjectPart* part, const Camera& camera, float viewport_height) {
+	HMM_Vec3 closest_point;
+	for (int k = 0; k < 3; k++) {
+		float p = camera.lazy_pos.Elements[k];
+		closest_point.Elements[k] = p < part->bounds_min.Elements[k] ? part->bounds_min.Elements[k] : p > part->bounds_max.Elements[k] ? part->bounds_max.Elements[k] : p;
+	}
+	float distance = HMM_LenV3(HMM_SubV3(closest_point, camera.lazy_pos));
+	if (distance < camera.z_near) distance = camera.z_near;
+	return fabsf(camera.clip_from_view.Elements[1][1]) * 0.5f * viewport_height / distance;
+}
+
+// Finest first mip that the textures of `part` need. Sampling is one texel per pixel when the texels per world unit
+// (texture size * UV units per world unit) match the pixels per world unit, and every mip halves the texels.
+static void UpdateWantedMips(const RenderObjectPart* part, float pixels_per_unit) {
+	GPU_Texture* textures[] = {part->tex_base_color, part->tex_normal, part->tex_orm, part->tex_emissive};
+	for (int i = 0; i < 4; i++) {
+		StreamedTexture* st = FindStreamedTexture(textures[i]);
+		if (st == NULL) continue;
+		st->last_used_frame = TEXTURE_STREAMING.frame;
+		if (part->uv_density <= 0.f) continue; // No UV mapping to speak of, the mip tail will do
+
+		uint32_t size = st->source.width > st->source.height ? st->source.width : st->source.height;
+		float texels_per_pixel = (float)size * part->uv_density / pixels_per_unit;
+		uint32_t mip = texels_per_pixel > 1.f ? (uint32_t)log2f(texels_per_pixel) : 0;
+		if (mip < st->wanted_first_mip) st->wanted_first_mip = mip;
+	}
+}
+
+static bool PartUsesSwappedTexture(const RenderObjectPart* part) {
+	GPU_Texture* textures[] = {part->tex_base_color, part->tex_normal, part->tex_orm, part->tex_emissive};
+	for (int i = 0; i < 4; i++) {
+		StreamedTexture* st = FindStreamedTexture(textures[i]);
+		if (st && st->swapped) return true;
+	}
+	return false;
+}
+
+// Least recently used texture that isn't needed this frame and has mips above its tail to give back
+static StreamedTexture* FindEvictionCandidate() {
+	TextureStreaming* s = &TEXTURE_STREAMING;
+	StreamedTexture* result = NULL;
+	for (int i = 0; i < s->textures.count; i++) {
+		StreamedTexture* st = s->textures[i];
+		if (st->state != StreamState_Idle || st->last_used_frame == s->frame || st->resident_first_mip >= st->tail_mip) continue;
+		if (result == NULL || st->last_used_frame < result->last_used_frame) result = st;
+	}
+	return result;
+}
+
+static int CompareLoadCandidates(const void* a, const void* b) {
+	const StreamedTexture* st_a = *(const StreamedTexture**)a;
+	const StreamedTexture* st_b = *(const StreamedTexture**)b;
+	uint32_t missing_a = st_a->resident_first_mip - st_a->wanted_first_mip;
+	uint32_t missing_b = st_b->resident_first_mip - st_b->wanted_first_mip;
+	return missing_a > missing_b ? -1 : missing_a < missing_b ? 1 : 0;
+}
+
+void UpdateTextureStreaming(Renderer* renderer, RenderObject** objects, int object_count, const Camera& camera) {
+	TextureStreaming* s = &TEXTURE_STREAMING;
+	if (!s->enabled) return;
+	s->frame++;
+
+	// Destroy whatever was replaced long enough ago that no frame in flight can be using it anymore
+	for (int i = 0; i < s->retired.count;) {
+		RetiredResource* retired = &s->retired[i];
+		if (retired->retired_frame + TEXTURE_STREAMING_FRAMES_IN_FLIGHT <= s->frame) {
+			GPU_DestroyTexture(retired->texture);
+			if (retired->descriptor_set) GPU_DestroyDescriptorSet(retired->descriptor_set);
+			DS_ArrRemove(&s->retired, i);
+		}
+		else i++;
+	}
+
+	// Swap in the textures whose uploads have finished. After the swap, `new_texture` holds the old mips.
+	bool any_swapped = false;
+	for (int i = 0; i < s->textures.count; i++) {
+		StreamedTexture* st = s->textures[i];
+		if (st->state != StreamState_Uploading || !GPU_UploadIsDone(st->upload_ticket)) continue;
+
+		GPU_SwapTextures(st->texture, st->new_texture);
+		RetireResource(st->new_texture, NULL);
+		GPU_DestroyBuffer(st->staging_buffer);
+		st->new_texture = NULL;
+		st->staging_buffer = NULL;
+		st->resident_first_mip = st->request_first_mip;
+		st->state = StreamState_Idle;
+		st->swapped = true;
+		any_swapped = true;
+	}
+
+	if (any_swapped) {
+		for (int i = 0; i < object_count; i++) {
+			for (int j = 0; j < objects[i]->parts.count; j++) {
+				RenderObjectPart* part = &objects[i]->parts[j];
+				if (part->shares_descriptor_set) {
+					part->descriptor_set = objects[i]->parts[j - 1].descriptor_set; // the previous part has the same textures
+					continue;
+				}
+				if (!PartUsesSwappedTexture(part)) continue;
+				RetireResource(NULL, part->descriptor_set);
+				part->descriptor_set = MakeRenderObjectPartDescriptorSet(renderer, objects[i], part);
+			}
+		}
+		for (int i = 0; i < s->textures.count; i++) s->textures[i]->swapped = false;
+	}
+
+	// Estimate the mips needed by the visible parts
+	for (int i = 0; i < s->textures.count; i++) {
+		s->textures[i]->wanted_first_mip = s->textures[i]->tail_mip;
+	}
+	for (int i = 0; i < object_count; i++) {
+		for (int j = 0; j < objects[i]->parts.count; j++) {
+			RenderObjectPart* part = &objects[i]->parts[j];
+			if (!AABBIsInFrustum(part->bounds_min, part->bounds_max, camera.clip_from_world)) continue;
+			UpdateWantedMips(part, GetPixelsPerUnit(part, camera, (float)renderer->window_height));
+		}
+	}
+
+	// Upload the finished reads. They go through the GPU layer's upload graph, which uses the transfer queue when there is one,
+	// so they don't hold up rendering. They're swapped in by a later update, once their tickets are done.
+	DS_DynArray<StreamedTexture*> read_done = {TEMP};
+	OS_SYNC_MutexLock(&s->mutex);
+	for (int i = 0; i < s->textures.count; i++) {
+		if (s->textures[i]->state == StreamState_ReadDone) DS_ArrPush(&read_done, s->textures[i]);
+	}
+	OS_SYNC_MutexUnlock(&s->mutex);
+
+	for (int i = 0; i < read_done.count; i++) {
+		StreamedTexture* st = read_done[i];
+		if (!st->read_ok) {
+			GPU_DestroyTexture(st->new_texture);
+			GPU_DestroyBuffer(st->staging_buffer);
+			st->new_texture = NULL;
+			st->staging_buffer = NULL;
+			st->state = StreamState_Idle;
+			st->failed = true;
+			continue;
+		}
+
+		uint32_t region_count = st->source.mip_level_count - st->request_first_mip;
+		GPU_TextureCopyRegion* regions = (GPU_TextureCopyRegion*)DS_ArenaPush(TEMP, region_count * sizeof(GPU_TextureCopyRegion));
+		for (uint32_t j = 0; j < region_count; j++) {
+			uint32_t mip = st->request_first_mip + j;
+			GPU_TextureCopyRegion region = {(uint32_t)(st->source.mip_offsets[mip] - st->source.mip_offsets[st->request_first_mip]), 0, j};
+			regions[j] = region;
+		}
+		st->upload_ticket = GPU_CopyBufferToTextureAsync(st->staging_buffer, st->new_texture, regions, region_count);
+		st->state = StreamState_Uploading;
+	}
+	if (read_done.count > 0) GPU_FlushUploads();
+
+	// Request the missing mips, most missing first. Requests count towards the budget from the moment they're made.
+	uint64_t committed = 0;
+	uint32_t in_flight = 0;
+	DS_DynArray<StreamedTexture*> candidates = {TEMP};
+	for (int i = 0; i < s->textures.count; i++) {
+		StreamedTexture* st = s->textures[i];
+		if (st->state == StreamState_Idle) {
+			committed += GetMipChainSize(&st->source, st->resident_first_mip);
+			if (!st->failed && st->wanted_first_mip < st->resident_first_mip) DS_ArrPush(&candidates, st);
+		}
+		else {
+			committed += GetMipChainSize(&st->source, st->request_first_mip);
+			in_flight++;
+		}
+	}
+	qsort(candidates.data, candidates.count, sizeof(StreamedTexture*), CompareLoadCandidates);
+
+	for (int i = 0; i < candidates.count && in_flight < TEXTURE_STREAMING_MAX_REQUESTS; i++) {
+		StreamedTexture* st = candidates[i];
+		uint64_t resident_size = GetMipChainSize(&st->source, st->resident_first_mip);
+
+		// Make room by dropping the least recently used textures back to their tail. If that's not enough, settle for coarser mips.
+		uint32_t first_mip = st->wanted_first_mip;
+		while (first_mip < st->resident_first_mip && committed - resident_size + GetMipChainSize(&st->source, first_mip) > s->vram_budget) {
+			StreamedTexture* evicted = in_flight + 1 < TEXTURE_STREAMING_MAX_REQUESTS ? FindEvictionCandidate() : NULL;
+			if (evicted) {
+				committed -= GetMipChainSize(&evicted->source, evicted->resident_first_mip) - GetMipChainSize(&evicted->source, evicted->tail_mip);
+				RequestMips(evicted, evicted->tail_mip);
+				in_flight++;
+			}
+			else first_mip++;
+		}
+		if (first_mip == st->resident_first_mip) continue;
+
+		committed += GetMipChainSize(&st->source, first_mip) - resident_size;
+		RequestMips(st, first_mip);
+		in_flight++;
+	}
+}
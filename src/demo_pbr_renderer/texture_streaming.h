@@ -0,0 +1,44 @@
+// Texture streaming
+//
+// Streamed textures are created with only their mip tail resident, i.e. the mips that are at most TEXTURE_STREAMING_TAIL_SIZE
+// texels wide and high. Every frame, UpdateTextureStreaming estimates the finest mip each texture needs from the parts that
+// use it, and a background thread reads the missing mips from disk. Once read, a texture is replaced by a new one with the
+// finer mip chain (see GPU_SwapTextures), so the GPU_Texture* pointers held by parts and the texture cache stay valid.
+// When the resident mips would go over the VRAM budget, the least recently used textures drop back to their mip tail.
+//
+// Only non-cubemap DDS files with a mip chain are streamed, everything else is loaded in full by LoadMesh.
+
+#define TEXTURE_STREAMING_TAIL_SIZE 64
+#define TEXTURE_STREAMING_MAX_MIPS 16
+
+// Where the mips of a streamed texture live. Each mip of a DDS file is stored contiguously, from the finest to the coarsest.
+struct StreamedTextureSource {
+	STR_View filepath; // the mips are read from this file when `mapped_data` is empty
+	STR_View mapped_data; // the whole file, if it's in the open asset archive
+	GPU_Format format;
+	uint32_t width; // of mip 0
+	uint32_t height;
+	uint32_t mip_level_count;
+	uint64_t mip_offsets[TEXTURE_STREAMING_MAX_MIPS]; // from the start of the file
+	uint64_t mip_sizes[TEXTURE_STREAMING_MAX_MIPS];
+};
+
+// Must be called before LoadMesh to have its textures streamed. `vram_budget` is the maximum number of bytes that the resident
+// mips of all streamed textures may use. The mip tails are always resident, even if they alone go over the budget.
+void InitTextureStreaming(uint64_t vram_budget);
+void DeinitTextureStreaming(); // all meshes must have been unloaded
+
+bool TextureStreamingIsEnabled();
+
+// Returns the first mip of the mip tail, clamped to the mips that exist.
+uint32_t GetTextureStreamingTailMip(uint32_t width, uint32_t height, uint32_t mip_level_count);
+
+// `texture` holds the mips of `source` starting from `resident_first_mip`. The source file path is copied.
+void RegisterStreamedTexture(GPU_Texture* texture, const StreamedTextureSource* source, uint32_t resident_first_mip);
+
+// Does nothing if `texture` isn't streamed. Must be called before the texture is destroyed.
+void UnregisterStreamedTexture(GPU_Texture* texture);
+
+// Call once per frame, after waiting on the frame's graph and before building its commands. Every loaded object must be passed,
+// since the descriptor sets of the parts using a texture are recreated when the texture is replaced.
+void UpdateTextureStreaming(Renderer* renderer, RenderObject** objects, int object_count, const Camera& camera);
@@ -97,7 +97,7 @@ int main() {
 			GPU_OpBeginRenderPass(graph);
 			
 			GPU_OpBindDrawParams(graph, draw_params);
-			GPU_OpBindIndexBuffer(graph, index_buffer);
+			GPU_OpBindIndexBuffer(graph, index_buffer, GPU_IndexType_U32);
 			GPU_OpBindVertexBuffer(graph, vertex_buffer);
 			GPU_OpDraw(graph, 3, 1, 0, 0);
 			
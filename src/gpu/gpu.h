@@ -45,8 +45,8 @@ typedef struct GPU_FormatInfo {
 	const char* glsl; // glsl image format qualifier
 } GPU_FormatInfo;
 
-// TODO: API to ask for what is supported by the driver
-// Different formats support different rendering features. See GPU_GetFormatInfo() to check for feature support per format.
+// Different formats support different rendering features. See GPU_GetFormatInfo() to check for feature support per format,
+// and GPU_FormatSupportsUploadAndSampling() for formats that the driver doesn't have to support.
 // Or alternatively, https://docs.vulkan.org/spec/latest/chapters/formats.html#features-required-format-support
 typedef enum GPU_Format {
 	GPU_Format_Invalid,
@@ -66,6 +66,7 @@ typedef enum GPU_Format {
 	GPU_Format_RG32F,
 	GPU_Format_RGB32F,
 	GPU_Format_RGBA32F,
+	GPU_Format_RGB9E5, // Unsigned, with a 5-bit exponent shared by the three 9-bit mantissas. Can only be sampled.
 
 	// Unsigned integer formats (I), no range limit.
 	GPU_Format_R8I,
@@ -91,6 +92,7 @@ typedef enum GPU_Format {
 	GPU_Format_BC1_RGBA_UN,
 	GPU_Format_BC3_RGBA_UN,
 	GPU_Format_BC5_UN,
+	GPU_Format_BC7_RGBA_UN,
 } GPU_Format;
 
 #define GPU_FORMAT_INFO(BLOCK_EXTENT, BLOCK_SIZE, SAMPLED, VERTEX_INPUT, COLOR_TARGET, DEPTH_TARGET, STENCIL_TARGET, IS_INT, GLSL) \
@@ -118,6 +120,7 @@ static GPU_FormatInfo GPU_GetFormatInfo(GPU_Format format) {
 	case GPU_Format_RG32F:               return GPU_FORMAT_INFO(1,  8, 1, 1, 1, 0, 0, 0, "rg32f");
 	case GPU_Format_RGB32F:              return GPU_FORMAT_INFO(1, 12, 0, 1, 0, 0, 0, 0, NULL);
 	case GPU_Format_RGBA32F:             return GPU_FORMAT_INFO(1, 16, 1, 1, 1, 0, 0, 0, "rgba32f");
+	case GPU_Format_RGB9E5:              return GPU_FORMAT_INFO(1,  4, 1, 0, 0, 0, 0, 0, NULL);
 	case GPU_Format_R8I:                 return GPU_FORMAT_INFO(1,  1, 1, 1, 1, 0, 0, 1, "r8ui");
 	case GPU_Format_R16I:                return GPU_FORMAT_INFO(1,  2, 1, 1, 1, 0, 0, 1, "r16ui");
 	case GPU_Format_RG16I:               return GPU_FORMAT_INFO(1,  4, 1, 1, 1, 0, 0, 1, "rg16ui");
@@ -138,6 +141,7 @@ static GPU_FormatInfo GPU_GetFormatInfo(GPU_Format format) {
 	case GPU_Format_BC1_RGBA_UN:         return GPU_FORMAT_INFO(4,  8, 1, 0, 0, 0, 0, 0, NULL);
 	case GPU_Format_BC3_RGBA_UN:         return GPU_FORMAT_INFO(4, 16, 1, 0, 0, 0, 0, 0, NULL);
 	case GPU_Format_BC5_UN:              return GPU_FORMAT_INFO(4, 16, 1, 0, 0, 0, 0, 0, NULL);
+	case GPU_Format_BC7_RGBA_UN:         return GPU_FORMAT_INFO(4, 16, 1, 0, 0, 0, 0, 0, NULL);
 	case GPU_Format_Invalid: break;
 	}
 	return GPU_FORMAT_INFO(0, 0, 0, 0, 0, 0, 0, 0, NULL);
@@ -151,6 +155,11 @@ typedef enum GPU_ShaderStage {
 	GPU_ShaderStage_Compute,
 } GPU_ShaderStage;
 
+typedef enum GPU_IndexType {
+	GPU_IndexType_U32,
+	GPU_IndexType_U16,
+} GPU_IndexType;
+
 typedef enum GPU_CullMode {
 	GPU_CullMode_TwoSided,
 	GPU_CullMode_DrawCW, // Draw only clockwise triangles
@@ -170,6 +179,7 @@ typedef enum GPU_BufferFlag {
 	GPU_BufferFlag_CPU = 1 << 0,
 	GPU_BufferFlag_GPU = 1 << 1,
 	GPU_BufferFlag_StorageBuffer = 1 << 2,
+	GPU_BufferFlag_ComputeShared = 1 << 3, // The buffer may be used by graphs made with GPU_MakeComputeGraph
 } GPU_BufferFlag;
 
 typedef int GPU_TextureFlags;
@@ -182,7 +192,8 @@ typedef enum GPU_TextureFlag {
 	GPU_TextureFlag_MSAA4x = 1 << 5,
 	GPU_TextureFlag_MSAA8x = 1 << 6,
 	GPU_TextureFlag_PerMipBinding = 1 << 7,
-	GPU_TextureFlag_SwapchainTarget = 1 << 8, // For internal use only
+	GPU_TextureFlag_ComputeShared = 1 << 8, // The texture may be used by graphs made with GPU_MakeComputeGraph
+	GPU_TextureFlag_SwapchainTarget = 1 << 9, // For internal use only
 } GPU_TextureFlag;
 
 typedef struct GPU_Texture {
@@ -204,6 +215,16 @@ typedef struct GPU_TextureView {
 	uint32_t mip_level;
 } GPU_TextureView;
 
+// Identifies an upload started by one of the *Async functions, see GPU_UploadIsDone. 0 is an upload that has already finished.
+typedef uint64_t GPU_UploadTicket;
+
+// Space in the staging ring, see GPU_AllocateStaging
+typedef struct GPU_StagingAllocation {
+	GPU_Buffer* buffer; // the ring buffer, use this as the source of the copy
+	uint32_t offset; // in `buffer`
+	void* data; // write the data to upload here
+} GPU_StagingAllocation;
+
 #define GPU_SWAPCHAIN_COLOR_TARGET ((GPU_TextureView*)-1)
 
 typedef struct GPU_RenderPassDesc {
@@ -326,6 +347,12 @@ typedef struct GPU_OpBlitInfo {
 	GPU_Offset3D dst_area[2];
 } GPU_OpBlitInfo;
 
+typedef struct GPU_TextureCopyRegion {
+	uint32_t src_offset; // must be a multiple of 4 and of the texel block size
+	uint32_t dst_layer;
+	uint32_t dst_mip_level;
+} GPU_TextureCopyRegion;
+
 typedef struct GPU_GLSLError {
 	GPU_ShaderStage shader_stage;
 	uint32_t line;
@@ -407,17 +434,53 @@ GPU_API void GPU_DestroyDescriptorSet(GPU_DescriptorSet* set);
 
 // ------------------------------------------------------------------------------
 
-// If `data` is non-NULL, the texture data will be uploaded immediately, and mipmaps will be generated if `HasMipmaps` is provided. The function will wait
-// for the GPU to finish before returning. If the texture is a cubemap, the provided data must contain all 6 cubemap faces tightly packed together.
-// NOTE: You probably shouldn't use the `data` parameter at all, but rather use GPU_OpCopyBufferToTexture on your own graph to reduce unnecessary idling.
+// If `data` is non-NULL, the upload is recorded into the internal upload graph through the staging ring, and mipmaps will be generated if `HasMipmaps`
+// is provided. The upload is submitted as soon as any other graph records or submits something, so the texture can be used right away without
+// waiting for it. If the texture is a cubemap, the provided data must contain all 6 cubemap faces tightly packed together.
 GPU_API GPU_Texture* GPU_MakeTexture(GPU_Format format, uint32_t width, uint32_t height, uint32_t depth, GPU_TextureFlags flags, const void* data);
 
+// Same as GPU_MakeTexture, but also returns a ticket for the upload, for when the CPU needs to know that it has finished.
+// Graphs don't need to wait for the ticket, since they're always ordered after the uploads that were started before them.
+// * `out_ticket` is set to 0 if there was nothing to upload, or if the data was too big for the staging ring and got uploaded right away.
+GPU_API GPU_Texture* GPU_MakeTextureAsync(GPU_Format format, uint32_t width, uint32_t height, uint32_t depth, GPU_TextureFlags flags, const void* data, GPU_UploadTicket* out_ticket);
+
+// Uploads `data` into an existing texture through the upload graph, the same way as GPU_MakeTextureAsync. Useful when the mip chain is
+// already in `data`, e.g. from a DDS file. The region offsets are relative to `data`. If the texture has GPU_TextureFlag_HasMipmaps,
+// the rest of the mip chain is generated from mip 0 afterwards.
+// * `texture` must not have been used by any graph yet, since the upload may run on a transfer queue that takes the texture over as is.
+GPU_API GPU_UploadTicket GPU_UploadTextureAsync(GPU_Texture* texture, const void* data, uint32_t data_size, const GPU_TextureCopyRegion* regions, uint32_t region_count);
+
+// Same as GPU_UploadTextureAsync, but copies from a buffer that already holds the data, e.g. one that was filled on another thread.
+// The region offsets are relative to the start of `src`.
+// * `src` must be CPU-accessible and must be kept alive until the upload is done.
+GPU_API GPU_UploadTicket GPU_CopyBufferToTextureAsync(GPU_Buffer* src, GPU_Texture* dst, const GPU_TextureCopyRegion* regions, uint32_t region_count);
+
+// Same as GPU_MakeTexture without `data`, but lets you pick the number of mip levels. This is useful when the mip chain comes
+// from a file and doesn't go all the way down to 1x1.
+// * `mip_level_count` may be 0, in which case it's decided by GPU_TextureFlag_HasMipmaps the same way as in GPU_MakeTexture.
+GPU_API GPU_Texture* GPU_MakeTextureEx(GPU_Format format, uint32_t width, uint32_t height, uint32_t depth, uint32_t mip_level_count, GPU_TextureFlags flags);
+
+// If an upload to the texture hasn't finished yet, this waits for it first.
 // * `texture` may be NULL
 GPU_API void GPU_DestroyTexture(GPU_Texture* texture);
 
+// Swaps the contents of two textures, so that every GPU_Texture* pointing to `a` now refers to the image of `b` and vice versa.
+// This is useful for replacing a texture with a new version (e.g. more mips resident) without having to patch up every pointer to it.
+// NOTE: Descriptor sets capture image views when they're finalized, so any descriptor set referencing either texture must be recreated.
+GPU_API void GPU_SwapTextures(GPU_Texture* a, GPU_Texture* b);
+
+// Returns true if textures of `format` can be both uploaded to (transfer dst) and sampled with linear filtering on this device.
+GPU_API bool GPU_FormatSupportsUploadAndSampling(GPU_Format format);
+
+// If `data` is non-NULL and the buffer isn't CPU-accessible, the upload goes through the internal upload graph the same way as in GPU_MakeTexture.
 // * `data` may be NULL
 GPU_API GPU_Buffer* GPU_MakeBuffer(uint32_t size, GPU_BufferFlags flags, const void* data);
 
+// Same as GPU_MakeBuffer, but returns a ticket for the upload, see GPU_MakeTextureAsync. CPU-accessible buffers are written to directly,
+// so their ticket is always 0.
+GPU_API GPU_Buffer* GPU_MakeBufferAsync(uint32_t size, GPU_BufferFlags flags, const void* data, GPU_UploadTicket* out_ticket);
+
+// If an upload to or from the buffer hasn't finished yet, this waits for it first.
 // * `buffer` may be NULL
 GPU_API void GPU_DestroyBuffer(GPU_Buffer* buffer);
 
@@ -459,10 +522,53 @@ GPU_API void GPU_MakeSwapchainGraphs(uint32_t count, GPU_Graph** out_graphs);
 // * NULL is returned if the window is minimized.
 GPU_API GPU_Texture* GPU_GetBackbuffer(GPU_Graph* graph);
 
+// Makes a graph for compute work that doesn't depend on the rendering around it. If the device has a compute queue family
+// without graphics, the graph runs on that queue and can overlap with the graphs on the graphics queue; otherwise it's an
+// ordinary graph. Use GPU_GraphDependsOn to order it against the other graphs.
+// * Only dispatches, clears and copies may be recorded into it, and no staging.
+// * It may only use textures made with GPU_TextureFlag_ComputeShared and buffers made with GPU_BufferFlag_ComputeShared or
+//   GPU_BufferFlag_CPU, since only those are shared between the queue families.
+GPU_API GPU_Graph* GPU_MakeComputeGraph(void);
+
+// Makes the next submit of `graph` wait on the GPU until the latest submit of `dependency` has finished. `dependency` may be
+// on another queue. Call this after submitting `dependency`; if it hasn't been submitted yet, this does nothing.
+GPU_API void GPU_GraphDependsOn(GPU_Graph* graph, GPU_Graph* dependency);
+
 GPU_API void GPU_WaitUntilIdle();
 
+// -- Staging ---------------------------------------------------
+
+#ifndef GPU_STAGING_RING_SIZE
+#define GPU_STAGING_RING_SIZE (64*1024*1024)
+#endif
+
+// All uploads go through one persistently mapped staging buffer of GPU_STAGING_RING_SIZE bytes. Space is handed out in order,
+// and reused once the GPU has finished the submission that reads from it.
+//
+// If the device has a transfer-only queue, the internal upload graph runs on it, so uploads made while rendering don't take time
+// away from the frame. The resources are then handed over to the graphics queue before any graph can use them.
+//
+// Reserves `size` bytes for copies that will be recorded into `graph`. The space is released once the next submit of `graph`
+// has finished on the GPU. If the ring is full, this waits for earlier submissions to finish. Returns false if the ring can't
+// make room until `graph` (or another graph with staged uploads) is submitted, or if `size` is bigger than the whole ring.
+// * `alignment` doesn't need to be a power of two; for texture copies, pass a multiple of 4 and the format's block size.
+GPU_API bool GPU_AllocateStaging(GPU_Graph* graph, uint32_t size, uint32_t alignment, GPU_StagingAllocation* out_allocation);
+
+// Submits the uploads recorded by GPU_MakeBuffer and GPU_MakeTexture, without waiting for them. This is done automatically
+// whenever another graph records or submits something, so you normally don't need to call this, unless you want the GPU to
+// start copying while the CPU does something else.
+GPU_API void GPU_FlushUploads(void);
+
+// Returns true once the GPU has finished the upload. If it hasn't been submitted yet, this submits it, so polling will eventually succeed.
+GPU_API bool GPU_UploadIsDone(GPU_UploadTicket ticket);
+
+// Blocks until the GPU has finished the upload. Tickets for older uploads are finished by then too.
+GPU_API void GPU_WaitForUpload(GPU_UploadTicket ticket);
+
 GPU_API void GPU_OpBindVertexBuffer(GPU_Graph* graph, GPU_Buffer* buffer);
-GPU_API void GPU_OpBindIndexBuffer(GPU_Graph* graph, GPU_Buffer* buffer);
+// `first_index` in GPU_OpDrawIndexed is counted in units of `index_type`, so a single buffer can hold both 16-bit and 32-bit
+// index ranges as long as each range is aligned to its own index size.
+GPU_API void GPU_OpBindIndexBuffer(GPU_Graph* graph, GPU_Buffer* buffer, GPU_IndexType index_type);
 
 GPU_API void GPU_OpBindComputePipeline(GPU_Graph* graph, GPU_ComputePipeline* pipeline);
 
@@ -478,6 +584,7 @@ GPU_API void GPU_OpEndRenderPass(GPU_Graph* graph);
 GPU_API void GPU_OpBindDrawParams(GPU_Graph* graph, uint32_t draw_params);
 
 GPU_API void GPU_OpDraw(GPU_Graph* graph, uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance);
+// * `vertex_offset` is added to each index before fetching the vertex. This lets you use 16-bit indices on big vertex buffers.
 GPU_API void GPU_OpDrawIndexed(GPU_Graph* graph, uint32_t index_count, uint32_t instance_count, uint32_t first_index, uint32_t vertex_offset, uint32_t first_instance);
 
 GPU_API void GPU_OpDispatch(GPU_Graph* graph, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z);
@@ -490,8 +597,20 @@ GPU_API void GPU_OpPushComputeConstants(GPU_Graph* graph, GPU_PipelineLayout* pi
 
 GPU_API void GPU_OpCopyBufferToBuffer(GPU_Graph* graph, GPU_Buffer* src, GPU_Buffer* dst, uint32_t dst_offset, uint32_t src_offset, uint32_t size);
 GPU_API void GPU_OpCopyBufferToTexture(GPU_Graph* graph, GPU_Buffer* src, GPU_Texture* dst, uint32_t dst_first_layer, uint32_t dst_layer_count, uint32_t dst_mip_level);
+
+// Same as GPU_OpCopyBufferToTexture, but reads the texel data starting at `src_offset`. This lets you pack many uploads into one staging buffer.
+// * `src_offset` must be a multiple of 4 and of the texel block size of `dst`
+GPU_API void GPU_OpCopyBufferToTextureEx(GPU_Graph* graph, GPU_Buffer* src, uint32_t src_offset, GPU_Texture* dst, uint32_t dst_first_layer, uint32_t dst_layer_count, uint32_t dst_mip_level);
+
+// Copy any number of (layer, mip level) subresources from `src` into `dst` with a single command. Each region is read tightly packed
+// from its own `src_offset`, so e.g. a whole DDS mip chain can be uploaded as is.
+GPU_API void GPU_OpCopyBufferToTextureRegions(GPU_Graph* graph, GPU_Buffer* src, GPU_Texture* dst, const GPU_TextureCopyRegion* regions, uint32_t region_count);
 GPU_API void GPU_OpCopyTextureToBuffer(GPU_Graph* graph, GPU_Texture* src, GPU_Buffer* dst);
 
+// The reverse of GPU_OpCopyBufferToTextureRegions, for reading back mip chains. Here, `src_offset` is where each (`dst_layer`, `dst_mip_level`)
+// subresource of `src` gets written to in `dst`.
+GPU_API void GPU_OpCopyTextureToBufferRegions(GPU_Graph* graph, GPU_Texture* src, GPU_Buffer* dst, const GPU_TextureCopyRegion* regions, uint32_t region_count);
+
 GPU_API void GPU_OpBlit(GPU_Graph* graph, const GPU_OpBlitInfo* info);
 GPU_API void GPU_OpGenerateMipmaps(GPU_Graph* graph, GPU_Texture* texture);
 
@@ -0,0 +1,315 @@
+#include "../Fire/fire_ds.h"
+#include "gpu_block_allocator.h"
+
+#ifndef GPU_ASSERT
+#define GPU_ASSERT(x) if (!(x)) __debugbreak()
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static uint32_t GPU_LowestSetBit32(uint32_t x) { unsigned long i; _BitScanForward(&i, x); return (uint32_t)i; }
+static uint32_t GPU_LowestSetBit64(uint64_t x) { unsigned long i; _BitScanForward64(&i, x); return (uint32_t)i; }
+static uint32_t GPU_HighestSetBit64(uint64_t x) { unsigned long i; _BitScanReverse64(&i, x); return (uint32_t)i; }
+#else
+static uint32_t GPU_LowestSetBit32(uint32_t x) { return (uint32_t)__builtin_ctz(x); }
+static uint32_t GPU_LowestSetBit64(uint64_t x) { return (uint32_t)__builtin_ctzll(x); }
+static uint32_t GPU_HighestSetBit64(uint64_t x) { return 63 - (uint32_t)__builtin_clzll(x); }
+#endif
+
+// Sizes below GPU_TLSF_SL_COUNT all go to the first row, one bucket per size. Above that, the row is the power of two and the
+// bucket is given by the next GPU_TLSF_SL_LOG2 bits below the highest set bit.
+static void GPU_TLSFMapping(uint64_t size, uint32_t* fl, uint32_t* sl) {
+	if (size < GPU_TLSF_SL_COUNT) {
+		*fl = 0;
+		*sl = (uint32_t)size;
+	}
+	else {
+		uint32_t log2 = GPU_HighestSetBit64(size);
+		*sl = (uint32_t)(size >> (log2 - GPU_TLSF_SL_LOG2)) - GPU_TLSF_SL_COUNT;
+		*fl = log2 - GPU_TLSF_SL_LOG2 + 1;
+	}
+}
+
+// Rounds the size up to the start of the next bucket, so that any range in the bucket it maps to is big enough for `size`.
+static uint64_t GPU_TLSFRoundUpSize(uint64_t size) {
+	if (size >= GPU_TLSF_SL_COUNT) {
+		uint64_t bucket_step = (uint64_t)1 << (GPU_HighestSetBit64(size) - GPU_TLSF_SL_LOG2);
+		size = (size + bucket_step - 1) & ~(bucket_step - 1);
+	}
+	return size;
+}
+
+static uint32_t GPU_TLSFFindFreeRange(GPU_BlockAllocator* allocator, uint64_t size) {
+	size = GPU_TLSFRoundUpSize(size);
+	uint32_t fl, sl;
+	GPU_TLSFMapping(size, &fl, &sl);
+	if (fl >= GPU_TLSF_FL_COUNT) return GPU_BLOCK_NIL;
+
+	uint32_t sl_bitmap = allocator->sl_bitmaps[fl] & (~0u << sl);
+	if (sl_bitmap == 0) {
+		uint64_t fl_bitmap = fl + 1 < 64 ? allocator->fl_bitmap & (~0ull << (fl + 1)) : 0;
+		if (fl_bitmap == 0) return GPU_BLOCK_NIL;
+
+		fl = GPU_LowestSetBit64(fl_bitmap);
+		sl_bitmap = allocator->sl_bitmaps[fl];
+	}
+	sl = GPU_LowestSetBit32(sl_bitmap);
+	return allocator->free_lists[fl][sl];
+}
+
+static void GPU_TLSFInsertFreeRange(GPU_BlockAllocator* allocator, uint32_t range_idx) {
+	GPU_BlockRange* range = DS_ArrGetPtr(allocator->ranges, range_idx);
+	uint32_t fl, sl;
+	GPU_TLSFMapping(range->size, &fl, &sl);
+
+	uint32_t head = allocator->free_lists[fl][sl];
+	range->is_free = true;
+	range->prev_free = GPU_BLOCK_NIL;
+	range->next_free = head;
+	if (head != GPU_BLOCK_NIL) DS_ArrGetPtr(allocator->ranges, head)->prev_free = range_idx;
+
+	allocator->free_lists[fl][sl] = range_idx;
+	allocator->fl_bitmap |= 1ull << fl;
+	allocator->sl_bitmaps[fl] |= 1u << sl;
+}
+
+static void GPU_TLSFRemoveFreeRange(GPU_BlockAllocator* allocator, uint32_t range_idx) {
+	GPU_BlockRange* range = DS_ArrGetPtr(allocator->ranges, range_idx);
+	GPU_ASSERT(range->is_free);
+	uint32_t fl, sl;
+	GPU_TLSFMapping(range->size, &fl, &sl);
+
+	if (range->prev_free != GPU_BLOCK_NIL) DS_ArrGetPtr(allocator->ranges, range->prev_free)->next_free = range->next_free;
+	else allocator->free_lists[fl][sl] = range->next_free;
+
+	if (range->next_free != GPU_BLOCK_NIL) DS_ArrGetPtr(allocator->ranges, range->next_free)->prev_free = range->prev_free;
+
+	if (allocator->free_lists[fl][sl] == GPU_BLOCK_NIL) {
+		allocator->sl_bitmaps[fl] &= ~(1u << sl);
+		if (allocator->sl_bitmaps[fl] == 0) allocator->fl_bitmap &= ~(1ull << fl);
+	}
+	range->is_free = false;
+}
+
+static uint32_t GPU_NewBlockRange(GPU_BlockAllocator* allocator) {
+	uint32_t range_idx = allocator->first_unused_range;
+	if (range_idx != GPU_BLOCK_NIL) {
+		allocator->first_unused_range = DS_ArrGet(allocator->ranges, range_idx).next_free;
+	}
+	else {
+		GPU_BlockRange range = {0};
+		range_idx = (uint32_t)allocator->ranges.count;
+		DS_ArrPush(&allocator->ranges, range);
+	}
+	return range_idx;
+}
+
+static void GPU_FreeBlockRange(GPU_BlockAllocator* allocator, uint32_t range_idx) {
+	DS_ArrGetPtr(allocator->ranges, range_idx)->next_free = allocator->first_unused_range;
+	allocator->first_unused_range = range_idx;
+}
+
+// Splits the range into [offset, offset + size) and a new range after it, and returns the new range.
+static uint32_t GPU_SplitBlockRange(GPU_BlockAllocator* allocator, uint32_t range_idx, uint64_t size) {
+	uint32_t new_range_idx = GPU_NewBlockRange(allocator); // may reallocate the range array
+	GPU_BlockRange* range = DS_ArrGetPtr(allocator->ranges, range_idx);
+	GPU_BlockRange* new_range = DS_ArrGetPtr(allocator->ranges, new_range_idx);
+	new_range->offset = range->offset + size;
+	new_range->size = range->size - size;
+	new_range->block = range->block;
+	new_range->prev_in_block = range_idx;
+	new_range->next_in_block = range->next_in_block;
+	new_range->is_free = false;
+	if (range->next_in_block != GPU_BLOCK_NIL) DS_ArrGetPtr(allocator->ranges, range->next_in_block)->prev_in_block = new_range_idx;
+
+	range->next_in_block = new_range_idx;
+	range->size = size;
+	return new_range_idx;
+}
+
+// Merges the range into the one before it in the same block, which is kept.
+static void GPU_MergeBlockRangeIntoPrev(GPU_BlockAllocator* allocator, uint32_t range_idx) {
+	GPU_BlockRange* range = DS_ArrGetPtr(allocator->ranges, range_idx);
+	GPU_BlockRange* prev = DS_ArrGetPtr(allocator->ranges, range->prev_in_block);
+	prev->size += range->size;
+	prev->next_in_block = range->next_in_block;
+	if (range->next_in_block != GPU_BLOCK_NIL) DS_ArrGetPtr(allocator->ranges, range->next_in_block)->prev_in_block = range->prev_in_block;
+	GPU_FreeBlockRange(allocator, range_idx);
+}
+
+static bool GPU_AddAllocatorBlock(GPU_BlockAllocator* allocator, uint64_t size) {
+	void* handle;
+	if (!allocator->allocate_block(allocator->user_data, size, &handle)) return false;
+	GPU_ASSERT(handle != NULL);
+
+	uint32_t block_idx = GPU_BLOCK_NIL;
+	for (int32_t i = 0; i < allocator->blocks.count; i++) {
+		if (DS_ArrGet(allocator->blocks, i).handle == NULL) {
+			block_idx = (uint32_t)i;
+			break;
+		}
+	}
+	if (block_idx == GPU_BLOCK_NIL) {
+		GPU_AllocatorBlock empty = {0};
+		block_idx = (uint32_t)allocator->blocks.count;
+		DS_ArrPush(&allocator->blocks, empty);
+	}
+
+	GPU_AllocatorBlock* block = DS_ArrGetPtr(allocator->blocks, block_idx);
+	block->handle = handle;
+	block->size = size;
+	block->allocation_count = 0;
+	allocator->empty_block_count++;
+
+	uint32_t range_idx = GPU_NewBlockRange(allocator);
+	GPU_BlockRange* range = DS_ArrGetPtr(allocator->ranges, range_idx);
+	range->offset = 0;
+	range->size = size;
+	range->block = block_idx;
+	range->prev_in_block = GPU_BLOCK_NIL;
+	range->next_in_block = GPU_BLOCK_NIL;
+	GPU_TLSFInsertFreeRange(allocator, range_idx);
+	return true;
+}
+
+void GPU_BlockAllocatorInit(GPU_BlockAllocator* allocator, uint64_t block_size, GPU_AllocateBlockFn allocate_block, GPU_FreeBlockFn free_block, void* user_data) {
+	DS_ProfEnter();
+	memset(allocator, 0, sizeof(*allocator));
+	allocator->block_size = block_size;
+	allocator->allocate_block = allocate_block;
+	allocator->free_block = free_block;
+	allocator->user_data = user_data;
+	allocator->first_unused_range = GPU_BLOCK_NIL;
+	DS_ArrInit(&allocator->ranges, DS_HEAP);
+	DS_ArrInit(&allocator->blocks, DS_HEAP);
+	memset(allocator->free_lists, 0xFF, sizeof(allocator->free_lists));
+	DS_ProfExit();
+}
+
+void GPU_BlockAllocatorDeinit(GPU_BlockAllocator* allocator) {
+	DS_ProfEnter();
+	for (int32_t i = 0; i < allocator->blocks.count; i++) {
+		GPU_AllocatorBlock block = DS_ArrGet(allocator->blocks, i);
+		if (block.handle) allocator->free_block(allocator->user_data, block.handle);
+	}
+	DS_ArrDeinit(&allocator->ranges);
+	DS_ArrDeinit(&allocator->blocks);
+	DS_ProfExit();
+}
+
+bool GPU_BlockAllocatorAlloc(GPU_BlockAllocator* allocator, uint64_t size, uint64_t alignment, GPU_BlockAllocation* out_allocation) {
+	DS_ProfEnter();
+	GPU_ASSERT(size > 0);
+	GPU_ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	// Look for room for the worst case alignment padding, so that whatever range we find, the aligned allocation fits in it.
+	uint64_t search_size = size + alignment - 1;
+
+	uint32_t range_idx = GPU_TLSFFindFreeRange(allocator, search_size);
+	if (range_idx == GPU_BLOCK_NIL) {
+		// Size the new block so that it lands in a bucket the search looks at
+		uint64_t new_block_size = GPU_TLSFRoundUpSize(search_size);
+		if (new_block_size < allocator->block_size) new_block_size = allocator->block_size;
+
+		if (!GPU_AddAllocatorBlock(allocator, new_block_size)) {
+			DS_ProfExit();
+			return false;
+		}
+		range_idx = GPU_TLSFFindFreeRange(allocator, search_size);
+		GPU_ASSERT(range_idx != GPU_BLOCK_NIL);
+	}
+
+	GPU_TLSFRemoveFreeRange(allocator, range_idx);
+
+	GPU_BlockRange range = DS_ArrGet(allocator->ranges, range_idx);
+	uint64_t aligned_offset = (range.offset + alignment - 1) & ~(alignment - 1);
+	uint64_t padding = aligned_offset - range.offset;
+	if (padding > 0) {
+		// The padding becomes a free range of its own. The range before it can't be free, since free neighbours are always merged.
+		uint32_t aligned_range_idx = GPU_SplitBlockRange(allocator, range_idx, padding);
+		GPU_TLSFInsertFreeRange(allocator, range_idx);
+		range_idx = aligned_range_idx;
+	}
+
+	if (DS_ArrGet(allocator->ranges, range_idx).size > size) {
+		uint32_t remainder_idx = GPU_SplitBlockRange(allocator, range_idx, size);
+		GPU_TLSFInsertFreeRange(allocator, remainder_idx);
+	}
+
+	GPU_BlockRange* allocated = DS_ArrGetPtr(allocator->ranges, range_idx);
+	GPU_AllocatorBlock* block = DS_ArrGetPtr(allocator->blocks, allocated->block);
+	if (block->allocation_count == 0) allocator->empty_block_count--;
+	block->allocation_count++;
+	allocator->allocation_count++;
+	allocator->allocated_size += size;
+
+	out_allocation->block = block->handle;
+	out_allocation->offset = allocated->offset;
+	out_allocation->range = range_idx;
+	DS_ProfExit();
+	return true;
+}
+
+void GPU_BlockAllocatorFree(GPU_BlockAllocator* allocator, uint32_t range_idx) {
+	DS_ProfEnter();
+	GPU_BlockRange* range = DS_ArrGetPtr(allocator->ranges, range_idx);
+	GPU_ASSERT(!range->is_free);
+	uint32_t block_idx = range->block;
+	allocator->allocation_count--;
+	allocator->allocated_size -= range->size;
+
+	if (range->next_in_block != GPU_BLOCK_NIL && DS_ArrGet(allocator->ranges, range->next_in_block).is_free) {
+		uint32_t next_idx = range->next_in_block;
+		GPU_TLSFRemoveFreeRange(allocator, next_idx);
+		GPU_MergeBlockRangeIntoPrev(allocator, next_idx);
+	}
+
+	range = DS_ArrGetPtr(allocator->ranges, range_idx);
+	if (range->prev_in_block != GPU_BLOCK_NIL && DS_ArrGet(allocator->ranges, range->prev_in_block).is_free) {
+		uint32_t prev_idx = range->prev_in_block;
+		GPU_TLSFRemoveFreeRange(allocator, prev_idx);
+		GPU_MergeBlockRangeIntoPrev(allocator, range_idx);
+		range_idx = prev_idx;
+	}
+
+	GPU_AllocatorBlock* block = DS_ArrGetPtr(allocator->blocks, block_idx);
+	block->allocation_count--;
+	if (block->allocation_count == 0 && allocator->empty_block_count > 0) {
+		// There's already an empty block around, so give this one back. Its only range is the one we just merged together.
+		allocator->free_block(allocator->user_data, block->handle);
+		block->handle = NULL;
+		block->size = 0;
+		GPU_FreeBlockRange(allocator, range_idx);
+	}
+	else {
+		if (block->allocation_count == 0) allocator->empty_block_count++;
+		GPU_TLSFInsertFreeRange(allocator, range_idx);
+	}
+	DS_ProfExit();
+}
+
+GPU_BlockAllocatorStats GPU_BlockAllocatorGetStats(const GPU_BlockAllocator* allocator) {
+	DS_ProfEnter();
+	GPU_BlockAllocatorStats stats = {0};
+	for (int32_t i = 0; i < allocator->blocks.count; i++) {
+		GPU_AllocatorBlock block = DS_ArrGet(allocator->blocks, i);
+		if (block.handle) {
+			stats.block_count++;
+			stats.block_bytes += block.size;
+		}
+	}
+	stats.allocation_count = allocator->allocation_count;
+	stats.allocated_bytes = allocator->allocated_size;
+
+	for (uint32_t fl = 0; fl < GPU_TLSF_FL_COUNT; fl++) {
+		for (uint32_t sl = 0; sl < GPU_TLSF_SL_COUNT; sl++) {
+			for (uint32_t r = allocator->free_lists[fl][sl]; r != GPU_BLOCK_NIL; r = DS_ArrGet(allocator->ranges, r).next_free) {
+				uint64_t size = DS_ArrGet(allocator->ranges, r).size;
+				stats.free_range_count++;
+				if (size > stats.largest_free_range) stats.largest_free_range = size;
+			}
+		}
+	}
+	DS_ProfExit();
+	return stats;
+}
@@ -0,0 +1,102 @@
+#ifndef GPU_BLOCK_ALLOCATOR_INCLUDED
+#define GPU_BLOCK_ALLOCATOR_INCLUDED
+
+#ifndef FIRE_DS_INCLUDED
+#error "fire_ds.h" must be included before this file!
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sub-allocator for packing lots of resources into a few big memory blocks, so that each resource doesn't need its own
+// vkAllocateMemory. It only deals with offsets and sizes and gets its blocks through callbacks, so it doesn't depend on Vulkan
+// and can be tried out without a GPU.
+//
+// Free ranges are kept in a two-level segregated fit (TLSF) structure. The first level splits sizes by power of two and the second
+// level splits each power of two into GPU_TLSF_SL_COUNT linear buckets, which makes finding a fitting range and freeing one O(1).
+// Neighbouring free ranges are merged right when they're freed.
+
+#define GPU_BLOCK_NIL 0xFFFFFFFF
+
+#define GPU_TLSF_SL_LOG2 4
+#define GPU_TLSF_SL_COUNT (1 << GPU_TLSF_SL_LOG2)
+#define GPU_TLSF_FL_COUNT (64 - GPU_TLSF_SL_LOG2 + 1)
+
+// Should return false if the block couldn't be allocated. `out_handle` must not be set to NULL on success.
+typedef bool (*GPU_AllocateBlockFn)(void* user_data, uint64_t size, void** out_handle);
+typedef void (*GPU_FreeBlockFn)(void* user_data, void* handle);
+
+typedef struct GPU_BlockRange { // a range of a block, either free or allocated
+	uint64_t offset;
+	uint64_t size;
+	uint32_t block;
+	uint32_t prev_in_block; // GPU_BLOCK_NIL at the start of the block
+	uint32_t next_in_block; // GPU_BLOCK_NIL at the end of the block
+	uint32_t prev_free; // only used while in a free list
+	uint32_t next_free; // links both the free lists and the list of unused range slots
+	bool is_free;
+} GPU_BlockRange;
+
+typedef struct GPU_AllocatorBlock {
+	void* handle; // NULL if this slot is unused
+	uint64_t size;
+	uint32_t allocation_count;
+} GPU_AllocatorBlock;
+
+typedef struct GPU_BlockAllocator {
+	uint64_t block_size; // new blocks are at least this big
+	GPU_AllocateBlockFn allocate_block;
+	GPU_FreeBlockFn free_block;
+	void* user_data;
+
+	DS_DynArray(GPU_BlockRange) ranges;
+	uint32_t first_unused_range;
+
+	DS_DynArray(GPU_AllocatorBlock) blocks;
+	uint32_t empty_block_count; // At most one empty block is kept around, so that allocating and freeing at a block boundary doesn't keep reallocating it
+
+	uint64_t fl_bitmap;
+	uint32_t sl_bitmaps[GPU_TLSF_FL_COUNT];
+	uint32_t free_lists[GPU_TLSF_FL_COUNT][GPU_TLSF_SL_COUNT]; // first free range of each bucket, or GPU_BLOCK_NIL
+
+	uint64_t allocated_size;
+	uint32_t allocation_count;
+} GPU_BlockAllocator;
+
+typedef struct GPU_BlockAllocation {
+	void* block; // the handle that allocate_block returned
+	uint64_t offset;
+	uint32_t range; // pass this to GPU_BlockAllocatorFree
+} GPU_BlockAllocation;
+
+typedef struct GPU_BlockAllocatorStats {
+	uint32_t block_count;
+	uint64_t block_bytes;
+	uint32_t allocation_count;
+	uint64_t allocated_bytes;
+	uint32_t free_range_count;
+	uint64_t largest_free_range; // allocated_bytes / block_bytes and this tell how fragmented the blocks are
+} GPU_BlockAllocatorStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void GPU_BlockAllocatorInit(GPU_BlockAllocator* allocator, uint64_t block_size, GPU_AllocateBlockFn allocate_block, GPU_FreeBlockFn free_block, void* user_data);
+
+// Frees all the blocks, even if there are allocations left in them.
+void GPU_BlockAllocatorDeinit(GPU_BlockAllocator* allocator);
+
+// `alignment` must be a power of two. Allocates a new block if none of the existing ones have room; a new block is made bigger
+// than block_size if the allocation doesn't fit otherwise. Returns false if allocate_block failed.
+bool GPU_BlockAllocatorAlloc(GPU_BlockAllocator* allocator, uint64_t size, uint64_t alignment, GPU_BlockAllocation* out_allocation);
+
+void GPU_BlockAllocatorFree(GPU_BlockAllocator* allocator, uint32_t range);
+
+GPU_BlockAllocatorStats GPU_BlockAllocatorGetStats(const GPU_BlockAllocator* allocator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GPU_BLOCK_ALLOCATOR_INCLUDED
@@ -1,5 +1,6 @@
 #include "../Fire/fire_ds.h"
 #include "gpu.h"
+#include "gpu_block_allocator.h"
 
 #include <stdio.h>
 
@@ -27,6 +28,18 @@
 
 #define GPU_SWAPCHAIN_IMG_COUNT 3
 
+// The upload graphs are double-buffered, so that recording the next upload batch doesn't have to wait for the previous one.
+#define GPU_UPLOAD_SLOT_COUNT 2
+
+// Buffers and textures are sub-allocated from device memory blocks of this size. Anything bigger than half a block gets its own allocation.
+#define GPU_MEMORY_BLOCK_SIZE (64*1024*1024)
+
+// Render targets at least this big get their own allocation, as drivers can place those better.
+#define GPU_DEDICATED_RENDER_TARGET_MIN_SIZE (16*1024*1024)
+
+// How many semaphores a single graph submit can wait on, besides the swapchain image
+#define GPU_MAX_GRAPH_WAITS 4
+
 // Allocate a slot from a bucket array with a freelist
 #define GPU_NEW_SLOT(OUT_SLOT, BUCKET_ARRAY, FIRST_FREE_SLOT, NEXT) \
 	if (*FIRST_FREE_SLOT) { \
@@ -179,15 +192,34 @@ typedef struct GPU_IndexAllocator {
 #endif
 
 
+typedef struct GPU_MemoryBlock {
+	VkDeviceMemory vk_handle;
+	void* mapped; // NULL if the memory type isn't host visible. Host visible blocks stay mapped for their whole lifetime.
+} GPU_MemoryBlock;
+
+typedef struct GPU_MemoryPool {
+	GPU_BlockAllocator allocator;
+	uint32_t memory_type_idx;
+} GPU_MemoryPool;
+
+typedef struct GPU_MemoryAllocation {
+	VkDeviceMemory memory; // the block this was sub-allocated from, or the dedicated allocation
+	VkDeviceSize offset;
+	void* mapped; // points to `offset`; NULL if the memory isn't host visible
+	GPU_MemoryPool* pool; // NULL for dedicated allocations
+	uint32_t range; // in the pool's allocator
+} GPU_MemoryAllocation;
+
 typedef struct GPU_TextureImpl {
 	GPU_Texture base;
 	VkImage vk_handle;
-	VkDeviceMemory allocation;
+	GPU_MemoryAllocation allocation;
 	VkImageView img_view;
 	VkImageView atomics_img_view;
 	VkImageView* mip_level_img_views; // May be NULL. Each image view is a view into a single mip level, starting from 0
 
 	VkImageLayout idle_layout_;
+	uint64_t upload_batch; // the last upload batch that used this texture, or 0
 
 	GPU_TextureState* temp; // state in graph
 
@@ -197,8 +229,9 @@ typedef struct GPU_TextureImpl {
 
 typedef struct GPU_BufferImpl {
 	GPU_Buffer base;
-	VkDeviceMemory allocation;
+	GPU_MemoryAllocation allocation;
 	VkBuffer vk_handle;
+	uint64_t upload_batch; // the last upload batch that used this buffer, or 0
 
 	GPU_BufferState* temp; // state in graph
 	//Opt(struct GPU_BufferImpl*) next;
@@ -226,6 +259,25 @@ typedef struct GPU_Swapchain {
 	GPU_TextureImpl textures[GPU_SWAPCHAIN_IMG_COUNT];
 } GPU_Swapchain;
 
+typedef struct GPU_StagingRange {
+	uint32_t begin, end;
+	GPU_Graph* graph;
+	uint64_t submit_value; // 0 until `graph` is submitted. The range can be reused once submit_timeline reaches this.
+} GPU_StagingRange;
+
+typedef struct GPU_UploadSlot {
+	GPU_Graph* graph;
+	GPU_Graph* acquire_graph; // only with a transfer queue, see upload_acquire_graph
+	uint64_t submitted_batch; // 0 if the graphs are ready for recording. Otherwise they need a GPU_GraphWait, which only blocks until this batch is done.
+} GPU_UploadSlot;
+
+typedef struct GPU_StagingRing {
+	GPU_Buffer* buffer;
+	uint32_t head; // where the next allocation goes, if it fits before the end of the buffer
+	DS_DynArray(GPU_StagingRange) ranges; // in use, oldest first starting at `first_range`
+	int32_t first_range;
+} GPU_StagingRing;
+
 typedef struct GPU_State {
 	GPU_WindowHandle window;
 
@@ -237,9 +289,55 @@ typedef struct GPU_State {
 	VkDevice device;
 	VkPhysicalDeviceMemoryProperties mem_properties;
 
+	// Made on first use. Buffers and images get separate pools, so that bufferImageGranularity never needs to be considered
+	// between neighbouring resources.
+	GPU_MemoryPool* buffer_memory_pools[VK_MAX_MEMORY_TYPES];
+	GPU_MemoryPool* image_memory_pools[VK_MAX_MEMORY_TYPES];
+
 	uint32_t queue_family;
 	VkQueue queue;
 
+	// A transfer-only queue family, if the device has one. The upload graph runs on it, so that uploads don't take time away from
+	// rendering. Otherwise transfer_queue is VK_NULL_HANDLE and uploads go to `queue` too.
+	uint32_t transfer_queue_family;
+	VkQueue transfer_queue;
+	VkCommandPool transfer_cmd_pool;
+
+	// A compute family without graphics, if the device has one. Graphs made with GPU_MakeComputeGraph run on it, so that they
+	// can overlap with the rendering. Otherwise compute_queue is VK_NULL_HANDLE and compute graphs go to `queue`.
+	uint32_t compute_queue_family;
+	VkQueue compute_queue;
+	VkCommandPool compute_cmd_pool;
+	VkSemaphore compute_timeline; // like submit_timeline, but for the submits to compute_queue
+	uint64_t compute_last_submit_value;
+
+	// Every graphics queue submit signals this with the next value, so anything that needs to know when the GPU is done with a submission
+	// (e.g. the staging ring) can just remember the value.
+	VkSemaphore submit_timeline;
+	uint64_t last_submit_value;
+
+	GPU_StagingRing staging_ring;
+
+	// GPU_MakeBuffer and GPU_MakeTexture record their uploads here. It's submitted as soon as another graph records or submits anything, see GPU_FlushUploads.
+	// upload_graph and upload_acquire_graph are the graphs of the current slot. Each flush moves on to the next slot.
+	GPU_Graph* upload_graph;
+	bool upload_graph_has_work;
+	GPU_UploadSlot upload_slots[GPU_UPLOAD_SLOT_COUNT];
+	uint32_t upload_slot;
+
+	// Each submit of the upload graph signals this with `upload_batch` and then increments it, so an upload ticket is
+	// just the batch number it was recorded into.
+	VkSemaphore upload_timeline;
+	uint64_t upload_batch;
+
+	// Only used with a transfer queue. The upload graph signals transfer_timeline with the batch number when its copies are done,
+	// and then this graph waits for it on the graphics queue, takes ownership of the uploaded resources and generates their mipmaps.
+	GPU_Graph* upload_acquire_graph;
+	VkSemaphore transfer_timeline;
+	DS_DynArray(VkImageMemoryBarrier) upload_image_acquires; // filled in when the upload graph is submitted
+	DS_DynArray(VkBufferMemoryBarrier) upload_buffer_acquires;
+	DS_DynArray(GPU_Texture*) upload_mipmap_textures; // blits aren't supported on transfer queues
+
 	VkSurfaceKHR surface;
 	GPU_Swapchain swapchain;
 
@@ -273,11 +371,27 @@ typedef struct GPU_DrawParams {
 typedef struct GPU_Graph {
 	DS_Arena arena;
 	DS_ArenaMark arena_begin_mark;
+	VkQueue queue;
+	uint32_t queue_family; // on the transfer queue, everything that isn't shared is handed over to the graphics queue family on submit
+	VkCommandPool cmd_pool;
 	VkCommandBuffer cmd_buffer;
 	bool has_began_cmd_buffer;
 
+	// Extra timeline semaphore operations for the next submit, see GPU_GraphAddWait. They're reset after submitting.
+	VkSemaphore wait_timelines[GPU_MAX_GRAPH_WAITS];
+	uint64_t wait_values[GPU_MAX_GRAPH_WAITS];
+	uint32_t wait_count;
+	VkSemaphore signal_timeline;
+	uint64_t signal_value;
+
+	// The timeline and value that the last submit signaled, for GPU_GraphDependsOn. VK_NULL_HANDLE if not submitted yet.
+	VkSemaphore submitted_timeline;
+	uint64_t submitted_value;
+
 	VkFence gpu_finished_working_fence;
 
+	bool has_staged_uploads; // since the last submit
+
 	// GPU_DescriptorArena *descriptor_arena; // may be NULL
 
 	struct {
@@ -501,6 +615,7 @@ static VkFormat GPU_GetVkFormat(GPU_Format format) {
 	case GPU_Format_RG32F:			return VK_FORMAT_R32G32_SFLOAT;
 	case GPU_Format_RGB32F:		   return VK_FORMAT_R32G32B32_SFLOAT;
 	case GPU_Format_RGBA32F:		  return VK_FORMAT_R32G32B32A32_SFLOAT;
+	case GPU_Format_RGB9E5:		   return VK_FORMAT_E5B9G9R9_UFLOAT_PACK32;
 	case GPU_Format_R8I:			  return VK_FORMAT_R8_UINT;
 	case GPU_Format_R16I:			 return VK_FORMAT_R16_UINT;
 	case GPU_Format_RG16I:			return VK_FORMAT_R16G16_UINT;
@@ -518,6 +633,7 @@ static VkFormat GPU_GetVkFormat(GPU_Format format) {
 	case GPU_Format_BC1_RGBA_UN:	  return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
 	case GPU_Format_BC3_RGBA_UN:	  return VK_FORMAT_BC3_UNORM_BLOCK;
 	case GPU_Format_BC5_UN:		   return VK_FORMAT_BC5_UNORM_BLOCK;
+	case GPU_Format_BC7_RGBA_UN:	  return VK_FORMAT_BC7_UNORM_BLOCK;
 	case GPU_Format_Invalid:	 break;
 	}
 	return VK_FORMAT_UNDEFINED;
@@ -942,6 +1058,8 @@ static GPU_Sampler* MakeCommonSampler(GPU_AddressMode address_mode, GPU_Filter f
 	return GPU_MakeSampler(&desc);
 }
 
+static GPU_Graph* GPU_MakeGraphEx(VkQueue queue, uint32_t queue_family, VkCommandPool cmd_pool); // see the render graph section
+
 GPU_API void GPU_Init(GPU_WindowHandle window) {
 	DS_ProfEnter();
 
@@ -1035,9 +1153,31 @@ GPU_API void GPU_Init(GPU_WindowHandle window) {
 		}
 		GPU_ASSERT(queue_family != -1);
 		GPU_STATE.queue_family = (uint32_t)queue_family;
+
+		// Look for a transfer-only family for uploads. Its image copies must work with any offset and extent.
+		GPU_STATE.transfer_queue_family = GPU_STATE.queue_family;
+		for (int i = 0; i < (int)count; i++) {
+			VkQueueFlags flags = queues[i].queueFlags;
+			VkExtent3D granularity = queues[i].minImageTransferGranularity;
+			if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+				granularity.width == 1 && granularity.height == 1 && granularity.depth == 1)
+			{
+				GPU_STATE.transfer_queue_family = (uint32_t)i;
+				break;
+			}
+		}
+
+		// Look for a compute family without graphics for the async compute graphs
+		GPU_STATE.compute_queue_family = GPU_STATE.queue_family;
+		for (int i = 0; i < (int)count; i++) {
+			if ((queues[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queues[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+				GPU_STATE.compute_queue_family = (uint32_t)i;
+				break;
+			}
+		}
 	}
 
-	{ // Create device (with 1 queue)
+	{ // Create device (with a graphics queue, and transfer and compute queues if there are such families)
 		const char* device_extensions[] = {
 			VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 			VK_EXT_CONSERVATIVE_RASTERIZATION_EXTENSION_NAME,
@@ -1051,11 +1191,27 @@ GPU_API void GPU_Init(GPU_WindowHandle window) {
 		};
 		const float queue_priority[] = { 1.0f };
 
-		VkDeviceQueueCreateInfo queue_info[1] = { {0} };
+		bool has_transfer_queue = GPU_STATE.transfer_queue_family != GPU_STATE.queue_family;
+		bool has_compute_queue = GPU_STATE.compute_queue_family != GPU_STATE.queue_family;
+
+		VkDeviceQueueCreateInfo queue_info[3] = { {0} };
+		uint32_t queue_info_count = 0;
 		queue_info[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 		queue_info[0].queueFamilyIndex = GPU_STATE.queue_family;
 		queue_info[0].queueCount = 1;
 		queue_info[0].pQueuePriorities = queue_priority;
+		queue_info_count++;
+		if (has_transfer_queue) {
+			queue_info[queue_info_count] = queue_info[0];
+			queue_info[queue_info_count++].queueFamilyIndex = GPU_STATE.transfer_queue_family;
+		}
+		if (has_compute_queue) {
+			queue_info[queue_info_count] = queue_info[0];
+			queue_info[queue_info_count++].queueFamilyIndex = GPU_STATE.compute_queue_family;
+		}
+
+		VkPhysicalDeviceTimelineSemaphoreFeatures features_5 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES };
+		features_5.timelineSemaphore = true; // core in vulkan 1.2
 
 		VkPhysicalDeviceFloat16Int8FeaturesKHR features_4 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES };
 		features_4.shaderFloat16 = true;
@@ -1090,7 +1246,7 @@ GPU_API void GPU_Init(GPU_WindowHandle window) {
 		//vk_1_3_features.dynamicRendering = true;
 
 		VkDeviceCreateInfo device_info = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
-		device_info.queueCreateInfoCount = DS_ArrayCount(queue_info);
+		device_info.queueCreateInfoCount = queue_info_count;
 		device_info.pQueueCreateInfos = queue_info;
 		device_info.enabledExtensionCount = DS_ArrayCount(device_extensions);
 		device_info.ppEnabledExtensionNames = device_extensions;
@@ -1098,18 +1254,57 @@ GPU_API void GPU_Init(GPU_WindowHandle window) {
 		device_info.pNext = &features_2;
 		features_2.pNext = &features_3;
 		features_3.pNext = &features_4;
+		features_4.pNext = &features_5;
 		//vk_1_2_features.pNext = &vk_1_3_features;
 
 		GPU_CheckVK(vkCreateDevice(GPU_STATE.physical_device, &device_info, NULL, &GPU_STATE.device));
 
 		vkGetDeviceQueue(GPU_STATE.device, GPU_STATE.queue_family, 0, &GPU_STATE.queue);
+		if (has_transfer_queue) {
+			vkGetDeviceQueue(GPU_STATE.device, GPU_STATE.transfer_queue_family, 0, &GPU_STATE.transfer_queue);
+		}
+		if (has_compute_queue) {
+			vkGetDeviceQueue(GPU_STATE.device, GPU_STATE.compute_queue_family, 0, &GPU_STATE.compute_queue);
+		}
 	}
 
-	{ // Create command pool
+	{ // Create command pools
 		VkCommandPoolCreateInfo pool_info = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
 		pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 		pool_info.queueFamilyIndex = GPU_STATE.queue_family;
 		GPU_CheckVK(vkCreateCommandPool(GPU_STATE.device, &pool_info, NULL, &GPU_STATE.cmd_pool));
+
+		if (GPU_STATE.transfer_queue) {
+			pool_info.queueFamilyIndex = GPU_STATE.transfer_queue_family;
+			GPU_CheckVK(vkCreateCommandPool(GPU_STATE.device, &pool_info, NULL, &GPU_STATE.transfer_cmd_pool));
+		}
+		if (GPU_STATE.compute_queue) {
+			pool_info.queueFamilyIndex = GPU_STATE.compute_queue_family;
+			GPU_CheckVK(vkCreateCommandPool(GPU_STATE.device, &pool_info, NULL, &GPU_STATE.compute_cmd_pool));
+		}
+	}
+
+	{ // Create submit timeline
+		VkSemaphoreTypeCreateInfo type_info = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+		type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		type_info.initialValue = 1; // Start from 1, so that 0 can mean "not submitted yet"
+		VkSemaphoreCreateInfo semaphore_info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+		semaphore_info.pNext = &type_info;
+		GPU_CheckVK(vkCreateSemaphore(GPU_STATE.device, &semaphore_info, NULL, &GPU_STATE.submit_timeline));
+		GPU_STATE.last_submit_value = 1;
+
+		if (GPU_STATE.compute_queue) {
+			GPU_CheckVK(vkCreateSemaphore(GPU_STATE.device, &semaphore_info, NULL, &GPU_STATE.compute_timeline));
+			GPU_STATE.compute_last_submit_value = 1;
+		}
+
+		type_info.initialValue = 0; // ticket 0 is always done
+		GPU_CheckVK(vkCreateSemaphore(GPU_STATE.device, &semaphore_info, NULL, &GPU_STATE.upload_timeline));
+		GPU_STATE.upload_batch = 1;
+
+		if (GPU_STATE.transfer_queue) {
+			GPU_CheckVK(vkCreateSemaphore(GPU_STATE.device, &semaphore_info, NULL, &GPU_STATE.transfer_timeline));
+		}
 	}
 
 	{ // Create surface
@@ -1135,13 +1330,83 @@ GPU_API void GPU_Init(GPU_WindowHandle window) {
 		GPU_STATE.nil_sampler = GPU_STATE.sampler_linear_clamp;
 	}
 
+	{ // uploads
+		GPU_STATE.staging_ring.buffer = GPU_MakeBuffer(GPU_STAGING_RING_SIZE, GPU_BufferFlag_CPU, NULL);
+		DS_ArrInit(&GPU_STATE.staging_ring.ranges, DS_HEAP);
+
+		for (uint32_t i = 0; i < GPU_UPLOAD_SLOT_COUNT; i++) {
+			GPU_UploadSlot* slot = &GPU_STATE.upload_slots[i];
+			if (GPU_STATE.transfer_queue) {
+				slot->graph = GPU_MakeGraphEx(GPU_STATE.transfer_queue, GPU_STATE.transfer_queue_family, GPU_STATE.transfer_cmd_pool);
+				slot->acquire_graph = GPU_MakeGraph();
+			}
+			else {
+				slot->graph = GPU_MakeGraph();
+			}
+		}
+		GPU_STATE.upload_graph = GPU_STATE.upload_slots[0].graph;
+		GPU_STATE.upload_acquire_graph = GPU_STATE.upload_slots[0].acquire_graph;
+
+		if (GPU_STATE.transfer_queue) {
+			DS_ArrInit(&GPU_STATE.upload_image_acquires, DS_HEAP);
+			DS_ArrInit(&GPU_STATE.upload_buffer_acquires, DS_HEAP);
+			DS_ArrInit(&GPU_STATE.upload_mipmap_textures, DS_HEAP);
+		}
+	}
+
 	DS_ArenaSetMark(&GPU_STATE.temp_arena, T);
 	DS_ProfExit();
 }
 
+// Gets the graphs of an upload slot ready for recording. The slot was last submitted GPU_UPLOAD_SLOT_COUNT batches ago,
+// so this only blocks if that batch still isn't done on the GPU.
+static void GPU_WaitForUploadSlot(GPU_UploadSlot* slot) {
+	if (slot->submitted_batch != 0) {
+		GPU_GraphWait(slot->graph);
+		if (slot->acquire_graph) GPU_GraphWait(slot->acquire_graph);
+		slot->submitted_batch = 0;
+	}
+}
+
+static void GPU_WaitForUploadGraphs(void) {
+	GPU_WaitForUploadSlot(&GPU_STATE.upload_slots[GPU_STATE.upload_slot]);
+}
+
+// Submits the pending uploads and waits for them, so that the upload graphs no longer refer to anything.
+static void GPU_FinishUploads(void) {
+	GPU_FlushUploads();
+	for (uint32_t i = 0; i < GPU_UPLOAD_SLOT_COUNT; i++) GPU_WaitForUploadSlot(&GPU_STATE.upload_slots[i]);
+}
+
+static void GPU_DestroyMemoryPool(GPU_MemoryPool* pool) {
+	if (pool) {
+		GPU_BlockAllocatorDeinit(&pool->allocator);
+		DS_MemFree(DS_HEAP, pool);
+	}
+}
+
 GPU_API void GPU_Deinit() {
 	DS_ProfEnter();
 
+	{ // uploads
+		GPU_FinishUploads();
+		for (uint32_t i = 0; i < GPU_UPLOAD_SLOT_COUNT; i++) {
+			GPU_DestroyGraph(GPU_STATE.upload_slots[i].graph);
+			if (GPU_STATE.upload_slots[i].acquire_graph) GPU_DestroyGraph(GPU_STATE.upload_slots[i].acquire_graph);
+		}
+		GPU_DestroyBuffer(GPU_STATE.staging_ring.buffer);
+		DS_ArrDeinit(&GPU_STATE.staging_ring.ranges);
+		vkDestroySemaphore(GPU_STATE.device, GPU_STATE.submit_timeline, NULL);
+		vkDestroySemaphore(GPU_STATE.device, GPU_STATE.upload_timeline, NULL);
+
+		if (GPU_STATE.transfer_queue) {
+			vkDestroySemaphore(GPU_STATE.device, GPU_STATE.transfer_timeline, NULL);
+			DS_ArrDeinit(&GPU_STATE.upload_image_acquires);
+			DS_ArrDeinit(&GPU_STATE.upload_buffer_acquires);
+			DS_ArrDeinit(&GPU_STATE.upload_mipmap_textures);
+		}
+	}
+
 	{ // common resources
 		GPU_DestroySampler(GPU_STATE.sampler_linear_clamp);
 		GPU_DestroySampler(GPU_STATE.sampler_linear_wrap);
@@ -1156,6 +1421,9 @@ GPU_API void GPU_Deinit() {
 	GPU_CheckVK(vkDeviceWaitIdle(GPU_STATE.device));
 
 	vkDestroyCommandPool(GPU_STATE.device, GPU_STATE.cmd_pool, NULL);
+	if (GPU_STATE.transfer_cmd_pool) vkDestroyCommandPool(GPU_STATE.device, GPU_STATE.transfer_cmd_pool, NULL);
+	if (GPU_STATE.compute_cmd_pool) vkDestroyCommandPool(GPU_STATE.device, GPU_STATE.compute_cmd_pool, NULL);
+	if (GPU_STATE.compute_timeline) vkDestroySemaphore(GPU_STATE.device, GPU_STATE.compute_timeline, NULL);
 
 	vkDestroyDescriptorPool(GPU_STATE.device, GPU_STATE.global_descriptor_pool, NULL);
 
@@ -1170,6 +1438,11 @@ GPU_API void GPU_Deinit() {
 
 	// TODO: make sure there aren't any unfreed GPU resources.
 
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+		GPU_DestroyMemoryPool(GPU_STATE.buffer_memory_pools[i]);
+		GPU_DestroyMemoryPool(GPU_STATE.image_memory_pools[i]);
+	}
+
 	vkDestroyDevice(GPU_STATE.device, NULL);
 	vkDestroyInstance(GPU_STATE.instance, NULL);
 
@@ -1197,18 +1470,154 @@ static bool FindVKMemoryTypeIndex(VkMemoryRequirements requirements, VkMemoryPro
 	return found;
 }
 
+static bool GPU_AllocateMemoryBlock(void* user_data, uint64_t size, void** out_handle) {
+	GPU_MemoryPool* pool = (GPU_MemoryPool*)user_data;
+	VkMemoryAllocateInfo alloc_info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	alloc_info.allocationSize = size;
+	alloc_info.memoryTypeIndex = pool->memory_type_idx;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(GPU_STATE.device, &alloc_info, NULL, &memory) != VK_SUCCESS) return false;
+
+	GPU_MemoryBlock* block = (GPU_MemoryBlock*)DS_MemAlloc(DS_HEAP, sizeof(GPU_MemoryBlock));
+	block->vk_handle = memory;
+	block->mapped = NULL;
+	if (GPU_STATE.mem_properties.memoryTypes[pool->memory_type_idx].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		GPU_CheckVK(vkMapMemory(GPU_STATE.device, memory, 0, VK_WHOLE_SIZE, 0, &block->mapped));
+	}
+	*out_handle = block;
+	return true;
+}
+
+static void GPU_FreeMemoryBlock(void* user_data, void* handle) {
+	GPU_MemoryBlock* block = (GPU_MemoryBlock*)handle;
+	vkFreeMemory(GPU_STATE.device, block->vk_handle, NULL); // this unmaps it too
+	DS_MemFree(DS_HEAP, block);
+}
+
+// `dedicated_image` can be set to give an image its own allocation, otherwise the memory is sub-allocated from a pool unless it's very big.
+static GPU_MemoryAllocation GPU_AllocateMemory(VkMemoryRequirements requirements, VkMemoryPropertyFlags required_properties, bool is_image, VkImage dedicated_image) {
+	DS_ProfEnter();
+	uint32_t memory_type_idx;
+	GPU_ASSERT(FindVKMemoryTypeIndex(requirements, required_properties, &memory_type_idx));
+	bool host_visible = GPU_STATE.mem_properties.memoryTypes[memory_type_idx].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+	GPU_MemoryAllocation result = {0};
+	if (dedicated_image || requirements.size > GPU_MEMORY_BLOCK_SIZE / 2) {
+		VkMemoryAllocateInfo alloc_info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+		alloc_info.allocationSize = requirements.size;
+		alloc_info.memoryTypeIndex = memory_type_idx;
+
+		VkMemoryDedicatedAllocateInfo dedicated_info = { VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO };
+		if (dedicated_image) {
+			dedicated_info.image = dedicated_image;
+			alloc_info.pNext = &dedicated_info;
+		}
+		GPU_CheckVK(vkAllocateMemory(GPU_STATE.device, &alloc_info, NULL, &result.memory));
+
+		if (host_visible) {
+			GPU_CheckVK(vkMapMemory(GPU_STATE.device, result.memory, 0, VK_WHOLE_SIZE, 0, &result.mapped));
+		}
+	}
+	else {
+		GPU_MemoryPool** pool = is_image ? &GPU_STATE.image_memory_pools[memory_type_idx] : &GPU_STATE.buffer_memory_pools[memory_type_idx];
+		if (*pool == NULL) {
+			*pool = (GPU_MemoryPool*)DS_MemAlloc(DS_HEAP, sizeof(GPU_MemoryPool));
+			(*pool)->memory_type_idx = memory_type_idx;
+			GPU_BlockAllocatorInit(&(*pool)->allocator, GPU_MEMORY_BLOCK_SIZE, GPU_AllocateMemoryBlock, GPU_FreeMemoryBlock, *pool);
+		}
+
+		GPU_BlockAllocation allocation;
+		GPU_ASSERT(GPU_BlockAllocatorAlloc(&(*pool)->allocator, requirements.size, requirements.alignment, &allocation));
+
+		GPU_MemoryBlock* block = (GPU_MemoryBlock*)allocation.block;
+		result.memory = block->vk_handle;
+		result.offset = allocation.offset;
+		result.mapped = block->mapped ? (char*)block->mapped + allocation.offset : NULL;
+		result.pool = *pool;
+		result.range = allocation.range;
+	}
+	DS_ProfExit();
+	return result;
+}
+
+static void GPU_FreeMemory(GPU_MemoryAllocation allocation) {
+	if (allocation.pool) {
+		GPU_BlockAllocatorFree(&allocation.pool->allocator, allocation.range);
+	}
+	else {
+		vkFreeMemory(GPU_STATE.device, allocation.memory, NULL);
+	}
+}
+
+// Reserves staging space in the upload graph. Returns false if it doesn't fit in the staging ring at all.
+static bool GPU_StageUpload(uint32_t size, uint32_t alignment, GPU_StagingAllocation* out_allocation) {
+	GPU_WaitForUploadGraphs();
+
+	if (!GPU_AllocateStaging(GPU_STATE.upload_graph, size, alignment, out_allocation)) {
+		if (!GPU_STATE.upload_graph_has_work) return false;
+
+		// The ring is full of uploads that haven't been submitted yet, so submit them and try again. Allocating waits for
+		// their staging ranges to be released.
+		GPU_FlushUploads();
+		GPU_WaitForUploadGraphs();
+		if (!GPU_AllocateStaging(GPU_STATE.upload_graph, size, alignment, out_allocation)) return false;
+	}
+	GPU_STATE.upload_graph_has_work = true;
+	return true;
+}
+
+// Blits aren't supported on transfer queues, so with a transfer queue the mipmaps are generated after the hand-over to the graphics queue.
+static void GPU_GenerateUploadMipmaps(GPU_Texture* texture) {
+	if (GPU_STATE.upload_acquire_graph) DS_ArrPush(&GPU_STATE.upload_mipmap_textures, texture);
+	else GPU_OpGenerateMipmaps(GPU_STATE.upload_graph, texture);
+}
+
+// A resource can only be destroyed once the upload batch that last used it is done on the GPU. If the batch is still being
+// recorded, it's submitted first. Resources that no pending or in-flight batch uses are destroyed without waiting.
+static void GPU_WaitForResourceUpload(uint64_t upload_batch) {
+	if (upload_batch != 0 && !GPU_UploadIsDone(upload_batch)) {
+		GPU_WaitForUpload(upload_batch);
+	}
+}
+
 GPU_API void GPU_DestroyBuffer(GPU_Buffer* buffer) {
 	if (buffer) {
 		DS_ProfEnter();
 		GPU_BufferImpl* buffer_impl = (GPU_BufferImpl*)buffer;
-		vkFreeMemory(GPU_STATE.device, buffer_impl->allocation, NULL);
+		GPU_WaitForResourceUpload(buffer_impl->upload_batch);
 		vkDestroyBuffer(GPU_STATE.device, buffer_impl->vk_handle, NULL);
+		GPU_FreeMemory(buffer_impl->allocation);
 		GPU_FreeEntity((GPU_Entity*)buffer);
 		DS_ProfExit();
 	}
 }
 
+// Resources that more than one queue family works on are made with concurrent sharing, so that they never need to be handed over
+// between the queues. CPU buffers are staging and readback buffers on every queue, and the ComputeShared flags mark what the
+// async compute graphs use. Everything else stays exclusive to the graphics queue family, since concurrent sharing can be slower.
+static bool GPU_BufferIsShared(GPU_BufferFlags flags) {
+	return (flags & GPU_BufferFlag_CPU) || (GPU_STATE.compute_queue && (flags & GPU_BufferFlag_ComputeShared));
+}
+
+static bool GPU_TextureIsShared(GPU_TextureFlags flags) {
+	return GPU_STATE.compute_queue && (flags & GPU_TextureFlag_ComputeShared);
+}
+
+// Returns the number of queue families that the device was made with
+static uint32_t GPU_GetQueueFamilies(uint32_t out_families[3]) {
+	uint32_t count = 0;
+	out_families[count++] = GPU_STATE.queue_family;
+	if (GPU_STATE.transfer_queue) out_families[count++] = GPU_STATE.transfer_queue_family;
+	if (GPU_STATE.compute_queue) out_families[count++] = GPU_STATE.compute_queue_family;
+	return count;
+}
+
 GPU_API GPU_Buffer* GPU_MakeBuffer(uint32_t size, GPU_BufferFlags flags, const void* data) {
+	return GPU_MakeBufferAsync(size, flags, data, NULL);
+}
+
+GPU_API GPU_Buffer* GPU_MakeBufferAsync(uint32_t size, GPU_BufferFlags flags, const void* data, GPU_UploadTicket* out_ticket) {
 	DS_ProfEnter();
 	GPU_ASSERT((flags & GPU_BufferFlag_CPU) || (flags & GPU_BufferFlag_GPU)); // The buffer must be accessible from either the CPU or the GPU, or both.
 	GPU_ASSERT(size > 0);
@@ -1221,6 +1630,14 @@ GPU_API GPU_Buffer* GPU_MakeBuffer(uint32_t size, GPU_BufferFlags flags, const v
 	if (flags & GPU_BufferFlag_GPU) info.usage |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 	if (flags & GPU_BufferFlag_StorageBuffer) info.usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 
+	uint32_t queue_families[3];
+	uint32_t queue_family_count = GPU_GetQueueFamilies(queue_families);
+	if (GPU_BufferIsShared(flags) && queue_family_count > 1) {
+		info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		info.queueFamilyIndexCount = queue_family_count;
+		info.pQueueFamilyIndices = queue_families;
+	}
+
 	buffer_impl->base.flags = flags;
 	buffer_impl->base.size = size;
 
@@ -1234,26 +1651,26 @@ GPU_API GPU_Buffer* GPU_MakeBuffer(uint32_t size, GPU_BufferFlags flags, const v
 		required_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 	}
 
-	uint32_t memory_type_idx;
-	GPU_ASSERT(FindVKMemoryTypeIndex(mem_requirements, required_properties, &memory_type_idx));
-
-	VkMemoryAllocateInfo alloc_info = {0};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = mem_requirements.size;
-	alloc_info.memoryTypeIndex = memory_type_idx;
-	GPU_CheckVK(vkAllocateMemory(GPU_STATE.device, &alloc_info, NULL, &buffer_impl->allocation));
-
-	GPU_CheckVK(vkBindBufferMemory(GPU_STATE.device, buffer_impl->vk_handle, buffer_impl->allocation, 0 /* specify memory offset */));
+	buffer_impl->allocation = GPU_AllocateMemory(mem_requirements, required_properties, false, VK_NULL_HANDLE);
+	GPU_CheckVK(vkBindBufferMemory(GPU_STATE.device, buffer_impl->vk_handle, buffer_impl->allocation.memory, buffer_impl->allocation.offset));
 
 	if (flags & GPU_BufferFlag_CPU) {
-		GPU_CheckVK(vkMapMemory(GPU_STATE.device, buffer_impl->allocation, 0, mem_requirements.size, 0, &buffer_impl->base.data));
+		buffer_impl->base.data = buffer_impl->allocation.mapped;
 	}
 
+	GPU_UploadTicket ticket = 0;
 	if (data) {
+		GPU_StagingAllocation staging;
 		if (flags & GPU_BufferFlag_CPU) {
 			memcpy(buffer_impl->base.data, data, size);
 		}
+		else if (GPU_StageUpload(size, 4, &staging)) {
+			memcpy(staging.data, data, size);
+			GPU_OpCopyBufferToBuffer(GPU_STATE.upload_graph, staging.buffer, &buffer_impl->base, 0, staging.offset, size);
+			ticket = GPU_STATE.upload_batch;
+		}
 		else {
+			// Bigger than the whole staging ring
 			GPU_Buffer* staging_buf = GPU_MakeBuffer(size, GPU_BufferFlag_CPU, data);
 			GPU_Graph* graph = GPU_MakeGraph();
 
@@ -1265,6 +1682,7 @@ GPU_API GPU_Buffer* GPU_MakeBuffer(uint32_t size, GPU_BufferFlags flags, const v
 			GPU_DestroyBuffer(staging_buf);
 		}
 	}
+	if (out_ticket) *out_ticket = ticket;
 	DS_ProfExit();
 	return &buffer_impl->base;
 }
@@ -1322,31 +1740,52 @@ static VkImageView GPU_MakeImageView(VkFormat vk_format, VkImageUsageFlags usage
 GPU_API void GPU_DestroyTexture(GPU_Texture* texture) {
 	if (texture) {
 		GPU_TextureImpl* texture_impl = (GPU_TextureImpl*)texture;
+		GPU_WaitForResourceUpload(texture_impl->upload_batch);
 		if (texture_impl->mip_level_img_views) {
 			for (uint32_t i = 0; i < texture_impl->base.mip_level_count; i++) vkDestroyImageView(GPU_STATE.device, texture_impl->mip_level_img_views[i], NULL);
 			DS_MemFree(DS_HEAP, texture_impl->mip_level_img_views);
 		}
 		vkDestroyImageView(GPU_STATE.device, texture_impl->img_view, NULL);
 		vkDestroyImageView(GPU_STATE.device, texture_impl->atomics_img_view, NULL);
-		vkFreeMemory(GPU_STATE.device, texture_impl->allocation, NULL);
 		vkDestroyImage(GPU_STATE.device, texture_impl->vk_handle, NULL);
+		GPU_FreeMemory(texture_impl->allocation);
 		GPU_FreeEntity((GPU_Entity*)texture);
 	}
 }
 
-GPU_API GPU_Texture* GPU_MakeTexture(GPU_Format format, uint32_t width, uint32_t height, uint32_t depth, GPU_TextureFlags flags, const void* data) {
+GPU_API void GPU_SwapTextures(GPU_Texture* a, GPU_Texture* b) {
+	GPU_TextureImpl* a_impl = (GPU_TextureImpl*)a;
+	GPU_TextureImpl* b_impl = (GPU_TextureImpl*)b;
+	// The upload graph may be tracking either texture
+	if (a_impl->upload_batch == GPU_STATE.upload_batch || b_impl->upload_batch == GPU_STATE.upload_batch) GPU_FlushUploads();
+	GPU_ASSERT(a_impl->temp == NULL && b_impl->temp == NULL); // the textures must not be in use by a graph that's being built
+	GPU_TextureImpl tmp = *a_impl;
+	*a_impl = *b_impl;
+	*b_impl = tmp;
+}
+
+GPU_API bool GPU_FormatSupportsUploadAndSampling(GPU_Format format) {
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(GPU_STATE.physical_device, GPU_GetVkFormat(format), &props);
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+	return (props.optimalTilingFeatures & required) == required;
+}
+
+GPU_API GPU_Texture* GPU_MakeTextureEx(GPU_Format format, uint32_t width, uint32_t height, uint32_t depth, uint32_t mip_level_count, GPU_TextureFlags flags) {
 	DS_ProfEnter();
 	GPU_ASSERT(width > 0 && height > 0 && depth > 0);
 
 	GPU_TextureImpl* texture_impl = &GPU_NewEntity()->texture;
 	texture_impl->idle_layout_ = VK_IMAGE_LAYOUT_UNDEFINED;
 
-	uint32_t mip_level_count = 1;
-	if (flags & GPU_TextureFlag_HasMipmaps) {
-		uint32_t smallest_dimension = width < height ? width : height;
-		while (smallest_dimension > 1) {
-			smallest_dimension /= 2;
-			mip_level_count += 1;
+	if (mip_level_count == 0) {
+		mip_level_count = 1;
+		if (flags & GPU_TextureFlag_HasMipmaps) {
+			uint32_t smallest_dimension = width < height ? width : height;
+			while (smallest_dimension > 1) {
+				smallest_dimension /= 2;
+				mip_level_count += 1;
+			}
 		}
 	}
 
@@ -1375,6 +1814,14 @@ GPU_API GPU_Texture* GPU_MakeTexture(GPU_Format format, uint32_t width, uint32_t
 	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	info.samples = GPU_GetTextureMSAASampleCount(flags).vk_count;
 
+	uint32_t queue_families[3];
+	uint32_t queue_family_count = GPU_GetQueueFamilies(queue_families);
+	if (GPU_TextureIsShared(flags) && queue_family_count > 1) {
+		info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		info.queueFamilyIndexCount = queue_family_count;
+		info.pQueueFamilyIndices = queue_families;
+	}
+
 	GPU_Format make_atomics_img_view_with_format = GPU_Format_Invalid;
 	if (flags & GPU_TextureFlag_StorageImage) {
 		// Make an integer-format image view for this texture. Maybe we should do this on demand instead of here, since most storage images probably don't need this.
@@ -1398,15 +1845,9 @@ GPU_API GPU_Texture* GPU_MakeTexture(GPU_Format format, uint32_t width, uint32_t
 	VkMemoryRequirements mem_requirements;
 	vkGetImageMemoryRequirements(GPU_STATE.device, texture_impl->vk_handle, &mem_requirements);
 
-	uint32_t memory_type_idx;
-	GPU_ASSERT(FindVKMemoryTypeIndex(mem_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memory_type_idx));
-
-	VkMemoryAllocateInfo alloc_info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-	alloc_info.allocationSize = mem_requirements.size;
-	alloc_info.memoryTypeIndex = memory_type_idx;
-	GPU_CheckVK(vkAllocateMemory(GPU_STATE.device, &alloc_info, NULL, &texture_impl->allocation));
-
-	GPU_CheckVK(vkBindImageMemory(GPU_STATE.device, texture_impl->vk_handle, texture_impl->allocation, 0 /* specify memory offset */));
+	bool dedicated = (flags & GPU_TextureFlag_RenderTarget) && mem_requirements.size >= GPU_DEDICATED_RENDER_TARGET_MIN_SIZE;
+	texture_impl->allocation = GPU_AllocateMemory(mem_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, dedicated ? texture_impl->vk_handle : VK_NULL_HANDLE);
+	GPU_CheckVK(vkBindImageMemory(GPU_STATE.device, texture_impl->vk_handle, texture_impl->allocation.memory, texture_impl->allocation.offset));
 
 	// Create default image view
 	texture_impl->img_view = GPU_MakeImageView(info.format, info.usage, format_info, texture_impl, 0, VK_REMAINING_MIP_LEVELS);
@@ -1428,22 +1869,88 @@ GPU_API GPU_Texture* GPU_MakeTexture(GPU_Format format, uint32_t width, uint32_t
 		}
 	}
 
+	DS_ProfExit();
+	return &texture_impl->base;
+}
+
+GPU_API GPU_Texture* GPU_MakeTexture(GPU_Format format, uint32_t width, uint32_t height, uint32_t depth, GPU_TextureFlags flags, const void* data) {
+	return GPU_MakeTextureAsync(format, width, height, depth, flags, data, NULL);
+}
+
+GPU_API GPU_Texture* GPU_MakeTextureAsync(GPU_Format format, uint32_t width, uint32_t height, uint32_t depth, GPU_TextureFlags flags, const void* data, GPU_UploadTicket* out_ticket) {
+	DS_ProfEnter();
+	GPU_Texture* texture = GPU_MakeTextureEx(format, width, height, depth, 0, flags);
+
+	GPU_UploadTicket ticket = 0;
 	if (data) {
+		GPU_FormatInfo format_info = GPU_GetFormatInfo(format);
 		uint32_t num_blocks = width * height;
 		if (format_info.block_extent != 1) {
 			num_blocks /= format_info.block_extent * format_info.block_extent;
 			if (num_blocks < 1) num_blocks = 1;
 		}
 
-		uint32_t size_in_bytes = num_blocks * format_info.block_size * info.arrayLayers;
-		GPU_Buffer* staging_buffer = GPU_MakeBuffer(size_in_bytes, GPU_BufferFlag_CPU, data);
-		GPU_Graph* graph = GPU_MakeGraph();
+		uint32_t size_in_bytes = num_blocks * format_info.block_size * texture->layer_count;
 
-		GPU_OpCopyBufferToTexture(graph, staging_buffer, &texture_impl->base, 0, texture_impl->base.layer_count, 0);
+		GPU_StagingAllocation staging;
+		if (GPU_StageUpload(size_in_bytes, format_info.block_size * 4, &staging)) {
+			memcpy(staging.data, data, size_in_bytes);
+			GPU_OpCopyBufferToTextureEx(GPU_STATE.upload_graph, staging.buffer, staging.offset, texture, 0, texture->layer_count, 0);
 
-		if (mip_level_count > 1) {
-			GPU_OpGenerateMipmaps(graph, &texture_impl->base);
+			if (texture->mip_level_count > 1) {
+				GPU_GenerateUploadMipmaps(texture);
+			}
+			ticket = GPU_STATE.upload_batch;
 		}
+		else {
+			// Bigger than the whole staging ring
+			GPU_Buffer* staging_buffer = GPU_MakeBuffer(size_in_bytes, GPU_BufferFlag_CPU, data);
+			GPU_Graph* graph = GPU_MakeGraph();
+
+			GPU_OpCopyBufferToTexture(graph, staging_buffer, texture, 0, texture->layer_count, 0);
+
+			if (texture->mip_level_count > 1) {
+				GPU_OpGenerateMipmaps(graph, texture);
+			}
+
+			GPU_GraphSubmit(graph);
+			GPU_GraphWait(graph);
+			GPU_DestroyGraph(graph);
+
+			GPU_DestroyBuffer(staging_buffer);
+		}
+	}
+	if (out_ticket) *out_ticket = ticket;
+	DS_ProfExit();
+	return texture;
+}
+
+GPU_API GPU_UploadTicket GPU_UploadTextureAsync(GPU_Texture* texture, const void* data, uint32_t data_size, const GPU_TextureCopyRegion* regions, uint32_t region_count) {
+	DS_ProfEnter();
+	GPU_ASSERT(((GPU_TextureImpl*)texture)->idle_layout_ == VK_IMAGE_LAYOUT_UNDEFINED); // The texture must not have been used by a graph yet
+	bool generate_mipmaps = (texture->flags & GPU_TextureFlag_HasMipmaps) && texture->mip_level_count > 1;
+
+	GPU_UploadTicket ticket = 0;
+	GPU_StagingAllocation staging;
+	if (GPU_StageUpload(data_size, GPU_GetFormatInfo(texture->format).block_size * 4, &staging)) {
+		memcpy(staging.data, data, data_size);
+
+		GPU_TextureCopyRegion* staged_regions = (GPU_TextureCopyRegion*)DS_ArenaPush(&GPU_STATE.upload_graph->arena, region_count * sizeof(GPU_TextureCopyRegion));
+		for (uint32_t i = 0; i < region_count; i++) {
+			staged_regions[i] = regions[i];
+			staged_regions[i].src_offset += staging.offset;
+		}
+		GPU_OpCopyBufferToTextureRegions(GPU_STATE.upload_graph, staging.buffer, texture, staged_regions, region_count);
+		if (generate_mipmaps) GPU_GenerateUploadMipmaps(texture);
+		ticket = GPU_STATE.upload_batch;
+	}
+	else {
+		// Bigger than the whole staging ring
+		GPU_Buffer* staging_buffer = GPU_MakeBuffer(data_size, GPU_BufferFlag_CPU, data);
+		GPU_Graph* graph = GPU_MakeGraph();
+
+		GPU_OpCopyBufferToTextureRegions(graph, staging_buffer, texture, regions, region_count);
+		if (generate_mipmaps) GPU_OpGenerateMipmaps(graph, texture);
 
 		GPU_GraphSubmit(graph);
 		GPU_GraphWait(graph);
@@ -1452,7 +1959,21 @@ GPU_API GPU_Texture* GPU_MakeTexture(GPU_Format format, uint32_t width, uint32_t
 		GPU_DestroyBuffer(staging_buffer);
 	}
 	DS_ProfExit();
-	return &texture_impl->base;
+	return ticket;
+}
+
+GPU_API GPU_UploadTicket GPU_CopyBufferToTextureAsync(GPU_Buffer* src, GPU_Texture* dst, const GPU_TextureCopyRegion* regions, uint32_t region_count) {
+	DS_ProfEnter();
+	GPU_ASSERT(src->flags & GPU_BufferFlag_CPU); // Only CPU buffers are shared with the transfer queue
+	GPU_ASSERT(((GPU_TextureImpl*)dst)->idle_layout_ == VK_IMAGE_LAYOUT_UNDEFINED); // The texture must not have been used by a graph yet
+
+	GPU_WaitForUploadGraphs();
+	GPU_OpCopyBufferToTextureRegions(GPU_STATE.upload_graph, src, dst, regions, region_count);
+	if ((dst->flags & GPU_TextureFlag_HasMipmaps) && dst->mip_level_count > 1) GPU_GenerateUploadMipmaps(dst);
+	GPU_STATE.upload_graph_has_work = true;
+
+	DS_ProfExit();
+	return GPU_STATE.upload_batch;
 }
 
 GPU_API void GPU_OpGenerateMipmaps(GPU_Graph* graph, GPU_Texture* texture) {
@@ -2224,7 +2745,50 @@ static void GPU_GetVkStageAccessLayout(const GPU_ResourceAccess* access, VkPipel
 	DS_ProfExit();
 }
 
+// The stages above don't know which kind of pipeline an access comes from, but a compute queue doesn't have the graphics stages,
+// so in a compute graph they're replaced with the compute shader stage.
+static VkPipelineStageFlags GPU_GraphStageMask(GPU_Graph* graph, VkPipelineStageFlags stages) {
+	if (GPU_STATE.compute_queue && graph->queue == GPU_STATE.compute_queue) {
+		VkPipelineStageFlags graphics_stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		if (stages & graphics_stages) stages = (stages & ~graphics_stages) | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	}
+	return stages;
+}
+
+// The upload graphs are recorded by GPU_FlushUploads itself, so they must never flush the uploads.
+static bool GPU_IsUploadGraph(GPU_Graph* graph) {
+	for (uint32_t i = 0; i < GPU_UPLOAD_SLOT_COUNT; i++) {
+		if (graph == GPU_STATE.upload_slots[i].graph || graph == GPU_STATE.upload_slots[i].acquire_graph) return true;
+	}
+	return false;
+}
+
+// Is the resource used by the upload batch that's still being recorded?
+static bool GPU_AccessIsPendingUpload(const GPU_ResourceAccess* access) {
+	uint64_t upload_batch = 0;
+	switch (access->resource_kind) {
+	case GPU_ResourceKind_StorageImage: // fallthrough
+	case GPU_ResourceKind_Texture: upload_batch = ((GPU_TextureImpl*)access->resource)->upload_batch; break;
+	case GPU_ResourceKind_Buffer: upload_batch = ((GPU_BufferImpl*)access->resource)->upload_batch; break;
+	case GPU_ResourceKind_Sampler: break;
+	}
+	return upload_batch == GPU_STATE.upload_batch;
+}
+
 static void GPU_InsertBarriers(GPU_Graph* graph, GPU_ResourceAccess* accesses, uint32_t accesses_count) {
+	// Resources are tracked by one graph at a time, so if the pending uploads are still tracking something this op uses,
+	// get them out of the way first. Anything else is flushed when the graph is submitted.
+	if (!GPU_IsUploadGraph(graph) && GPU_STATE.upload_graph_has_work) {
+		for (uint32_t access_i = 0; access_i < accesses_count; access_i++) {
+			if (GPU_AccessIsPendingUpload(&accesses[access_i])) {
+				GPU_FlushUploads();
+				break;
+			}
+		}
+	}
+
 	VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT; // By default, this barrier depends on nothing
 	VkPipelineStageFlags dst_stage_mask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT; // By default, nothing depends on this barrier
 
@@ -2256,6 +2820,7 @@ static void GPU_InsertBarriers(GPU_Graph* graph, GPU_ResourceAccess* accesses, u
 
 				texture->temp = state;
 				DS_ArrPush(&graph->builder_state.textures, texture);
+				if (graph == GPU_STATE.upload_graph) texture->upload_batch = GPU_STATE.upload_batch;
 			}
 
 			VkImageLayout dst_layout;
@@ -2297,6 +2862,7 @@ static void GPU_InsertBarriers(GPU_Graph* graph, GPU_ResourceAccess* accesses, u
 				state->access_flags = 0;
 				buffer->temp = state;
 				DS_ArrPush(&graph->builder_state.buffers, buffer);
+				if (graph == GPU_STATE.upload_graph) buffer->upload_batch = GPU_STATE.upload_batch;
 			}
 
 			VkAccessFlags dst_access_flags = 0;
@@ -2321,7 +2887,7 @@ static void GPU_InsertBarriers(GPU_Graph* graph, GPU_ResourceAccess* accesses, u
 	}
 
 	if (mem_barriers.count > 0 || img_barriers.count > 0) {
-		vkCmdPipelineBarrier(graph->cmd_buffer, src_stage_mask, dst_stage_mask, 0, (uint32_t)mem_barriers.count, mem_barriers.data, 0, NULL, (uint32_t)img_barriers.count, img_barriers.data);
+		vkCmdPipelineBarrier(graph->cmd_buffer, GPU_GraphStageMask(graph, src_stage_mask), GPU_GraphStageMask(graph, dst_stage_mask), 0, (uint32_t)mem_barriers.count, mem_barriers.data, 0, NULL, (uint32_t)img_barriers.count, img_barriers.data);
 	}
 }
 
@@ -2361,6 +2927,199 @@ GPU_API void GPU_DestroyDescriptorArena(GPU_DescriptorArena* descriptor_arena) {
 	}
 }
 
+// -- Staging ring ------------------------------------------------------------
+
+static void GPU_RetireStagingRanges(uint64_t completed_value) {
+	GPU_StagingRing* ring = &GPU_STATE.staging_ring;
+	while (ring->first_range < ring->ranges.count) {
+		GPU_StagingRange range = DS_ArrGet(ring->ranges, ring->first_range);
+		if (range.submit_value == 0 || range.submit_value > completed_value) break;
+		ring->first_range++;
+	}
+
+	if (ring->first_range == ring->ranges.count) {
+		DS_ArrClear(&ring->ranges);
+		ring->first_range = 0;
+		ring->head = 0; // the whole ring is free, so start from the beginning again
+	}
+	else if (ring->first_range > 64 && ring->first_range > ring->ranges.count / 2) {
+		DS_ArrRemoveN(&ring->ranges, 0, ring->first_range);
+		ring->first_range = 0;
+	}
+}
+
+// Returns UINT32_MAX if there isn't room right now
+static uint32_t GPU_FindStagingSpace(uint32_t size, uint32_t alignment) {
+	GPU_StagingRing* ring = &GPU_STATE.staging_ring;
+	if (ring->first_range == ring->ranges.count) return 0;
+
+	uint64_t offset = ((uint64_t)ring->head + alignment - 1) / alignment * alignment;
+	uint32_t tail = DS_ArrGet(ring->ranges, ring->first_range).begin;
+	if (ring->head > tail) {
+		// The used space is [tail, head), so there's room after it and before it
+		if (offset + size <= ring->buffer->size) return (uint32_t)offset;
+		if (size <= tail) return 0;
+	}
+	else {
+		// The used space wraps around, so the room is [head, tail)
+		if (offset + size <= tail) return (uint32_t)offset;
+	}
+	return UINT32_MAX;
+}
+
+static void GPU_SetStagingSubmitValue(GPU_Graph* graph, uint64_t submit_value) {
+	GPU_StagingRing* ring = &GPU_STATE.staging_ring;
+	for (int32_t i = ring->first_range; i < ring->ranges.count; i++) {
+		GPU_StagingRange* range = DS_ArrGetPtr(ring->ranges, i);
+		if (range->graph == graph && range->submit_value == 0) range->submit_value = submit_value;
+	}
+	graph->has_staged_uploads = false;
+}
+
+GPU_API bool GPU_AllocateStaging(GPU_Graph* graph, uint32_t size, uint32_t alignment, GPU_StagingAllocation* out_allocation) {
+	DS_ProfEnter();
+	GPU_ASSERT(size > 0 && alignment > 0);
+	GPU_ASSERT(!GPU_STATE.compute_queue || graph->queue != GPU_STATE.compute_queue); // staging is only tracked on the graphics queue's timeline
+	GPU_StagingRing* ring = &GPU_STATE.staging_ring;
+
+	uint32_t offset = UINT32_MAX;
+	if (size <= ring->buffer->size) {
+		uint64_t completed_value;
+		GPU_CheckVK(vkGetSemaphoreCounterValue(GPU_STATE.device, GPU_STATE.submit_timeline, &completed_value));
+		GPU_RetireStagingRanges(completed_value);
+
+		for (;;) {
+			offset = GPU_FindStagingSpace(size, alignment);
+			if (offset != UINT32_MAX) break;
+
+			// Wait for the oldest range to be released. If it hasn't been submitted yet, there's nothing to wait for,
+			// unless it's from the upload graph which we can submit ourselves.
+			GPU_StagingRange oldest = DS_ArrGet(ring->ranges, ring->first_range);
+			if (oldest.submit_value == 0 && oldest.graph == GPU_STATE.upload_graph && graph != GPU_STATE.upload_graph) {
+				GPU_FlushUploads();
+				oldest = DS_ArrGet(ring->ranges, ring->first_range);
+			}
+			if (oldest.submit_value == 0) break;
+
+			VkSemaphoreWaitInfo wait_info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+			wait_info.semaphoreCount = 1;
+			wait_info.pSemaphores = &GPU_STATE.submit_timeline;
+			wait_info.pValues = &oldest.submit_value;
+			GPU_CheckVK(vkWaitSemaphores(GPU_STATE.device, &wait_info, ~(uint64_t)0));
+			GPU_RetireStagingRanges(oldest.submit_value);
+		}
+	}
+
+	if (offset == UINT32_MAX) {
+		DS_ProfExit();
+		return false;
+	}
+
+	// Consecutive allocations for the same submission share one range
+	GPU_StagingRange* last = ring->ranges.count > ring->first_range ? DS_ArrPeekPtr(ring->ranges) : NULL;
+	if (last && last->graph == graph && last->submit_value == 0 && offset >= last->end) {
+		last->end = offset + size;
+	}
+	else {
+		GPU_StagingRange range = { offset, offset + size, graph, 0 };
+		DS_ArrPush(&ring->ranges, range);
+	}
+	ring->head = offset + size;
+	graph->has_staged_uploads = true;
+
+	out_allocation->buffer = ring->buffer;
+	out_allocation->offset = offset;
+	out_allocation->data = (char*)ring->buffer->data + offset;
+	DS_ProfExit();
+	return true;
+}
+
+// Makes the next submit of `graph` wait until `timeline` reaches `value`
+static void GPU_GraphAddWait(GPU_Graph* graph, VkSemaphore timeline, uint64_t value) {
+	for (uint32_t i = 0; i < graph->wait_count; i++) {
+		if (graph->wait_timelines[i] == timeline) {
+			if (value > graph->wait_values[i]) graph->wait_values[i] = value;
+			return;
+		}
+	}
+	GPU_ASSERT(graph->wait_count < GPU_MAX_GRAPH_WAITS);
+	graph->wait_timelines[graph->wait_count] = timeline;
+	graph->wait_values[graph->wait_count] = value;
+	graph->wait_count++;
+}
+
+GPU_API void GPU_FlushUploads(void) {
+	if (GPU_STATE.upload_graph_has_work) {
+		DS_ProfEnter();
+		GPU_STATE.upload_graph_has_work = false;
+
+		GPU_Graph* upload_graph = GPU_STATE.upload_graph;
+		GPU_Graph* acquire_graph = GPU_STATE.upload_acquire_graph;
+		uint64_t batch = GPU_STATE.upload_batch++;
+
+		if (acquire_graph) {
+			// Copy on the transfer queue. Submitting releases everything the copies used to the graphics queue family.
+			upload_graph->signal_timeline = GPU_STATE.transfer_timeline;
+			upload_graph->signal_value = batch;
+			GPU_GraphSubmit(upload_graph);
+
+			// Then take ownership on the graphics queue once the copies are done, and finish the textures there
+			if (GPU_STATE.upload_buffer_acquires.count > 0 || GPU_STATE.upload_image_acquires.count > 0) {
+				vkCmdPipelineBarrier(acquire_graph->cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL,
+					(uint32_t)GPU_STATE.upload_buffer_acquires.count, GPU_STATE.upload_buffer_acquires.data,
+					(uint32_t)GPU_STATE.upload_image_acquires.count, GPU_STATE.upload_image_acquires.data);
+			}
+			DS_ArrClear(&GPU_STATE.upload_buffer_acquires);
+			DS_ArrClear(&GPU_STATE.upload_image_acquires);
+
+			DS_ForArrEach(GPU_Texture*, &GPU_STATE.upload_mipmap_textures, it) {
+				GPU_OpGenerateMipmaps(acquire_graph, *it.ptr);
+			}
+			DS_ArrClear(&GPU_STATE.upload_mipmap_textures);
+
+			GPU_GraphAddWait(acquire_graph, GPU_STATE.transfer_timeline, batch);
+			acquire_graph->signal_timeline = GPU_STATE.upload_timeline;
+			acquire_graph->signal_value = batch;
+			GPU_GraphSubmit(acquire_graph);
+
+			// The staging ranges are free once the acquire graph is done, since it only starts after the copies
+			GPU_SetStagingSubmitValue(upload_graph, GPU_STATE.last_submit_value);
+		}
+		else {
+			upload_graph->signal_timeline = GPU_STATE.upload_timeline;
+			upload_graph->signal_value = batch;
+			GPU_GraphSubmit(upload_graph);
+		}
+
+		// Record the next batch into the next slot, so that it doesn't have to wait for this one
+		GPU_STATE.upload_slots[GPU_STATE.upload_slot].submitted_batch = batch;
+		GPU_STATE.upload_slot = (GPU_STATE.upload_slot + 1) % GPU_UPLOAD_SLOT_COUNT;
+		GPU_STATE.upload_graph = GPU_STATE.upload_slots[GPU_STATE.upload_slot].graph;
+		GPU_STATE.upload_acquire_graph = GPU_STATE.upload_slots[GPU_STATE.upload_slot].acquire_graph;
+		DS_ProfExit();
+	}
+}
+
+GPU_API bool GPU_UploadIsDone(GPU_UploadTicket ticket) {
+	if (ticket >= GPU_STATE.upload_batch) GPU_FlushUploads(); // still being recorded
+
+	uint64_t completed_batch;
+	GPU_CheckVK(vkGetSemaphoreCounterValue(GPU_STATE.device, GPU_STATE.upload_timeline, &completed_batch));
+	return completed_batch >= ticket;
+}
+
+GPU_API void GPU_WaitForUpload(GPU_UploadTicket ticket) {
+	DS_ProfEnter();
+	if (ticket >= GPU_STATE.upload_batch) GPU_FlushUploads(); // still being recorded
+
+	VkSemaphoreWaitInfo wait_info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+	wait_info.semaphoreCount = 1;
+	wait_info.pSemaphores = &GPU_STATE.upload_timeline;
+	wait_info.pValues = &ticket;
+	GPU_CheckVK(vkWaitSemaphores(GPU_STATE.device, &wait_info, ~(uint64_t)0));
+	DS_ProfExit();
+}
+
 static void GPU_GraphBegin(GPU_Graph* graph) {
 	DS_ArrInit(&graph->builder_state.prepared_draw_params, &graph->arena);
 	DS_ArrInit(&graph->builder_state.textures, &graph->arena);
@@ -2391,19 +3150,24 @@ static void GPU_GraphBegin(GPU_Graph* graph) {
 }
 
 GPU_API void GPU_DestroyGraph(GPU_Graph* graph) {
+	if (graph->has_staged_uploads) {
+		// Nothing is going to read these ranges, so they can be reused after whatever was submitted last
+		GPU_SetStagingSubmitValue(graph, GPU_STATE.last_submit_value);
+	}
+
 	if (graph->frame.img_index != GPU_NOT_A_SWAPCHAIN_GRAPH) {
 		vkDestroySemaphore(GPU_STATE.device, graph->frame.img_available_semaphore, NULL);
 		vkDestroySemaphore(GPU_STATE.device, graph->frame.img_finished_rendering_semaphore, NULL);
 	}
 
 	vkDestroyFence(GPU_STATE.device, graph->gpu_finished_working_fence, NULL);
-	vkFreeCommandBuffers(GPU_STATE.device, GPU_STATE.cmd_pool, 1, &graph->cmd_buffer);
+	vkFreeCommandBuffers(GPU_STATE.device, graph->cmd_pool, 1, &graph->cmd_buffer);
 	
 	DS_Arena graph_arena = graph->arena; // make a local copy to avoid reading from deallocated memory in DS_ArenaDeinit since the graph is allocated from its own arena
 	DS_ArenaDeinit(&graph_arena);
 }
 
-GPU_API GPU_Graph* GPU_MakeGraph(void) {
+static GPU_Graph* GPU_MakeGraphEx(VkQueue queue, uint32_t queue_family, VkCommandPool cmd_pool) {
 	DS_Arena _arena;
 	DS_ArenaInit(&_arena, DS_KIB(1), DS_HEAP);
 
@@ -2411,9 +3175,12 @@ GPU_API GPU_Graph* GPU_MakeGraph(void) {
 	graph->arena = _arena;
 	graph->arena_begin_mark = DS_ArenaGetMark(&graph->arena);
 	graph->frame.img_index = GPU_NOT_A_SWAPCHAIN_GRAPH;
+	graph->queue = queue;
+	graph->queue_family = queue_family;
+	graph->cmd_pool = cmd_pool;
 
 	VkCommandBufferAllocateInfo cmd_buffer_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
-	cmd_buffer_info.commandPool = GPU_STATE.cmd_pool;
+	cmd_buffer_info.commandPool = cmd_pool;
 	cmd_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	cmd_buffer_info.commandBufferCount = 1;
 	GPU_CheckVK(vkAllocateCommandBuffers(GPU_STATE.device, &cmd_buffer_info, &graph->cmd_buffer));
@@ -2427,6 +3194,23 @@ GPU_API GPU_Graph* GPU_MakeGraph(void) {
 	return graph;
 }
 
+GPU_API GPU_Graph* GPU_MakeGraph(void) {
+	return GPU_MakeGraphEx(GPU_STATE.queue, GPU_STATE.queue_family, GPU_STATE.cmd_pool);
+}
+
+GPU_API GPU_Graph* GPU_MakeComputeGraph(void) {
+	if (GPU_STATE.compute_queue) {
+		return GPU_MakeGraphEx(GPU_STATE.compute_queue, GPU_STATE.compute_queue_family, GPU_STATE.compute_cmd_pool);
+	}
+	return GPU_MakeGraph();
+}
+
+GPU_API void GPU_GraphDependsOn(GPU_Graph* graph, GPU_Graph* dependency) {
+	if (dependency->submitted_timeline) {
+		GPU_GraphAddWait(graph, dependency->submitted_timeline, dependency->submitted_value);
+	}
+}
+
 GPU_API void GPU_MakeSwapchainGraphs(uint32_t count, GPU_Graph** out_graphs) {
 	GPU_ASSERT(count == 2); // I don't think there's any reason not to have 2 frames in-flight
 
@@ -2481,18 +3265,51 @@ GPU_API void GPU_GraphWait(GPU_Graph* graph) {
 GPU_API void GPU_GraphSubmit(GPU_Graph* graph) {
 	DS_ProfEnter();
 
-	// Make sure each texture has a single layout for all of its layers and levels.
+	// Anything this graph uses might have been made with GPU_MakeBuffer / GPU_MakeTexture and not uploaded yet
+	if (!GPU_IsUploadGraph(graph)) GPU_FlushUploads();
+
+	bool is_transfer_graph = GPU_STATE.transfer_queue && graph->queue == GPU_STATE.transfer_queue;
+	bool is_compute_graph = GPU_STATE.compute_queue && graph->queue == GPU_STATE.compute_queue;
+
+	// The uploads are finished on the graphics queue, which the compute queue doesn't otherwise wait for
+	if (is_compute_graph && GPU_STATE.upload_batch > 1) {
+		GPU_GraphAddWait(graph, GPU_STATE.upload_timeline, GPU_STATE.upload_batch - 1);
+	}
+
+	// Make sure each texture has a single layout for all of its layers and levels. A graph on the transfer queue also releases
+	// everything it used that isn't shared to the graphics queue family here; the matching acquires are recorded by GPU_FlushUploads.
 	{
 		DS_DynArray(VkImageMemoryBarrier) img_barriers = { &graph->arena };
+		DS_DynArray(VkBufferMemoryBarrier) buf_barriers = { &graph->arena };
 
 		VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT; // By default, this barrier depends on nothing
 
 		DS_ForArrEach(GPU_BufferImpl*, &graph->builder_state.buffers, it) {
-			(*it.ptr)->temp = NULL;
+			GPU_BufferImpl* buffer = *it.ptr;
+			GPU_ASSERT(!is_compute_graph || GPU_BufferIsShared(buffer->base.flags)); // see GPU_MakeComputeGraph
+
+			if (is_transfer_graph && !GPU_BufferIsShared(buffer->base.flags)) {
+				src_stage_mask |= buffer->temp->stage;
+
+				VkBufferMemoryBarrier buf_barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+				buf_barrier.srcAccessMask = buffer->temp->access_flags;
+				buf_barrier.srcQueueFamilyIndex = graph->queue_family;
+				buf_barrier.dstQueueFamilyIndex = GPU_STATE.queue_family;
+				buf_barrier.buffer = buffer->vk_handle;
+				buf_barrier.size = VK_WHOLE_SIZE;
+				DS_ArrPush(&buf_barriers, buf_barrier);
+
+				buf_barrier.srcAccessMask = 0;
+				buf_barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+				DS_ArrPush(&GPU_STATE.upload_buffer_acquires, buf_barrier);
+			}
+			buffer->temp = NULL;
 		}
 		DS_ForArrEach(GPU_TextureImpl*, &graph->builder_state.textures, it) {
 			GPU_TextureImpl* texture = *it.ptr;
 			VkAccessFlags aspect = GPU_GetImageAspectFlags(texture->base.format);
+			GPU_ASSERT(!is_compute_graph || GPU_TextureIsShared(texture->base.flags)); // see GPU_MakeComputeGraph
+			bool release = is_transfer_graph && !GPU_TextureIsShared(texture->base.flags);
 
 			// Let's default idle_layout to SHADER_READ_ONLY_OPTIMAL for all textures (except for swapchain textures). This makes it so that you can do some arbitrary storage image computations with a texture, and it shouldn't affect performance when you're not doing writes anymore. But this might just be a dumb heuristic. If we have a storage image that we always write to at the start of a new frame/graph, then we would like to keep it as GENERAL. One solution would be to keep track of `idle_layout` separately for every view, and not even try to transition them to anything at the end of a graph. Another idea would be to add a texture flag for "preferred idle layout". Idk.
 
@@ -2504,10 +3321,19 @@ GPU_API void GPU_GraphSubmit(GPU_Graph* graph) {
 				for (uint32_t level = 0; level < texture->base.mip_level_count; level++) {
 					GPU_SubresourceState* sub_state = &state->sub_states[level + layer * texture->base.mip_level_count];
 
-					if (sub_state->layout != dst_layout) {
+					if (sub_state->layout != dst_layout || release) {
 						src_stage_mask |= sub_state->stage; // Make the barrier wait for the previous stage
 
 						VkImageMemoryBarrier img_barrier = GPU_ImageBarrier(texture->vk_handle, aspect, layer, 1, level, 1, sub_state->layout, dst_layout, sub_state->access_flags, 0);
+						if (release) {
+							img_barrier.srcQueueFamilyIndex = graph->queue_family;
+							img_barrier.dstQueueFamilyIndex = GPU_STATE.queue_family;
+
+							VkImageMemoryBarrier acquire = img_barrier; // must have the same layouts as the release
+							acquire.srcAccessMask = 0;
+							acquire.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+							DS_ArrPush(&GPU_STATE.upload_image_acquires, acquire);
+						}
 						DS_ArrPush(&img_barriers, img_barrier);
 					}
 				}
@@ -2516,8 +3342,9 @@ GPU_API void GPU_GraphSubmit(GPU_Graph* graph) {
 			texture->idle_layout_ = dst_layout;
 		}
 
-		if (img_barriers.count > 0) {
-			vkCmdPipelineBarrier(graph->cmd_buffer, src_stage_mask, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, (uint32_t)img_barriers.count, img_barriers.data);
+		if (img_barriers.count > 0 || buf_barriers.count > 0) {
+			vkCmdPipelineBarrier(graph->cmd_buffer, GPU_GraphStageMask(graph, src_stage_mask), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL,
+				(uint32_t)buf_barriers.count, buf_barriers.data, (uint32_t)img_barriers.count, img_barriers.data);
 		}
 	}
 
@@ -2539,6 +3366,14 @@ GPU_API void GPU_GraphSubmit(GPU_Graph* graph) {
 		backbuffer->idle_layout_ = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 	}
 
+	if ((graph->has_staged_uploads && !is_transfer_graph) || graph == GPU_STATE.upload_acquire_graph) {
+		// The uploaded resources may be used by any later submission without further synchronization, so make the writes visible to everything.
+		VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		vkCmdPipelineBarrier(graph->cmd_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+	}
+
 	GPU_CheckVK(vkEndCommandBuffer(graph->cmd_buffer));
 	graph->has_began_cmd_buffer = false;
 
@@ -2548,17 +3383,73 @@ GPU_API void GPU_GraphSubmit(GPU_Graph* graph) {
 	submit_info.commandBufferCount = 1;
 	submit_info.pCommandBuffers = &graph->cmd_buffer;
 
-	VkPipelineStageFlags wait_dst_stage_mask = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	VkSemaphore wait_semaphores[GPU_MAX_GRAPH_WAITS + 1];
+	uint64_t wait_values[GPU_MAX_GRAPH_WAITS + 1] = {0};
+	VkPipelineStageFlags wait_dst_stage_masks[GPU_MAX_GRAPH_WAITS + 1];
+	uint32_t wait_count = 0;
+
+	VkSemaphore signal_semaphores[3];
+	uint64_t signal_values[3] = {0}; // binary semaphores ignore their value
+	uint32_t signal_count = 0;
 
 	if (graph->frame.img_index != GPU_NOT_A_SWAPCHAIN_GRAPH) {
-		submit_info.waitSemaphoreCount = 1;
-		submit_info.pWaitSemaphores = &graph->frame.img_available_semaphore;
-		submit_info.pWaitDstStageMask = &wait_dst_stage_mask;
-		submit_info.signalSemaphoreCount = 1;
-		submit_info.pSignalSemaphores = &graph->frame.img_finished_rendering_semaphore;
+		wait_dst_stage_masks[wait_count] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		wait_semaphores[wait_count++] = graph->frame.img_available_semaphore;
+		signal_semaphores[signal_count++] = graph->frame.img_finished_rendering_semaphore;
 	}
 
-	GPU_CheckVK(vkQueueSubmit(GPU_STATE.queue, 1, &submit_info, graph->gpu_finished_working_fence));
+	for (uint32_t i = 0; i < graph->wait_count; i++) {
+		wait_values[wait_count] = graph->wait_values[i];
+		wait_dst_stage_masks[wait_count] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		wait_semaphores[wait_count++] = graph->wait_timelines[i];
+	}
+
+	// A timeline must be signaled in increasing order, so the graphics and compute queues each signal their own. The transfer
+	// queue only signals what GPU_FlushUploads asks for.
+	uint64_t submit_value = 0;
+	if (is_compute_graph) {
+		submit_value = ++GPU_STATE.compute_last_submit_value;
+		graph->submitted_timeline = GPU_STATE.compute_timeline;
+	}
+	else if (!is_transfer_graph) {
+		submit_value = ++GPU_STATE.last_submit_value;
+		graph->submitted_timeline = GPU_STATE.submit_timeline;
+	}
+	if (submit_value) {
+		graph->submitted_value = submit_value;
+		signal_values[signal_count] = submit_value;
+		signal_semaphores[signal_count++] = graph->submitted_timeline;
+	}
+
+	if (graph->signal_timeline) {
+		if (is_transfer_graph) {
+			graph->submitted_timeline = graph->signal_timeline;
+			graph->submitted_value = graph->signal_value;
+		}
+		signal_values[signal_count] = graph->signal_value;
+		signal_semaphores[signal_count++] = graph->signal_timeline;
+	}
+
+	VkTimelineSemaphoreSubmitInfo timeline_info = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timeline_info.waitSemaphoreValueCount = wait_count;
+	timeline_info.pWaitSemaphoreValues = wait_values;
+	timeline_info.signalSemaphoreValueCount = signal_count;
+	timeline_info.pSignalSemaphoreValues = signal_values;
+	submit_info.pNext = &timeline_info;
+	submit_info.waitSemaphoreCount = wait_count;
+	submit_info.pWaitSemaphores = wait_semaphores;
+	submit_info.pWaitDstStageMask = wait_dst_stage_masks;
+	submit_info.signalSemaphoreCount = signal_count;
+	submit_info.pSignalSemaphores = signal_semaphores;
+
+	GPU_CheckVK(vkQueueSubmit(graph->queue, 1, &submit_info, graph->gpu_finished_working_fence));
+	graph->wait_count = 0;
+	graph->signal_timeline = VK_NULL_HANDLE;
+
+	// The staging ranges of a transfer graph are released by whoever knows when it's done, see GPU_FlushUploads
+	if (graph->has_staged_uploads && !is_transfer_graph) {
+		GPU_SetStagingSubmitValue(graph, submit_value);
+	}
 
 	if (graph->frame.img_index != GPU_NOT_A_SWAPCHAIN_GRAPH) {
 		VkPresentInfoKHR present_info = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
@@ -2579,6 +3470,7 @@ GPU_API void GPU_GraphSubmit(GPU_Graph* graph) {
 
 GPU_API void GPU_WaitUntilIdle() {
 	DS_ProfEnter();
+	GPU_FlushUploads();
 	vkDeviceWaitIdle(GPU_STATE.device);
 	DS_ProfExit();
 }
@@ -2588,8 +3480,9 @@ GPU_API void GPU_OpBindVertexBuffer(GPU_Graph* graph, GPU_Buffer* buffer) {
 	vkCmdBindVertexBuffers(graph->cmd_buffer, 0, 1, &((GPU_BufferImpl*)buffer)->vk_handle, &zero);
 }
 
-GPU_API void GPU_OpBindIndexBuffer(GPU_Graph* graph, GPU_Buffer* buffer) {
-	vkCmdBindIndexBuffer(graph->cmd_buffer, ((GPU_BufferImpl*)buffer)->vk_handle, 0, VK_INDEX_TYPE_UINT32);
+GPU_API void GPU_OpBindIndexBuffer(GPU_Graph* graph, GPU_Buffer* buffer, GPU_IndexType index_type) {
+	VkIndexType vk_index_type = index_type == GPU_IndexType_U16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	vkCmdBindIndexBuffer(graph->cmd_buffer, ((GPU_BufferImpl*)buffer)->vk_handle, 0, vk_index_type);
 }
 
 GPU_API void GPU_OpBindComputePipeline(GPU_Graph* graph, GPU_ComputePipeline* pipeline) {
@@ -2608,6 +3501,7 @@ GPU_API void GPU_OpBindComputeDescriptorSet(GPU_Graph* graph, GPU_DescriptorSet*
 
 GPU_API void GPU_OpBeginRenderPass(GPU_Graph* graph) {
 	GPU_ASSERT(graph->builder_state.preparing_render_pass != NULL);
+	GPU_ASSERT(graph->queue_family == GPU_STATE.queue_family); // render passes can't go into compute graphs
 
 	GPU_RenderPass* render_pass = graph->builder_state.preparing_render_pass;
 	graph->builder_state.render_pass = render_pass;
@@ -2770,7 +3664,7 @@ GPU_API void GPU_OpDispatch(GPU_Graph* graph, uint32_t group_count_x, uint32_t g
 }
 
 GPU_API void GPU_OpDrawIndexed(GPU_Graph* graph, uint32_t index_count, uint32_t instance_count, uint32_t first_index, uint32_t vertex_offset, uint32_t first_instance) {
-	vkCmdDrawIndexed(graph->cmd_buffer, index_count, instance_count, first_index, vertex_offset, first_instance);
+	vkCmdDrawIndexed(graph->cmd_buffer, index_count, instance_count, first_index, (int32_t)vertex_offset, first_instance);
 }
 
 GPU_API void GPU_OpDraw(GPU_Graph* graph, uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance) {
@@ -2914,7 +3808,12 @@ GPU_API void GPU_OpCopyBufferToBuffer(GPU_Graph* graph, GPU_Buffer* src, GPU_Buf
 }
 
 GPU_API void GPU_OpCopyBufferToTexture(GPU_Graph* graph, GPU_Buffer* src, GPU_Texture* dst, uint32_t dst_first_layer, uint32_t dst_layer_count, uint32_t dst_mip_level) {
+	GPU_OpCopyBufferToTextureEx(graph, src, 0, dst, dst_first_layer, dst_layer_count, dst_mip_level);
+}
+
+GPU_API void GPU_OpCopyBufferToTextureEx(GPU_Graph* graph, GPU_Buffer* src, uint32_t src_offset, GPU_Texture* dst, uint32_t dst_first_layer, uint32_t dst_layer_count, uint32_t dst_mip_level) {
 	GPU_ASSERT(graph->builder_state.render_pass == NULL); // You can't do this operation when inside OpBegin/EndRenderPass scope.
+	GPU_ASSERT(src_offset % 4 == 0 && src_offset % GPU_GetFormatInfo(dst->format).block_size == 0);
 
 	GPU_ResourceAccess accesses[] = {
 		{src, GPU_ResourceKind_Buffer, GPU_ResourceAccessFlag_TransferRead, 0, 1, 0, 1},
@@ -2922,8 +3821,12 @@ GPU_API void GPU_OpCopyBufferToTexture(GPU_Graph* graph, GPU_Buffer* src, GPU_Te
 	};
 	GPU_InsertBarriers(graph, accesses, DS_ArrayCount(accesses));
 
-	VkExtent3D extent = { dst->width, dst->height, dst->depth };
+	uint32_t mip_width = dst->width >> dst_mip_level;
+	uint32_t mip_height = dst->height >> dst_mip_level;
+	uint32_t mip_depth = dst->depth >> dst_mip_level;
+	VkExtent3D extent = { mip_width ? mip_width : 1, mip_height ? mip_height : 1, mip_depth ? mip_depth : 1 };
 	VkBufferImageCopy region = {0};
+	region.bufferOffset = src_offset;
 	region.imageSubresource.aspectMask = GPU_GetImageAspectFlags(dst->format);
 	region.imageSubresource.mipLevel = dst_mip_level;
 	region.imageSubresource.baseArrayLayer = dst_first_layer;
@@ -2932,6 +3835,88 @@ GPU_API void GPU_OpCopyBufferToTexture(GPU_Graph* graph, GPU_Buffer* src, GPU_Te
 	vkCmdCopyBufferToImage(graph->cmd_buffer, ((GPU_BufferImpl*)src)->vk_handle, ((GPU_TextureImpl*)dst)->vk_handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 }
 
+GPU_API void GPU_OpCopyBufferToTextureRegions(GPU_Graph* graph, GPU_Buffer* src, GPU_Texture* dst, const GPU_TextureCopyRegion* regions, uint32_t region_count) {
+	GPU_ASSERT(graph->builder_state.render_pass == NULL); // You can't do this operation when inside OpBegin/EndRenderPass scope.
+	if (region_count == 0) return;
+	
+	uint32_t block_size = GPU_GetFormatInfo(dst->format).block_size;
+	uint32_t min_layer = ~0u, max_layer = 0, min_mip = ~0u, max_mip = 0;
+	
+	VkBufferImageCopy* vk_regions = (VkBufferImageCopy*)DS_ArenaPushZero(&graph->arena, sizeof(VkBufferImageCopy) * region_count);
+	for (uint32_t i = 0; i < region_count; i++) {
+		const GPU_TextureCopyRegion* region = &regions[i];
+		GPU_ASSERT(region->src_offset % 4 == 0 && region->src_offset % block_size == 0);
+		GPU_ASSERT(region->dst_layer < dst->layer_count && region->dst_mip_level < dst->mip_level_count);
+
+		if (region->dst_layer < min_layer) min_layer = region->dst_layer;
+		if (region->dst_layer > max_layer) max_layer = region->dst_layer;
+		if (region->dst_mip_level < min_mip) min_mip = region->dst_mip_level;
+		if (region->dst_mip_level > max_mip) max_mip = region->dst_mip_level;
+
+		uint32_t mip_width = dst->width >> region->dst_mip_level;
+		uint32_t mip_height = dst->height >> region->dst_mip_level;
+		uint32_t mip_depth = dst->depth >> region->dst_mip_level;
+		VkExtent3D extent = { mip_width ? mip_width : 1, mip_height ? mip_height : 1, mip_depth ? mip_depth : 1 };
+
+		VkBufferImageCopy* vk_region = &vk_regions[i];
+		vk_region->bufferOffset = region->src_offset;
+		vk_region->imageSubresource.aspectMask = GPU_GetImageAspectFlags(dst->format);
+		vk_region->imageSubresource.mipLevel = region->dst_mip_level;
+		vk_region->imageSubresource.baseArrayLayer = region->dst_layer;
+		vk_region->imageSubresource.layerCount = 1;
+		vk_region->imageExtent = extent;
+	}
+
+	GPU_ResourceAccess accesses[] = {
+		{src, GPU_ResourceKind_Buffer, GPU_ResourceAccessFlag_TransferRead, 0, 1, 0, 1},
+		{dst, GPU_ResourceKind_Texture, GPU_ResourceAccessFlag_TransferWrite, min_layer, max_layer - min_layer + 1, min_mip, max_mip - min_mip + 1},
+	};
+	GPU_InsertBarriers(graph, accesses, DS_ArrayCount(accesses));
+
+	vkCmdCopyBufferToImage(graph->cmd_buffer, ((GPU_BufferImpl*)src)->vk_handle, ((GPU_TextureImpl*)dst)->vk_handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, region_count, vk_regions);
+}
+
+GPU_API void GPU_OpCopyTextureToBufferRegions(GPU_Graph* graph, GPU_Texture* src, GPU_Buffer* dst, const GPU_TextureCopyRegion* regions, uint32_t region_count) {
+	GPU_ASSERT(graph->builder_state.render_pass == NULL); // You can't do this operation when inside OpBegin/EndRenderPass scope.
+	if (region_count == 0) return;
+	
+	uint32_t block_size = GPU_GetFormatInfo(src->format).block_size;
+	uint32_t min_layer = ~0u, max_layer = 0, min_mip = ~0u, max_mip = 0;
+	
+	VkBufferImageCopy* vk_regions = (VkBufferImageCopy*)DS_ArenaPushZero(&graph->arena, sizeof(VkBufferImageCopy) * region_count);
+	for (uint32_t i = 0; i < region_count; i++) {
+		const GPU_TextureCopyRegion* region = &regions[i];
+		GPU_ASSERT(region->src_offset % 4 == 0 && region->src_offset % block_size == 0);
+		GPU_ASSERT(region->dst_layer < src->layer_count && region->dst_mip_level < src->mip_level_count);
+
+		if (region->dst_layer < min_layer) min_layer = region->dst_layer;
+		if (region->dst_layer > max_layer) max_layer = region->dst_layer;
+		if (region->dst_mip_level < min_mip) min_mip = region->dst_mip_level;
+		if (region->dst_mip_level > max_mip) max_mip = region->dst_mip_level;
+
+		uint32_t mip_width = src->width >> region->dst_mip_level;
+		uint32_t mip_height = src->height >> region->dst_mip_level;
+		uint32_t mip_depth = src->depth >> region->dst_mip_level;
+		VkExtent3D extent = { mip_width ? mip_width : 1, mip_height ? mip_height : 1, mip_depth ? mip_depth : 1 };
+
+		VkBufferImageCopy* vk_region = &vk_regions[i];
+		vk_region->bufferOffset = region->src_offset;
+		vk_region->imageSubresource.aspectMask = GPU_GetImageAspectFlags(src->format);
+		vk_region->imageSubresource.mipLevel = region->dst_mip_level;
+		vk_region->imageSubresource.baseArrayLayer = region->dst_layer;
+		vk_region->imageSubresource.layerCount = 1;
+		vk_region->imageExtent = extent;
+	}
+
+	GPU_ResourceAccess accesses[] = {
+		{src, GPU_ResourceKind_Texture, GPU_ResourceAccessFlag_TransferRead, min_layer, max_layer - min_layer + 1, min_mip, max_mip - min_mip + 1},
+		{dst, GPU_ResourceKind_Buffer, GPU_ResourceAccessFlag_TransferWrite, 0, 1, 0, 1},
+	};
+	GPU_InsertBarriers(graph, accesses, DS_ArrayCount(accesses));
+
+	vkCmdCopyImageToBuffer(graph->cmd_buffer, ((GPU_TextureImpl*)src)->vk_handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ((GPU_BufferImpl*)dst)->vk_handle, region_count, vk_regions);
+}
+
 GPU_API void GPU_OpCopyTextureToBuffer(GPU_Graph* graph, GPU_Texture* src, GPU_Buffer* dst) {
 	GPU_ASSERT(graph->builder_state.render_pass == NULL); // You can't do this operation when inside OpBegin/EndRenderPass scope.
 
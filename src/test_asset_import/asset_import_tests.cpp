@@ -0,0 +1,542 @@
+// Tests and a vertex conversion benchmark for the CPU side of mesh importing, see demo_pbr_renderer/assimp_convert.h and
+// demo_pbr_renderer/mesh_optimize.h.
+// Nothing here touches the GPU.
+//
+// Usage: AssetImportTests [mesh file]
+// e.g.   AssetImportTests ../resources/SunTemple/SunTemple.fbx
+//
+// A synthetic scene is always tested. If a mesh file is given, it's imported with Assimp and tested too.
+// Prints every failed check, followed by the benchmark results. The exit code is the number of failed checks.
+
+#include "demo_pbr_renderer/common.h"
+#include "demo_pbr_renderer/render.h"
+#include "demo_pbr_renderer/os_utils.h"
+#include "demo_pbr_renderer/assimp_convert.h"
+#include "demo_pbr_renderer/mesh_optimize.h"
+
+#define FIRE_OS_TIMING_IMPLEMENTATION
+#include "fire/fire_os_timing.h"
+
+#define ASSIMP_DLL
+#define ASSIMP_API
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <assimp/cimport.h>
+
+#include <stdio.h>
+#include <stdlib.h> // qsort
+
+DS_Arena* TEMP; // os_utils.cpp wants this
+
+static int FAILED_CHECK_COUNT;
+
+#define CHECK(x) if (!(x)) { printf("FAILED: %s (%s:%d)\n", #x, __FILE__, __LINE__); FAILED_CHECK_COUNT++; }
+
+static uint32_t RandomU32(uint32_t* state) { // xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static float RandomFloat(uint32_t* state, float min, float max) {
+	return min + (max - min) * (float)(RandomU32(state) >> 8) / (float)(1 << 24);
+}
+
+static aiVector3D RandomVector(uint32_t* state, float extent) {
+	return aiVector3D(RandomFloat(state, -extent, extent), RandomFloat(state, -extent, extent), RandomFloat(state, -extent, extent));
+}
+
+static aiVector3D RandomDirection(uint32_t* state) {
+	HMM_Vec3 v = HMM_NormV3(HMM_V3(RandomFloat(state, -1.f, 1.f), RandomFloat(state, -1.f, 1.f), 0.1f + RandomFloat(state, 0.f, 1.f)));
+	return aiVector3D(v.X, v.Y, v.Z);
+}
+
+// Random vertices with normals, tangents and texcoords, and no faces
+static aiMesh* MakeSyntheticMesh(uint32_t* rng, uint32_t vertex_count) {
+	aiMesh* mesh = new aiMesh();
+	mesh->mNumVertices = vertex_count;
+	mesh->mVertices = new aiVector3D[vertex_count];
+	mesh->mNormals = new aiVector3D[vertex_count];
+	mesh->mTangents = new aiVector3D[vertex_count];
+	mesh->mTextureCoords[0] = new aiVector3D[vertex_count];
+	mesh->mNumUVComponents[0] = 2;
+	for (uint32_t i = 0; i < vertex_count; i++) {
+		mesh->mVertices[i] = RandomVector(rng, 100.f);
+		mesh->mNormals[i] = RandomDirection(rng);
+		mesh->mTangents[i] = RandomDirection(rng);
+		mesh->mTextureCoords[0][i] = aiVector3D(RandomFloat(rng, 0.f, 4.f), RandomFloat(rng, 0.f, 4.f), 0.f);
+	}
+	return mesh;
+}
+
+// Meshes of all sizes, including ones with a single vertex or without faces, spread over a few materials
+static aiScene* MakeSyntheticScene(uint32_t mesh_count, uint32_t material_count) {
+	uint32_t rng = 12345;
+	aiScene* scene = new aiScene();
+	scene->mNumMeshes = mesh_count;
+	scene->mMeshes = new aiMesh*[mesh_count];
+	for (uint32_t mesh_i = 0; mesh_i < mesh_count; mesh_i++) {
+		aiMesh* mesh = MakeSyntheticMesh(&rng, mesh_i % 10 == 0 ? 1 : 1 + RandomU32(&rng) % 5000);
+		mesh->mMaterialIndex = RandomU32(&rng) % material_count;
+
+		mesh->mNumFaces = mesh_i % 10 == 5 ? 0 : RandomU32(&rng) % (mesh->mNumVertices * 2);
+		mesh->mFaces = mesh->mNumFaces > 0 ? new aiFace[mesh->mNumFaces] : NULL;
+		for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
+			aiFace* face = &mesh->mFaces[i];
+			face->mNumIndices = 3;
+			face->mIndices = new unsigned int[3];
+			for (uint32_t c = 0; c < 3; c++) face->mIndices[c] = RandomU32(&rng) % mesh->mNumVertices;
+		}
+		scene->mMeshes[mesh_i] = mesh;
+	}
+	return scene;
+}
+
+// The vendored aiScene has no destructor, so the meshes are freed here. ~aiMesh frees the vertex data and faces.
+static void FreeSyntheticScene(aiScene* scene) {
+	for (uint32_t i = 0; i < scene->mNumMeshes; i++) delete scene->mMeshes[i];
+	delete[] scene->mMeshes;
+	delete scene;
+}
+
+// Lays out the scene the way ImportMeshWithAssimp does it, with one slice per material. Meshes that the importer would assert
+// on are left out, as is every 7th mesh to have some unused ones.
+static void LayoutScene(const aiScene* scene, const MeshInstance* const* mesh_bake_transform, AssimpMeshLayout* out_layout) {
+	uint32_t material_count = 0;
+	uint32_t* mesh_slice = (uint32_t*)DS_ArenaPush(TEMP, scene->mNumMeshes * sizeof(uint32_t));
+	for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+		const aiMesh* mesh = scene->mMeshes[i];
+		bool used = i % 7 != 3 && mesh->mNormals && mesh->mTangents && mesh->mTextureCoords[0];
+		mesh_slice[i] = used ? mesh->mMaterialIndex : UINT32_MAX;
+		if (mesh->mMaterialIndex + 1 > material_count) material_count = mesh->mMaterialIndex + 1;
+	}
+	LayoutAssimpMeshes(TEMP, scene, mesh_slice, material_count, mesh_bake_transform, HMM_V3(1.f, -2.f, 3.f), 0.5f, out_layout);
+}
+
+// Each slice must hold exactly its aiMeshes in mesh order, with the slices back to back, and the indices of each aiMesh must
+// be rebased to where its vertices start within the slice
+static void CheckLayout(const aiScene* scene, const AssimpMeshLayout* layout) {
+	uint32_t slice_count = 0;
+	for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+		if (scene->mMeshes[i]->mMaterialIndex + 1 > slice_count) slice_count = scene->mMeshes[i]->mMaterialIndex + 1;
+	}
+
+	uint32_t first_vertex = 0;
+	uint32_t first_index = 0;
+	for (uint32_t slice = 0; slice < slice_count; slice++) {
+		CHECK(layout->slice_first_vertex[slice] == first_vertex);
+		CHECK(layout->slice_first_index[slice] == first_index);
+		
+		uint32_t vertex_count = 0;
+		uint32_t index_count = 0;
+		for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+			if (layout->jobs.mesh_vertices[i] == NULL || scene->mMeshes[i]->mMaterialIndex != slice) continue;
+			CHECK(layout->jobs.mesh_vertices[i] == layout->vertices + first_vertex + vertex_count);
+			CHECK(layout->jobs.mesh_indices[i] == layout->indices + first_index + index_count);
+			CHECK(layout->jobs.mesh_base_vertex[i] == vertex_count);
+			vertex_count += scene->mMeshes[i]->mNumVertices;
+			index_count += scene->mMeshes[i]->mNumFaces * 3;
+		}
+		CHECK(layout->slice_vertex_count[slice] == vertex_count);
+		CHECK(layout->slice_index_count[slice] == index_count);
+		first_vertex += vertex_count;
+		first_index += index_count;
+	}
+	CHECK(layout->vertex_count == first_vertex);
+	CHECK(layout->index_count == first_index);
+	
+	for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+		if (i % 7 == 3) CHECK(layout->jobs.mesh_vertices[i] == NULL);
+	}
+}
+
+// Converting the meshes on the worker threads must give exactly the same bytes as converting them one after another
+static void TestParallelConversion(const aiScene* scene, const char* name) {
+	DS_ArenaMark mark = DS_ArenaGetMark(TEMP);
+
+	// Bake a transform into every third mesh, so that TransformVertices runs on the workers too
+	MeshInstance* bake_transform = DS_New(MeshInstance, TEMP);
+	bake_transform->world_from_local = HMM_MulM4(HMM_Translate(HMM_V3(10.f, 0.f, -5.f)), HMM_Rotate_RH(0.7f, HMM_NormV3(HMM_V3(1.f, 2.f, 3.f))));
+	bake_transform->normal_from_local = HMM_TransposeM4(HMM_InvGeneralM4(bake_transform->world_from_local));
+	const MeshInstance** mesh_bake_transform = (const MeshInstance**)DS_ArenaPushZero(TEMP, scene->mNumMeshes * sizeof(MeshInstance*));
+	for (uint32_t i = 0; i < scene->mNumMeshes; i += 3) mesh_bake_transform[i] = bake_transform;
+
+	AssimpMeshLayout serial, parallel;
+	LayoutScene(scene, mesh_bake_transform, &serial);
+	LayoutScene(scene, mesh_bake_transform, &parallel);
+	CheckLayout(scene, &serial);
+	CHECK(serial.vertex_count == parallel.vertex_count && serial.index_count == parallel.index_count);
+
+	memset(serial.vertices, 0, serial.vertex_count * sizeof(Vertex));
+	memset(serial.indices, 0, serial.index_count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+		AssimpConvertJobRun(&serial.jobs, i);
+	}
+
+	// A few rounds, since a race wouldn't necessarily show up every time
+	for (int round = 0; round < 8; round++) {
+		memset(parallel.vertices, 0xFF, parallel.vertex_count * sizeof(Vertex));
+		memset(parallel.indices, 0xFF, parallel.index_count * sizeof(uint32_t));
+		OS_ParallelFor(scene->mNumMeshes, AssimpConvertJobRun, &parallel.jobs);
+
+		CHECK(memcmp(serial.vertices, parallel.vertices, serial.vertex_count * sizeof(Vertex)) == 0);
+		CHECK(memcmp(serial.indices, parallel.indices, serial.index_count * sizeof(uint32_t)) == 0);
+	}
+
+	printf("Parallel conversion of %s: %u meshes, %u vertices, %u indices\n", name, scene->mNumMeshes, serial.vertex_count, serial.index_count);
+	DS_ArenaSetMark(TEMP, mark);
+}
+
+// A bumpy height field of `cells` x `cells` quads, built as `patches` x `patches` separate patches that each have their own
+// copy of the vertices on the shared edges. The copies are bit-identical, so welding must merge them back to (cells + 1)^2.
+// With `uv_seam`, the right half of the patches gets its own UV island, so the middle column is split into a UV seam instead.
+static void MakeGridMesh(uint32_t cells, uint32_t patches, bool uv_seam, Vertex** out_vertices, uint32_t* out_vertex_count, uint32_t** out_indices, uint32_t* out_index_count) {
+	uint32_t patch_cells = cells / patches;
+	assert(patch_cells * patches == cells);
+	
+	*out_vertex_count = patches * patches * (patch_cells + 1) * (patch_cells + 1);
+	*out_index_count = cells * cells * 6;
+	*out_vertices = (Vertex*)DS_ArenaPush(TEMP, *out_vertex_count * sizeof(Vertex));
+	*out_indices = (uint32_t*)DS_ArenaPush(TEMP, *out_index_count * sizeof(uint32_t));
+	
+	uint32_t vertex_i = 0;
+	uint32_t index_i = 0;
+	for (uint32_t patch_y = 0; patch_y < patches; patch_y++) {
+		for (uint32_t patch_x = 0; patch_x < patches; patch_x++) {
+			uint32_t first_vertex = vertex_i;
+			for (uint32_t y = 0; y <= patch_cells; y++) {
+				for (uint32_t x = 0; x <= patch_cells; x++) {
+					uint32_t grid_x = patch_x * patch_cells + x;
+					uint32_t grid_y = patch_y * patch_cells + y;
+					Vertex* v = &(*out_vertices)[vertex_i++];
+					v->position = HMM_V3((float)grid_x, sinf((float)grid_x * 0.3f) * cosf((float)grid_y * 0.2f), (float)grid_y);
+					v->normal = HMM_V3(0.f, 1.f, 0.f);
+					v->tangent = HMM_V3(1.f, 0.f, 0.f);
+					v->tangent_sign = 1.f;
+					v->tex_coord = HMM_V2((float)grid_x / (float)cells, (float)grid_y / (float)cells);
+					if (uv_seam && patch_x >= patches / 2) v->tex_coord.X += 1.f;
+				}
+			}
+			for (uint32_t y = 0; y < patch_cells; y++) {
+				for (uint32_t x = 0; x < patch_cells; x++) {
+					uint32_t v00 = first_vertex + y * (patch_cells + 1) + x;
+					uint32_t v10 = v00 + 1;
+					uint32_t v01 = v00 + patch_cells + 1;
+					uint32_t v11 = v01 + 1;
+					uint32_t quad[6] = { v00, v01, v10, v10, v01, v11 };
+					memcpy(*out_indices + index_i, quad, sizeof(quad));
+					index_i += 6;
+				}
+			}
+		}
+	}
+}
+
+static int CompareU64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// One key per triangle of a MakeGridMesh grid, made of the grid coordinates of its corners so that it doesn't depend on how
+// the vertices are numbered. The corners are rotated to start from the smallest, which keeps the winding. Returned sorted.
+static uint64_t* GridTriangleKeys(const Vertex* vertices, const uint32_t* indices, uint32_t index_count, uint32_t cells) {
+	uint64_t* keys = (uint64_t*)DS_ArenaPush(TEMP, (index_count / 3) * sizeof(uint64_t));
+	for (uint32_t i = 0; i < index_count; i += 3) {
+		uint64_t corners[3];
+		for (int j = 0; j < 3; j++) {
+			HMM_Vec3 p = vertices[indices[i + j]].position;
+			corners[j] = (uint64_t)p.Z * (cells + 1) + (uint64_t)p.X;
+		}
+		int first = corners[1] < corners[0] ? (corners[2] < corners[1] ? 2 : 1) : (corners[2] < corners[0] ? 2 : 0);
+		keys[i / 3] = (corners[first] << 42) | (corners[(first + 1) % 3] << 21) | corners[(first + 2) % 3];
+	}
+	qsort(keys, index_count / 3, sizeof(uint64_t), CompareU64);
+	return keys;
+}
+
+// OptimizeMesh must weld the duplicated patch seams, not make the vertex cache behave worse, keep the exact set of triangles
+// with their winding, and leave the vertices numbered in the order the indices first reference them
+static void TestOptimizeMesh(bool shuffle_triangles) {
+	DS_ArenaMark mark = DS_ArenaGetMark(TEMP);
+	
+	uint32_t cells = 48;
+	Vertex* vertices;
+	uint32_t* indices;
+	uint32_t vertex_count, index_count;
+	MakeGridMesh(cells, 4, false, &vertices, &vertex_count, &indices, &index_count);
+	
+	if (shuffle_triangles) {
+		uint32_t rng = 777;
+		for (uint32_t t = index_count / 3 - 1; t > 0; t--) {
+			uint32_t other = RandomU32(&rng) % (t + 1);
+			for (int j = 0; j < 3; j++) {
+				uint32_t tmp = indices[t*3 + j];
+				indices[t*3 + j] = indices[other*3 + j];
+				indices[other*3 + j] = tmp;
+			}
+		}
+	}
+	
+	uint32_t input_vertex_count = vertex_count;
+	uint32_t input_cache_misses = CountVertexCacheMisses(TEMP, indices, index_count, vertex_count);
+	uint64_t* input_triangles = GridTriangleKeys(vertices, indices, index_count, cells);
+	
+	MeshOptimizeStats stats = OptimizeMesh(TEMP, vertices, &vertex_count, indices, index_count);
+	
+	// Weld
+	CHECK(stats.vertex_count_before == input_vertex_count);
+	CHECK(stats.vertex_count_after == vertex_count);
+	CHECK(vertex_count == (cells + 1) * (cells + 1));
+	CHECK(stats.triangle_count == index_count / 3);
+	
+	// Tipsify. The ACMR is misses divided by the triangle count, which doesn't change.
+	CHECK(stats.cache_misses_before == input_cache_misses);
+	CHECK(stats.cache_misses_after == CountVertexCacheMisses(TEMP, indices, index_count, vertex_count));
+	CHECK(stats.cache_misses_after <= stats.cache_misses_before);
+	if (shuffle_triangles) CHECK(stats.cache_misses_after * 2 < stats.cache_misses_before);
+	
+	// Reordering for fetch. Each vertex must be referenced, and first referenced right after the vertex before it.
+	uint32_t next_new_vertex = 0;
+	for (uint32_t i = 0; i < index_count; i++) {
+		CHECK(indices[i] < vertex_count);
+		CHECK(indices[i] <= next_new_vertex);
+		if (indices[i] == next_new_vertex) next_new_vertex++;
+	}
+	CHECK(next_new_vertex == vertex_count);
+	
+	// The same triangles as before, looked up through the reordered vertices
+	uint64_t* output_triangles = GridTriangleKeys(vertices, indices, index_count, cells);
+	CHECK(memcmp(input_triangles, output_triangles, (index_count / 3) * sizeof(uint64_t)) == 0);
+	
+	printf("OptimizeMesh (%s): %u -> %u vertices, ACMR %.3f -> %.3f\n", shuffle_triangles ? "shuffled" : "in order",
+		stats.vertex_count_before, stats.vertex_count_after,
+		(float)stats.cache_misses_before / (float)stats.triangle_count, (float)stats.cache_misses_after / (float)stats.triangle_count);
+	DS_ArenaSetMark(TEMP, mark);
+}
+
+// Runs BuildMeshlets on the triangles and checks that the meshlets stay within the limits, that they reproduce every input
+// triangle exactly once and in order, and that each bounding sphere contains the vertices of its meshlet
+static void CheckMeshlets(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count, uint32_t base_vertex) {
+	DS_ArenaMark mark = DS_ArenaGetMark(TEMP);
+	
+	DS_DynArray<Meshlet> meshlets = {TEMP};
+	DS_DynArray<uint32_t> meshlet_vertices = {TEMP};
+	DS_DynArray<uint8_t> meshlet_triangles = {TEMP};
+	
+	// Something already in the output arrays, as when building the meshlets of several parts one after another
+	DS_ArrPush(&meshlets, Meshlet{});
+	DS_ArrPush(&meshlet_vertices, 0u);
+	for (int i = 0; i < 3; i++) DS_ArrPush(&meshlet_triangles, (uint8_t)0);
+	
+	uint32_t meshlet_count = BuildMeshlets(TEMP, vertices, vertex_count, indices, index_count, base_vertex, &meshlets, &meshlet_vertices, &meshlet_triangles);
+	CHECK(meshlet_count == (uint32_t)meshlets.count - 1);
+	CHECK(meshlet_count >= (index_count / 3 + MESHLET_MAX_TRIANGLES - 1) / MESHLET_MAX_TRIANGLES);
+	
+	uint32_t next_vertex = 1;
+	uint32_t next_triangle = 1;
+	uint32_t index_i = 0;
+	for (uint32_t m = 1; m < (uint32_t)meshlets.count; m++) {
+		const Meshlet* meshlet = &meshlets.data[m];
+		CHECK(meshlet->vertex_count > 0 && meshlet->vertex_count <= MESHLET_MAX_VERTICES);
+		CHECK(meshlet->triangle_count > 0 && meshlet->triangle_count <= MESHLET_MAX_TRIANGLES);
+		CHECK(meshlet->first_vertex == next_vertex);
+		CHECK(meshlet->first_triangle == next_triangle);
+		next_vertex += meshlet->vertex_count;
+		next_triangle += meshlet->triangle_count;
+		if (next_vertex > (uint32_t)meshlet_vertices.count || next_triangle * 3 > (uint32_t)meshlet_triangles.count) break;
+		
+		for (uint32_t t = 0; t < meshlet->triangle_count * 3 && index_i < index_count; t++) {
+			uint8_t local = meshlet_triangles.data[meshlet->first_triangle*3 + t];
+			CHECK(local < meshlet->vertex_count);
+			CHECK(meshlet_vertices.data[meshlet->first_vertex + local] + base_vertex == indices[index_i]);
+			index_i++;
+		}
+		
+		HMM_Vec3 center = meshlet->bounding_sphere.XYZ;
+		float radius = meshlet->bounding_sphere.W;
+		for (uint32_t i = 0; i < meshlet->vertex_count; i++) {
+			uint32_t vertex = meshlet_vertices.data[meshlet->first_vertex + i];
+			CHECK(vertex < vertex_count);
+			if (vertex < vertex_count) {
+				CHECK(HMM_LenV3(HMM_SubV3(vertices[vertex].position, center)) <= radius * 1.0001f + 0.0001f);
+			}
+		}
+	}
+	CHECK(index_i == index_count);
+	CHECK(next_vertex == (uint32_t)meshlet_vertices.count);
+	CHECK(next_triangle * 3 == (uint32_t)meshlet_triangles.count);
+	
+	DS_ArenaSetMark(TEMP, mark);
+}
+
+static void TestMeshlets() {
+	DS_ArenaMark mark = DS_ArenaGetMark(TEMP);
+	
+	// An optimized grid, the way the importer builds meshlets
+	Vertex* vertices;
+	uint32_t* indices;
+	uint32_t vertex_count, index_count;
+	MakeGridMesh(64, 4, false, &vertices, &vertex_count, &indices, &index_count);
+	OptimizeMesh(TEMP, vertices, &vertex_count, indices, index_count);
+	CheckMeshlets(vertices, vertex_count, indices, index_count, 0);
+	
+	// The same indices, rebased as if the part started at vertex 1000 of a shared vertex buffer
+	uint32_t* rebased_indices = (uint32_t*)DS_ArenaPush(TEMP, index_count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < index_count; i++) rebased_indices[i] = indices[i] + 1000;
+	CheckMeshlets(vertices, vertex_count, rebased_indices, index_count, 1000);
+	
+	// Random triangles run into the vertex limit long before the triangle limit. Some of them are degenerate.
+	uint32_t rng = 4242;
+	uint32_t soup_index_count = 3000;
+	uint32_t* soup_indices = (uint32_t*)DS_ArenaPush(TEMP, soup_index_count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < soup_index_count; i++) soup_indices[i] = RandomU32(&rng) % vertex_count;
+	for (uint32_t i = 0; i < soup_index_count; i += 30) soup_indices[i + 1] = soup_indices[i];
+	CheckMeshlets(vertices, vertex_count, soup_indices, soup_index_count, 0);
+	
+	printf("Meshlets: %u vertices, %u triangles\n", vertex_count, index_count / 3);
+	DS_ArenaSetMark(TEMP, mark);
+}
+
+// Builds a LOD chain the way MergeMaterialMeshes does, on a grid with open borders and a UV seam down the middle. Each LOD
+// must get to around half of the previous one without degenerate triangles, the locked border and seam vertices must all still
+// be in use, and the error must go up with each LOD.
+static void TestSimplifyMesh() {
+	DS_ArenaMark mark = DS_ArenaGetMark(TEMP);
+	
+	uint32_t cells = 64;
+	Vertex* vertices;
+	uint32_t* indices;
+	uint32_t vertex_count, index_count;
+	MakeGridMesh(cells, 2, true, &vertices, &vertex_count, &indices, &index_count);
+	OptimizeMesh(TEMP, vertices, &vertex_count, indices, index_count);
+	CHECK(vertex_count == (cells + 1) * (cells + 2)); // the seam column stays split
+	
+	bool* locked = (bool*)DS_ArenaPushZero(TEMP, vertex_count * sizeof(bool));
+	uint32_t locked_count = 0;
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		HMM_Vec3 p = vertices[v].position;
+		locked[v] = p.X == 0.f || p.Z == 0.f || p.X == (float)cells || p.Z == (float)cells || p.X == (float)(cells / 2);
+		if (locked[v]) locked_count++;
+	}
+	CHECK(locked_count == 4 * cells + 2 + 2 * (cells - 1)); // the border with both ends of the seam doubled, and the rest of the seam
+	
+	uint32_t* lod_indices = indices;
+	uint32_t lod_index_count = index_count;
+	float lod_error = 0.f;
+	float prev_error = 0.f;
+	bool* used = (bool*)DS_ArenaPush(TEMP, vertex_count * sizeof(bool));
+	printf("SimplifyMesh: %u -> ", index_count / 3);
+	int lod_count = 1;
+	for (; lod_count < MESH_LOD_MAX_COUNT; lod_count++) {
+		uint32_t target_index_count = lod_index_count / 2;
+		uint32_t* next_indices = (uint32_t*)DS_ArenaPush(TEMP, lod_index_count * sizeof(uint32_t));
+		float error;
+		uint32_t next_index_count = SimplifyMesh(TEMP, vertices, vertex_count, lod_indices, lod_index_count, target_index_count, next_indices, &error);
+		CHECK(next_index_count % 3 == 0);
+		CHECK(next_index_count <= target_index_count + target_index_count / 10);
+		CHECK(next_index_count >= target_index_count - target_index_count / 10);
+		CHECK(error > 0.f);
+		CHECK(error >= prev_error); // the coarser the input, the more each halving costs
+		
+		memset(used, 0, vertex_count * sizeof(bool));
+		for (uint32_t i = 0; i < next_index_count; i += 3) {
+			uint32_t a = next_indices[i], b = next_indices[i + 1], c = next_indices[i + 2];
+			CHECK(a < vertex_count && b < vertex_count && c < vertex_count);
+			if (a >= vertex_count || b >= vertex_count || c >= vertex_count) break;
+			CHECK(a != b && b != c && c != a);
+			HMM_Vec3 normal = HMM_Cross(HMM_SubV3(vertices[b].position, vertices[a].position), HMM_SubV3(vertices[c].position, vertices[a].position));
+			CHECK(HMM_LenV3(normal) > 0.f);
+			used[a] = used[b] = used[c] = true;
+		}
+		for (uint32_t v = 0; v < vertex_count; v++) {
+			if (locked[v]) CHECK(used[v]);
+		}
+		
+		lod_indices = next_indices;
+		lod_index_count = next_index_count;
+		prev_error = error;
+		CHECK(lod_error + error > lod_error); // what the importer stores as the LOD error
+		lod_error += error;
+		printf("%u", lod_index_count / 3);
+		if (lod_count + 1 < MESH_LOD_MAX_COUNT) printf(" -> ");
+	}
+	printf(" triangles, error %.3f\n", lod_error);
+	
+	DS_ArenaSetMark(TEMP, mark);
+}
+
+// Times the SSE path of ConvertAssimpVertices against the scalar one on a mesh that's much bigger than the caches, the way
+// the big meshes of a scene are. The best of a few runs is taken for both, and the outputs must match exactly.
+static void BenchmarkVertexConversion() {
+	uint32_t rng = 6789;
+	uint32_t vertex_count = 1000000;
+	int run_count = 10;
+	aiMesh* mesh = MakeSyntheticMesh(&rng, vertex_count);
+	HMM_Vec3 offset = HMM_V3(1.f, -2.f, 3.f);
+	float scale = 0.5f;
+
+	Vertex* sse_vertices = new Vertex[vertex_count];
+	Vertex* scalar_vertices = new Vertex[vertex_count];
+	memset(sse_vertices, 0, vertex_count * sizeof(Vertex));
+	memset(scalar_vertices, 0xFF, vertex_count * sizeof(Vertex));
+
+	uint64_t cpu_frequency = OS_GetCPUFrequency();
+	double sse_duration = 1000000.0;
+	double scalar_duration = 1000000.0;
+	for (int run = 0; run < run_count; run++) {
+		uint64_t start_tick = OS_GetCPUTick();
+		ConvertAssimpVertices(mesh, offset, scale, sse_vertices);
+		uint64_t middle_tick = OS_GetCPUTick();
+		ConvertAssimpVerticesScalar(mesh, 0, offset, scale, scalar_vertices);
+		uint64_t end_tick = OS_GetCPUTick();
+		
+		double sse_run_duration = OS_GetDuration(cpu_frequency, start_tick, middle_tick);
+		double scalar_run_duration = OS_GetDuration(cpu_frequency, middle_tick, end_tick);
+		if (sse_run_duration < sse_duration) sse_duration = sse_run_duration;
+		if (scalar_run_duration < scalar_duration) scalar_duration = scalar_run_duration;
+	}
+
+	CHECK(memcmp(sse_vertices, scalar_vertices, vertex_count * sizeof(Vertex)) == 0);
+
+	printf("Vertex conversion benchmark: %u vertices, best of %d runs\n", vertex_count, run_count);
+	printf("  SSE:      %.2f ns per vertex\n", sse_duration * 1000000000.0 / (double)vertex_count);
+	printf("  scalar:   %.2f ns per vertex\n", scalar_duration * 1000000000.0 / (double)vertex_count);
+	printf("  speedup:  %.2fx\n", scalar_duration / sse_duration);
+
+	delete[] sse_vertices;
+	delete[] scalar_vertices;
+	delete mesh;
+}
+
+int main(int argc, char** argv) {
+	DS_Arena temp_arena;
+	DS_ArenaInit(&temp_arena, DS_MIB(1), DS_HEAP);
+	TEMP = &temp_arena;
+
+	aiScene* synthetic_scene = MakeSyntheticScene(200, 3);
+	TestParallelConversion(synthetic_scene, "the synthetic scene");
+	FreeSyntheticScene(synthetic_scene);
+	
+	TestOptimizeMesh(false);
+	TestOptimizeMesh(true);
+	TestMeshlets();
+	TestSimplifyMesh();
+
+	if (argc > 1) {
+		// The same import flags as ImportMeshWithAssimp without LoadMeshFlag_KeepInstances
+		const aiScene* scene = aiImportFile(argv[1], aiProcess_Triangulate|aiProcess_GlobalScale|aiProcess_CalcTangentSpace|aiProcess_PreTransformVertices);
+		CHECK(scene != NULL);
+		if (scene) {
+			TestParallelConversion(scene, argv[1]);
+			aiReleaseImport(scene);
+		}
+	}
+
+	BenchmarkVertexConversion();
+
+	printf("%s\n", FAILED_CHECK_COUNT == 0 ? "All checks passed." : "Some checks failed!");
+	DS_ArenaDeinit(&temp_arena);
+	return FAILED_CHECK_COUNT;
+}
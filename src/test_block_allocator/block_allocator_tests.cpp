@@ -0,0 +1,383 @@
+// Tests and a fragmentation benchmark for the GPU block allocator, see gpu/gpu_block_allocator.h. The blocks are only counted
+// and never backed by memory, so this runs without a GPU.
+//
+// Usage: BlockAllocatorTests
+//
+// Prints every failed check, followed by the benchmark results. The exit code is the number of failed checks.
+
+#include "fire/fire_ds.h"
+
+#define FIRE_OS_TIMING_IMPLEMENTATION
+#include "fire/fire_os_timing.h"
+
+#include "gpu/gpu_block_allocator.h"
+
+#include <stdio.h>
+
+#define BLOCK_SIZE DS_MIB(64)
+
+static int FAILED_CHECK_COUNT;
+
+#define CHECK(x) if (!(x)) { printf("FAILED: %s (%s:%d)\n", #x, __FILE__, __LINE__); FAILED_CHECK_COUNT++; }
+
+// Stands in for the memory pools of gpu_vulkan.c. Handing out more than `budget` bytes of blocks fails, like vkAllocateMemory
+// would when the heap is full. The handles are indices into `block_sizes`, plus one so that they're never NULL.
+struct FakeBlocks {
+	uint64_t budget;
+	uint64_t allocated_bytes;
+	uint32_t live_block_count;
+	DS_DynArray<uint64_t> block_sizes;
+};
+
+static bool AllocateFakeBlock(void* user_data, uint64_t size, void** out_handle) {
+	FakeBlocks* blocks = (FakeBlocks*)user_data;
+	if (blocks->allocated_bytes + size > blocks->budget) return false;
+	blocks->allocated_bytes += size;
+	blocks->live_block_count++;
+	DS_ArrPush(&blocks->block_sizes, size);
+	*out_handle = (void*)(uintptr_t)blocks->block_sizes.count;
+	return true;
+}
+
+static void FreeFakeBlock(void* user_data, void* handle) {
+	FakeBlocks* blocks = (FakeBlocks*)user_data;
+	int block_i = (int)(uintptr_t)handle - 1;
+	CHECK(block_i >= 0 && block_i < blocks->block_sizes.count && blocks->block_sizes[block_i] > 0);
+	blocks->allocated_bytes -= blocks->block_sizes[block_i];
+	blocks->block_sizes[block_i] = 0; // freeing the same block twice fails the check above
+	blocks->live_block_count--;
+}
+
+struct TestContext {
+	FakeBlocks blocks;
+	GPU_BlockAllocator allocator;
+};
+
+static void InitTest(TestContext* ctx, uint64_t budget) {
+	ctx->blocks = {};
+	ctx->blocks.budget = budget;
+	DS_ArrInit(&ctx->blocks.block_sizes, DS_HEAP);
+	GPU_BlockAllocatorInit(&ctx->allocator, BLOCK_SIZE, AllocateFakeBlock, FreeFakeBlock, &ctx->blocks);
+}
+
+static void DeinitTest(TestContext* ctx) {
+	GPU_BlockAllocatorDeinit(&ctx->allocator);
+	CHECK(ctx->blocks.live_block_count == 0 && ctx->blocks.allocated_bytes == 0);
+	DS_ArrDeinit(&ctx->blocks.block_sizes);
+}
+
+// Walks the ranges of every block and checks that they tile it exactly, and that no two free ranges are next to each other.
+static void CheckBlockRanges(const GPU_BlockAllocator* allocator) {
+	for (uint32_t block_i = 0; block_i < (uint32_t)allocator->blocks.count; block_i++) {
+		GPU_AllocatorBlock block = DS_ArrGet(allocator->blocks, block_i);
+		if (block.handle == NULL) continue;
+
+		uint32_t first = GPU_BLOCK_NIL;
+		for (uint32_t r = 0; r < (uint32_t)allocator->ranges.count; r++) {
+			GPU_BlockRange range = DS_ArrGet(allocator->ranges, r);
+			if (range.block == block_i && range.size > 0 && range.prev_in_block == GPU_BLOCK_NIL && range.offset == 0) {
+				first = r;
+				break;
+			}
+		}
+		CHECK(first != GPU_BLOCK_NIL);
+		if (first == GPU_BLOCK_NIL) continue;
+
+		uint64_t end = 0;
+		uint32_t allocation_count = 0;
+		bool prev_is_free = false;
+		for (uint32_t r = first; r != GPU_BLOCK_NIL; r = DS_ArrGet(allocator->ranges, r).next_in_block) {
+			GPU_BlockRange range = DS_ArrGet(allocator->ranges, r);
+			CHECK(range.block == block_i);
+			CHECK(range.offset == end);
+			CHECK(range.size > 0);
+			CHECK(!(prev_is_free && range.is_free)); // free neighbours must have been merged
+			if (!range.is_free) allocation_count++;
+			prev_is_free = range.is_free;
+			end = range.offset + range.size;
+		}
+		CHECK(end == block.size);
+		CHECK(allocation_count == block.allocation_count);
+	}
+}
+
+// Checks that none of the allocations overlap, given that they're all `size` bytes
+static void CheckNoOverlap(const GPU_BlockAllocation* allocations, uint32_t count, uint64_t size) {
+	for (uint32_t i = 0; i < count; i++) {
+		for (uint32_t j = i + 1; j < count; j++) {
+			if (allocations[i].block != allocations[j].block) continue;
+			bool disjoint = allocations[i].offset + size <= allocations[j].offset || allocations[j].offset + size <= allocations[i].offset;
+			CHECK(disjoint);
+		}
+	}
+}
+
+static void TestAllocFree() {
+	TestContext ctx;
+	InitTest(&ctx, DS_GIB(1));
+
+	GPU_BlockAllocation allocations[64];
+	for (uint32_t i = 0; i < DS_ArrayCount(allocations); i++) {
+		CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, DS_KIB(64), 1, &allocations[i]));
+	}
+	CheckNoOverlap(allocations, (uint32_t)DS_ArrayCount(allocations), DS_KIB(64));
+	CheckBlockRanges(&ctx.allocator);
+
+	GPU_BlockAllocatorStats stats = GPU_BlockAllocatorGetStats(&ctx.allocator);
+	CHECK(stats.block_count == 1);
+	CHECK(stats.block_bytes == BLOCK_SIZE);
+	CHECK(stats.allocation_count == DS_ArrayCount(allocations));
+	CHECK(stats.allocated_bytes == DS_ArrayCount(allocations) * DS_KIB(64));
+
+	// Free every other one, then the rest
+	for (uint32_t i = 0; i < DS_ArrayCount(allocations); i += 2) GPU_BlockAllocatorFree(&ctx.allocator, allocations[i].range);
+	CheckBlockRanges(&ctx.allocator);
+	for (uint32_t i = 1; i < DS_ArrayCount(allocations); i += 2) GPU_BlockAllocatorFree(&ctx.allocator, allocations[i].range);
+	CheckBlockRanges(&ctx.allocator);
+
+	stats = GPU_BlockAllocatorGetStats(&ctx.allocator);
+	CHECK(stats.allocation_count == 0);
+	CHECK(stats.allocated_bytes == 0);
+	CHECK(stats.block_count == 1); // one empty block is kept around
+	CHECK(stats.free_range_count == 1);
+	CHECK(stats.largest_free_range == BLOCK_SIZE);
+
+	// The range slots are reused, so allocating the same again doesn't grow anything
+	int32_t range_slot_count = ctx.allocator.ranges.count;
+	for (uint32_t i = 0; i < DS_ArrayCount(allocations); i++) {
+		CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, DS_KIB(64), 1, &allocations[i]));
+	}
+	CHECK(ctx.allocator.ranges.count == range_slot_count);
+	CHECK(ctx.blocks.live_block_count == 1);
+
+	DeinitTest(&ctx);
+}
+
+static void TestAlignment() {
+	TestContext ctx;
+	InitTest(&ctx, DS_GIB(1));
+
+	// Odd sizes in between, so that the next allocation always starts misaligned
+	uint64_t alignments[] = {1, 2, 4, 16, 256, 4096, DS_KIB(64), DS_MIB(1)};
+	GPU_BlockAllocation allocations[DS_ArrayCount(alignments) * 2];
+	for (uint32_t i = 0; i < DS_ArrayCount(alignments); i++) {
+		GPU_BlockAllocation* odd = &allocations[i*2];
+		GPU_BlockAllocation* aligned = &allocations[i*2 + 1];
+		CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, 3, 1, odd));
+		CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, 1000, alignments[i], aligned));
+		CHECK(aligned->offset % alignments[i] == 0);
+	}
+	CheckBlockRanges(&ctx.allocator);
+
+	// The padding in front of the aligned allocations is free, so small allocations should fill it instead of going at the end
+	GPU_BlockAllocatorStats before = GPU_BlockAllocatorGetStats(&ctx.allocator);
+	CHECK(before.free_range_count > 1);
+	GPU_BlockAllocation filler;
+	CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, 8, 1, &filler));
+	CHECK(filler.offset < allocations[DS_ArrayCount(allocations) - 1].offset);
+
+	GPU_BlockAllocatorFree(&ctx.allocator, filler.range);
+	for (uint32_t i = 0; i < DS_ArrayCount(allocations); i++) GPU_BlockAllocatorFree(&ctx.allocator, allocations[i].range);
+	CheckBlockRanges(&ctx.allocator);
+	CHECK(GPU_BlockAllocatorGetStats(&ctx.allocator).free_range_count == 1);
+
+	// An alignment as big as the block itself
+	GPU_BlockAllocation whole;
+	CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, 1, BLOCK_SIZE, &whole));
+	CHECK(whole.offset % BLOCK_SIZE == 0);
+	GPU_BlockAllocatorFree(&ctx.allocator, whole.range);
+
+	DeinitTest(&ctx);
+}
+
+static void TestBlockExhaustion() {
+	TestContext ctx;
+	InitTest(&ctx, BLOCK_SIZE * 2);
+
+	// Two blocks fit in the budget, the third one doesn't
+	GPU_BlockAllocation allocations[8];
+	for (uint32_t i = 0; i < DS_ArrayCount(allocations); i++) {
+		CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, BLOCK_SIZE / 4, 1, &allocations[i]));
+	}
+	CHECK(ctx.blocks.live_block_count == 2);
+
+	GPU_BlockAllocation failed;
+	CHECK(!GPU_BlockAllocatorAlloc(&ctx.allocator, 1, 1, &failed));
+	CHECK(GPU_BlockAllocatorGetStats(&ctx.allocator).allocation_count == DS_ArrayCount(allocations));
+	CheckBlockRanges(&ctx.allocator);
+
+	// Once there's room again, the freed range is reused without a new block
+	GPU_BlockAllocatorFree(&ctx.allocator, allocations[5].range);
+	CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, BLOCK_SIZE / 4, 1, &allocations[5]));
+	CHECK(ctx.blocks.live_block_count == 2);
+
+	// Emptying a block keeps it for the next allocation. Emptying the second one too gives one of them back.
+	for (uint32_t i = 0; i < 4; i++) GPU_BlockAllocatorFree(&ctx.allocator, allocations[i].range);
+	CHECK(ctx.blocks.live_block_count == 2);
+	for (uint32_t i = 4; i < 8; i++) GPU_BlockAllocatorFree(&ctx.allocator, allocations[i].range);
+	CHECK(ctx.blocks.live_block_count == 1);
+	CheckBlockRanges(&ctx.allocator);
+
+	// A new block has to fit in the budget too, even if it's only needed for a single allocation
+	GPU_BlockAllocation big;
+	CHECK(!GPU_BlockAllocatorAlloc(&ctx.allocator, BLOCK_SIZE * 2, 1, &big));
+	CHECK(ctx.blocks.live_block_count == 1);
+
+	DeinitTest(&ctx);
+}
+
+static void TestBigAllocation() {
+	TestContext ctx;
+	InitTest(&ctx, DS_GIB(1));
+
+	// Allocations bigger than block_size get a bigger block, which is given back like any other once it's empty
+	GPU_BlockAllocation small, big;
+	CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, 16, 1, &small));
+	CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, BLOCK_SIZE + 1, DS_KIB(64), &big));
+	CHECK(big.block != small.block);
+	CHECK(big.offset % DS_KIB(64) == 0);
+
+	GPU_BlockAllocatorStats stats = GPU_BlockAllocatorGetStats(&ctx.allocator);
+	CHECK(stats.block_count == 2);
+	CHECK(stats.block_bytes >= BLOCK_SIZE * 2 + 1);
+	CheckBlockRanges(&ctx.allocator);
+
+	GPU_BlockAllocatorFree(&ctx.allocator, small.range);
+	GPU_BlockAllocatorFree(&ctx.allocator, big.range);
+	CHECK(GPU_BlockAllocatorGetStats(&ctx.allocator).block_count == 1);
+
+	DeinitTest(&ctx);
+}
+
+static void TestCoalescing() {
+	TestContext ctx;
+	InitTest(&ctx, DS_GIB(1));
+
+	// Every order of freeing three neighbours should end with the block in one piece
+	uint32_t orders[][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+	for (uint32_t order_i = 0; order_i < DS_ArrayCount(orders); order_i++) {
+		GPU_BlockAllocation allocations[3];
+		for (uint32_t i = 0; i < 3; i++) {
+			CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, DS_MIB(1), 1, &allocations[i]));
+		}
+		CHECK(allocations[1].offset == allocations[0].offset + DS_MIB(1));
+		CHECK(allocations[2].offset == allocations[1].offset + DS_MIB(1));
+
+		for (uint32_t i = 0; i < 3; i++) {
+			GPU_BlockAllocatorFree(&ctx.allocator, allocations[orders[order_i][i]].range);
+			CheckBlockRanges(&ctx.allocator);
+		}
+		GPU_BlockAllocatorStats stats = GPU_BlockAllocatorGetStats(&ctx.allocator);
+		CHECK(stats.free_range_count == 1);
+		CHECK(stats.largest_free_range == BLOCK_SIZE);
+	}
+
+	// Freeing the middle one of three leaves a hole that an allocation of exactly that size fills again
+	GPU_BlockAllocation a, b, c;
+	CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, DS_MIB(1), 1, &a));
+	CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, DS_MIB(1), 1, &b));
+	CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, DS_MIB(1), 1, &c));
+	uint64_t hole_offset = b.offset;
+	GPU_BlockAllocatorFree(&ctx.allocator, b.range);
+	CHECK(GPU_BlockAllocatorGetStats(&ctx.allocator).free_range_count == 2);
+	CHECK(GPU_BlockAllocatorAlloc(&ctx.allocator, DS_MIB(1), 1, &b));
+	CHECK(b.offset == hole_offset);
+	CHECK(GPU_BlockAllocatorGetStats(&ctx.allocator).free_range_count == 1);
+
+	GPU_BlockAllocatorFree(&ctx.allocator, a.range);
+	GPU_BlockAllocatorFree(&ctx.allocator, b.range);
+	GPU_BlockAllocatorFree(&ctx.allocator, c.range);
+	DeinitTest(&ctx);
+}
+
+static uint32_t RandomU32(uint32_t* state) { // xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// Allocates and frees resource-like sizes in random order, the way streaming textures and meshes in and out would, and reports
+// how long that takes and how fragmented the blocks end up.
+static void BenchmarkFragmentation() {
+	TestContext ctx;
+	InitTest(&ctx, ~0ull);
+
+	const uint32_t live_count = 4096;
+	const uint32_t op_count = 1000000;
+	GPU_BlockAllocation* live = (GPU_BlockAllocation*)DS_MemAlloc(DS_HEAP, live_count * sizeof(GPU_BlockAllocation));
+	bool* is_live = (bool*)DS_MemAlloc(DS_HEAP, live_count * sizeof(bool));
+	memset(is_live, 0, live_count * sizeof(bool));
+
+	uint32_t rng = 12345;
+	uint64_t peak_block_bytes = 0;
+	double worst_usage = 1.0;
+
+	uint64_t cpu_frequency = OS_GetCPUFrequency();
+	uint64_t start_tick = OS_GetCPUTick();
+	uint64_t stats_ticks = 0;
+	for (uint32_t op = 0; op < op_count; op++) {
+		uint32_t slot = RandomU32(&rng) % live_count;
+		if (is_live[slot]) {
+			GPU_BlockAllocatorFree(&ctx.allocator, live[slot].range);
+			is_live[slot] = false;
+			continue;
+		}
+
+		// Mostly small buffers, some textures and a few big ones, with the alignments that Vulkan typically asks for
+		uint32_t r = RandomU32(&rng);
+		uint64_t size = (r % 100) < 70 ? 256 + (RandomU32(&rng) % DS_KIB(64)) :
+		                (r % 100) < 97 ? DS_KIB(64) + (RandomU32(&rng) % DS_MIB(4)) :
+		                                 DS_MIB(4) + (RandomU32(&rng) % DS_MIB(32));
+		uint64_t alignment = (r % 100) < 70 ? 256 : DS_KIB(64);
+
+		bool ok = GPU_BlockAllocatorAlloc(&ctx.allocator, size, alignment, &live[slot]);
+		CHECK(ok);
+		is_live[slot] = ok;
+
+		if (op % 1024 == 0) { // walking the free lists is slow, so this is left out of the timing
+			uint64_t stats_start_tick = OS_GetCPUTick();
+			GPU_BlockAllocatorStats stats = GPU_BlockAllocatorGetStats(&ctx.allocator);
+			if (stats.block_bytes > peak_block_bytes) peak_block_bytes = stats.block_bytes;
+			if (op > op_count / 10) { // skip the warm-up
+				double usage = (double)stats.allocated_bytes / (double)stats.block_bytes;
+				if (usage < worst_usage) worst_usage = usage;
+			}
+			stats_ticks += OS_GetCPUTick() - stats_start_tick;
+		}
+	}
+	double duration = OS_GetDuration(cpu_frequency, start_tick + stats_ticks, OS_GetCPUTick());
+
+	CheckBlockRanges(&ctx.allocator);
+	GPU_BlockAllocatorStats stats = GPU_BlockAllocatorGetStats(&ctx.allocator);
+
+	printf("Fragmentation benchmark: %u random allocs/frees of up to %u live allocations\n", op_count, live_count);
+	printf("  time:                %.1f ns per operation\n", duration * 1000000000.0 / (double)op_count);
+	printf("  blocks at the end:   %u (%.1f MiB, peak %.1f MiB)\n", stats.block_count, (double)stats.block_bytes / DS_MIB(1), (double)peak_block_bytes / DS_MIB(1));
+	printf("  allocated:           %.1f MiB in %u allocations\n", (double)stats.allocated_bytes / DS_MIB(1), stats.allocation_count);
+	printf("  usage:               %.1f%% at the end, %.1f%% at worst\n", 100.0 * (double)stats.allocated_bytes / (double)stats.block_bytes, 100.0 * worst_usage);
+	printf("  free ranges:         %u, the largest %.1f MiB\n", stats.free_range_count, (double)stats.largest_free_range / DS_MIB(1));
+
+	for (uint32_t i = 0; i < live_count; i++) {
+		if (is_live[i]) GPU_BlockAllocatorFree(&ctx.allocator, live[i].range);
+	}
+	CHECK(GPU_BlockAllocatorGetStats(&ctx.allocator).block_count == 1);
+	CheckBlockRanges(&ctx.allocator);
+
+	DS_MemFree(DS_HEAP, live);
+	DS_MemFree(DS_HEAP, is_live);
+	DeinitTest(&ctx);
+}
+
+int main() {
+	TestAllocFree();
+	TestAlignment();
+	TestBlockExhaustion();
+	TestBigAllocation();
+	TestCoalescing();
+	printf("%s\n", FAILED_CHECK_COUNT == 0 ? "All checks passed." : "Some checks failed!");
+
+	BenchmarkFragmentation();
+	return FAILED_CHECK_COUNT;
+}
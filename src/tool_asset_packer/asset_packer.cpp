@@ -0,0 +1,177 @@
+// Packs every file in a directory tree into a single asset archive. See demo_pbr_renderer/asset_archive.h for the format.
+//
+// Usage: AssetPacker <directory> <output file>
+// e.g.   AssetPacker ../resources ../resources/assets.pack
+//
+// Cooked meshes ("*.cooked") are packed like any other file, so run the renderer once before packing to have them included.
+
+#include "fire/fire_ds.h"
+#include "fire/fire_string.h"
+
+#include "demo_pbr_renderer/asset_archive.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <stdio.h>
+
+#define COPY_CHUNK_SIZE DS_MIB(4)
+
+struct PackedFile {
+	STR_View filepath; // where to read the file from
+	STR_View relative_path; // lowercase, relative to the packed directory
+	uint64_t size;
+	uint64_t data_offset;
+};
+
+static bool IsSameFile(DS_Arena* arena, STR_View a, STR_View b) {
+	char full_a[MAX_PATH], full_b[MAX_PATH];
+	if (GetFullPathNameA(STR_ToC(arena, a), MAX_PATH, full_a, NULL) == 0) return false;
+	if (GetFullPathNameA(STR_ToC(arena, b), MAX_PATH, full_b, NULL) == 0) return false;
+	return STR_MatchCaseInsensitive(STR_ToV(full_a), STR_ToV(full_b));
+}
+
+static void GatherFiles(DS_Arena* arena, STR_View directory, STR_View relative_directory, STR_View skip_filepath, DS_DynArray<PackedFile>* out_files) {
+	WIN32_FIND_DATAA find_data;
+	HANDLE find = FindFirstFileA(STR_ToC(arena, STR_Form(arena, "%v/*", directory)), &find_data);
+	if (find == INVALID_HANDLE_VALUE) return;
+
+	do {
+		STR_View name = STR_ToV(find_data.cFileName);
+		if (STR_Match(name, ".") || STR_Match(name, "..")) continue;
+
+		STR_View filepath = STR_Form(arena, "%v/%v", directory, name);
+		STR_View relative_path = relative_directory.size > 0 ? STR_Form(arena, "%v/%v", relative_directory, name) : STR_Form(arena, "%v", name);
+
+		if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			GatherFiles(arena, filepath, relative_path, skip_filepath, out_files);
+			continue;
+		}
+		if (IsSameFile(arena, filepath, skip_filepath)) continue;
+
+		PackedFile file = {};
+		file.filepath = filepath;
+		file.relative_path = STR_ToLower(arena, relative_path);
+		file.size = ((uint64_t)find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow;
+		DS_ArrPush(out_files, file);
+	} while (FindNextFileA(find, &find_data));
+
+	FindClose(find);
+}
+
+static bool WritePadding(FILE* f, uint64_t* offset, uint64_t to_offset) {
+	static const char zeros[ASSET_ARCHIVE_ALIGNMENT] = {};
+	uint64_t padding = to_offset - *offset;
+	*offset = to_offset;
+	return fwrite(zeros, 1, padding, f) == padding;
+}
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		printf("Usage: AssetPacker <directory> <output file>\n");
+		return 1;
+	}
+
+	DS_Arena arena;
+	DS_ArenaInit(&arena, DS_KIB(64), DS_HEAP);
+
+	STR_View directory = STR_ToV(argv[1]);
+	STR_View output_filepath = STR_ToV(argv[2]);
+
+	DS_DynArray<PackedFile> files = {&arena};
+	GatherFiles(&arena, directory, {}, output_filepath, &files);
+
+	uint32_t file_count = (uint32_t)files.count;
+	uint32_t slot_count = 1;
+	while (slot_count < file_count * 2) slot_count *= 2; // keep the table at most half full
+
+	AssetArchiveHeader header = {};
+	header.magic = ASSET_ARCHIVE_MAGIC;
+	header.version = ASSET_ARCHIVE_VERSION;
+	header.slot_count = slot_count;
+	header.file_count = file_count;
+	header.entries_offset = sizeof(AssetArchiveHeader);
+	header.strings_offset = header.entries_offset + slot_count * sizeof(AssetArchiveEntry);
+	for (uint32_t i = 0; i < file_count; i++) {
+		header.string_data_size += files[i].relative_path.size;
+	}
+
+	AssetArchiveEntry* entries = (AssetArchiveEntry*)DS_ArenaPushZero(&arena, slot_count * sizeof(AssetArchiveEntry));
+	char* string_data = DS_ArenaPush(&arena, header.string_data_size);
+
+	uint64_t data_offset = header.strings_offset + header.string_data_size;
+	uint32_t string_offset = 0;
+	for (uint32_t i = 0; i < file_count; i++) {
+		PackedFile* file = &files[i];
+		data_offset = DS_AlignUpPow2(data_offset, ASSET_ARCHIVE_ALIGNMENT);
+		file->data_offset = data_offset;
+		data_offset += file->size;
+
+		uint64_t path_hash = AssetArchivePathHash(file->relative_path);
+		uint32_t slot = (uint32_t)path_hash & (slot_count - 1);
+		while (entries[slot].path_size != 0) {
+			STR_View other_path = {string_data + entries[slot].path_offset, entries[slot].path_size};
+			if (STR_Match(other_path, file->relative_path)) {
+				printf("ERROR: \"%.*s\" is in the directory twice (paths are case-insensitive).\n", (int)other_path.size, other_path.data);
+				return 1;
+			}
+			slot = (slot + 1) & (slot_count - 1);
+		}
+
+		memcpy(string_data + string_offset, file->relative_path.data, file->relative_path.size);
+
+		AssetArchiveEntry* entry = &entries[slot];
+		entry->path_hash = path_hash;
+		entry->data_offset = file->data_offset;
+		entry->data_size = file->size;
+		entry->path_offset = string_offset;
+		entry->path_size = (uint32_t)file->relative_path.size;
+		string_offset += (uint32_t)file->relative_path.size;
+	}
+
+	FILE* f = NULL;
+	fopen_s(&f, STR_ToC(&arena, output_filepath), "wb");
+	if (f == NULL) {
+		printf("ERROR: failed to open \"%s\" for writing.\n", argv[2]);
+		return 1;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && fwrite(entries, sizeof(AssetArchiveEntry), slot_count, f) == slot_count;
+	ok = ok && fwrite(string_data, 1, header.string_data_size, f) == header.string_data_size;
+
+	// Copy the files over in chunks, so that big files don't need to fit in memory.
+	char* chunk = DS_ArenaPush(&arena, COPY_CHUNK_SIZE);
+	uint64_t offset = header.strings_offset + header.string_data_size;
+
+	for (uint32_t i = 0; i < file_count && ok; i++) {
+		PackedFile* file = &files[i];
+		ok = WritePadding(f, &offset, file->data_offset);
+
+		FILE* src = NULL;
+		fopen_s(&src, STR_ToC(&arena, file->filepath), "rb");
+		if (src == NULL) {
+			printf("ERROR: failed to open \"%.*s\".\n", (int)file->filepath.size, file->filepath.data);
+			ok = false;
+			break;
+		}
+
+		for (uint64_t remaining = file->size; remaining > 0 && ok;) {
+			size_t chunk_size = (size_t)(remaining < COPY_CHUNK_SIZE ? remaining : COPY_CHUNK_SIZE);
+			ok = fread(chunk, 1, chunk_size, src) == chunk_size && fwrite(chunk, 1, chunk_size, f) == chunk_size;
+			remaining -= chunk_size;
+		}
+		offset += file->size;
+		fclose(src);
+	}
+	fclose(f);
+
+	if (!ok) {
+		printf("ERROR: failed to write \"%s\".\n", argv[2]);
+		return 1;
+	}
+
+	printf("Packed %u files (%.1f MiB) into \"%s\".\n", file_count, (double)offset / (1024.0 * 1024.0), argv[2]);
+	DS_ArenaDeinit(&arena);
+	return 0;
+}
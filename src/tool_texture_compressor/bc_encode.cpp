@@ -0,0 +1,495 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h> // FLT_MAX
+#include <xmmintrin.h> // SSE
+
+#include "bc_encode.h"
+
+// The pixels of a block as floats in [0, 255], both row by row for fitting the endpoints, and split by channel
+// into groups of 4 pixels for the SIMD index search. Unused channels are zero.
+struct Block {
+	int channel_count;
+	float px[16][4];
+	__m128 soa[4][4]; // [channel][group of 4 pixels]
+};
+
+static void LoadBlock(const uint8_t pixels[16*4], const int* channels, int channel_count, Block* out) {
+	alignas(16) float soa[4][16] = {};
+	memset(out->px, 0, sizeof(out->px));
+	out->channel_count = channel_count;
+
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < channel_count; c++) {
+			float value = (float)pixels[i*4 + channels[c]];
+			out->px[i][c] = value;
+			soa[c][i] = value;
+		}
+	}
+	for (int c = 0; c < 4; c++) {
+		for (int group = 0; group < 4; group++) out->soa[c][group] = _mm_load_ps(&soa[c][group*4]);
+	}
+}
+
+static float Clamp255(float value) {
+	return value < 0.f ? 0.f : value > 255.f ? 255.f : value;
+}
+
+// Picks the closest palette entry for every pixel, 4 pixels at a time. Returns the total squared error.
+static float FindClosestIndices(const Block* block, const float (*palette)[4], int palette_size, uint8_t out_indices[16]) {
+	__m128 total_error = _mm_setzero_ps();
+	for (int group = 0; group < 4; group++) {
+		__m128 best_error = _mm_set1_ps(FLT_MAX);
+		__m128 best_index = _mm_setzero_ps();
+
+		for (int i = 0; i < palette_size; i++) {
+			__m128 error = _mm_setzero_ps();
+			for (int c = 0; c < block->channel_count; c++) {
+				__m128 diff = _mm_sub_ps(block->soa[c][group], _mm_set1_ps(palette[i][c]));
+				error = _mm_add_ps(error, _mm_mul_ps(diff, diff));
+			}
+			__m128 closer = _mm_cmplt_ps(error, best_error);
+			best_error = _mm_min_ps(error, best_error);
+			best_index = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)i)), _mm_andnot_ps(closer, best_index));
+		}
+		total_error = _mm_add_ps(total_error, best_error);
+
+		alignas(16) float indices[4];
+		_mm_store_ps(indices, best_index);
+		for (int j = 0; j < 4; j++) out_indices[group*4 + j] = (uint8_t)indices[j];
+	}
+
+	alignas(16) float errors[4];
+	_mm_store_ps(errors, total_error);
+	return errors[0] + errors[1] + errors[2] + errors[3];
+}
+
+// Endpoints at the extremes of the block's colors along their principal axis, which is found by power iteration on the
+// covariance matrix.
+static void FitEndpointsPCA(const Block* block, float e0[4], float e1[4]) {
+	int n = block->channel_count;
+	float mean[4] = {};
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < n; c++) mean[c] += block->px[i][c] * (1.f / 16.f);
+	}
+
+	float cov[4][4] = {};
+	for (int i = 0; i < 16; i++) {
+		for (int a = 0; a < n; a++) {
+			for (int b = 0; b < n; b++) cov[a][b] += (block->px[i][a] - mean[a]) * (block->px[i][b] - mean[b]);
+		}
+	}
+
+	// Start from the channel with the largest variance
+	float axis[4] = {};
+	int largest = 0;
+	for (int c = 1; c < n; c++) {
+		if (cov[c][c] > cov[largest][largest]) largest = c;
+	}
+	axis[largest] = 1.f;
+
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = {};
+		float length_sq = 0.f;
+		for (int a = 0; a < n; a++) {
+			for (int b = 0; b < n; b++) next[a] += cov[a][b] * axis[b];
+			length_sq += next[a] * next[a];
+		}
+		if (length_sq < 1e-12f) break; // a solid block
+		float inv_length = 1.f / sqrtf(length_sq);
+		for (int c = 0; c < n; c++) axis[c] = next[c] * inv_length;
+	}
+
+	float t_min = FLT_MAX, t_max = -FLT_MAX;
+	for (int i = 0; i < 16; i++) {
+		float t = 0.f;
+		for (int c = 0; c < n; c++) t += (block->px[i][c] - mean[c]) * axis[c];
+		if (t < t_min) t_min = t;
+		if (t > t_max) t_max = t;
+	}
+	for (int c = 0; c < 4; c++) {
+		e0[c] = c < n ? Clamp255(mean[c] + axis[c] * t_min) : 0.f;
+		e1[c] = c < n ? Clamp255(mean[c] + axis[c] * t_max) : 0.f;
+	}
+}
+
+// Least squares endpoints for the given indices, where index i interpolates `index_weights[i]` of the way from e0 to e1.
+// Returns false if the indices don't pin down the endpoints, e.g. when all of them are the same.
+static bool RefineEndpoints(const Block* block, const uint8_t indices[16], const float* index_weights, float e0[4], float e1[4]) {
+	float aa = 0.f, ab = 0.f, bb = 0.f;
+	float x0[4] = {}, x1[4] = {};
+	for (int i = 0; i < 16; i++) {
+		float t = index_weights[indices[i]];
+		float s = 1.f - t;
+		aa += s * s;
+		ab += s * t;
+		bb += t * t;
+		for (int c = 0; c < block->channel_count; c++) {
+			x0[c] += s * block->px[i][c];
+			x1[c] += t * block->px[i][c];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f) return false;
+
+	float inv_det = 1.f / det;
+	for (int c = 0; c < block->channel_count; c++) {
+		e0[c] = Clamp255((bb * x0[c] - ab * x1[c]) * inv_det);
+		e1[c] = Clamp255((aa * x1[c] - ab * x0[c]) * inv_det);
+	}
+	return true;
+}
+
+static void Swap(float a[4], float b[4]) {
+	for (int c = 0; c < 4; c++) {
+		float tmp = a[c];
+		a[c] = b[c];
+		b[c] = tmp;
+	}
+}
+
+// -- BC1 -------------------------------------------------------------------------
+
+static const float BC1_INDEX_WEIGHTS[4] = {0.f, 1.f, 1.f/3.f, 2.f/3.f};
+
+static uint16_t QuantizeRGB565(const float c[4]) {
+	uint32_t r = (uint32_t)(c[0] * (31.f / 255.f) + 0.5f);
+	uint32_t g = (uint32_t)(c[1] * (63.f / 255.f) + 0.5f);
+	uint32_t b = (uint32_t)(c[2] * (31.f / 255.f) + 0.5f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void DequantizeRGB565(uint16_t value, uint32_t out[3]) {
+	uint32_t r = value >> 11, g = (value >> 5) & 63, b = value & 31;
+	out[0] = (r << 3) | (r >> 2);
+	out[1] = (g << 2) | (g >> 4);
+	out[2] = (b << 3) | (b >> 2);
+}
+
+// Always uses the 4-color mode (color0 > color1), which is also the only mode of the color block in BC3.
+static void EncodeBC1Color(const uint8_t pixels[16*4], int quality, uint8_t out[8]) {
+	static const int channels[] = {0, 1, 2};
+	Block block;
+	LoadBlock(pixels, channels, 3, &block);
+
+	float e0[4], e1[4];
+	FitEndpointsPCA(&block, e0, e1);
+
+	float best_error = FLT_MAX;
+	uint16_t best_c0 = 0, best_c1 = 0;
+	uint8_t best_indices[16] = {};
+
+	for (int pass = 0; pass <= quality; pass++) {
+		uint16_t c0 = QuantizeRGB565(e0);
+		uint16_t c1 = QuantizeRGB565(e1);
+		if (c0 < c1) {
+			uint16_t tmp = c0; c0 = c1; c1 = tmp;
+			Swap(e0, e1);
+		}
+
+		uint32_t p0[3], p1[3];
+		DequantizeRGB565(c0, p0);
+		DequantizeRGB565(c1, p1);
+		float palette[4][4] = {};
+		for (int c = 0; c < 3; c++) {
+			palette[0][c] = (float)p0[c];
+			palette[1][c] = (float)p1[c];
+			palette[2][c] = (float)((2*p0[c] + p1[c]) / 3);
+			palette[3][c] = (float)((p0[c] + 2*p1[c]) / 3);
+		}
+
+		// With equal endpoints, the block would decode in the 3-color mode, so stick to index 0.
+		uint8_t indices[16];
+		float error = FindClosestIndices(&block, palette, c0 == c1 ? 1 : 4, indices);
+		if (error < best_error) {
+			best_error = error;
+			best_c0 = c0;
+			best_c1 = c1;
+			memcpy(best_indices, indices, 16);
+		}
+
+		if (pass == quality || c0 == c1 || !RefineEndpoints(&block, indices, BC1_INDEX_WEIGHTS, e0, e1)) break;
+	}
+
+	uint32_t index_bits = 0;
+	for (int i = 0; i < 16; i++) index_bits |= (uint32_t)best_indices[i] << (i*2);
+
+	out[0] = (uint8_t)best_c0; out[1] = (uint8_t)(best_c0 >> 8);
+	out[2] = (uint8_t)best_c1; out[3] = (uint8_t)(best_c1 >> 8);
+	memcpy(out + 4, &index_bits, 4);
+}
+
+static void DecodeBC1Color(const uint8_t block[8], bool allow_3_color_mode, uint8_t out_pixels[16*4]) {
+	uint16_t c0 = (uint16_t)(block[0] | (block[1] << 8));
+	uint16_t c1 = (uint16_t)(block[2] | (block[3] << 8));
+	uint32_t p0[3], p1[3];
+	DequantizeRGB565(c0, p0);
+	DequantizeRGB565(c1, p1);
+
+	uint8_t palette[4][4];
+	for (int c = 0; c < 3; c++) {
+		palette[0][c] = (uint8_t)p0[c];
+		palette[1][c] = (uint8_t)p1[c];
+		if (c0 > c1 || !allow_3_color_mode) {
+			palette[2][c] = (uint8_t)((2*p0[c] + p1[c]) / 3);
+			palette[3][c] = (uint8_t)((p0[c] + 2*p1[c]) / 3);
+		}
+		else {
+			palette[2][c] = (uint8_t)((p0[c] + p1[c]) / 2);
+			palette[3][c] = 0;
+		}
+	}
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	palette[3][3] = c0 > c1 || !allow_3_color_mode ? 255 : 0;
+
+	uint32_t index_bits;
+	memcpy(&index_bits, block + 4, 4);
+	for (int i = 0; i < 16; i++) memcpy(&out_pixels[i*4], palette[(index_bits >> (i*2)) & 3], 4);
+}
+
+// -- BC4 -------------------------------------------------------------------------
+
+static const float BC4_INDEX_WEIGHTS[8] = {0.f, 1.f, 1.f/7.f, 2.f/7.f, 3.f/7.f, 4.f/7.f, 5.f/7.f, 6.f/7.f};
+
+// Always uses the 8-value mode (e0 > e1)
+static void EncodeBC4(const uint8_t pixels[16*4], int channel, int quality, uint8_t out[8]) {
+	Block block;
+	LoadBlock(pixels, &channel, 1, &block);
+
+	float e0[4] = {}, e1[4] = {255.f};
+	for (int i = 0; i < 16; i++) {
+		if (block.px[i][0] > e0[0]) e0[0] = block.px[i][0];
+		if (block.px[i][0] < e1[0]) e1[0] = block.px[i][0];
+	}
+
+	float best_error = FLT_MAX;
+	uint8_t best_e0 = 0, best_e1 = 0;
+	uint8_t best_indices[16] = {};
+
+	for (int pass = 0; pass <= quality; pass++) {
+		uint8_t q0 = (uint8_t)(e0[0] + 0.5f);
+		uint8_t q1 = (uint8_t)(e1[0] + 0.5f);
+		if (q0 < q1) {
+			uint8_t tmp = q0; q0 = q1; q1 = tmp;
+			Swap(e0, e1);
+		}
+
+		float palette[8][4] = {};
+		palette[0][0] = q0;
+		palette[1][0] = q1;
+		for (int k = 2; k < 8; k++) palette[k][0] = (float)(((8 - k)*q0 + (k - 1)*q1) / 7);
+
+		// With equal endpoints, the block would decode in the 6-value mode, so stick to index 0.
+		uint8_t indices[16];
+		float error = FindClosestIndices(&block, palette, q0 == q1 ? 1 : 8, indices);
+		if (error < best_error) {
+			best_error = error;
+			best_e0 = q0;
+			best_e1 = q1;
+			memcpy(best_indices, indices, 16);
+		}
+
+		if (pass == quality || q0 == q1 || !RefineEndpoints(&block, indices, BC4_INDEX_WEIGHTS, e0, e1)) break;
+	}
+
+	uint64_t index_bits = 0;
+	for (int i = 0; i < 16; i++) index_bits |= (uint64_t)best_indices[i] << (i*3);
+
+	out[0] = best_e0;
+	out[1] = best_e1;
+	for (int i = 0; i < 6; i++) out[2 + i] = (uint8_t)(index_bits >> (i*8));
+}
+
+static void DecodeBC4(const uint8_t block[8], int channel, uint8_t out_pixels[16*4]) {
+	uint32_t e0 = block[0], e1 = block[1];
+	uint8_t palette[8];
+	palette[0] = (uint8_t)e0;
+	palette[1] = (uint8_t)e1;
+	if (e0 > e1) {
+		for (uint32_t k = 2; k < 8; k++) palette[k] = (uint8_t)(((8 - k)*e0 + (k - 1)*e1) / 7);
+	}
+	else {
+		for (uint32_t k = 2; k < 6; k++) palette[k] = (uint8_t)(((6 - k)*e0 + (k - 1)*e1) / 5);
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	uint64_t index_bits = 0;
+	for (int i = 0; i < 6; i++) index_bits |= (uint64_t)block[2 + i] << (i*8);
+	for (int i = 0; i < 16; i++) out_pixels[i*4 + channel] = palette[(index_bits >> (i*3)) & 7];
+}
+
+// -- BC7 -------------------------------------------------------------------------
+
+static const uint32_t BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64}; // out of 64
+static const float BC7_INDEX_WEIGHTS[16] = {
+	0.f/64.f, 4.f/64.f, 9.f/64.f, 13.f/64.f, 17.f/64.f, 21.f/64.f, 26.f/64.f, 30.f/64.f,
+	34.f/64.f, 38.f/64.f, 43.f/64.f, 47.f/64.f, 51.f/64.f, 55.f/64.f, 60.f/64.f, 64.f/64.f};
+
+struct BitStream {
+	uint64_t words[2];
+	uint32_t pos;
+};
+
+static void WriteBits(BitStream* stream, uint32_t value, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++, stream->pos++) {
+		stream->words[stream->pos >> 6] |= (uint64_t)((value >> i) & 1) << (stream->pos & 63);
+	}
+}
+
+static uint32_t ReadBits(BitStream* stream, uint32_t count) {
+	uint32_t value = 0;
+	for (uint32_t i = 0; i < count; i++, stream->pos++) {
+		value |= (uint32_t)((stream->words[stream->pos >> 6] >> (stream->pos & 63)) & 1) << i;
+	}
+	return value;
+}
+
+// Mode 6 endpoints are 7 bits per channel, with the endpoint's p-bit as the lowest bit of all channels.
+static float QuantizeBC7Endpoint(const float e[4], uint32_t p_bit, uint32_t out_q[4], uint32_t out_dequantized[4]) {
+	float error = 0.f;
+	for (int c = 0; c < 4; c++) {
+		int q = (int)((e[c] - (float)p_bit) * 0.5f + 0.5f);
+		q = q < 0 ? 0 : q > 127 ? 127 : q;
+		out_q[c] = (uint32_t)q;
+		out_dequantized[c] = ((uint32_t)q << 1) | p_bit;
+		float diff = e[c] - (float)out_dequantized[c];
+		error += diff * diff;
+	}
+	return error;
+}
+
+static void EncodeBC7(const uint8_t pixels[16*4], int quality, uint8_t out[16]) {
+	static const int channels[] = {0, 1, 2, 3};
+	Block block;
+	LoadBlock(pixels, channels, 4, &block);
+
+	float e0[4], e1[4];
+	FitEndpointsPCA(&block, e0, e1);
+
+	float best_error = FLT_MAX;
+	uint32_t best_q0[4] = {}, best_q1[4] = {};
+	uint32_t best_p0 = 0, best_p1 = 0;
+	uint8_t best_indices[16] = {};
+
+	for (int pass = 0; pass <= quality; pass++) {
+		// Pick the p-bits that quantize each endpoint best, or from quality 2, try every combination.
+		uint32_t q[4], dq[4];
+		uint32_t p0 = QuantizeBC7Endpoint(e0, 1, q, dq) < QuantizeBC7Endpoint(e0, 0, q, dq) ? 1 : 0;
+		uint32_t p1 = QuantizeBC7Endpoint(e1, 1, q, dq) < QuantizeBC7Endpoint(e1, 0, q, dq) ? 1 : 0;
+		uint32_t first_combination = quality >= 2 ? 0 : p0 | (p1 << 1);
+		uint32_t last_combination = quality >= 2 ? 3 : first_combination;
+
+		float pass_error = FLT_MAX;
+		uint8_t pass_indices[16] = {};
+		for (uint32_t combination = first_combination; combination <= last_combination; combination++) {
+			uint32_t q0[4], q1[4], d0[4], d1[4];
+			QuantizeBC7Endpoint(e0, combination & 1, q0, d0);
+			QuantizeBC7Endpoint(e1, combination >> 1, q1, d1);
+
+			float palette[16][4];
+			for (int i = 0; i < 16; i++) {
+				for (int c = 0; c < 4; c++) palette[i][c] = (float)(((64 - BC7_WEIGHTS[i])*d0[c] + BC7_WEIGHTS[i]*d1[c] + 32) >> 6);
+			}
+
+			uint8_t indices[16];
+			float error = FindClosestIndices(&block, palette, 16, indices);
+			if (error < pass_error) {
+				pass_error = error;
+				memcpy(pass_indices, indices, 16);
+			}
+			if (error < best_error) {
+				best_error = error;
+				memcpy(best_q0, q0, sizeof(q0));
+				memcpy(best_q1, q1, sizeof(q1));
+				best_p0 = combination & 1;
+				best_p1 = combination >> 1;
+				memcpy(best_indices, indices, 16);
+			}
+		}
+
+		if (pass == quality || !RefineEndpoints(&block, pass_indices, BC7_INDEX_WEIGHTS, e0, e1)) break;
+	}
+
+	// The MSB of the first index is implicitly 0, so swap the endpoints if it's set.
+	if (best_indices[0] >= 8) {
+		for (int c = 0; c < 4; c++) {
+			uint32_t tmp = best_q0[c]; best_q0[c] = best_q1[c]; best_q1[c] = tmp;
+		}
+		uint32_t tmp = best_p0; best_p0 = best_p1; best_p1 = tmp;
+		for (int i = 0; i < 16; i++) best_indices[i] = (uint8_t)(15 - best_indices[i]);
+	}
+
+	BitStream stream = {};
+	WriteBits(&stream, 1 << 6, 7); // mode 6
+	for (int c = 0; c < 4; c++) {
+		WriteBits(&stream, best_q0[c], 7);
+		WriteBits(&stream, best_q1[c], 7);
+	}
+	WriteBits(&stream, best_p0, 1);
+	WriteBits(&stream, best_p1, 1);
+	for (int i = 0; i < 16; i++) WriteBits(&stream, best_indices[i], i == 0 ? 3 : 4);
+	memcpy(out, stream.words, 16);
+}
+
+static void DecodeBC7(const uint8_t block[16], uint8_t out_pixels[16*4]) {
+	BitStream stream = {};
+	memcpy(stream.words, block, 16);
+
+	uint32_t mode_bits = ReadBits(&stream, 7);
+	if (mode_bits != 1 << 6) { // Not mode 6, decode as black
+		memset(out_pixels, 0, 16*4);
+		return;
+	}
+
+	uint32_t q0[4], q1[4];
+	for (int c = 0; c < 4; c++) {
+		q0[c] = ReadBits(&stream, 7);
+		q1[c] = ReadBits(&stream, 7);
+	}
+	uint32_t p0 = ReadBits(&stream, 1);
+	uint32_t p1 = ReadBits(&stream, 1);
+
+	for (int i = 0; i < 16; i++) {
+		uint32_t weight = BC7_WEIGHTS[ReadBits(&stream, i == 0 ? 3 : 4)];
+		for (int c = 0; c < 4; c++) {
+			uint32_t d0 = (q0[c] << 1) | p0;
+			uint32_t d1 = (q1[c] << 1) | p1;
+			out_pixels[i*4 + c] = (uint8_t)(((64 - weight)*d0 + weight*d1 + 32) >> 6);
+		}
+	}
+}
+
+// --------------------------------------------------------------------------------
+
+uint32_t BCBlockSize(BCFormat format) {
+	return format == BCFormat_BC1 ? 8 : 16;
+}
+
+void BCEncodeBlock(BCFormat format, const uint8_t pixels[16*4], int quality, void* out_block) {
+	uint8_t* out = (uint8_t*)out_block;
+	switch (format) {
+	case BCFormat_BC1: EncodeBC1Color(pixels, quality, out); break;
+	case BCFormat_BC3: EncodeBC4(pixels, 3, quality, out); EncodeBC1Color(pixels, quality, out + 8); break;
+	case BCFormat_BC5: EncodeBC4(pixels, 0, quality, out); EncodeBC4(pixels, 1, quality, out + 8); break;
+	case BCFormat_BC7: EncodeBC7(pixels, quality, out); break;
+	}
+}
+
+void BCDecodeBlock(BCFormat format, const void* block, uint8_t out_pixels[16*4]) {
+	const uint8_t* in = (const uint8_t*)block;
+	switch (format) {
+	case BCFormat_BC1: DecodeBC1Color(in, true, out_pixels); break;
+	case BCFormat_BC3: DecodeBC1Color(in + 8, false, out_pixels); DecodeBC4(in, 3, out_pixels); break;
+	case BCFormat_BC5: {
+		DecodeBC4(in, 0, out_pixels);
+		DecodeBC4(in + 8, 1, out_pixels);
+		for (int i = 0; i < 16; i++) {
+			out_pixels[i*4 + 2] = 0;
+			out_pixels[i*4 + 3] = 255;
+		}
+	} break;
+	case BCFormat_BC7: DecodeBC7(in, out_pixels); break;
+	}
+}
@@ -0,0 +1,26 @@
+// CPU block compression into the BCn formats that the renderer can load.
+//
+// Every encoder takes a 4x4 block of RGBA8 pixels, stored row by row, and writes one compressed block. The endpoints start
+// out along the principal axis of the block's colors, and are then refined by least squares against the chosen indices.
+// BC7 only uses mode 6 (one subset, RGBA endpoints with a p-bit each, 4-bit indices), which is good for smooth color and
+// alpha gradients but worse than the multi-subset modes on blocks with several distinct colors.
+//
+// The decoders only exist for measuring the quality, so the BC7 decoder only supports mode 6.
+
+#define BC_MAX_QUALITY 4
+
+enum BCFormat {
+	BCFormat_BC1, // RGB, 8 bytes per block
+	BCFormat_BC3, // RGBA, BC1 for the color and BC4 for the alpha, 16 bytes per block
+	BCFormat_BC5, // RG, two BC4 blocks, 16 bytes per block
+	BCFormat_BC7, // RGBA, 16 bytes per block
+};
+
+uint32_t BCBlockSize(BCFormat format);
+
+// `quality` goes from 0 (fastest) to BC_MAX_QUALITY. It's the number of endpoint refinement passes, and from 2 upwards,
+// BC7 also tries every combination of p-bits.
+void BCEncodeBlock(BCFormat format, const uint8_t pixels[16*4], int quality, void* out_block);
+
+// BC5 decodes with a blue of 0 and an alpha of 255, and so does BC1 except for the transparent index of its 3-color mode.
+void BCDecodeBlock(BCFormat format, const void* block, uint8_t out_pixels[16*4]);
@@ -0,0 +1,294 @@
+// Compresses an image (anything stb_image reads) into a BCn DDS file with a full mip chain. See bc_encode.h for the encoders.
+//
+// Usage: TextureCompressor <input image> <output.dds> [-format bc1|bc3|bc5|bc7] [-quality 0-4] [-srgb] [-normalmap]
+// e.g.   TextureCompressor ../resources/MetalRoughSpheres_Albedo.tga ../resources/MetalRoughSpheres_Albedo.dds -srgb
+//
+// -format     defaults to BC5 for normal maps and to BC7 for everything else
+// -quality    defaults to 2, see BCEncodeBlock
+// -srgb       filters the mips in linear space, for color textures. The data is stored as is, like in the other textures.
+// -normalmap  renormalizes the normals of each mip
+//
+// LoadMesh picks up a .dds file with the same name as a texture that a mesh references, so the compressed file doesn't
+// need the mesh to be changed.
+
+#include "fire/fire_ds.h"
+#include "fire/fire_string.h"
+
+#define FIRE_OS_SYNC_IMPLEMENTATION
+#define FIRE_OS_TIMING_IMPLEMENTATION
+#include "fire/fire_os_sync.h"
+#include "fire/fire_os_timing.h"
+
+#include "bc_encode.h"
+
+#include "stb_image.h"
+#include "ddspp.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <stdio.h>
+#include <stdlib.h> // atoi
+#include <math.h>
+
+#define MAX_WORKER_THREADS 64
+
+struct Mip {
+	uint32_t width;
+	uint32_t height;
+	uint8_t* pixels; // RGBA8
+	uint8_t* blocks;
+	uint32_t blocks_size;
+};
+
+struct CompressMipJob {
+	BCFormat format;
+	int quality;
+	const Mip* mip;
+	uint32_t blocks_x;
+	uint32_t blocks_y;
+	volatile LONG next_row;
+};
+
+// Block that covers (block_x, block_y). Blocks that stick out of the image repeat its last row and column.
+static void GatherBlock(const Mip* mip, uint32_t block_x, uint32_t block_y, uint8_t out_pixels[16*4]) {
+	for (uint32_t y = 0; y < 4; y++) {
+		for (uint32_t x = 0; x < 4; x++) {
+			uint32_t px = block_x*4 + x < mip->width ? block_x*4 + x : mip->width - 1;
+			uint32_t py = block_y*4 + y < mip->height ? block_y*4 + y : mip->height - 1;
+			memcpy(&out_pixels[(y*4 + x)*4], &mip->pixels[(py*mip->width + px)*4], 4);
+		}
+	}
+}
+
+static void CompressMipWorker(void* user_data) {
+	CompressMipJob* job = (CompressMipJob*)user_data;
+	uint32_t block_size = BCBlockSize(job->format);
+	for (;;) {
+		uint32_t row = (uint32_t)InterlockedIncrement(&job->next_row) - 1;
+		if (row >= job->blocks_y) break;
+
+		for (uint32_t x = 0; x < job->blocks_x; x++) {
+			uint8_t pixels[16*4];
+			GatherBlock(job->mip, x, row, pixels);
+			BCEncodeBlock(job->format, pixels, job->quality, job->mip->blocks + (row*job->blocks_x + x)*block_size);
+		}
+	}
+}
+
+// Compresses the rows of blocks on all cores
+static void CompressMip(BCFormat format, int quality, Mip* mip) {
+	CompressMipJob job = {format, quality, mip, (mip->width + 3) / 4, (mip->height + 3) / 4, 0};
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	uint32_t thread_count = info.dwNumberOfProcessors - 1; // The calling thread works too
+	if (thread_count > job.blocks_y - 1) thread_count = job.blocks_y - 1;
+	if (thread_count > MAX_WORKER_THREADS) thread_count = MAX_WORKER_THREADS;
+
+	OS_SYNC_Thread threads[MAX_WORKER_THREADS] = {};
+	for (uint32_t i = 0; i < thread_count; i++) {
+		OS_SYNC_ThreadStart(&threads[i], CompressMipWorker, &job, "Compress");
+	}
+	CompressMipWorker(&job);
+	for (uint32_t i = 0; i < thread_count; i++) {
+		OS_SYNC_ThreadJoin(&threads[i]);
+	}
+}
+
+static float SRGBToLinear(float c) {
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float LinearToSRGB(float c) {
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.f / 2.4f) - 0.055f;
+}
+
+static uint8_t FloatToUNorm8(float c) {
+	c = c < 0.f ? 0.f : c > 1.f ? 1.f : c;
+	return (uint8_t)(c * 255.f + 0.5f);
+}
+
+// 2x2 box filter. With an odd width or height, the last column or row is used twice.
+static void Downsample(const Mip* src, bool srgb, bool normal_map, Mip* dst) {
+	float to_float[2][256]; // [srgb][value]
+	for (int i = 0; i < 256; i++) {
+		to_float[0][i] = (float)i / 255.f;
+		to_float[1][i] = SRGBToLinear((float)i / 255.f);
+	}
+
+	for (uint32_t y = 0; y < dst->height; y++) {
+		for (uint32_t x = 0; x < dst->width; x++) {
+			float sum[4] = {};
+			for (uint32_t j = 0; j < 4; j++) {
+				uint32_t sx = x*2 + (j & 1) < src->width ? x*2 + (j & 1) : src->width - 1;
+				uint32_t sy = y*2 + (j >> 1) < src->height ? y*2 + (j >> 1) : src->height - 1;
+				const uint8_t* p = &src->pixels[(sy*src->width + sx)*4];
+				for (int c = 0; c < 4; c++) sum[c] += to_float[srgb && c < 3][p[c]] * 0.25f;
+			}
+
+			if (normal_map) {
+				float n[3] = {sum[0]*2.f - 1.f, sum[1]*2.f - 1.f, sum[2]*2.f - 1.f};
+				float length = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+				if (length > 0.f) {
+					for (int c = 0; c < 3; c++) sum[c] = n[c] / length * 0.5f + 0.5f;
+				}
+			}
+
+			uint8_t* out = &dst->pixels[(y*dst->width + x)*4];
+			for (int c = 0; c < 4; c++) out[c] = FloatToUNorm8(srgb && c < 3 ? LinearToSRGB(sum[c]) : sum[c]);
+		}
+	}
+}
+
+// Sum of squared differences between the decoded blocks and the source pixels, over the first `channel_count` channels
+static double MeasureSquaredError(BCFormat format, const Mip* mip, int channel_count) {
+	uint32_t block_size = BCBlockSize(format);
+	uint32_t blocks_x = (mip->width + 3) / 4;
+	uint32_t blocks_y = (mip->height + 3) / 4;
+	double error = 0.0;
+	for (uint32_t by = 0; by < blocks_y; by++) {
+		for (uint32_t bx = 0; bx < blocks_x; bx++) {
+			uint8_t decoded[16*4];
+			BCDecodeBlock(format, mip->blocks + (by*blocks_x + bx)*block_size, decoded);
+
+			for (uint32_t y = 0; y < 4 && by*4 + y < mip->height; y++) {
+				for (uint32_t x = 0; x < 4 && bx*4 + x < mip->width; x++) {
+					const uint8_t* src = &mip->pixels[((by*4 + y)*mip->width + bx*4 + x)*4];
+					for (int c = 0; c < channel_count; c++) {
+						double diff = (double)src[c] - (double)decoded[(y*4 + x)*4 + c];
+						error += diff * diff;
+					}
+				}
+			}
+		}
+	}
+	return error;
+}
+
+static double PSNR(double squared_error, uint64_t value_count) {
+	if (squared_error == 0.0) return INFINITY;
+	return 10.0 * log10(255.0 * 255.0 * (double)value_count / squared_error);
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		printf("Usage: TextureCompressor <input image> <output.dds> [-format bc1|bc3|bc5|bc7] [-quality 0-%d] [-srgb] [-normalmap]\n", BC_MAX_QUALITY);
+		return 1;
+	}
+
+	STR_View format_name = {};
+	int quality = 2;
+	bool srgb = false;
+	bool normal_map = false;
+	for (int i = 3; i < argc; i++) {
+		STR_View arg = STR_ToV(argv[i]);
+		if (STR_Match(arg, "-format") && i + 1 < argc) format_name = STR_ToV(argv[++i]);
+		else if (STR_Match(arg, "-quality") && i + 1 < argc) quality = atoi(argv[++i]);
+		else if (STR_Match(arg, "-srgb")) srgb = true;
+		else if (STR_Match(arg, "-normalmap")) normal_map = true;
+		else {
+			printf("ERROR: unknown argument \"%s\".\n", argv[i]);
+			return 1;
+		}
+	}
+	quality = quality < 0 ? 0 : quality > BC_MAX_QUALITY ? BC_MAX_QUALITY : quality;
+
+	if (format_name.size == 0) format_name = normal_map ? "bc5" : "bc7";
+
+	BCFormat format;
+	DDSPP_DXGIFormat dds_format;
+	int channel_count; // for measuring the error
+	if (STR_MatchCaseInsensitive(format_name, "bc1"))      { format = BCFormat_BC1; dds_format = BC1_UNORM; channel_count = 3; }
+	else if (STR_MatchCaseInsensitive(format_name, "bc3")) { format = BCFormat_BC3; dds_format = BC3_UNORM; channel_count = 4; }
+	else if (STR_MatchCaseInsensitive(format_name, "bc5")) { format = BCFormat_BC5; dds_format = BC5_UNORM; channel_count = 2; }
+	else if (STR_MatchCaseInsensitive(format_name, "bc7")) { format = BCFormat_BC7; dds_format = BC7_UNORM; channel_count = 4; }
+	else {
+		printf("ERROR: unknown format \"%.*s\".\n", (int)format_name.size, format_name.data);
+		return 1;
+	}
+
+	int width, height, comp;
+	uint8_t* image = stbi_load(argv[1], &width, &height, &comp, 4);
+	if (image == NULL) {
+		printf("ERROR: failed to load \"%s\": %s\n", argv[1], stbi_failure_reason());
+		return 1;
+	}
+
+	DS_Arena arena;
+	DS_ArenaInit(&arena, DS_MIB(1), DS_HEAP);
+
+	uint32_t mip_count = 1;
+	while (((uint32_t)width >> mip_count) > 0 || ((uint32_t)height >> mip_count) > 0) mip_count++;
+
+	Mip* mips = (Mip*)DS_ArenaPushZero(&arena, mip_count * sizeof(Mip));
+	mips[0].width = (uint32_t)width;
+	mips[0].height = (uint32_t)height;
+	mips[0].pixels = image;
+	for (uint32_t i = 1; i < mip_count; i++) {
+		mips[i].width = mips[i - 1].width > 1 ? mips[i - 1].width / 2 : 1;
+		mips[i].height = mips[i - 1].height > 1 ? mips[i - 1].height / 2 : 1;
+		mips[i].pixels = (uint8_t*)DS_ArenaPush(&arena, mips[i].width * mips[i].height * 4);
+		Downsample(&mips[i - 1], srgb, normal_map, &mips[i]);
+	}
+
+	uint64_t cpu_frequency = OS_GetCPUFrequency();
+	uint64_t start_tick = OS_GetCPUTick();
+
+	uint64_t uncompressed_size = 0;
+	uint64_t compressed_size = 0;
+	for (uint32_t i = 0; i < mip_count; i++) {
+		Mip* mip = &mips[i];
+		mip->blocks_size = ((mip->width + 3) / 4) * ((mip->height + 3) / 4) * BCBlockSize(format);
+		mip->blocks = (uint8_t*)DS_ArenaPush(&arena, mip->blocks_size);
+		CompressMip(format, quality, mip);
+
+		uncompressed_size += mip->width * mip->height * 4;
+		compressed_size += mip->blocks_size;
+	}
+
+	double duration = OS_GetDuration(cpu_frequency, start_tick, OS_GetCPUTick());
+
+	// The PSNR of the whole chain weighs every texel equally, so it's dominated by mip 0.
+	double total_error = 0.0;
+	uint64_t total_value_count = 0;
+	for (uint32_t i = 0; i < mip_count; i++) {
+		double error = MeasureSquaredError(format, &mips[i], channel_count);
+		uint64_t value_count = (uint64_t)mips[i].width * mips[i].height * channel_count;
+		total_error += error;
+		total_value_count += value_count;
+		if (i < 4) printf("  mip %u (%ux%u): PSNR %.2f dB\n", i, mips[i].width, mips[i].height, PSNR(error, value_count));
+	}
+
+	DDSPP_Header header = {};
+	DDSPP_HeaderDXT10 header_dxt10 = {};
+	ddspp_encode_header(dds_format, (uint32_t)width, (uint32_t)height, 1, Texture2D, mip_count, 1, &header, &header_dxt10);
+
+	FILE* f = NULL;
+	fopen_s(&f, argv[2], "wb");
+	if (f == NULL) {
+		printf("ERROR: failed to open \"%s\" for writing.\n", argv[2]);
+		return 1;
+	}
+
+	bool ok = fwrite(&DDS_MAGIC, sizeof(DDS_MAGIC), 1, f) == 1;
+	ok = ok && fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && fwrite(&header_dxt10, sizeof(header_dxt10), 1, f) == 1;
+	for (uint32_t i = 0; i < mip_count && ok; i++) {
+		ok = fwrite(mips[i].blocks, 1, mips[i].blocks_size, f) == mips[i].blocks_size;
+	}
+	fclose(f);
+
+	if (!ok) {
+		printf("ERROR: failed to write \"%s\".\n", argv[2]);
+		return 1;
+	}
+
+	printf("Compressed \"%s\" (%dx%d, %u mips) to %.*s in %.2f s: %.1f KiB -> %.1f KiB, PSNR %.2f dB\n", argv[1], width, height, mip_count,
+		(int)format_name.size, format_name.data, duration, (double)uncompressed_size / 1024.0, (double)compressed_size / 1024.0,
+		PSNR(total_error, total_value_count));
+
+	stbi_image_free(image);
+	DS_ArenaDeinit(&arena);
+	return 0;
+}